@@ -1,16 +1,38 @@
 #pragma once
 
+#include "EditJournal.h"
+#include "EncodingDetector.h"
+#include "MatchIndex.h"
 #include "MemoryMappedFile.h"
 #include "PieceTable.h"
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
-
-enum class Encoding { UTF8, UTF16LE, UTF16BE, ANSI };
+#include <thread>
 
 enum class SelectionMode { Normal, Box };
 
+// The text of an opened file before it goes into a piece table: a
+// contiguous block, or a SpanSource over mapped windows or transcoded UTF-16
+struct OpenedOriginal {
+  Encoding encoding = Encoding::UTF8;
+  bool bom = false; // the file starts with a byte order mark
+  const char *data = nullptr;
+  SpanSource source;
+  size_t length = 0;
+  // Where the text starts in the file (after any BOM) when the text is the
+  // file's own bytes; NO_FILE_OFFSET for transcoded text
+  uint64_t fileOffset = NO_FILE_OFFSET;
+  static constexpr uint64_t NO_FILE_OFFSET = UINT64_MAX;
+};
+
 class Process;
 
 class Buffer {
@@ -19,9 +41,92 @@ public:
   ~Buffer();
 
   bool OpenFile(const std::wstring &path);
+  // Returns at once and opens the file on a worker thread: mapping, BOM
+  // detection, UTF-16 conversion and indexing all happen there. The
+  // document stays empty until FinishIndexing applies the first indexed
+  // chunk, then grows chunk by chunk. Until that first chunk is applied
+  // the buffer is read-only (see IsOpening).
+  void OpenFileAsync(const std::wstring &path);
+  // True while an OpenFileAsync has not been applied yet. Insert, Delete,
+  // Undo and Redo are ignored meanwhile, since applying the open replaces
+  // the document and its history.
+  bool IsOpening() const { return m_opening; }
   bool SaveFile(const std::wstring &path);
+  // Returns at once and saves on a worker thread from a snapshot of the
+  // text taken now, so editing goes on while the file is written; the file
+  // is replaced only once the whole snapshot is on disk. The progress
+  // callback is not used (see GetSaveProgress). FinishSave collects the
+  // result.
+  void SaveFileAsync(const std::wstring &path);
+  bool IsSaving() const { return m_saveThread.joinable(); }
+  // Called on the saving thread every percent or so of progress and once
+  // the save is over
+  void SetSaveCallback(std::function<void()> cb) { m_saveCb = std::move(cb); }
+  // Collects a finished save on the owner thread; with 'wait', blocks until
+  // it is over. Returns true once no save is running, with the outcome in
+  // 'succeeded'. The buffer becomes clean only if it was not edited after
+  // the snapshot was taken.
+  bool FinishSave(bool wait, bool *succeeded = nullptr);
+  // Fraction of the running save written so far
+  float GetSaveProgress() const;
+
+  // Crash recovery: from now on every edit is logged to an EditJournal at
+  // 'journalPath', which a save restarts and closing the buffer deletes.
+  bool StartJournal(const std::wstring &journalPath,
+                    unsigned flushMs = EditJournal::DEFAULT_FLUSH_MS);
+  // Replays the journal a crashed session left at 'journalPath' onto this
+  // buffer, which must hold the same file as then, and goes on journaling
+  // into it. False if the journal does not belong to the file as it is now.
+  // Indexing waits only for the part of the file the edits reach.
+  bool RecoverJournal(const std::wstring &journalPath,
+                      unsigned flushMs = EditJournal::DEFAULT_FLUSH_MS);
+  void StopJournal(); // deletes the journal
+  bool IsJournaling() const { return m_journal != nullptr; }
+  // Files of at least this many bytes are opened through an LRU of mapped
+  // windows (see MemoryMappedFile) rather than one mapping; 0 disables.
+  void SetWindowedOpenThreshold(uint64_t bytes) { m_windowedOpenBytes = bytes; }
+  static constexpr uint64_t DEFAULT_WINDOWED_OPEN_BYTES =
+      2ull * 1024 * 1024 * 1024;
+
+  // Files of at least this many bytes open as soon as their first
+  // INITIAL_INDEX_BYTES are indexed; the rest is indexed on worker threads.
+  // Until FinishIndexing appends it, the document ends with the indexed
+  // lines. 0 indexes every file in full before OpenFile returns.
+  // The buffer stays editable meanwhile: the rest of the file is appended
+  // after the last byte, so text inserted at the end of the indexed part
+  // ends up before the rest of the file, and offsets of earlier edits (and
+  // their undo records) stay valid.
+  void SetBackgroundIndexThreshold(uint64_t bytes) {
+    m_backgroundIndexBytes = bytes;
+  }
+  static constexpr uint64_t DEFAULT_BACKGROUND_INDEX_BYTES = 64 * 1024 * 1024;
+  static constexpr size_t INITIAL_INDEX_BYTES = 4 * 1024 * 1024;
+  static constexpr size_t INDEX_CHUNK_BYTES = 64 * 1024 * 1024;
+  bool IsIndexing() const { return m_indexThread.joinable(); }
+  // Called on the indexing thread whenever FinishIndexing has something to
+  // apply: the file was opened, a chunk was indexed, or the load failed
+  void SetIndexedCallback(std::function<void()> cb) {
+    m_indexedCb = std::move(cb);
+  }
+  // Appends the chunks indexed so far to the document; call on the thread
+  // that owns the buffer. With 'wait', blocks until the whole file is in.
+  // Returns true once indexing is over (check LoadFailed after an async
+  // open).
+  bool FinishIndexing(bool wait);
+  // Stops indexing. The document keeps only what was applied so far, so
+  // saving it over the file would truncate it; callers close the buffer.
+  void CancelIndexing();
+  bool LoadFailed() const { return m_loadFailed; }
+  // Fraction of the file indexed so far, for progress bars
+  float GetIndexProgress() const;
+  // Lines of the whole file, extrapolated from the indexed part while
+  // indexing is still running
+  size_t GetEstimatedTotalLines() const;
 
+  // Saves write text back in the encoding it was read in, byte order mark
+  // included, and fail if it has characters that encoding cannot hold
   Encoding GetEncoding() const { return m_encoding; }
+  bool HasBom() const { return m_hasBom; }
 
   void Insert(size_t pos, const std::string &text);
   void Delete(size_t pos, size_t length);
@@ -35,6 +140,27 @@ public:
   size_t Find(const std::string &query, size_t startPos, bool forward = true,
               bool useRegex = false, bool matchCase = true) const;
   void Replace(size_t start, size_t end, const std::string &replacement);
+  // Replaces every non-overlapping match in one scan and one piece-table
+  // splice (a single undo step). Returns the number of replacements.
+  size_t ReplaceAll(const std::string &query, const std::string &replacement,
+                    const SearchOptions &options = SearchOptions());
+  // Sorted start offsets of every non-overlapping match, from one scan of the
+  // document (split across threads for large documents when 'parallel')
+  std::vector<size_t> FindAll(const std::string &query,
+                              const SearchOptions &options = SearchOptions(),
+                              bool parallel = true) const;
+
+  // Match index for the find UI: set the query once and the matches follow
+  // every edit incrementally, so "N of M" stays cheap while typing
+  void SetMatchQuery(const std::string &query,
+                     const SearchOptions &options = SearchOptions()) {
+    m_matchIndex.SetQuery(query, options);
+  }
+  const MatchList &GetMatches() const {
+    return m_matchIndex.Get(m_pieceTable);
+  }
+  // 1-based number of the match starting at pos, or 0 if none does
+  size_t GetMatchNumber(size_t pos) const;
 
   std::string GetSelectedText() const;
   void DeleteSelection();
@@ -43,6 +169,9 @@ public:
   void Redo();
   bool CanUndo() const;
   bool CanRedo() const;
+  // Edits between Begin/EndUndoGroup undo as one step (groups nest)
+  void BeginUndoGroup() { m_pieceTable.BeginUndoGroup(); }
+  void EndUndoGroup() { m_pieceTable.EndUndoGroup(); }
 
   void SelectLine(size_t lineIndex);
 
@@ -151,6 +280,11 @@ public:
   Process *GetShellProcess() const;
   void AddProcess(std::unique_ptr<Process> process);
   void SendToShell(const std::string &input);
+  // Converts UTF-8 input to what the shell process reads (see the shell
+  // encoding setting); input is sent as is without one
+  void SetShellEncoder(std::function<std::string(const std::string &)> enc) {
+    m_shellEncoder = std::move(enc);
+  }
 
   size_t GetInputStart() const { return m_inputStart; }
   void SetInputStart(size_t pos) { m_inputStart = pos; }
@@ -162,7 +296,40 @@ public:
 private:
   std::function<void(float)> m_progressCb;
   std::wstring m_filePath;
-  std::unique_ptr<MemoryMappedFile> m_mmFile;
+  // Shared with a running save, which still reads the original from it
+  std::shared_ptr<MemoryMappedFile> m_mmFile;
+  // File offset of the original text in m_mmFile, so a save can copy
+  // unedited runs straight from the file
+  uint64_t m_originalFileOffset = OpenedOriginal::NO_FILE_OFFSET;
+  bool m_hasBom = false;
+  uint64_t m_windowedOpenBytes = DEFAULT_WINDOWED_OPEN_BYTES;
+  uint64_t m_backgroundIndexBytes = DEFAULT_BACKGROUND_INDEX_BYTES;
+  std::thread m_indexThread;
+  std::atomic<bool> m_indexCancel{false};
+  std::atomic<size_t> m_indexedBytes{0};
+  std::atomic<size_t> m_indexTotal{0};
+  bool m_loadFailed = false;
+  bool m_opening = false; // an OpenFileAsync waits for FinishIndexing
+  std::function<void()> m_indexedCb;
+  // Handed from m_indexThread to FinishIndexing
+  std::mutex m_indexMutex;
+  std::condition_variable m_indexCv;
+  std::unique_ptr<OpenedOriginal> m_pendingOpen;
+  std::deque<PieceTable::OriginalIndex> m_readyIndexes;
+  bool m_indexDone = false;
+  bool m_pendingFailure = false;
+  std::thread m_saveThread;
+  std::atomic<bool> m_saveDone{false};
+  bool m_saveResult = false; // set by m_saveThread before m_saveDone
+  std::atomic<size_t> m_savedBytes{0};
+  size_t m_saveTotal = 0;
+  std::wstring m_savePath;
+  uint64_t m_saveGeneration = 0; // m_editGeneration of the snapshot
+  std::function<void()> m_saveCb;
+  std::unique_ptr<EditJournal> m_journal;
+  // The file the original text was read from, as it was then; original
+  // pieces are journaled by reference only while the journal is against it
+  EditJournal::Fingerprint m_originalFile;
   PieceTable m_pieceTable;
   SelectionMode m_selectionMode = SelectionMode::Normal;
   size_t m_caretPos;
@@ -171,14 +338,41 @@ private:
   float m_scrollX;
   size_t m_desiredColumn; // For vertical movement
   Encoding m_encoding;
-  std::string m_convertedData; // For files that need conversion (UTF-16)
   std::set<size_t> m_foldedLines;
   std::vector<HighlightRange> m_highlights;
+  mutable MatchIndex m_matchIndex; // refreshed lazily by GetMatches
   bool m_isDirty;
+  // Bumped by every edit, so a finished save can tell whether the text it
+  // wrote is still the text of the buffer
+  uint64_t m_editGeneration = 0;
   bool m_isScratch;
   bool m_isShell = false;
   std::vector<std::unique_ptr<Process>> m_processes;
+  std::function<std::string(const std::string &)> m_shellEncoder;
   size_t m_inputStart = 0;
   std::vector<std::string> m_shellHistory;
   int m_shellHistoryIndex = -1;
+
+  // How much of an original of 'size' bytes LoadOriginal indexes up front
+  size_t InitialIndexBytes(size_t size) const;
+  // Maps the file and works out its text; safe on a worker thread, as it
+  // touches only the mapping. UTF-16 files get a transcoding source.
+  bool MapOriginal(const std::wstring &path, OpenedOriginal &out,
+                   const std::atomic<bool> *cancel = nullptr);
+  // Makes the first 'prefix' bytes of a mapped original the document
+  void LoadOpened(const std::wstring &path, const OpenedOriginal &original,
+                  size_t prefix);
+  // One pass of FinishIndexing: applies what the index thread handed over,
+  // waiting for some with 'wait'. True once indexing has finished.
+  bool TakeIndexed(bool wait);
+  // Indexes 'original' from 'from' to its end in chunks for FinishIndexing
+  void IndexChunks(const OpenedOriginal &original, size_t from);
+  void StartIndexing(const OpenedOriginal &original);
+  void PublishIndexing(std::function<void()> update);
+  void MarkEdited();
+  // Restarts the journal against the file now at 'path'
+  void CheckpointJournal(const std::wstring &path);
+  // Journals a splice of the piece table (see PieceTable::SpliceListener)
+  void JournalSplice(size_t pos, const std::vector<Piece> &removed,
+                     const std::vector<Piece> &inserted);
 };
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Conversions between UTF-8 and the legacy code pages files may be saved
+// in (Shift-JIS and the system ANSI code page). Windows uses its own
+// converters; elsewhere iconv stands in, with Windows-1252 as the ANSI code
+// page. Ill-formed input never fails: undecodable bytes become U+FFFD and
+// characters the code page lacks become '?', as the Win32 converters do.
+// Both report through 'lossy' when the result does not convert back to
+// exactly 'text' (a replacement, or a best-fit or many-to-one mapping), as
+// opening and saving a file must not change its bytes.
+class CodePage {
+public:
+  static constexpr unsigned ANSI = 0; // CP_ACP
+  static constexpr unsigned SHIFT_JIS = 932;
+
+  static std::string ToUtf8(const char *text, size_t length, unsigned codePage,
+                            bool *lossy = nullptr);
+  static std::string FromUtf8(const char *text, size_t length,
+                              unsigned codePage, bool *lossy = nullptr);
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "PieceTable.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Presents text in a legacy code page (see CodePage) as UTF-8 without
+// converting it up front, as Utf16Transcoder does for UTF-16. The source is
+// cut into blocks of about BLOCK_BYTES, each ending after a byte below 0x40,
+// which is never the trail byte of a double-byte character; BuildMap
+// records where each block starts in the UTF-8 text, and GetSpan decodes a
+// block only when it is read, keeping the most recently used ones.
+class CodePageTranscoder {
+public:
+  // 'source' supplies the 'length' raw bytes
+  CodePageTranscoder(SpanSource source, size_t length, unsigned codePage);
+
+  // Computes the UTF-8 length of every block, and clears 'exact' if some
+  // block does not decode to text that encodes back to the same bytes. Must
+  // be called before the text is read. 'workers' as for
+  // Utf16Transcoder::BuildMap. Returns false if cancelled or the source
+  // could not be read.
+  bool BuildMap(bool &exact, const std::atomic<bool> *cancel = nullptr,
+                size_t workers = 0);
+
+  // Length of the UTF-8 text
+  size_t GetLength() const { return m_blockStarts.back(); }
+
+  // The decoded block holding UTF-8 byte 'offset'. Safe to call from
+  // several threads at once.
+  TextSpan GetSpan(size_t offset) const;
+  // A SpanSource over the UTF-8 text that keeps the transcoder alive
+  static SpanSource MakeSource(std::shared_ptr<CodePageTranscoder> transcoder);
+
+  static constexpr size_t BLOCK_BYTES = 64 * 1024;
+  static constexpr size_t MAX_CACHED_BLOCKS = 32;
+  static constexpr size_t PARALLEL_MAP_MIN_BYTES = 16 * 1024 * 1024;
+
+private:
+  struct Block;
+
+  SpanSource m_source;
+  size_t m_length;
+  unsigned m_codePage;
+  // Source offset of each block's first byte, plus the length at the end
+  std::vector<size_t> m_sourceStarts;
+  // UTF-8 offset of each block's first byte, plus the total at the end
+  std::vector<size_t> m_blockStarts;
+
+  mutable std::mutex m_cacheMutex;
+  // Decoded blocks, least recently used first
+  mutable std::vector<std::shared_ptr<Block>> m_cache;
+
+  // Appends source bytes [from, from + count) to 'out'; false if they could
+  // not all be read
+  bool ReadBytes(size_t from, size_t count, std::string &out) const;
+  // First offset in [from, limit) that follows a byte below 0x40, or limit
+  size_t NextBoundary(size_t from, size_t limit) const;
+  // The block holding UTF-8 byte 'offset'
+  size_t BlockOf(size_t offset) const;
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// Crash recovery log of a buffer's edits. Each edit is appended as a
+// checksummed record (insert text / delete range at a document offset, or
+// a batch of replacements) behind a header naming the file the edits apply
+// to, with a fingerprint of it. Recording only encodes the edit into
+// memory; a writer thread checksums and appends what has gathered every
+// flush interval and syncs it to disk, so typing never waits on the disk.
+// After a crash, Resume replays the records up to the first torn one.
+class EditJournal {
+public:
+  // Identifies the saved file the edits were made against
+  struct Fingerprint {
+    std::wstring path;
+    bool exists = false; // an untitled buffer has no file
+    uint64_t size = 0;
+    uint64_t modified = 0; // last write time, in file clock ticks
+    bool operator==(const Fingerprint &other) const {
+      return path == other.path && exists == other.exists &&
+             size == other.size && modified == other.modified;
+    }
+    bool operator!=(const Fingerprint &other) const {
+      return !(*this == other);
+    }
+  };
+  static Fingerprint Take(const std::wstring &path);
+
+  enum class Op : uint8_t { Insert = 1, Delete = 2, Replace = 3 };
+  // Inserted text: literal bytes, or with 'original' the range
+  // [start, start + length) of the file the journal is written against
+  struct Segment {
+    bool original = false;
+    uint64_t start = 0;
+    uint64_t length = 0;
+    std::string bytes;
+    bool operator==(const Segment &other) const {
+      return original == other.original && start == other.start &&
+             length == other.length && bytes == other.bytes;
+    }
+  };
+  // [pos, pos + removed) of the document before the edit was replaced by
+  // 'segments'; with 'repeat', by the segments of the change before
+  struct Change {
+    uint64_t pos = 0;
+    uint64_t removed = 0;
+    bool repeat = false;
+    std::vector<Segment> segments;
+  };
+  // Receives each recorded edit as its changes, in document order and at
+  // offsets from before any of them
+  using Visitor = std::function<void(const std::vector<Change> &changes)>;
+
+  explicit EditJournal(unsigned flushMs = DEFAULT_FLUSH_MS);
+  ~EditJournal(); // flushes; see Close
+
+  // Starts a new journal at 'path' for edits to the file 'file'
+  bool Create(const std::wstring &path, const Fingerprint &file);
+  // Reads the journal at 'path', passing every intact record to 'visitor',
+  // then keeps appending to it after the last one. False, replaying
+  // nothing, if it has no valid header or was not written against 'file'.
+  bool Resume(const std::wstring &path, const Fingerprint &file,
+              const Visitor &visitor);
+  // Reads only the header of the journal at 'path'
+  static bool ReadHeader(const std::wstring &path, Fingerprint &file);
+
+  // Called on every edit: the range [pos, pos + removed) was replaced by
+  // 'inserted'. Never touches the disk.
+  void Record(uint64_t pos, uint64_t removed, const std::string &inserted);
+  // Records one edit made of 'changes', as for Visitor. A single change of
+  // literal text is stored as Record stores it; anything else as one
+  // record whose size follows the number of changes, not their text.
+  void RecordChanges(const std::vector<Change> &changes);
+  // True if original segments recorded now refer to 'file': the journal is
+  // written against it and no save is about to move it to another file
+  bool IsAgainst(const Fingerprint &file) const;
+
+  // A save restarts the journal against the saved file. Edits recorded
+  // after BeginCheckpoint (made while the save wrote its snapshot) are
+  // kept; EndCheckpoint with saved == false leaves the journal as it was.
+  void BeginCheckpoint();
+  void EndCheckpoint(bool saved, const Fingerprint &file);
+
+  // Stops the writer after a last flush; with 'discard', deletes the
+  // journal, as when the buffer is saved or closed on purpose
+  void Close(bool discard);
+
+  const std::wstring &GetPath() const { return m_path; }
+  // Set once a write or sync fails; later records are dropped
+  bool Failed() const;
+
+  static constexpr unsigned DEFAULT_FLUSH_MS = 1000;
+
+private:
+  std::wstring m_path;
+  Fingerprint m_source; // the file the journal is written against
+  unsigned m_flushMs;
+#ifdef _WIN32
+  HANDLE m_file = INVALID_HANDLE_VALUE;
+#else
+  int m_fd = -1;
+#endif
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::string m_pending;   // encoded records not yet written
+  bool m_marked = false;   // between BeginCheckpoint and EndCheckpoint
+  std::string m_sinceMark; // records since BeginCheckpoint
+  bool m_restart = false;  // rewrite the journal as m_restartData
+  std::string m_restartData;
+  size_t m_restartHeader = 0; // bytes of m_restartData before its records
+  bool m_stop = false;
+  bool m_failed = false;
+  std::thread m_writer;
+
+  void Start();
+  void WriterLoop();
+  static std::string EncodeHeader(const Fingerprint &file);
+  void Append(const std::string &records);
+
+  // Journal file access, from the writer thread once it runs. OpenJournal
+  // cuts the file to its first 'keep' bytes (creating it if need be) and
+  // appends after them.
+  bool OpenJournal(const std::wstring &path, uint64_t keep);
+  bool WriteOut(const std::string &data);
+  bool Sync();
+  void CloseJournal();
+  // Replaces the journal with 'data' through a synced temporary
+  bool Rewrite(const std::string &data);
+};
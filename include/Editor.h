@@ -1,13 +1,27 @@
 #pragma once
 
 #include "Buffer.h"
+#include "FileSearch.h"
 #include <functional>
+#include <map>
 #include <memory>
+#include <thread>
 #include <vector>
 #include <windows.h>
 
 extern HWND g_mainHwnd;
 
+// One batch of background Find in Files output, posted to the main window
+// with WM_FIND_RESULTS
+struct FindResultsBatch {
+  unsigned int searchId;
+  std::string text;
+  size_t filesScanned;
+  size_t filesFound;
+  bool done;
+  bool cancelled;
+};
+
 class Editor {
 public:
   Editor();
@@ -16,10 +30,51 @@ public:
   void SetProgressCallback(std::function<void(float)> cb) { m_progressCb = cb; }
 
   size_t OpenFile(const std::wstring &path);
+  // Opens the file on a worker thread and returns its buffer index at once.
+  // The text appears chunk by chunk as WM_BUFFER_INDEXED messages are
+  // handled; 'done' receives (index, success) once the file is complete or
+  // could not be read, or (-1, false) if the open is cancelled.
+  using OpenCallback = std::function<void(size_t, bool)>;
+  size_t OpenFileAsync(const std::wstring &path, OpenCallback done = nullptr);
+  // Applies what a loading buffer has indexed (WM_BUFFER_INDEXED); returns
+  // false if the buffer is not loading
+  bool HandleBufferIndexed(Buffer *buf);
+  // Stops every file still loading and closes its buffer
+  void CancelOpens();
+  bool IsOpening() const { return !m_loading.empty(); }
+  // Saves the buffer on a worker thread while editing goes on; progress and
+  // completion arrive as WM_BUFFER_SAVED messages, and 'done' receives
+  // whether the file was written.
+  using SaveCallback = std::function<void(bool)>;
+  void SaveFileAsync(Buffer *buf, const std::wstring &path,
+                     SaveCallback done = nullptr);
+  // Reports progress of a saving buffer (WM_BUFFER_SAVED) and completes it
+  // once written; returns false if the buffer is not saving
+  bool HandleBufferSaved(Buffer *buf);
+  bool IsSaving() const { return !m_saving.empty(); }
+  // Crash recovery: reopens the files of journals a crashed session left
+  // in 'dir' (not those of instances still running) and replays their
+  // unsaved edits, then journals the edits of
+  // every file buffer under 'dir' (see Buffer::StartJournal). Returns how
+  // many buffers were recovered.
+  size_t EnableJournals(const std::wstring &dir, unsigned flushMs);
   void NewFile(const std::string &name = "Untitled");
   size_t OpenShell(const std::wstring &cmd);
   size_t OpenJsShell();
-  void FindInFiles(const std::wstring &dir, const std::wstring &pattern);
+  // Searches every file under dir on a worker pool and blocks until done;
+  // results are appended to *Find Results* in batches
+  void FindInFiles(const std::wstring &dir, const std::wstring &pattern,
+                   const SearchOptions &options = SearchOptions(),
+                   const FileSearchFilter &filter = FileSearchFilter());
+  // The same search on a background thread. Batches are posted to the main
+  // window as they arrive; starting another search cancels this one.
+  void StartFindInFiles(const std::wstring &dir, const std::wstring &pattern,
+                        const SearchOptions &options = SearchOptions(),
+                        const FileSearchFilter &filter = FileSearchFilter());
+  void CancelFindInFiles();
+  bool IsFindInFilesRunning() const { return m_fileSearch != nullptr; }
+  // Appends a posted batch; returns false if it belongs to an old search
+  bool HandleFindResults(const FindResultsBatch &batch);
   void CloseBuffer(size_t index);
 
   void SwitchToBuffer(size_t index);
@@ -47,4 +102,23 @@ private:
   std::vector<std::unique_ptr<Buffer>> m_buffers;
   size_t m_activeBufferIndex;
   Buffer *m_messagesBuffer = nullptr;
+
+  Buffer *PrepareFindResults(const std::wstring &dir,
+                             const std::wstring &pattern);
+  std::shared_ptr<FileSearch> m_fileSearch; // running background search
+  std::thread m_fileSearchThread;
+  unsigned int m_fileSearchId = 0;
+
+  // Buffers whose file is still being indexed, with their open callbacks
+  std::map<Buffer *, OpenCallback> m_loading;
+  void WatchIndexing(Buffer *buf);
+  // Buffers with a save running, with their save callbacks
+  std::map<Buffer *, SaveCallback> m_saving;
+
+  std::wstring m_journalDir; // empty: journaling is off
+  unsigned m_journalFlushMs = 0;
+  unsigned m_journalCount = 0;
+  void StartJournal(Buffer *buf);
+  size_t RecoverJournals();
+  size_t IndexOfBuffer(Buffer *buf) const;
 };
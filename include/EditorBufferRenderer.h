@@ -9,6 +9,9 @@
 using Microsoft::WRL::ComPtr;
 
 #include "Buffer.h"
+#include <cstdint>
+#include <list>
+#include <unordered_map>
 #include <vector>
 
 struct Theme {
@@ -46,7 +49,20 @@ public:
   bool HitTestGutter(float x, float y, size_t totalLinesInFile,
                      size_t &lineIndex);
   float GetTextWidth(const std::string &text);
-  float GetLineHeight() const;
+  float GetLineHeight() const { return m_metrics.lineHeight; }
+  // Gutter width for numbers up to 'maxLineNumber'; 0 when hidden
+  float GetGutterWidth(size_t maxLineNumber) const;
+
+  // Measured once per font change, so geometry never lays out text to ask
+  struct FontMetrics {
+    float lineHeight = 20.0f;
+    float ascent = 16.0f;
+    float advance = 8.0f;    // Average character advance; exact if monospace
+    float digitWidth = 8.0f; // Line number digits
+    float tabStop = 32.0f;
+    bool monospace = false;
+  };
+  const FontMetrics &GetFontMetrics() const { return m_metrics; }
   void SetTopOffset(float offset) { val_TopPadding = offset; }
   void SetLeftOffset(float offset) { val_LeftPadding = offset; }
 
@@ -84,6 +100,12 @@ public:
     return true;
   }
   void SetTheme(const Theme &theme);
+  bool SetShowPerfOverlay(bool show) {
+    bool old = m_showPerfOverlay;
+    m_showPerfOverlay = show;
+    m_frame.valid = false;
+    return old;
+  }
 
   // Viewport rendering support for large files
   size_t CalculateVisibleLineCount() const;
@@ -93,6 +115,7 @@ public:
   DWRITE_FONT_WEIGHT GetFontWeight() const { return m_fontWeight; }
   bool GetEnableLigatures() const { return m_enableLigatures; }
   bool GetShowLineNumbers() const { return m_showLineNumbers; }
+  bool GetShowPerfOverlay() const { return m_showPerfOverlay; }
   bool IsWordWrap() const { return m_wordWrap; }
   bool GetWordWrap() const { return m_wordWrap; } // Alias for IsWordWrap
   float GetWrapWidth() const { return m_wrapWidth; }
@@ -102,31 +125,122 @@ public:
   D2D1_RECT_F GetLastCaretRect() const { return m_lastCaretRect; }
   POINT GetCaretScreenPoint() const;
 
+  // Line layout cache counters for the last DrawEditorLines call
+  struct LayoutCacheStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t cached = 0;
+  };
+  LayoutCacheStats GetLayoutCacheStats() const { return m_layoutStats; }
+  // Lines the last DrawEditorLines call actually redrew
+  size_t GetRepaintedLines() const { return m_repaintedLines; }
+
+  // Caret blink: invalidates only the row holding the caret, and nothing
+  // when that row is not in the current frame
+  void InvalidateCaret();
+  // Serves a paint from the retained frame when 'dirty' lies within the
+  // caret row; returns false when the caller must redraw the viewport
+  bool RedrawCaret(const RECT &dirty);
+
 private:
   void UpdateFontFormat();
+  void UpdateFontMetrics();
+  float MeasureWidth(const wchar_t *text, UINT32 length) const;
+  FontMetrics m_metrics;
+
+  // Monospace fast path: without wrapping, a fixed pitch font places every
+  // character at the sum of the advances before it, so hit testing, caret,
+  // selection and widths need no DirectWrite layout. Advances come from an
+  // ASCII table and a per-font map for everything else, measured on demand.
+  float m_asciiAdvance[128] = {};
+  mutable std::unordered_map<uint32_t, float> m_wideAdvances;
+  bool UseMonospaceFastPath() const {
+    return m_metrics.monospace && !m_wordWrap;
+  }
+  float GetWideAdvance(uint32_t codePoint) const;
+  // Walks one line until 'stopAt' bytes or the character whose midpoint lies
+  // beyond 'stopX'; 'offset' and 'x' receive where it stopped. False when
+  // the line needs shaping (combining or reordering scripts) first.
+  bool WalkMonospace(const char *text, size_t length, size_t stopAt,
+                     float stopX, size_t &offset, float &x) const;
+  bool MonospaceX(const char *text, size_t length, size_t stopAt,
+                  float &x) const;
+  bool HitTestMonospace(const std::string &text, float x, float y,
+                        size_t &position) const;
   bool m_bIsCaretVisibleVal = true;
   bool m_enableCaretBlinking = true;
   CaretStyle m_caretStyle = CaretStyle::Line;
   bool m_showLineNumbers = true;
+  bool m_showPerfOverlay = false;
   bool m_wordWrap = false;
   float m_wrapWidth = 0.0f; // 0 means wrap to window width
   float val_TopPadding = 0.0f;
   float val_LeftPadding = 0.0f;
   HWND m_hwnd;
   D2D1_RECT_F m_lastCaretRect = {0, 0, 0, 0};
-  // OPTIMIZATION #6: UTF-8 to UTF-16 conversion caching
-  mutable std::string m_lastUtf8Content;
-  mutable std::vector<wchar_t> m_cachedWtext;
-  mutable bool m_isConversionCacheValid = false;
-
-  void InvalidateConversionCache() { m_isConversionCacheValid = false; }
-  void InvalidateLayoutCache() { m_cachedTextLayout = nullptr; }
-
-  // OPTIMIZATION #9: DirectWrite TextLayout caching
-  mutable ComPtr<IDWriteTextLayout> m_cachedTextLayout;
-  mutable float m_lastLayoutWidth = 0.0f;
-  mutable float m_lastLayoutHeight = 0.0f;
-  mutable std::vector<Buffer::HighlightRange> m_lastHighlights;
+
+  // OPTIMIZATION #9: DirectWrite TextLayout caching, one layout per viewport
+  // line keyed by its text, layout width and highlight spans, so scrolling
+  // shapes only the lines that come into view and typing only the edited one
+  struct LineLayout {
+    uint64_t hash;
+    float width;
+    std::string text;
+    std::vector<Buffer::HighlightRange> spans;
+    ComPtr<IDWriteTextLayout> layout;
+    float height;
+  };
+  static const size_t LINE_LAYOUT_CACHE_SIZE = 1024;
+  std::list<LineLayout> m_lineLayouts; // Most recently used first
+  std::unordered_multimap<uint64_t, std::list<LineLayout>::iterator>
+      m_lineLayoutIndex;
+  std::wstring m_layoutLocale;
+  LayoutCacheStats m_layoutStats;
+
+  const LineLayout *
+  GetLineLayout(const char *text, size_t length, float width,
+                const std::vector<Buffer::HighlightRange> &spans);
+  ID2D1SolidColorBrush *GetHighlightBrush(int type) const;
+  void InvalidateLineLayouts() {
+    m_lineLayouts.clear();
+    m_lineLayoutIndex.clear();
+  }
+
+  // What the render target currently shows. The target retains its contents
+  // between frames, so a new frame only redraws the rows whose layout,
+  // selection, number or caret differ from this one.
+  struct FrameLine {
+    float top;
+    float bottom;
+    ComPtr<IDWriteTextLayout> layout;
+    std::vector<D2D1_RECT_F> selection;
+    size_t number;
+    bool hasCaret;
+    D2D1_RECT_F caret;
+  };
+  struct Frame {
+    bool valid = false;
+    D2D1_SIZE_F size = {0, 0};
+    float gutterWidth = 0.0f;
+    float xOffset = 0.0f;
+    float lineHeight = 0.0f;
+    CaretStyle caretStyle = CaretStyle::Line;
+    bool caretShown = false;
+    std::vector<FrameLine> lines;
+  };
+  Frame m_frame;
+  size_t m_repaintedLines = 0;
+
+  // Frame timing breakdown drawn over the top right corner
+  ComPtr<IDWriteTextFormat> m_overlayFormat;
+  D2D1_RECT_F GetPerfOverlayRect() const;
+  void DrawPerfOverlay();
+
+  void DrawRows(float top, float bottom);
+  void DrawFrameLine(const FrameLine &line);
+  void EndFrame();
+  const FrameLine *GetCaretLine() const;
+  RECT ToPixels(float top, float bottom) const;
 
   ComPtr<ID2D1Factory> m_d2dFactory;
   ComPtr<ID2D1HwndRenderTarget> m_renderTarget;
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+enum class Encoding { UTF8, UTF16LE, UTF16BE, ANSI, ShiftJIS };
+
+// Guesses the encoding of a file without reading all of it: a BOM decides
+// at once; otherwise up to SAMPLES stretches of SAMPLE_BYTES at the head,
+// middle and tail are scored for NUL byte parity (UTF-16 holding ASCII),
+// UTF-8 well-formedness, UTF-16 code units falling in common scripts, and
+// Shift-JIS lead/trail byte pairs, in that order. Text that is none of
+// these is ANSI (the system code page). The work is bounded by the
+// samples, so huge files take no longer than small ones. Portable; ASCII
+// runs and NUL counts use SSE2 where available.
+class EncodingDetector {
+public:
+  struct Result {
+    Encoding encoding = Encoding::UTF8;
+    size_t bomLength = 0; // bytes before the text
+  };
+
+  // Copies up to 'length' bytes at 'offset' of the file to 'out'; returns
+  // how many it copied
+  using Reader = std::function<size_t(uint64_t offset, char *out,
+                                      size_t length)>;
+  static Result Detect(uint64_t size, const Reader &read);
+  // The same for a file already in memory
+  static Result Detect(const char *data, size_t size);
+
+  static constexpr size_t SAMPLES = 3;
+  static constexpr size_t SAMPLE_BYTES = 16 * 1024;
+
+private:
+  // A stretch of the file and where it starts in it
+  struct Sample {
+    const char *data = nullptr;
+    size_t length = 0;
+    uint64_t offset = 0;
+  };
+
+  // Where to sample a file of 'size' bytes; returns how many samples
+  static size_t PlanSamples(uint64_t size, uint64_t offsets[SAMPLES],
+                            size_t lengths[SAMPLES]);
+  static Result DetectBom(const char *head, size_t length);
+  static Encoding Score(const Sample *samples, size_t count, uint64_t size);
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "MatchIndex.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Which files a FileSearch looks at
+struct FileSearchFilter {
+  // Globs such as "*.cpp" or "src/**/*.h". A glob without a '/' matches the
+  // file name, otherwise the path relative to the search root. When
+  // 'include' is not empty a file must match one of them; files and
+  // directories matching an 'exclude' glob are skipped.
+  std::vector<std::string> include;
+  std::vector<std::string> exclude;
+  uint64_t maxFileSize = 0; // in bytes; 0 means no limit
+  // Skip files with a NUL byte in their first block
+  bool skipBinary = true;
+  // Honour .gitignore and .ecodeignore files and skip VCS directories
+  bool useIgnoreFiles = true;
+};
+
+// One matching line
+struct FileSearchMatch {
+  std::string path; // UTF-8
+  size_t line = 0;  // 1-based
+  std::string text; // without the line ending
+};
+
+// Parallel Find in Files. A pool of worker threads both enumerates
+// directories and scans files. Each worker keeps its own task deque and
+// steals from the others when it runs dry, so one deep directory or one huge
+// file never leaves the rest of the pool idle. Files are memory mapped and
+// searched in place with the same matchers as Buffer::Find; each matching
+// line is reported once, as "path(line): text" or as a FileSearchMatch.
+class FileSearch {
+public:
+  // Receives a batch of result lines
+  using ResultCallback = std::function<void(const std::string &)>;
+  // Receives the same batches as fields, for callers that don't show text
+  using MatchCallback =
+      std::function<void(const std::vector<FileSearchMatch> &)>;
+  // Receives (files scanned, files found so far)
+  using ProgressCallback = std::function<void(size_t, size_t)>;
+
+  FileSearch(const std::wstring &root, const std::string &pattern,
+             const SearchOptions &options = SearchOptions());
+  ~FileSearch();
+
+  // Callbacks run one at a time (under a lock) on whichever thread produced
+  // the batch; results arrive every BATCH_INTERVAL_MS or BATCH_BYTES.
+  void SetResultCallback(ResultCallback cb) { m_resultCb = std::move(cb); }
+  void SetMatchCallback(MatchCallback cb) { m_matchCb = std::move(cb); }
+  void SetProgressCallback(ProgressCallback cb) {
+    m_progressCb = std::move(cb);
+  }
+  // Worker threads including the caller of Run; 0 means one per core
+  void SetThreadCount(size_t threads) { m_threadCount = threads; }
+  void SetFilter(const FileSearchFilter &filter) { m_filter = filter; }
+
+  // Searches the whole tree and returns the number of matching lines. Returns
+  // early (with the results so far delivered) once Cancel is called.
+  size_t Run();
+  // Safe to call from any thread, before or during Run
+  void Cancel() { m_cancelled = true; }
+  bool IsCancelled() const { return m_cancelled; }
+
+  // Gitignore-style glob match of a '/'-separated path: '*' and '?' stop at
+  // '/', "**" spans directories, [a-z] and [!a-z] are classes. Case is
+  // ignored for ASCII, as Windows file names are.
+  static bool GlobMatch(const std::string &glob, const std::string &path);
+
+  static constexpr size_t BATCH_BYTES = 64 * 1024;
+  static constexpr int BATCH_INTERVAL_MS = 100;
+  // Files are sniffed for a NUL byte in this many leading bytes (as git does)
+  static constexpr size_t BINARY_SNIFF_BYTES = 8000;
+
+private:
+  struct Task;
+  struct Worker;
+  struct Matcher;
+  struct IgnoreList;
+
+  std::wstring m_root;
+  std::string m_pattern;
+  SearchOptions m_options;
+  FileSearchFilter m_filter;
+  size_t m_threadCount = 0;
+  ResultCallback m_resultCb;
+  MatchCallback m_matchCb;
+  ProgressCallback m_progressCb;
+
+  std::unique_ptr<Matcher> m_matcher;
+  std::vector<std::unique_ptr<Worker>> m_workers;
+  std::atomic<size_t> m_pending{0}; // tasks queued or running
+  std::atomic<bool> m_cancelled{false};
+  std::atomic<size_t> m_filesFound{0};
+  std::atomic<size_t> m_filesScanned{0};
+  std::atomic<size_t> m_matchingLines{0};
+  std::mutex m_deliverMutex;
+
+  void WorkerLoop(size_t index);
+  bool TakeTask(size_t index, Task &task);
+  void Push(size_t index, Task task);
+  void ScanDirectory(size_t index, const Task &task);
+  bool Excluded(const std::string &relative, bool directory) const;
+  void ScanFile(Worker &worker, const Task &task);
+  void Deliver(Worker &worker, bool force);
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+class MemoryMappedFile;
+
+// Writes a file for saving. The bytes go to a temporary next to the target
+// that Commit renames over it, so the target is never left half written.
+// Writes are gathered in an aligned BUFFER_SIZE block, so a fragmented
+// document still goes out in a few large writes, and CopyFrom lets the
+// kernel copy ranges of another file (copy_file_range, then sendfile, on
+// Linux) so untouched text never passes through user space.
+class FileWriter {
+public:
+  FileWriter();
+  ~FileWriter(); // removes the temporary unless committed
+
+  bool Open(const std::wstring &targetPath);
+  bool Write(const char *data, size_t length);
+  // Appends 'length' bytes at 'offset' of the open 'file'. Returns false,
+  // having written nothing, if the kernel cannot copy them (always on
+  // Windows, and for ranges under MIN_COPY_BYTES); write the bytes instead.
+  bool CopyFrom(const MemoryMappedFile &file, uint64_t offset, size_t length);
+  // Flushes, closes and renames the temporary over the target
+  bool Commit();
+
+  // Once a write, copy or the rename fails, later calls do nothing and
+  // Commit returns false
+  bool Failed() const { return m_failed; }
+  const std::string &GetError() const { return m_error; }
+  uint64_t GetBytesWritten() const { return m_written; } // including copies
+  uint64_t GetBytesCopied() const { return m_copied; }
+  size_t GetSystemCalls() const { return m_calls; }
+
+  static constexpr size_t BUFFER_SIZE = 4 * 1024 * 1024;
+  // Shorter runs cost less to write from memory than to copy
+  static constexpr size_t MIN_COPY_BYTES = 1024 * 1024;
+
+private:
+  std::wstring m_targetPath;
+  std::wstring m_tempPath;
+#ifdef _WIN32
+  HANDLE m_file = INVALID_HANDLE_VALUE;
+#else
+  int m_fd = -1;
+#endif
+  std::vector<char> m_storage;
+  char *m_buffer; // m_storage aligned for direct I/O
+  size_t m_used = 0;
+  bool m_failed = false;
+  bool m_committed = false;
+  bool m_copyUnsupported = false;
+  std::string m_error;
+  uint64_t m_written = 0;
+  uint64_t m_copied = 0;
+  size_t m_calls = 0;
+
+  bool Flush();
+  // Writes straight to the file
+  bool WriteOut(const char *data, size_t length);
+  bool Fail(const std::string &error);
+  void CloseFile();
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+// Rolling timings of the paint path. Each stage keeps its last WINDOW
+// samples, so percentiles follow what the editor is doing now rather than
+// averaging over the whole session. Used from the UI thread only.
+class FrameProfiler {
+public:
+  enum class Stage {
+    Frame,      // Whole viewport paint
+    Buffer,     // Viewport text, caret and line mapping from the buffer
+    Highlights, // Highlight and selection remapping into the viewport
+    Layout,     // Line layouts, selection and caret hit testing
+    Draw        // Direct2D drawing and present
+  };
+  static const size_t STAGE_COUNT = 5;
+  static const size_t WINDOW = 256;
+
+  struct Percentiles {
+    double p50 = 0.0; // Microseconds
+    double p95 = 0.0;
+    double p99 = 0.0;
+    double last = 0.0;
+    size_t samples = 0;
+  };
+
+  // Times one stage from construction until Stop or destruction
+  class Scope {
+  public:
+    explicit Scope(Stage stage)
+        : m_stage(stage), m_start(std::chrono::steady_clock::now()),
+          m_running(true) {}
+    ~Scope() { Stop(); }
+    void Stop();
+
+  private:
+    Stage m_stage;
+    std::chrono::steady_clock::time_point m_start;
+    bool m_running;
+  };
+
+  static FrameProfiler &Instance();
+  static const char *GetStageName(Stage stage);
+
+  void Record(Stage stage, double microseconds);
+  Percentiles GetPercentiles(Stage stage) const;
+  void Reset();
+
+private:
+  FrameProfiler();
+
+  struct Samples {
+    std::vector<double> ring;
+    size_t next = 0;
+  };
+  Samples m_stages[STAGE_COUNT];
+};
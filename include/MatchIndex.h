@@ -0,0 +1,54 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+class PieceTable;
+
+struct SearchOptions {
+  bool matchCase = true;
+  bool useRegex = false;
+};
+
+// Sorted, non-overlapping (offset, length) pairs
+typedef std::vector<std::pair<size_t, size_t>> MatchList;
+
+// Every match of one query in a document, kept current as edits land so that
+// match highlighting and "N of M" counts never rescan the whole text. An edit
+// only rescans from the first match it can affect until the new matches line
+// up with the old ones again. Patterns whose matches may span lines (and
+// patterns only std::regex supports) are recollected lazily instead.
+class MatchIndex {
+public:
+  MatchIndex();
+  ~MatchIndex();
+
+  // All non-empty, non-overlapping matches from one scan. The document is
+  // split into 'workers' disjoint byte ranges searched on their own threads
+  // and stitched back into the sequential result; 0 picks a count from the
+  // document size and the number of cores.
+  static MatchList Collect(const PieceTable &table, const std::string &query,
+                           const SearchOptions &options, size_t workers = 0);
+
+  // An empty query clears the index. Setting the current query is a no-op.
+  void SetQuery(const std::string &query, const SearchOptions &options);
+  const std::string &GetQuery() const { return m_query; }
+  // Forget the matches (e.g. the document was reloaded)
+  void Invalidate();
+  // Call after every splice of the document, with the new text in 'table'
+  void OnEdit(const PieceTable &table, size_t pos, size_t removed,
+              size_t inserted);
+  // Current matches, collecting them first if the index is stale
+  const MatchList &Get(const PieceTable &table);
+
+  struct Matcher;
+
+private:
+  std::string m_query;
+  SearchOptions m_options;
+  std::unique_ptr<Matcher> m_matcher;
+  MatchList m_matches;
+  bool m_stale = true;
+};
@@ -1,24 +1,93 @@
 #pragma once
 
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
+#ifdef _WIN32
 #include <windows.h>
+#endif
 
+// Read-only view of a whole file. Regular files are memory mapped
+// (CreateFileMapping on Windows, mmap elsewhere). Pipes, character devices
+// and files that cannot be mapped are read into memory instead, so callers
+// always see one contiguous block either way.
+//
+// The Windowed backend never maps the whole file: fixed-size windows are
+// mapped on demand through GetView and the least recently used one is
+// unmapped once more than the configured number are resident, so address
+// space and resident memory stay bounded however large the file is.
 class MemoryMappedFile {
 public:
+  enum class Backend { None, Mapped, Read, Windowed };
+  enum class Access { Normal, Sequential };
+
+  // A block of the file. 'data' holds 'length' bytes starting at file offset
+  // 'offset', and stays valid while 'pin' is held, even after the window has
+  // been evicted or the file closed.
+  struct View {
+    const char *data = nullptr;
+    size_t offset = 0;
+    size_t length = 0;
+    std::shared_ptr<const void> pin;
+  };
+
   MemoryMappedFile();
   ~MemoryMappedFile();
 
-  bool Open(const std::wstring &filePath);
+  // Backend::Read skips mapping even for regular files (for comparisons).
+  // Backend::Windowed falls back to Read for files that cannot be mapped.
+  bool Open(const std::wstring &filePath, Backend backend = Backend::Mapped);
   void Close();
 
+  // nullptr for the Windowed backend; use GetView
   const char *GetData() const;
   size_t GetSize() const;
+  // How the open file is held
+  Backend GetBackend() const { return m_backend; }
+#ifndef _WIN32
+  // The open file, for kernel copies out of it (see FileWriter::CopyFrom);
+  // -1 when it was read into memory
+  int GetDescriptor() const { return m_fd; }
+#endif
+
+  // The block containing 'offset': its window for the Windowed backend, the
+  // whole file otherwise. Safe to call from several threads at once.
+  View GetView(size_t offset) const;
+  // Window size (rounded up to 64 KB) and how many windows may stay mapped.
+  // Call before Open.
+  void SetWindowing(size_t windowSize, size_t maxWindows);
 
   bool IsOpen() const;
 
+  // Sequential: read ahead aggressively and prefetch the start of the view,
+  // for a first pass over the whole file such as line counting. Normal:
+  // back to the default for random access. No effect on read files.
+  void Advise(Access access);
+
+  static constexpr size_t DEFAULT_WINDOW_SIZE = 64 * 1024 * 1024;
+  static constexpr size_t DEFAULT_MAX_WINDOWS = 8;
+
 private:
+  struct Window;
+
+#ifdef _WIN32
   HANDLE m_fileHandle;
   HANDLE m_mappingHandle;
+#else
+  int m_fd; // kept open unless the file was read
+#endif
   void *m_mappedView;
+  std::vector<char> m_readData; // contents when not mapped
   size_t m_fileSize;
+  Backend m_backend;
+
+  size_t m_windowSize = DEFAULT_WINDOW_SIZE;
+  size_t m_maxWindows = DEFAULT_MAX_WINDOWS;
+  bool m_sequential = false;
+  mutable std::mutex m_windowMutex;
+  // Resident windows, least recently used first
+  mutable std::vector<std::shared_ptr<Window>> m_windows;
+
+  std::shared_ptr<Window> MapWindow(size_t offset) const;
 };
@@ -1,21 +1,52 @@
 #pragma once
 
+#include "PieceTree.h"
+#include <atomic>
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
-enum class BufferType { Original, Added };
+// A block of the original text handed out by a SpanSource: 'length' bytes at
+// 'data' hold the text starting at offset 'offset', and stay valid while
+// 'pin' is held.
+struct TextSpan {
+  const char *data = nullptr;
+  size_t offset = 0;
+  size_t length = 0;
+  std::shared_ptr<const void> pin;
+};
+// Returns the block of the original text containing 'offset'
+using SpanSource = std::function<TextSpan(size_t offset)>;
+
+// The text added to a PieceTable, append-only, in blocks that never move or
+// reallocate. A copy shares the blocks rather than the bytes: the bytes
+// below its size never change, while the table it came from goes on
+// appending after them.
+class AddedText {
+public:
+  size_t size() const { return m_size; }
+  void Append(const char *data, size_t length);
+  // The block holding byte 'offset', up to its last byte in use; no data
+  // past the end of the text
+  TextSpan Span(size_t offset) const;
 
-struct Piece {
-  BufferType bufferType;
-  size_t start;
-  size_t length;
-  size_t lineCount;
+private:
+  struct Block {
+    size_t start;    // offset of its first byte in the text
+    size_t capacity; // bytes allocated
+    std::shared_ptr<char> data;
+  };
+  std::vector<Block> m_blocks;
+  size_t m_size = 0;
 
-  Piece(BufferType type, size_t s, size_t l, size_t lc = 0)
-      : bufferType(type), start(s), length(l), lineCount(lc) {}
+  // Blocks grow with the text, so small buffers stay small and large ones
+  // need few blocks
+  static constexpr size_t MIN_BLOCK = 4096;
+  static constexpr size_t MAX_BLOCK = 1024 * 1024;
 };
 
 class PieceTable {
@@ -26,60 +57,219 @@ public:
   // Load original content (e.g., from memory-mapped file)
   // Note: We assume the caller keeps the 'data' pointer valid for the lifetime
   // of the PieceTable
-  void LoadOriginal(const char *data, size_t length);
+  // Loading starts a new document: undo/redo history, open undo groups and
+  // added text are discarded.
+  // Only the first 'prefix' bytes (extended to the end of their line; none
+  // for 0) are indexed and become the document; the rest is added later
+  // through IndexOriginal and AppendOriginal.
+  void LoadOriginal(const char *data, size_t length,
+                    size_t prefix = SIZE_MAX);
+  // Load original content that is not one contiguous block, such as a file
+  // mapped window by window. Every read goes through 'source' (which must be
+  // safe to call from several threads). Newlines are counted per
+  // NEWLINE_BLOCK bytes instead of recorded one by one, so memory does not
+  // grow with the line count; a line lookup scans at most one block.
+  void LoadOriginal(SpanSource source, size_t length,
+                    size_t prefix = SIZE_MAX);
+  static constexpr size_t NEWLINE_BLOCK = 64 * 1024;
+
+  // Line index of the original bytes [begin, end)
+  struct OriginalIndex {
+    size_t begin = 0;
+    size_t end = 0;
+    size_t newlines = 0;
+    std::vector<size_t> offsets; // contiguous original: every newline
+    // SpanSource original: newlines in [begin, b) for each block boundary b
+    // in (begin, end]
+    std::vector<size_t> blockNewlines;
+  };
+  // Indexes [begin, end) of the original, split into chunks counted by
+  // 'workers' threads (0: one per core for large ranges). Only reads the
+  // original, so it may run on another thread while the table is used (but
+  // not reloaded). Returns an empty index (end == begin) once 'cancel' is
+  // set.
+  OriginalIndex IndexOriginal(size_t begin, size_t end,
+                              const std::atomic<bool> *cancel = nullptr,
+                              size_t workers = 0) const;
+  // Appends the indexed bytes to the end of the document. The index must
+  // start where the loaded part of the original ends; others are ignored.
+  void AppendOriginal(OriginalIndex index);
+  // Bytes of the original that are part of the document
+  size_t GetLoadedOriginalLength() const { return m_originalLoaded; }
+  size_t GetOriginalLength() const { return m_originalLength; }
+  // Below this many bytes per chunk, indexing stays on one thread
+  static constexpr size_t PARALLEL_INDEX_MIN_BYTES = 16 * 1024 * 1024;
 
   // Core editing operations
   void Insert(size_t pos, const std::string &text);
   void Delete(size_t pos, size_t length);
+  // Replace every (offset, length) range with 'text' in a single splice and a
+  // single undo record. Ranges must be sorted and non-overlapping. The
+  // replacement is stored once and shared by all inserted pieces.
+  void ReplaceRanges(const std::vector<std::pair<size_t, size_t>> &ranges,
+                     const std::string &text);
 
   // Undo/Redo
   void Undo();
   void Redo();
   bool CanUndo() const { return !m_undoStack.empty(); }
   bool CanRedo() const { return !m_redoStack.empty(); }
+  // Approximate heap bytes held by the undo/redo history
+  size_t GetUndoMemoryUsage() const;
+
+  // Undo transactions: every edit between BeginUndoGroup and the matching
+  // EndUndoGroup is undone/redone as a single step. Groups may nest; only the
+  // outermost pair delimits the step.
+  void BeginUndoGroup();
+  void EndUndoGroup();
 
   // Retrieval
   std::string GetText(size_t pos, size_t length) const;
   void WriteTo(std::function<void(const char *, size_t)> writer) const;
+  // Like WriteTo, but each run of the original that survives unbroken is
+  // first offered to 'copy' as (originalOffset, length), and its bytes go
+  // to 'writer' only if that returns false. Lets a save copy untouched
+  // stretches of the file without reading them.
+  void WriteTo(std::function<void(const char *, size_t)> writer,
+               std::function<bool(size_t, size_t)> copy) const;
+
+  // Frozen copy of the text that another thread can read while this table
+  // keeps changing: the pieces, sharing the added text and the original
+  // (whose backing, such as a file mapping, must outlive the snapshot).
+  // Costs O(pieces); it has no line index and no history.
+  class Snapshot {
+  public:
+    size_t GetTotalLength() const { return m_table->GetTotalLength(); }
+    void WriteTo(std::function<void(const char *, size_t)> writer,
+                 std::function<bool(size_t, size_t)> copy) const {
+      m_table->WriteTo(std::move(writer), std::move(copy));
+    }
+
+  private:
+    friend class PieceTable;
+    std::shared_ptr<const PieceTable> m_table;
+  };
+  Snapshot TakeSnapshot() const;
+  // Zero-copy access to the bytes of [pos, pos + length): visitor receives
+  // (data, length, documentOffset) for each piece span in document order, or
+  // last span first for the Reverse variant. Returning false stops the walk.
+  using SpanVisitor = std::function<bool(const char *, size_t, size_t)>;
+  void ForEachSpan(size_t pos, size_t length, const SpanVisitor &visitor) const;
+  void ForEachSpanReverse(size_t pos, size_t length,
+                          const SpanVisitor &visitor) const;
   size_t GetTotalLength() const;
   size_t GetTotalLines() const;
   size_t GetLineOffset(size_t lineIndex) const;
   size_t GetLineAtOffset(size_t offset) const;
 
+  // Called after every change to the text, including undo/redo, with
+  // (pos, removedLength, insertedLength), so indexes over the document can
+  // update only the region that changed.
+  using EditListener = std::function<void(size_t, size_t, size_t)>;
+  void SetEditListener(EditListener listener) {
+    m_editListener = std::move(listener);
+  }
+  // Called after every splice, before the EditListener, with its document
+  // offset, the pieces that covered the removed bytes and the pieces put in
+  // their place. Pieces stay readable through ReadPiece until the next
+  // load, so a listener can log an edit by reference instead of by text.
+  using SpliceListener =
+      std::function<void(size_t, const std::vector<Piece> &,
+                         const std::vector<Piece> &)>;
+  void SetSpliceListener(SpliceListener listener) {
+    m_spliceListener = std::move(listener);
+  }
+  // Calls f(data, length) for the bytes of 'piece', in order, until it
+  // returns false. False if f did, or the original could not supply them.
+  bool ReadPiece(const Piece &piece,
+                 const std::function<bool(const char *, size_t)> &f) const;
+
   // OPTIMIZATION: Piece table compaction
   void CompactPieces();
-  size_t GetPieceCount() const { return m_pieces.size(); }
-  void InvalidateLineCache() { m_lineCacheValid = false; }
+  size_t GetPieceCount() const { return m_pieces.Size(); }
 
 private:
   const char *m_originalData;
   size_t m_originalLength;
-  std::string m_addedBuffer;
-  std::vector<Piece> m_pieces;
+  size_t m_originalLoaded = 0;
+  AddedText m_added;
+  PieceTree m_pieces;
 
   size_t m_totalLength;
   size_t m_totalLines;
+  EditListener m_editListener;
+  SpliceListener m_spliceListener;
 
-  const char *GetPieceData(const Piece &p) const;
+  SpanSource m_originalSource; // set when the original is not contiguous
 
-  // History for Undo/Redo
-  std::vector<std::vector<Piece>> m_undoStack;
-  std::vector<std::vector<Piece>> m_redoStack;
+  // Calls f(data, length) for the bytes [start, start + length) of a backing
+  // buffer, in order (or last block first for the Reverse variant), in as
+  // few blocks as the buffer allows. Returns false once f does.
+  template <typename F>
+  bool VisitBuffer(BufferType type, size_t start, size_t length, F &&f) const;
+  template <typename F>
+  bool VisitBufferReverse(BufferType type, size_t start, size_t length,
+                          F &&f) const;
 
-  void SaveState();
+  // OPTIMIZATION: Piece-local line tables. Each backing buffer keeps the
+  // sorted offsets of its newlines; the original table is built once on load
+  // and the added table only grows on Insert, so no edit ever rescans the
+  // document. Combined with the per-node newline counts in m_pieces, line
+  // lookups cost O(log pieces + log lines).
+  std::vector<size_t> m_originalNewlines;
+  std::vector<size_t> m_addedNewlines;
+  // For a SpanSource original: newlines before each NEWLINE_BLOCK-byte block
+  std::vector<size_t> m_originalBlockNewlines;
 
-  // Internal helper to find which piece contains the position
-  struct PieceInfo {
-    size_t pieceIndex;
-    size_t offsetInPiece;
+  // Clears the document, its undo history, the added text and the
+  // original's line index
+  void ResetOriginal(size_t length);
+  // Indexes the original up to the end of the line holding byte prefix - 1
+  // and makes it the document
+  void LoadPrefix(size_t prefix);
+  // Indexes [begin, end) on the calling thread
+  void IndexRange(size_t begin, size_t end, const std::atomic<bool> *cancel,
+                  OriginalIndex &out) const;
+  // Newlines in [start, start + length) of the given backing buffer
+  size_t CountNewlinesIn(BufferType type, size_t start, size_t length) const;
+  // Newlines in the original buffer before 'offset'
+  size_t OriginalNewlinesBefore(size_t offset) const;
+  // Offset of the original buffer's newline number 'index' (from 0)
+  size_t FindOriginalNewline(size_t index) const;
+
+  // History for Undo/Redo. OPTIMIZATION: each record stores only the piece
+  // splice of one edit, keyed by document offset so it stays valid across
+  // CompactPieces. Undo/redo re-apply the inverse splice in O(changed pieces
+  // * log pieces).
+  struct UndoRecord {
+    size_t pos;                  // document offset of the splice
+    std::vector<Piece> removed;  // pieces that covered the removed bytes
+    std::vector<Piece> inserted; // pieces that cover the inserted bytes
+  };
+  // One undo step. Consecutive single-character inserts at adjacent
+  // positions are coalesced into the same record ("typing run").
+  struct UndoGroup {
+    std::vector<UndoRecord> records;
+    bool typingRun = false;
   };
-  PieceInfo FindPiecePosition(size_t pos) const;
+  std::deque<UndoGroup> m_undoStack;
+  std::deque<UndoGroup> m_redoStack;
+  int m_groupDepth = 0;
+  bool m_groupOpen = false; // the current transaction already has a group
+
+  void PushUndo(UndoRecord record, bool singleChar = false);
 
-  // OPTIMIZATION: Line offset cache for O(1) line lookups
-  mutable std::vector<size_t> m_lineOffsetCache;
-  mutable bool m_lineCacheValid = false;
+  // Split the piece containing 'pos' so that a piece starts exactly there.
+  // Returns that piece, or nullptr when pos is the end of the document.
+  PieceTree::Node *SplitAt(size_t pos);
+  // Replace [pos, pos + removeLength) with 'pieces' and return the pieces
+  // that were removed.
+  std::vector<Piece> SplicePieces(size_t pos, size_t removeLength,
+                                  const std::vector<Piece> &pieces);
 
-  void RebuildLineCache() const;
+  // Internal helper to find which piece contains the position (O(log pieces))
+  PieceTree::Position FindPiecePosition(size_t pos) const;
+  void MaybeCompact();
 
   // OPTIMIZATION: Piece table compaction tracking
   size_t m_editsSinceCompaction = 0;
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+enum class BufferType { Original, Added };
+
+struct Piece {
+  BufferType bufferType;
+  size_t start;
+  size_t length;
+  size_t lineCount;
+
+  Piece(BufferType type, size_t s, size_t l, size_t lc = 0)
+      : bufferType(type), start(s), length(l), lineCount(lc) {}
+};
+
+// Red-black tree of pieces in document order. Every node carries the byte
+// length, newline count and piece count of its subtree, so offset->piece,
+// line->piece and index->piece lookups are all O(log pieces).
+class PieceTree {
+public:
+  struct Node {
+    Piece piece;
+    Node *left;
+    Node *right;
+    Node *parent;
+    bool red;
+    size_t subLength;
+    size_t subLines;
+    size_t subCount;
+
+    explicit Node(const Piece &p)
+        : piece(p), left(nullptr), right(nullptr), parent(nullptr), red(true),
+          subLength(p.length), subLines(p.lineCount), subCount(1) {}
+  };
+
+  // Result of an offset or line lookup
+  struct Position {
+    Node *node;           // nullptr if the tree is empty
+    size_t offsetInPiece; // byte offset inside node->piece
+    size_t pieceStart;    // document offset of the first byte of the piece
+    size_t linesBefore;   // newlines in all pieces before this one
+  };
+
+  PieceTree();
+  ~PieceTree();
+  PieceTree(const PieceTree &other);
+  PieceTree &operator=(const PieceTree &other);
+  PieceTree(PieceTree &&other) noexcept;
+  PieceTree &operator=(PieceTree &&other) noexcept;
+
+  bool Empty() const { return m_root == m_nil; }
+  size_t Size() const { return m_root->subCount; }
+  size_t TotalLength() const { return m_root->subLength; }
+  size_t TotalLines() const { return m_root->subLines; }
+
+  void Clear();
+  // Rebuild the whole tree from pieces in document order in O(n)
+  void Build(const std::vector<Piece> &pieces);
+  std::vector<Piece> ToVector() const;
+
+  // Piece containing 'pos'. pos == TotalLength() resolves to the end of the
+  // last piece.
+  Position FindByOffset(size_t pos) const;
+  // Piece containing the newline that ends line 'lineIndex - 1', i.e. the
+  // piece in which line 'lineIndex' starts (lineIndex >= 1).
+  Position FindByNewline(size_t lineIndex) const;
+  Node *NodeAt(size_t index) const;
+  size_t IndexOf(const Node *node) const;
+
+  Node *First() const;
+  Node *Last() const;
+  Node *Next(const Node *node) const;
+  Node *Prev(const Node *node) const;
+
+  Node *InsertBefore(Node *at, const Piece &piece); // at == nullptr appends
+  Node *InsertAfter(Node *at, const Piece &piece);  // at == nullptr prepends
+  void Erase(Node *node);
+  // Must be called after changing node->piece length or line count in place
+  void Update(Node *node);
+
+private:
+  Node *m_nil;
+  Node *m_root;
+
+  Node *Nil() const { return m_nil; }
+  Node *Minimum(Node *x) const;
+  Node *Maximum(Node *x) const;
+  void Recalc(Node *x);
+  void UpdateUpwards(Node *x);
+  void RotateLeft(Node *x);
+  void RotateRight(Node *x);
+  void InsertFixup(Node *z);
+  void EraseFixup(Node *x);
+  void Transplant(Node *u, Node *v);
+  void Attach(Node *parent, Node *z, bool asLeft);
+  void FreeSubtree(Node *x);
+  Node *BuildRange(const std::vector<Piece> &pieces, size_t lo, size_t hi,
+                   size_t depth, size_t redDepth, Node *parent);
+};
@@ -3,9 +3,14 @@
 #include <atomic>
 #include <functional>
 #include <string>
+#ifdef _WIN32
 #include <windows.h>
+#endif
 
 
+// A child process with piped stdin/stdout. Processes start only on Windows;
+// elsewhere Start fails, so code that owns processes (such as Buffer) still
+// builds headless.
 class Process {
 public:
   Process();
@@ -18,12 +23,14 @@ public:
   bool IsRunning() const { return m_running; }
 
 private:
+#ifdef _WIN32
   static DWORD WINAPI ReadThreadProc(LPVOID lpParam);
 
   HANDLE m_hProcess;
   HANDLE m_hInWrite;
   HANDLE m_hOutRead;
   HANDLE m_hThread;
+#endif
   std::function<void(const std::string &)> m_onOutput;
   std::atomic<bool> m_running;
 };
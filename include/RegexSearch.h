@@ -0,0 +1,47 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+class PieceTable;
+
+// Streaming regular expression search. Patterns are compiled to a Thompson
+// NFA and simulated one byte at a time over piece spans (Pike VM), so search
+// time is linear in the text scanned and the document is never copied.
+//
+// Supported syntax (ECMAScript subset): literals, '.', classes with ranges
+// and negation, \d \w \s \D \W \S, \b \B, ^ and $ (line anchors), groups,
+// non-capturing groups, alternation and greedy/lazy * + ? {n,m}. '.' and
+// negated classes consume a whole UTF-8 character. Backreferences and
+// lookaround are not supported.
+class RegexSearcher {
+public:
+  ~RegexSearcher();
+
+  // Returns the compiled pattern from a small cache shared by all callers,
+  // or nullptr if the pattern is invalid or not supported by this engine.
+  static std::shared_ptr<const RegexSearcher> Get(const std::string &pattern,
+                                                  bool matchCase);
+
+  // First match starting at or after startPos (leftmost-first, as in
+  // ECMAScript), and no later than lastStart. Returns npos if there is none.
+  size_t FindForward(const PieceTable &table, size_t startPos,
+                     size_t *matchLength = nullptr,
+                     size_t lastStart = std::string::npos) const;
+  // Start of the last match that begins at or before startPos and ends at or
+  // before it. Returns npos if there is none.
+  size_t FindBackward(const PieceTable &table, size_t startPos) const;
+
+  // False when no match can contain a newline, so every match (and every
+  // byte the search looks at to decide one) lies within a single line
+  bool CanMatchNewline() const { return m_matchesNewline; }
+
+  struct Program;
+
+private:
+  RegexSearcher();
+
+  std::unique_ptr<Program> m_forward;
+  std::unique_ptr<Program> m_reverse; // reads the text right to left
+  bool m_matchesNewline = true;
+};
@@ -61,6 +61,11 @@ public:
   int GetCaretStyle() const { return m_caretStyle; }
   void SetCaretStyle(int style) { m_caretStyle = style; }
 
+  // How long edits gather before the crash recovery journal syncs them;
+  // 0 turns journaling off
+  int GetJournalFlushMs() const { return m_journalFlushMs; }
+  void SetJournalFlushMs(int ms) { m_journalFlushMs = ms; }
+
   std::wstring GetAppDataPath() const;
 
 private:
@@ -81,6 +86,7 @@ private:
   bool m_caretBlinking;
   int m_caretStyle = 0;
   int m_shellEncoding; // 0=UTF8, 1=ShiftJIS
+  int m_journalFlushMs = 1000;
   std::wstring m_projectDirectory;
   std::wstring m_findStartDir;
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "Utf.h"
 #include <string>
 #include <vector>
 #include <windows.h>
@@ -9,11 +10,7 @@ public:
   static std::string Utf8ToShiftJis(const std::string &utf8) {
     if (utf8.empty())
       return "";
-    int len = MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), -1, NULL, 0);
-    if (len <= 0)
-      return "";
-    std::vector<wchar_t> wstr(len);
-    MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), -1, wstr.data(), len);
+    std::wstring wstr = Utf::ToWide(utf8);
 
     int sjisLen = WideCharToMultiByte(932, 0, wstr.data(), -1, NULL, 0, NULL, NULL);
     if (sjisLen <= 0)
@@ -33,23 +30,12 @@ public:
     std::vector<wchar_t> wstr(len);
     MultiByteToWideChar(932, 0, sjis.c_str(), -1, wstr.data(), len);
 
-    int utf8Len = WideCharToMultiByte(CP_UTF8, 0, wstr.data(), -1, NULL, 0, NULL, NULL);
-    if (utf8Len <= 0)
-      return "";
-    std::vector<char> utf8(utf8Len);
-    WideCharToMultiByte(CP_UTF8, 0, wstr.data(), -1, utf8.data(), utf8Len, NULL, NULL);
-
-    return std::string(utf8.data());
+    return Utf::FromWide(wstr.data(), len - 1);
   }
 
   static std::string Utf16ToUtf8(const std::wstring &wstr) {
     if (wstr.empty())
       return "";
-    int len = WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), -1, NULL, 0, NULL, NULL);
-    if (len <= 0)
-      return "";
-    std::vector<char> utf8(len);
-    WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), -1, utf8.data(), len, NULL, NULL);
-    return std::string(utf8.data());
+    return Utf::FromWide(wstr);
   }
 };
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+
+class PieceTable;
+
+// Literal substring search kernel. Candidate positions are found with a
+// SIMD filter on the first and last byte of the needle (SSE2, or AVX2 when
+// the compiler targets it) and verified with a byte compare. Case-insensitive
+// search folds ASCII letters only, matching the rest of the editor.
+class TextSearcher {
+public:
+  TextSearcher(const std::string &needle, bool matchCase);
+
+  size_t Length() const { return m_needle.size(); }
+
+  // Offset of the first/last match inside one contiguous block, or npos
+  size_t FindFirst(const char *data, size_t length) const;
+  size_t FindLast(const char *data, size_t length) const;
+
+  // Search a piece table in place, span by span, including matches that
+  // straddle piece boundaries. FindForward returns the first match starting
+  // at or after startPos (and no later than lastStart); FindBackward the last
+  // match starting at or before startPos.
+  size_t FindForward(const PieceTable &table, size_t startPos,
+                     size_t lastStart = std::string::npos) const;
+  size_t FindBackward(const PieceTable &table, size_t startPos) const;
+
+private:
+  std::string m_needle; // folded to lower case when !m_matchCase
+  bool m_matchCase;
+  unsigned char m_first[2]; // accepted first byte (both cases)
+  unsigned char m_last[2];  // accepted last byte (both cases)
+
+  bool Verify(const char *candidate) const;
+  template <bool Fold>
+  size_t ScanForward(const char *data, size_t length) const;
+  template <bool Fold>
+  size_t ScanBackward(const char *data, size_t length) const;
+};
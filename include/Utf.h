@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+
+// UTF-8 <-> UTF-16 conversion for the whole editor. Each conversion is a
+// single pass into a worst-case sized output (UTF-8 never needs more UTF-16
+// units than it has bytes, and UTF-16 never more than three bytes a unit),
+// with SSE2/AVX2 fast paths for ASCII runs. Ill-formed input never fails:
+// each maximal invalid UTF-8 subpart and each lone surrogate becomes
+// U+FFFD, as the Win32 converters do. Portable; wchar_t helpers are
+// provided where wchar_t is UTF-16.
+class Utf {
+public:
+  // Converts 'length' bytes of UTF-8 into 'out', which must have room for
+  // 'length' units; returns the number of units written
+  static size_t Utf8ToUtf16(const char *utf8, size_t length, char16_t *out);
+  // Converts 'length' UTF-16 units into 'out', which must have room for
+  // 3 * 'length' bytes; returns the number of bytes written
+  static size_t Utf16ToUtf8(const char16_t *utf16, size_t length, char *out);
+
+  // UTF-16 units for 'length' bytes of UTF-8: a byte offset to a character
+  // index
+  static size_t Utf16Length(const char *utf8, size_t length);
+  // UTF-8 bytes for 'length' UTF-16 units: a character index to a byte
+  // offset
+  static size_t Utf8Length(const char16_t *utf16, size_t length);
+  // True if 'length' bytes are well-formed UTF-8
+  static bool IsValidUtf8(const char *utf8, size_t length);
+  // Length of the ASCII run 'text' starts with, counted in whole registers;
+  // callers check the bytes after it one at a time
+  static size_t AsciiRun(const char *text, size_t length);
+
+  static std::u16string ToUtf16(const char *utf8, size_t length) {
+    std::u16string out(length, u'\0');
+    out.resize(Utf8ToUtf16(utf8, length, &out[0]));
+    return out;
+  }
+  static std::string ToUtf8(const char16_t *utf16, size_t length) {
+    std::string out(length * 3, '\0');
+    out.resize(Utf16ToUtf8(utf16, length, &out[0]));
+    return out;
+  }
+
+#ifdef _WIN32
+  static_assert(sizeof(wchar_t) == sizeof(char16_t), "wchar_t is UTF-16");
+
+  static size_t Utf8ToWide(const char *utf8, size_t length, wchar_t *out) {
+    return Utf8ToUtf16(utf8, length, reinterpret_cast<char16_t *>(out));
+  }
+  static size_t Utf8Length(const wchar_t *wide, size_t length) {
+    return Utf8Length(reinterpret_cast<const char16_t *>(wide), length);
+  }
+  static std::wstring ToWide(const char *utf8, size_t length) {
+    std::wstring out(length, L'\0');
+    out.resize(Utf8ToWide(utf8, length, &out[0]));
+    return out;
+  }
+  static std::wstring ToWide(const std::string &utf8) {
+    return ToWide(utf8.data(), utf8.size());
+  }
+  static std::string FromWide(const wchar_t *wide, size_t length) {
+    return ToUtf8(reinterpret_cast<const char16_t *>(wide), length);
+  }
+  static std::string FromWide(const std::wstring &wide) {
+    return FromWide(wide.data(), wide.size());
+  }
+#endif
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "PieceTable.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Presents UTF-16 text as UTF-8 without converting it up front. The source
+// is cut into blocks of BLOCK_UNITS code units; BuildMap records where each
+// block starts in the UTF-8 text (one cheap counting pass, no output), and
+// GetSpan converts a block only when it is read, keeping the most recently
+// used ones. Lone surrogates become U+FFFD. Portable: no platform APIs.
+class Utf16Transcoder {
+public:
+  // 'source' supplies the raw UTF-16 bytes (after any BOM), 'length' of
+  // them; a trailing odd byte is ignored
+  Utf16Transcoder(SpanSource source, size_t length, bool bigEndian);
+
+  // Computes the UTF-8 length of every block. Must be called before the
+  // text is read. 'workers' as for PieceTable::IndexOriginal: 0 picks one
+  // per core for large sources. Returns false if cancelled or the source
+  // could not be read.
+  bool BuildMap(const std::atomic<bool> *cancel = nullptr, size_t workers = 0);
+
+  // Length of the UTF-8 text
+  size_t GetLength() const { return m_blockStarts.back(); }
+  size_t GetSourceLength() const { return m_units * 2; }
+
+  // The converted block holding UTF-8 byte 'offset'. Safe to call from
+  // several threads at once.
+  TextSpan GetSpan(size_t offset) const;
+  // A SpanSource over the UTF-8 text that keeps the transcoder alive
+  static SpanSource MakeSource(std::shared_ptr<Utf16Transcoder> transcoder);
+
+  // Source byte offset of the code unit that encodes UTF-8 byte 'offset'
+  size_t ToSourceOffset(size_t offset) const;
+  // UTF-8 offset of the character starting at source byte 'sourceOffset'
+  size_t ToUtf8Offset(size_t sourceOffset) const;
+
+  static constexpr size_t BLOCK_UNITS = 32 * 1024;
+  static constexpr size_t MAX_CACHED_BLOCKS = 32;
+  static constexpr size_t PARALLEL_MAP_MIN_BYTES = 16 * 1024 * 1024;
+
+private:
+  struct Block;
+
+  SpanSource m_source;
+  size_t m_units;
+  bool m_bigEndian;
+  // UTF-8 offset of each block's first byte, plus the total at the end
+  std::vector<size_t> m_blockStarts;
+
+  mutable std::mutex m_cacheMutex;
+  // Converted blocks, least recently used first
+  mutable std::vector<std::shared_ptr<Block>> m_cache;
+
+  // Copies units [first, first + count) in host order; returns how many
+  // could be read
+  size_t ReadUnits(size_t first, size_t count, char16_t *out) const;
+  // Reads the units of 'block' into 'units' with one unit of context on
+  // each side where there is one; 'begin' is the index of the block's first
+  // unit within 'units'
+  bool ReadBlock(size_t block, std::vector<char16_t> &units,
+                 size_t &begin) const;
+  // The block holding UTF-8 byte 'offset'
+  size_t BlockOf(size_t offset) const;
+  // Counts (out == nullptr) or writes the UTF-8 for units [begin, end) of
+  // 'units', which holds 'count' units including context
+  static size_t Transcode(const char16_t *units, size_t count, size_t begin,
+                          size_t end, char *out);
+};
@@ -82,7 +82,7 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
         static bool caretVisible = true;
         caretVisible = !caretVisible;
         g_renderer->SetCaretVisible(caretVisible);
-        InvalidateRect(hwnd, NULL, FALSE);
+        g_renderer->InvalidateCaret();
       } else {
         // Ensure it is visible if blinking is off
         g_renderer->SetCaretVisible(true);
@@ -112,13 +112,59 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam,
     }
     return 0;
   }
+  case WM_FIND_RESULTS: {
+    FindResultsBatch *batch = (FindResultsBatch *)wParam;
+    if (batch) {
+      if (g_editor && g_editor->HandleFindResults(*batch)) {
+        std::wstring status;
+        if (batch->done)
+          status = batch->cancelled ? L"Find in Files cancelled"
+                                    : L"Find in Files done";
+        else
+          status = L"Searching... " + std::to_wstring(batch->filesScanned) +
+                   L" / " + std::to_wstring(batch->filesFound) + L" files";
+        SendMessage(g_statusHwnd, SB_SETTEXT, 0, (LPARAM)status.c_str());
+        UpdateScrollbars(hwnd);
+        InvalidateRect(hwnd, NULL, FALSE);
+      }
+      delete batch;
+    }
+    return 0;
+  }
+  case WM_BUFFER_INDEXED: {
+    Buffer *buf = (Buffer *)wParam;
+    if (g_editor && g_editor->HandleBufferIndexed(buf)) {
+      std::wstring status = L"Ready";
+      if (!g_editor->IsValidBuffer(buf)) { // closed: the file was unreadable
+        status = L"Could not open file";
+        UpdateMenu(hwnd);
+      } else if (buf->IsIndexing()) {
+        status = L"Loading... " +
+                 std::to_wstring((int)(buf->GetIndexProgress() * 100)) + L"%";
+      }
+      SendMessage(g_statusHwnd, SB_SETTEXT, 0, (LPARAM)status.c_str());
+      UpdateScrollbars(hwnd);
+      InvalidateRect(hwnd, NULL, FALSE);
+    }
+    return 0;
+  }
+  case WM_BUFFER_SAVED: {
+    Buffer *buf = (Buffer *)wParam;
+    if (g_editor && g_editor->HandleBufferSaved(buf) && buf->IsSaving()) {
+      std::wstring status =
+          L"Saving... " +
+          std::to_wstring((int)(buf->GetSaveProgress() * 100)) + L"%";
+      SendMessage(g_statusHwnd, SB_SETTEXT, 0, (LPARAM)status.c_str());
+    }
+    return 0;
+  }
   case WM_DROPFILES: {
     HDROP hDrop = (HDROP)wParam;
     UINT count = DragQueryFile(hDrop, 0xFFFFFFFF, NULL, 0);
     for (UINT i = 0; i < count; i++) {
       wchar_t path[MAX_PATH];
       DragQueryFile(hDrop, i, path, MAX_PATH);
-      g_editor->OpenFile(path);
+      g_editor->OpenFileAsync(path);
     }
     DragFinish(hDrop);
     UpdateMenu(hwnd);
@@ -281,6 +327,16 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
   if (!hwnd)
     return 0;
 
+  // Crash recovery, before the command line opens anything. A headless run
+  // never closes its buffers, so it would leave journals behind.
+  int journalFlushMs = SettingsManager::Instance().GetJournalFlushMs();
+  if (!headless && journalFlushMs > 0) {
+    if (g_editor->EnableJournals(SettingsManager::Instance().GetAppDataPath() +
+                                     L"\\journal",
+                                 journalFlushMs) > 0)
+      UpdateMenu(hwnd);
+  }
+
   if (argv) {
     for (int i = 1; i < argc; ++i) {
       if (wcscmp(argv[i], L"-headless") == 0 ||
@@ -289,14 +345,7 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
         continue;
       else if (wcscmp(argv[i], L"-e") == 0 && i + 1 < argc) {
         std::wstring code = argv[++i];
-        int len = WideCharToMultiByte(CP_UTF8, 0, code.c_str(), -1, NULL, 0,
-                                      NULL, NULL);
-        if (len > 0) {
-          std::string codeA(len - 1, 0);
-          WideCharToMultiByte(CP_UTF8, 0, code.c_str(), -1, &codeA[0], len,
-                              NULL, NULL);
-          g_scriptEngine->Evaluate(codeA);
-        }
+        g_scriptEngine->Evaluate(Utf::FromWide(code));
       } else {
         g_editor->OpenFile(argv[i]);
       }
@@ -1,121 +1,848 @@
 #include "../include/Buffer.h"
+#include "../include/CodePage.h"
+#include "../include/CodePageTranscoder.h"
+#include "../include/FileWriter.h"
 #include "../include/Process.h"
-#include "../include/SettingsManager.h"
-#include "../include/StringHelpers.h"
+#include "../include/RegexSearch.h"
+#include "../include/TextSearch.h"
+#include "../include/Utf.h"
+#include "../include/Utf16Transcoder.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
 
 // Undefine Windows min/max macros to avoid conflicts with std::min/std::max
 #undef min
 #undef max
 
+enum LogLevel { LOG_DEBUG = 0, LOG_INFO = 1, LOG_WARN = 2, LOG_ERROR = 3 };
+void DebugLog(const std::string &msg, LogLevel level = LOG_INFO);
+
 Buffer::Buffer()
     : m_caretPos(0), m_selectionAnchor(0), m_scrollLine(0), m_scrollX(0.0f),
       m_desiredColumn(0), m_encoding(Encoding::UTF8), m_isDirty(false),
       m_isScratch(false), m_isShell(false), m_inputStart(0) {
-  m_mmFile = std::make_unique<MemoryMappedFile>();
+  m_mmFile = std::make_shared<MemoryMappedFile>();
+  m_pieceTable.SetEditListener(
+      [this](size_t pos, size_t removed, size_t inserted) {
+        m_matchIndex.OnEdit(m_pieceTable, pos, removed, inserted);
+      });
+  m_pieceTable.SetSpliceListener(
+      [this](size_t pos, const std::vector<Piece> &removed,
+             const std::vector<Piece> &inserted) {
+        if (m_journal)
+          JournalSplice(pos, removed, inserted);
+      });
 }
 
-Buffer::~Buffer() {}
+Buffer::~Buffer() {
+  CancelIndexing();
+  FinishSave(true);
+  StopJournal();
+}
 
 bool Buffer::OpenFile(const std::wstring &path) {
-  if (m_mmFile->Open(path)) {
-    m_filePath = path;
-    const char *data = m_mmFile->GetData();
-    size_t size = m_mmFile->GetSize();
-    m_encoding = Encoding::UTF8;
-    m_convertedData.clear();
-
-    if (size >= 2) {
-      if (static_cast<unsigned char>(data[0]) == 0xFF &&
-          static_cast<unsigned char>(data[1]) == 0xFE) {
-        m_encoding = Encoding::UTF16LE;
-      } else if (static_cast<unsigned char>(data[0]) == 0xFE &&
-                 static_cast<unsigned char>(data[1]) == 0xFF) {
-        m_encoding = Encoding::UTF16BE;
-      }
-    }
-    if (size >= 3 && static_cast<unsigned char>(data[0]) == 0xEF &&
-        static_cast<unsigned char>(data[1]) == 0xBB &&
-        static_cast<unsigned char>(data[2]) == 0xBF) {
-      m_encoding = Encoding::UTF8; // UTF8 with BOM
-      data += 3;
-      size -= 3;
+  CancelIndexing();
+  // A fresh mapping, since a running save may still read the old one
+  m_mmFile = std::make_shared<MemoryMappedFile>();
+  m_loadFailed = false;
+  OpenedOriginal original;
+  if (!MapOriginal(path, original))
+    return false;
+  LoadOpened(path, original, InitialIndexBytes(original.length));
+  StartIndexing(original);
+  CheckpointJournal(path);
+  return true;
+}
+
+void Buffer::OpenFileAsync(const std::wstring &path) {
+  CancelIndexing();
+  m_mmFile = std::make_shared<MemoryMappedFile>();
+  m_pieceTable.LoadOriginal(nullptr, 0);
+  m_originalFileOffset = OpenedOriginal::NO_FILE_OFFSET;
+  m_originalFile = EditJournal::Fingerprint();
+  m_matchIndex.Invalidate();
+  m_filePath = path;
+  m_isDirty = false;
+  m_caretPos = 0;
+  m_selectionAnchor = 0;
+  m_scrollLine = 0;
+  CheckpointJournal(path);
+
+  m_loadFailed = false;
+  m_opening = true;
+  m_indexCancel = false;
+  m_indexThread = std::thread([this, path]() {
+    OpenedOriginal original;
+    if (!MapOriginal(path, original, &m_indexCancel)) {
+      PublishIndexing([this]() {
+        m_pendingFailure = true;
+        m_indexDone = true;
+      });
+      return;
     }
+    m_indexTotal = original.length;
+    PublishIndexing([&]() {
+      m_pendingOpen = std::make_unique<OpenedOriginal>(original);
+    });
+    IndexChunks(original, 0);
+  });
+}
+
+// Code page of the legacy encodings, which are decoded to UTF-8 on open and
+// encoded back on save
+static bool LegacyCodePage(Encoding encoding, unsigned &codePage) {
+  switch (encoding) {
+  case Encoding::ShiftJIS:
+    codePage = CodePage::SHIFT_JIS;
+    return true;
+  case Encoding::ANSI:
+    codePage = CodePage::ANSI;
+    return true;
+  default:
+    return false;
+  }
+}
+
+// The byte order mark a file of 'encoding' starts with, if it has one
+static std::string ByteOrderMark(Encoding encoding) {
+  switch (encoding) {
+  case Encoding::UTF8:
+    return "\xEF\xBB\xBF";
+  case Encoding::UTF16LE:
+    return "\xFF\xFE";
+  case Encoding::UTF16BE:
+    return "\xFE\xFF";
+  default:
+    return std::string();
+  }
+}
 
-    if (m_encoding == Encoding::UTF16LE || m_encoding == Encoding::UTF16BE) {
-      bool be = (m_encoding == Encoding::UTF16BE);
-      const wchar_t *wdata = reinterpret_cast<const wchar_t *>(data + 2);
-      size_t wlen = (size - 2) / 2;
+// Length of 'text' less a UTF-8 character cut off at its end, if any, so
+// that text cut there encodes piece by piece; at most 3 bytes are left
+static size_t Utf8Prefix(const std::string &text) {
+  size_t i = text.size(), continuation = 0;
+  while (i > 0 && continuation < 3 &&
+         (static_cast<unsigned char>(text[i - 1]) & 0xC0) == 0x80) {
+    --i;
+    ++continuation;
+  }
+  if (i == 0)
+    return text.size();
+  unsigned char lead = static_cast<unsigned char>(text[i - 1]);
+  size_t n = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+  return n > continuation + 1 ? i - 1 : text.size();
+}
 
-      std::vector<wchar_t> switched;
-      if (be) {
-        switched.resize(wlen);
-        for (size_t i = 0; i < wlen; ++i) {
-          switched[i] = ((wdata[i] & 0xFF) << 8) | ((wdata[i] >> 8) & 0xFF);
+static const size_t CONVERT_CHUNK = 4 * 1024 * 1024;
+
+bool Buffer::MapOriginal(const std::wstring &path, OpenedOriginal &out,
+                         const std::atomic<bool> *cancel) {
+  // Files past the threshold are mapped window by window so that neither
+  // address space nor resident memory grows with the file
+  std::error_code ec;
+  uintmax_t fileSize = std::filesystem::file_size(path, ec);
+  bool windowed = !ec && m_windowedOpenBytes > 0 &&
+                  fileSize >= m_windowedOpenBytes;
+
+  if (!(windowed &&
+        m_mmFile->Open(path, MemoryMappedFile::Backend::Windowed) &&
+        m_mmFile->GetBackend() == MemoryMappedFile::Backend::Windowed) &&
+      !m_mmFile->Open(path))
+    return false;
+  MemoryMappedFile *file = m_mmFile.get();
+  windowed = file->GetBackend() == MemoryMappedFile::Backend::Windowed;
+  size_t size = file->GetSize();
+  // Transcoding and line counting read the file once, front to back
+  file->Advise(MemoryMappedFile::Access::Sequential);
+
+  // A BOM, or else a few samples of the file, tell its encoding
+  EncodingDetector::Result detected = EncodingDetector::Detect(
+      size, [file](uint64_t offset, char *out, size_t length) {
+        size_t copied = 0;
+        while (copied < length) {
+          MemoryMappedFile::View view = file->GetView(offset + copied);
+          size_t at = offset + copied;
+          if (!view.data || view.offset + view.length <= at)
+            break;
+          size_t n = (std::min)(view.offset + view.length - at,
+                                length - copied);
+          memcpy(out + copied, view.data + (at - view.offset), n);
+          copied += n;
         }
-        wdata = switched.data();
-      }
+        return copied;
+      });
+  size_t skip = detected.bomLength;
+  out.encoding = detected.encoding;
+  out.bom = skip > 0;
+
+  out.data = nullptr;
+  out.source = nullptr;
+  out.length = size - skip;
+  SpanSource raw;
+  if (windowed) {
+    raw = [file, skip](size_t offset) {
+      MemoryMappedFile::View view = file->GetView(offset + skip);
+      TextSpan span;
+      if (!view.data)
+        return span;
+      // Text offsets start after the BOM
+      size_t drop = view.offset < skip ? skip - view.offset : 0;
+      span.data = view.data + drop;
+      span.offset = view.offset + drop - skip;
+      span.length = view.length - drop;
+      span.pin = std::move(view.pin);
+      return span;
+    };
+  } else if (out.encoding == Encoding::UTF8) {
+    out.data = file->GetData() + skip;
+    out.fileOffset = skip;
+    return true;
+  } else {
+    const char *data = file->GetData() + skip;
+    size_t length = size - skip;
+    raw = [data, length](size_t) {
+      TextSpan span;
+      span.data = data;
+      span.length = length;
+      return span;
+    };
+  }
+  if (out.encoding == Encoding::UTF8) {
+    out.source = std::move(raw);
+    out.fileOffset = skip;
+    return true;
+  }
 
-      int utf8len = WideCharToMultiByte(
-          CP_UTF8, 0, wdata, static_cast<int>(wlen), NULL, 0, NULL, NULL);
-      m_convertedData.resize(utf8len);
-      WideCharToMultiByte(CP_UTF8, 0, wdata, static_cast<int>(wlen),
-                          &m_convertedData[0], utf8len, NULL, NULL);
-      m_pieceTable.LoadOriginal(m_convertedData.data(), m_convertedData.size());
-    } else {
-      m_pieceTable.LoadOriginal(data, size);
+  unsigned codePage;
+  if (LegacyCodePage(out.encoding, codePage)) {
+    // Decoded block by block as it is read, like UTF-16 below; the map pass
+    // also checks that every block would encode back to the bytes read
+    auto transcoder =
+        std::make_shared<CodePageTranscoder>(raw, size - skip, codePage);
+    bool exact = true;
+    if (!transcoder->BuildMap(exact, cancel))
+      return false;
+    if (!exact) {
+      // A save would not write back the bytes it read; the file is kept as
+      // it is instead, its bytes read as UTF-8
+      DebugLog("Buffer::MapOriginal - file does not round-trip through its "
+               "code page; reading it as UTF-8",
+               LOG_WARN);
+      out.encoding = Encoding::UTF8;
+      out.fileOffset = skip;
+      if (windowed)
+        out.source = std::move(raw);
+      else
+        out.data = file->GetData() + skip;
+      return true;
     }
+    out.length = transcoder->GetLength();
+    out.source = CodePageTranscoder::MakeSource(std::move(transcoder));
+    return true;
+  }
 
-    m_isDirty = false;
-    m_caretPos = 0;
-    m_selectionAnchor = 0;
-    m_scrollLine = 0;
+  // UTF-16 is transcoded block by block as it is read; only the map of
+  // where each block starts in the UTF-8 text is built now
+  auto transcoder = std::make_shared<Utf16Transcoder>(
+      std::move(raw), size - skip, out.encoding == Encoding::UTF16BE);
+  if (!transcoder->BuildMap(cancel))
+    return false;
+  out.length = transcoder->GetLength();
+  out.source = Utf16Transcoder::MakeSource(std::move(transcoder));
+  return true;
+}
+
+void Buffer::LoadOpened(const std::wstring &path,
+                        const OpenedOriginal &original, size_t prefix) {
+  m_filePath = path;
+  m_encoding = original.encoding;
+  m_hasBom = original.bom;
+  m_originalFileOffset = original.fileOffset;
+  m_originalFile = EditJournal::Take(path);
+  if (original.source)
+    m_pieceTable.LoadOriginal(original.source, original.length, prefix);
+  else
+    m_pieceTable.LoadOriginal(original.data, original.length, prefix);
+  m_matchIndex.Invalidate();
+
+  m_isDirty = false;
+  m_caretPos = 0;
+  m_selectionAnchor = 0;
+  m_scrollLine = 0;
+}
+
+size_t Buffer::InitialIndexBytes(size_t size) const {
+  if (m_backgroundIndexBytes == 0 || size < m_backgroundIndexBytes)
+    return SIZE_MAX;
+  return INITIAL_INDEX_BYTES;
+}
+
+void Buffer::StartIndexing(const OpenedOriginal &original) {
+  size_t loaded = m_pieceTable.GetLoadedOriginalLength();
+  m_indexTotal = original.length;
+  m_indexedBytes = loaded;
+  if (loaded >= original.length) {
+    m_mmFile->Advise(MemoryMappedFile::Access::Normal);
+    return;
+  }
+  m_indexCancel = false;
+  m_indexThread = std::thread(
+      [this, original, loaded]() { IndexChunks(original, loaded); });
+}
+
+void Buffer::IndexChunks(const OpenedOriginal &original, size_t from) {
+  // A private table over the same original does the reading, so the
+  // buffer's own table is only touched by its owner; the indexes it
+  // produces are plain data
+  PieceTable indexer;
+  if (original.source)
+    indexer.LoadOriginal(original.source, original.length, 0);
+  else
+    indexer.LoadOriginal(original.data, original.length, 0);
+
+  size_t pos = from;
+  size_t chunk = from == 0 ? INITIAL_INDEX_BYTES : INDEX_CHUNK_BYTES;
+  while (pos < original.length && !m_indexCancel) {
+    size_t end = (std::min)(original.length, pos + chunk);
+    PieceTable::OriginalIndex index =
+        indexer.IndexOriginal(pos, end, &m_indexCancel);
+    if (index.end != end)
+      break; // cancelled
+    m_indexedBytes = end;
+    PublishIndexing([&]() { m_readyIndexes.push_back(std::move(index)); });
+    pos = end;
+    chunk = INDEX_CHUNK_BYTES;
+  }
+  PublishIndexing([this]() { m_indexDone = true; });
+}
+
+void Buffer::PublishIndexing(std::function<void()> update) {
+  {
+    std::lock_guard<std::mutex> lock(m_indexMutex);
+    update();
+  }
+  m_indexCv.notify_all();
+  if (!m_indexCancel && m_indexedCb)
+    m_indexedCb();
+}
+
+void Buffer::CancelIndexing() {
+  m_indexCancel = true;
+  if (m_indexThread.joinable())
+    m_indexThread.join();
+  std::lock_guard<std::mutex> lock(m_indexMutex);
+  m_pendingOpen.reset();
+  m_readyIndexes.clear();
+  m_indexDone = false;
+  m_pendingFailure = false;
+  m_opening = false;
+}
+
+bool Buffer::FinishIndexing(bool wait) {
+  while (!TakeIndexed(wait)) {
+    if (!wait)
+      return false;
+  }
+  return true;
+}
+
+bool Buffer::TakeIndexed(bool wait) {
+  if (!m_indexThread.joinable())
     return true;
+  std::unique_ptr<OpenedOriginal> opened;
+  std::deque<PieceTable::OriginalIndex> ready;
+  bool done, failed;
+  {
+    std::unique_lock<std::mutex> lock(m_indexMutex);
+    if (wait) {
+      m_indexCv.wait(lock, [this]() {
+        return m_indexDone || m_pendingOpen || !m_readyIndexes.empty();
+      });
+    }
+    opened = std::move(m_pendingOpen);
+    ready.swap(m_readyIndexes);
+    done = m_indexDone;
+    failed = m_pendingFailure;
   }
-  return false;
+
+  if (opened) {
+    LoadOpened(m_filePath, *opened, 0);
+    m_opening = false;
+  }
+  for (PieceTable::OriginalIndex &index : ready)
+    m_pieceTable.AppendOriginal(std::move(index));
+
+  if (done) {
+    m_indexThread.join();
+    CancelIndexing(); // resets the hand-over state
+    m_loadFailed = failed;
+    if (!failed)
+      m_mmFile->Advise(MemoryMappedFile::Access::Normal);
+  }
+  return done;
+}
+
+float Buffer::GetIndexProgress() const {
+  size_t total = m_indexTotal;
+  if (!IsIndexing() || total == 0)
+    return 1.0f;
+  return static_cast<float>(static_cast<double>(m_indexedBytes) / total);
 }
 
-bool SafeSave(const std::wstring &targetPath, const std::string &content);
-bool SafeSaveStreaming(
-    const std::wstring &targetPath,
-    const std::function<void(std::function<void(const char *, size_t)>)>
-        &source);
+size_t Buffer::GetEstimatedTotalLines() const {
+  size_t lines = GetTotalLines();
+  size_t loaded = m_pieceTable.GetLoadedOriginalLength();
+  size_t length = m_pieceTable.GetOriginalLength();
+  if (!IsIndexing() || loaded == 0 || loaded >= length)
+    return lines;
+  return lines + static_cast<size_t>(static_cast<double>(lines) *
+                                     (length - loaded) / loaded);
+}
+
+// Writes 'text' to 'path', after the byte order mark if 'bom'. Pieces are
+// gathered into large writes, and unedited runs of a UTF-8 original are
+// copied from 'file' (which stays the same file even after a save renames
+// another over its path). Text of any other encoding is encoded back to it
+// a chunk at a time; a character the encoding lacks fails the save rather
+// than being written as '?'.
+static bool WriteSnapshot(const PieceTable::Snapshot &text,
+                          const std::wstring &path, Encoding encoding,
+                          bool bom, const MemoryMappedFile &file,
+                          uint64_t fileOffset,
+                          const std::function<void(size_t)> &progress) {
+  FileWriter writer;
+  unsigned codePage;
+  bool legacy = LegacyCodePage(encoding, codePage);
+  bool transcode = encoding != Encoding::UTF8;
+  bool lossy = false;
+  std::string carry;
+  std::u16string units;
+  auto encode = [&](size_t cut) {
+    std::string bytes;
+    if (legacy) {
+      bytes = CodePage::FromUtf8(carry.data(), cut, codePage, &lossy);
+    } else {
+      units.resize(cut);
+      units.resize(Utf::Utf8ToUtf16(carry.data(), cut, &units[0]));
+      bytes.resize(units.size() * 2);
+      size_t high = encoding == Encoding::UTF16BE ? 0 : 1;
+      for (size_t i = 0; i < units.size(); ++i) {
+        bytes[2 * i + high] = static_cast<char>(units[i] >> 8);
+        bytes[2 * i + (high ^ 1)] = static_cast<char>(units[i] & 0xFF);
+      }
+    }
+    if (!lossy)
+      writer.Write(bytes.data(), bytes.size());
+    carry.erase(0, cut);
+  };
+  if (writer.Open(path)) {
+    if (bom) {
+      std::string mark = ByteOrderMark(encoding);
+      writer.Write(mark.data(), mark.size());
+    }
+    text.WriteTo(
+        [&](const char *data, size_t len) {
+          if (!transcode) {
+            writer.Write(data, len);
+          } else if (!lossy) {
+            carry.append(data, len);
+            if (carry.size() >= CONVERT_CHUNK)
+              encode(Utf8Prefix(carry));
+          }
+          progress(len);
+        },
+        [&](size_t offset, size_t len) {
+          if (transcode || fileOffset == OpenedOriginal::NO_FILE_OFFSET ||
+              !writer.CopyFrom(file, fileOffset + offset, len))
+            return false;
+          progress(len);
+          return true;
+        });
+    if (transcode && !lossy)
+      encode(carry.size());
+  }
+  if (lossy) {
+    DebugLog("Buffer::SaveFile - text has characters the file's encoding "
+             "cannot hold; not saved",
+             LOG_ERROR);
+    return false;
+  }
+  if (writer.Commit())
+    return true;
+  DebugLog("Buffer::SaveFile - " + writer.GetError(), LOG_ERROR);
+  return false;
+}
 
 bool Buffer::SaveFile(const std::wstring &path) {
+  FinishIndexing(true);
+  FinishSave(true);
+  if (m_loadFailed && path == m_filePath)
+    return false; // never replace a file that could not be read
   size_t total = m_pieceTable.GetTotalLength();
   size_t written = 0;
+  bool saved = WriteSnapshot(
+      m_pieceTable.TakeSnapshot(), path, m_encoding, m_hasBom, *m_mmFile,
+      m_originalFileOffset,
+      [&](size_t len) {
+        written += len;
+        if (m_progressCb && total > 0) {
+          m_progressCb((float)written / total);
+        }
+      });
+  if (m_progressCb)
+    m_progressCb(0.0f); // Reset
+  if (saved && path == m_filePath) {
+    m_isDirty = false;
+    CheckpointJournal(path);
+  }
+  return saved;
+}
 
-  auto writer = [&](std::function<void(const char *, size_t)> chunkWriter) {
-    auto progressChunkWriter = [&](const char *data, size_t len) {
-      chunkWriter(data, len);
-      written += len;
-      if (m_progressCb && total > 0) {
-        m_progressCb((float)written / total);
+void Buffer::SaveFileAsync(const std::wstring &path) {
+  FinishIndexing(true);
+  FinishSave(true);
+  bool refused = m_loadFailed && path == m_filePath;
+  PieceTable::Snapshot text = m_pieceTable.TakeSnapshot();
+  std::shared_ptr<MemoryMappedFile> file = m_mmFile;
+  uint64_t fileOffset = m_originalFileOffset;
+  Encoding encoding = m_encoding;
+  bool bom = m_hasBom;
+  m_savePath = path;
+  m_saveGeneration = m_editGeneration;
+  if (m_journal && path == m_filePath)
+    m_journal->BeginCheckpoint(); // edits from now on outlive the save
+  m_saveTotal = text.GetTotalLength();
+  m_savedBytes = 0;
+  m_saveDone = false;
+  m_saveResult = false;
+
+  m_saveThread = std::thread([this, text, file, fileOffset, encoding, bom,
+                              path, refused]() {
+    size_t total = m_saveTotal;
+    size_t percent = 0;
+    auto progress = [&](size_t len) {
+      size_t written = m_savedBytes += len;
+      if (m_saveCb && total > 0 && written * 100 / total != percent) {
+        percent = written * 100 / total;
+        m_saveCb();
       }
     };
-    m_pieceTable.WriteTo(progressChunkWriter);
+    bool saved = !refused && WriteSnapshot(text, path, encoding, bom, *file,
+                                           fileOffset, progress);
+    m_saveResult = saved;
+    m_saveDone = true;
+    if (m_saveCb)
+      m_saveCb();
+  });
+}
+
+bool Buffer::FinishSave(bool wait, bool *succeeded) {
+  if (!m_saveThread.joinable())
+    return true;
+  if (!wait && !m_saveDone)
+    return false;
+  m_saveThread.join();
+  bool saved = m_saveResult && m_savePath == m_filePath;
+  if (m_journal && m_savePath == m_filePath)
+    m_journal->EndCheckpoint(saved, EditJournal::Take(m_filePath));
+  // Edits made while the snapshot was written are not in the file
+  if (saved && m_saveGeneration == m_editGeneration)
+    m_isDirty = false;
+  if (succeeded)
+    *succeeded = m_saveResult;
+  return true;
+}
+
+float Buffer::GetSaveProgress() const {
+  if (!IsSaving() || m_saveTotal == 0)
+    return 1.0f;
+  return static_cast<float>(static_cast<double>(m_savedBytes) / m_saveTotal);
+}
+
+bool Buffer::StartJournal(const std::wstring &journalPath, unsigned flushMs) {
+  StopJournal();
+  auto journal = std::make_unique<EditJournal>(flushMs);
+  if (!journal->Create(journalPath, EditJournal::Take(m_filePath))) {
+    DebugLog("Buffer::StartJournal - cannot create journal", LOG_WARN);
+    return false;
+  }
+  m_journal = std::move(journal);
+  return true;
+}
+
+bool Buffer::RecoverJournal(const std::wstring &journalPath,
+                            unsigned flushMs) {
+  StopJournal();
+  // An async open replaces the document once the file is mapped
+  while (m_opening && !TakeIndexed(true)) {
+  }
+  auto journal = std::make_unique<EditJournal>(flushMs);
+  size_t replayed = 0;
+  bool resumed = journal->Resume(
+      journalPath, EditJournal::Take(m_filePath),
+      [&](const std::vector<EditJournal::Change> &changes) {
+        // Only as much of the file is indexed as the edit reaches; the
+        // rest goes on in the background
+        uint64_t reach = 0;
+        for (const auto &change : changes)
+          reach = (std::max)(reach, change.pos + change.removed);
+        while (GetTotalLength() < reach && !TakeIndexed(true)) {
+        }
+
+        // Each change's text, shared by the changes repeating it
+        std::vector<std::string> texts;
+        std::vector<size_t> textOf;
+        size_t total = GetTotalLength();
+        uint64_t end = 0;
+        for (const auto &change : changes) {
+          if (change.pos < end || change.pos > total ||
+              (changes.size() > 1 && change.removed > total - change.pos))
+            return; // not an edit of this text; skip rather than guess
+          end = change.pos + change.removed;
+          if (change.repeat) {
+            textOf.push_back(textOf.back());
+            continue;
+          }
+          std::string text;
+          for (const auto &segment : change.segments) {
+            if (!segment.original) {
+              text += segment.bytes;
+              continue;
+            }
+            Piece piece(BufferType::Original,
+                        static_cast<size_t>(segment.start),
+                        static_cast<size_t>(segment.length));
+            if (!m_pieceTable.ReadPiece(piece,
+                                        [&](const char *data, size_t length) {
+                                          text.append(data, length);
+                                          return true;
+                                        }))
+              return;
+          }
+          textOf.push_back(texts.size());
+          texts.push_back(std::move(text));
+        }
+
+        if (changes.size() == 1) {
+          size_t pos = static_cast<size_t>(changes.front().pos);
+          m_pieceTable.Delete(
+              pos, (std::min)(static_cast<size_t>(changes.front().removed),
+                              total - pos));
+          m_pieceTable.Insert(pos, texts.front());
+        } else if (texts.size() == 1) {
+          // A replace-all, replayed as one
+          std::vector<std::pair<size_t, size_t>> ranges;
+          ranges.reserve(changes.size());
+          for (const auto &change : changes)
+            ranges.emplace_back(static_cast<size_t>(change.pos),
+                                static_cast<size_t>(change.removed));
+          m_pieceTable.ReplaceRanges(ranges, texts.front());
+        } else {
+          // Back to front, so each change's offset still holds
+          m_pieceTable.BeginUndoGroup();
+          for (size_t i = changes.size(); i-- > 0;) {
+            size_t pos = static_cast<size_t>(changes[i].pos);
+            m_pieceTable.Delete(pos, static_cast<size_t>(changes[i].removed));
+            m_pieceTable.Insert(pos, texts[textOf[i]]);
+          }
+          m_pieceTable.EndUndoGroup();
+        }
+        ++replayed;
+      });
+  if (!resumed)
+    return false;
+  if (replayed > 0)
+    MarkEdited();
+  m_journal = std::move(journal);
+  return true;
+}
+
+void Buffer::StopJournal() {
+  if (m_journal) {
+    m_journal->Close(true);
+    m_journal.reset();
+  }
+}
+
+// A change of a splice: [pos, pos + removed) of the document before it was
+// replaced by the bytes of 'inserted'
+struct SpliceChange {
+  size_t pos;
+  size_t removed;
+  std::vector<Piece> inserted;
+};
+
+// Splits a splice into the changes it makes. Where the inserted pieces
+// read the same buffer bytes as the removed ones the text is kept, so a
+// replace-all (or its undo/redo) comes out as one change per match rather
+// than one spanning them all. Any split is a correct description; this
+// looks a few pieces ahead on each side for the nearest shared bytes.
+static std::vector<SpliceChange>
+DescribeSplice(size_t pos, const std::vector<Piece> &removed,
+               const std::vector<Piece> &inserted) {
+  const size_t LOOKAHEAD = 4;
+  std::vector<SpliceChange> changes;
+  size_t r = 0, rOffset = 0; // removed piece and offset in it
+  size_t i = 0, iOffset = 0; // inserted piece and offset in it
+  size_t at = pos;           // document offset before the splice
+  bool open = false;
+  auto change = [&]() -> SpliceChange & {
+    if (!open)
+      changes.push_back({at, 0, {}});
+    open = true;
+    return changes.back();
   };
+  auto drop = [&](size_t length) {
+    while (length > 0) {
+      size_t n = (std::min)(length, removed[r].length - rOffset);
+      change().removed += n;
+      at += n;
+      length -= n;
+      if ((rOffset += n) == removed[r].length) {
+        ++r;
+        rOffset = 0;
+      }
+    }
+  };
+  auto add = [&](size_t length) {
+    while (length > 0) {
+      const Piece &piece = inserted[i];
+      size_t n = (std::min)(length, piece.length - iOffset);
+      change().inserted.emplace_back(piece.bufferType, piece.start + iOffset,
+                                     n);
+      length -= n;
+      if ((iOffset += n) == piece.length) {
+        ++i;
+        iOffset = 0;
+      }
+    }
+  };
+
+  while (r < removed.size() && i < inserted.size()) {
+    bool found = false;
+    size_t dropBytes = 0, addBytes = 0;
+    size_t rSkip = 0;
+    for (size_t k = r; k < removed.size() && k < r + LOOKAHEAD; ++k) {
+      const Piece &rp = removed[k];
+      size_t rFrom = rp.start + (k == r ? rOffset : 0);
+      size_t rEnd = rp.start + rp.length;
+      size_t iSkip = 0;
+      for (size_t j = i; j < inserted.size() && j < i + LOOKAHEAD; ++j) {
+        const Piece &ip = inserted[j];
+        size_t iFrom = ip.start + (j == i ? iOffset : 0);
+        size_t iEnd = ip.start + ip.length;
+        size_t from = (std::max)(rFrom, iFrom);
+        if (ip.bufferType == rp.bufferType && from < (std::min)(rEnd, iEnd)) {
+          size_t d = rSkip + (from - rFrom), a = iSkip + (from - iFrom);
+          if (!found || d + a < dropBytes + addBytes) {
+            found = true;
+            dropBytes = d;
+            addBytes = a;
+          }
+        }
+        iSkip += iEnd - iFrom;
+      }
+      rSkip += rEnd - rFrom;
+    }
+    if (!found) {
+      drop(removed[r].length - rOffset);
+      add(inserted[i].length - iOffset);
+      continue;
+    }
+    drop(dropBytes);
+    add(addBytes);
+    size_t kept = (std::min)(removed[r].length - rOffset,
+                             inserted[i].length - iOffset);
+    at += kept;
+    if ((rOffset += kept) == removed[r].length) {
+      ++r;
+      rOffset = 0;
+    }
+    if ((iOffset += kept) == inserted[i].length) {
+      ++i;
+      iOffset = 0;
+    }
+    open = false;
+  }
+  while (r < removed.size())
+    drop(removed[r].length - rOffset);
+  while (i < inserted.size())
+    add(inserted[i].length - iOffset);
+  return changes;
+}
+
+static bool SamePieces(const std::vector<Piece> &a,
+                       const std::vector<Piece> &b) {
+  return a.size() == b.size() &&
+         std::equal(a.begin(), a.end(), b.begin(),
+                    [](const Piece &x, const Piece &y) {
+                      return x.bufferType == y.bufferType &&
+                             x.start == y.start && x.length == y.length;
+                    });
+}
 
-  if (SafeSaveStreaming(path, writer)) {
-    if (m_progressCb)
-      m_progressCb(0.0f); // Reset
-    if (path == m_filePath) {
-      m_isDirty = false;
+void Buffer::JournalSplice(size_t pos, const std::vector<Piece> &removed,
+                           const std::vector<Piece> &inserted) {
+  // Original text is logged as a range of the file while the journal is
+  // written against that file; added text is logged once per distinct run
+  bool byReference = m_journal->IsAgainst(m_originalFile);
+  std::vector<SpliceChange> splices = DescribeSplice(pos, removed, inserted);
+  std::vector<EditJournal::Change> changes(splices.size());
+  for (size_t k = 0; k < splices.size(); ++k) {
+    EditJournal::Change &change = changes[k];
+    change.pos = splices[k].pos;
+    change.removed = splices[k].removed;
+    if (k > 0 && SamePieces(splices[k].inserted, splices[k - 1].inserted)) {
+      change.repeat = true;
+      continue;
+    }
+    for (const Piece &piece : splices[k].inserted) {
+      if (byReference && piece.bufferType == BufferType::Original) {
+        EditJournal::Segment segment;
+        segment.original = true;
+        segment.start = piece.start;
+        segment.length = piece.length;
+        change.segments.push_back(std::move(segment));
+        continue;
+      }
+      if (change.segments.empty() || change.segments.back().original)
+        change.segments.emplace_back();
+      EditJournal::Segment &segment = change.segments.back();
+      m_pieceTable.ReadPiece(piece, [&](const char *data, size_t length) {
+        segment.bytes.append(data, length);
+        return true;
+      });
+      segment.length = segment.bytes.size();
     }
-    return true;
   }
-  if (m_progressCb)
-    m_progressCb(0.0f); // Reset
-  return false;
+  m_journal->RecordChanges(changes);
+}
+
+void Buffer::CheckpointJournal(const std::wstring &path) {
+  if (!m_journal)
+    return;
+  m_journal->BeginCheckpoint();
+  m_journal->EndCheckpoint(true, EditJournal::Take(path));
+}
+
+void Buffer::MarkEdited() {
+  m_isDirty = true;
+  ++m_editGeneration;
 }
 
 void Buffer::Insert(size_t pos, const std::string &text) {
+  if (m_opening)
+    return; // LoadOpened would drop it
   m_pieceTable.Insert(pos, text);
-  m_isDirty = true;
+  MarkEdited();
 }
 
 void Buffer::Delete(size_t pos, size_t length) {
+  if (m_opening)
+    return;
   m_pieceTable.Delete(pos, length);
-  m_isDirty = true;
+  MarkEdited();
 }
 
 std::string Buffer::GetText(size_t pos, size_t length) const {
@@ -140,141 +867,118 @@ size_t Buffer::GetLineAtOffset(size_t offset) const {
 
 #include <regex>
 
-// OPTIMIZATION #7: Incremental search for large files (100x less memory, 10x
-// faster)
+// OPTIMIZATION #7: Literal search walks the piece spans in place with a SIMD
+// kernel (no chunk copies, no lowercase copies for case-insensitive search)
 size_t Buffer::Find(const std::string &query, size_t startPos, bool forward,
                     bool useRegex, bool matchCase) const {
   if (query.empty())
     return std::string::npos;
 
-  // For regex or small files, use old method (load entire file)
-  size_t totalLength = m_pieceTable.GetTotalLength();
-  if (useRegex || totalLength < 1024 * 1024) { // < 1MB
-    std::string text = m_pieceTable.GetText(0, totalLength);
-
-    if (useRegex) {
-      try {
-        std::regex_constants::syntax_option_type flags =
-            std::regex_constants::ECMAScript;
-        if (!matchCase)
-          flags |= std::regex_constants::icase;
-
-        std::regex re(query, flags);
-        if (forward) {
-          std::smatch match;
-          std::string searchPart = text.substr(startPos);
-          if (std::regex_search(searchPart, match, re)) {
-            return startPos + match.position();
-          }
-        } else {
-          // Backward regex search
-          auto words_begin =
-              std::sregex_iterator(text.begin(), text.begin() + startPos, re);
-          auto words_end = std::sregex_iterator();
-          size_t lastPos = std::string::npos;
-          for (std::sregex_iterator i = words_begin; i != words_end; ++i) {
-            lastPos = i->position();
-          }
-          return lastPos;
-        }
-      } catch (...) {
-        return std::string::npos;
-      }
-    } else {
-      // Literal search on small file
-      if (!matchCase) {
-        std::string lowerText = text;
-        std::string lowerQuery = query;
-        std::transform(lowerText.begin(), lowerText.end(), lowerText.begin(),
-                       [](unsigned char c) { return std::tolower(c); });
-        std::transform(lowerQuery.begin(), lowerQuery.end(), lowerQuery.begin(),
-                       [](unsigned char c) { return std::tolower(c); });
-        if (forward)
-          return lowerText.find(lowerQuery, startPos);
-        else
-          return lowerText.rfind(lowerQuery, startPos);
-      } else {
-        if (forward)
-          return text.find(query, startPos);
-        else
-          return text.rfind(query, startPos);
-      }
-    }
+  if (!useRegex) {
+    TextSearcher searcher(query, matchCase);
+    return forward ? searcher.FindForward(m_pieceTable, startPos)
+                   : searcher.FindBackward(m_pieceTable, startPos);
   }
 
-  // OPTIMIZED: For large files, search incrementally in chunks
-  const size_t CHUNK_SIZE = 64 * 1024; // 64KB chunks
-  const size_t overlapSize =
-      query.size() - 1; // Overlap to catch matches across chunks
-
-  if (forward) {
-    size_t pos = startPos;
-    while (pos < totalLength) {
-      size_t chunkSize = (std::min)(CHUNK_SIZE, totalLength - pos);
-      size_t readSize = (std::min)(chunkSize + overlapSize, totalLength - pos);
-      std::string chunk = m_pieceTable.GetText(pos, readSize);
-
-      if (!matchCase) {
-        std::string lowerChunk = chunk;
-        std::string lowerQuery = query;
-        std::transform(lowerChunk.begin(), lowerChunk.end(), lowerChunk.begin(),
-                       [](unsigned char c) { return std::tolower(c); });
-        std::transform(lowerQuery.begin(), lowerQuery.end(), lowerQuery.begin(),
-                       [](unsigned char c) { return std::tolower(c); });
-        size_t found = lowerChunk.find(lowerQuery);
-        if (found != std::string::npos) {
-          return pos + found;
-        }
-      } else {
-        size_t found = chunk.find(query);
-        if (found != std::string::npos) {
-          return pos + found;
-        }
-      }
+  // Streaming regex over the piece spans; compiled patterns are cached
+  std::shared_ptr<const RegexSearcher> regex =
+      RegexSearcher::Get(query, matchCase);
+  if (regex) {
+    return forward ? regex->FindForward(m_pieceTable, startPos)
+                   : regex->FindBackward(m_pieceTable, startPos);
+  }
 
-      pos += chunkSize;
-    }
-  } else {
-    // Backward search - start from startPos and go backwards
-    if (startPos > totalLength)
-      startPos = totalLength;
-    size_t pos = startPos;
-
-    while (pos > 0) {
-      size_t chunkStart = (pos > CHUNK_SIZE) ? (pos - CHUNK_SIZE) : 0;
-      size_t chunkSize = pos - chunkStart;
-      std::string chunk = m_pieceTable.GetText(chunkStart, chunkSize);
-
-      if (!matchCase) {
-        std::string lowerChunk = chunk;
-        std::string lowerQuery = query;
-        std::transform(lowerChunk.begin(), lowerChunk.end(), lowerChunk.begin(),
-                       [](unsigned char c) { return std::tolower(c); });
-        std::transform(lowerQuery.begin(), lowerQuery.end(), lowerQuery.begin(),
-                       [](unsigned char c) { return std::tolower(c); });
-        size_t found = lowerChunk.rfind(lowerQuery);
-        if (found != std::string::npos) {
-          return chunkStart + found;
-        }
-      } else {
-        size_t found = chunk.rfind(query);
-        if (found != std::string::npos) {
-          return chunkStart + found;
-        }
+  // Backreferences and lookaround (or an invalid pattern) need std::regex
+  // over a copy of the document. ^ and $ stay line anchors, as above, and
+  // the text around startPos is visible to them and to \b.
+  size_t totalLength = m_pieceTable.GetTotalLength();
+  if (startPos > totalLength)
+    startPos = totalLength;
+  std::string text = m_pieceTable.GetText(0, totalLength);
+  try {
+    std::regex_constants::syntax_option_type flags =
+        std::regex_constants::ECMAScript | std::regex_constants::multiline;
+    if (!matchCase)
+      flags |= std::regex_constants::icase;
+
+    std::regex re(query, flags);
+    if (forward) {
+      std::smatch match;
+      if (std::regex_search(text.cbegin() + startPos, text.cend(), match, re,
+                            startPos > 0
+                                ? std::regex_constants::match_prev_avail
+                                : std::regex_constants::match_default)) {
+        return startPos + match.position();
       }
-
-      pos = chunkStart;
+    } else {
+      // Backward regex search; the cut at startPos is not the end of a line
+      // unless one ends there
+      auto words_begin = std::sregex_iterator(
+          text.cbegin(), text.cbegin() + startPos, re,
+          startPos < totalLength && text[startPos] != '\n'
+              ? std::regex_constants::match_not_eol
+              : std::regex_constants::match_default);
+      auto words_end = std::sregex_iterator();
+      size_t lastPos = std::string::npos;
+      for (std::sregex_iterator i = words_begin; i != words_end; ++i) {
+        lastPos = i->position();
+      }
+      return lastPos;
     }
+  } catch (...) {
+    return std::string::npos;
   }
-
   return std::string::npos;
 }
 
 void Buffer::Replace(size_t start, size_t end, const std::string &replacement) {
   if (start > end)
     return;
+  BeginUndoGroup();
   Delete(start, end - start);
   Insert(start, replacement);
+  EndUndoGroup();
+}
+
+size_t Buffer::ReplaceAll(const std::string &query,
+                          const std::string &replacement,
+                          const SearchOptions &options) {
+  FinishIndexing(true); // replace in the whole file
+  MatchList matches = MatchIndex::Collect(m_pieceTable, query, options);
+  if (matches.empty())
+    return 0;
+
+  m_pieceTable.ReplaceRanges(matches, replacement);
+  MarkEdited();
+
+  size_t totalLength = GetTotalLength();
+  m_caretPos = (std::min)(m_caretPos, totalLength);
+  m_selectionAnchor = m_caretPos;
+  return matches.size();
+}
+
+std::vector<size_t> Buffer::FindAll(const std::string &query,
+                                    const SearchOptions &options,
+                                    bool parallel) const {
+  MatchList matches =
+      MatchIndex::Collect(m_pieceTable, query, options, parallel ? 0 : 1);
+  std::vector<size_t> offsets;
+  offsets.reserve(matches.size());
+  for (const auto &match : matches)
+    offsets.push_back(match.first);
+  return offsets;
+}
+
+size_t Buffer::GetMatchNumber(size_t pos) const {
+  const MatchList &matches = GetMatches();
+  auto it = std::lower_bound(
+      matches.begin(), matches.end(), pos,
+      [](const std::pair<size_t, size_t> &match, size_t offset) {
+        return match.first < offset;
+      });
+  if (it == matches.end() || it->first != pos)
+    return 0;
+  return static_cast<size_t>(it - matches.begin()) + 1;
 }
 
 std::string Buffer::GetSelectedText() const {
@@ -534,9 +1238,11 @@ void Buffer::DeleteSelection() {
               return a.start > b.start;
             });
 
+  BeginUndoGroup();
   for (const auto &r : ranges) {
     Delete(r.start, r.end - r.start);
   }
+  EndUndoGroup();
 
   m_caretPos =
       ranges.back().start; // Reset to start of first (now last in sorted) range
@@ -544,14 +1250,18 @@ void Buffer::DeleteSelection() {
 }
 
 void Buffer::Undo() {
+  if (m_opening)
+    return;
   m_pieceTable.Undo();
-  m_isDirty = true; // Still dirty if we undo/redo? Technically yes if it
-                    // differs from saved state.
+  MarkEdited(); // Still dirty if we undo/redo? Technically yes if it
+                // differs from saved state.
 }
 
 void Buffer::Redo() {
+  if (m_opening)
+    return;
   m_pieceTable.Redo();
-  m_isDirty = true;
+  MarkEdited();
 }
 
 bool Buffer::CanUndo() const { return m_pieceTable.CanUndo(); }
@@ -776,14 +1486,8 @@ void Buffer::AddProcess(std::unique_ptr<Process> process) {
 }
 
 void Buffer::SendToShell(const std::string &input) {
-  if (!m_processes.empty() && m_processes[0]) {
-    int enc = SettingsManager::Instance().GetShellEncoding();
-    if (enc == 1) { // Shift-JIS
-      m_processes[0]->Write(StringHelpers::Utf8ToShiftJis(input));
-    } else {
-      m_processes[0]->Write(input);
-    }
-  }
+  if (!m_processes.empty() && m_processes[0])
+    m_processes[0]->Write(m_shellEncoder ? m_shellEncoder(input) : input);
 }
 
 void Buffer::AddShellHistory(const std::string &cmd) {
@@ -0,0 +1,154 @@
+#include "../include/CodePage.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <vector>
+#ifdef _WIN32
+#include "../include/Utf.h"
+#include <windows.h>
+#else
+#include <cerrno>
+#include <iconv.h>
+#endif
+
+#ifdef _WIN32
+
+// Code page to UTF-8; sets *replaced if some bytes are not valid in it
+static std::string Decode(const char *text, size_t length, unsigned codePage,
+                          bool *replaced) {
+  std::string out;
+  if (length == 0 || length > INT_MAX)
+    return out;
+  DWORD flags = MB_ERR_INVALID_CHARS;
+  int len = MultiByteToWideChar(codePage, flags, text, (int)length, NULL, 0);
+  if (len <= 0) {
+    *replaced = true;
+    flags = 0;
+    len = MultiByteToWideChar(codePage, flags, text, (int)length, NULL, 0);
+    if (len <= 0)
+      return out;
+  }
+  std::vector<wchar_t> wstr(len);
+  MultiByteToWideChar(codePage, flags, text, (int)length, wstr.data(), len);
+  return Utf::FromWide(wstr.data(), len);
+}
+
+// UTF-8 to the code page; sets *replaced if it lacks some character.
+// Without best fit, a character it lacks becomes the default character
+// instead of a look-alike, and is reported.
+static std::string Encode(const char *text, size_t length, unsigned codePage,
+                          bool *replaced) {
+  std::string out;
+  if (length == 0 || length > INT_MAX)
+    return out;
+  std::wstring wstr = Utf::ToWide(text, length);
+  int len = WideCharToMultiByte(codePage, WC_NO_BEST_FIT_CHARS, wstr.data(),
+                                (int)wstr.size(), NULL, 0, NULL, NULL);
+  if (len <= 0)
+    return out;
+  out.resize(len);
+  BOOL usedDefault = FALSE;
+  WideCharToMultiByte(codePage, WC_NO_BEST_FIT_CHARS, wstr.data(),
+                      (int)wstr.size(), &out[0], len, NULL, &usedDefault);
+  if (usedDefault)
+    *replaced = true;
+  return out;
+}
+
+#else
+
+static const char *IconvName(unsigned codePage) {
+  return codePage == CodePage::SHIFT_JIS ? "CP932" : "CP1252";
+}
+
+// Converts with iconv; an input sequence it cannot convert is skipped
+// ('skip' returns its length), 'replacement' written in its place and
+// *replaced set
+template <typename Skip>
+static std::string Convert(const char *from, const char *to,
+                           const char *text, size_t length,
+                           const char *replacement, Skip skip,
+                           bool *replaced = nullptr) {
+  std::string out;
+  iconv_t cd = iconv_open(to, from);
+  if (cd == (iconv_t)-1)
+    return out;
+  std::vector<char> block(64 * 1024);
+  char *in = const_cast<char *>(text);
+  size_t inLeft = length;
+  while (inLeft > 0) {
+    char *dst = block.data();
+    size_t dstLeft = block.size();
+    size_t result = iconv(cd, &in, &inLeft, &dst, &dstLeft);
+    out.append(block.data(), block.size() - dstLeft);
+    if (result == (size_t)-1 && errno != E2BIG) {
+      // EILSEQ, or EINVAL for a sequence cut off by the end of the text
+      size_t n = (std::min)(inLeft, skip(in, inLeft));
+      in += n;
+      inLeft -= n;
+      out += replacement;
+      if (replaced)
+        *replaced = true;
+      iconv(cd, nullptr, nullptr, nullptr, nullptr); // reset shift state
+    }
+  }
+  iconv_close(cd);
+  return out;
+}
+
+static std::string Decode(const char *text, size_t length, unsigned codePage,
+                          bool *replaced) {
+  return Convert(IconvName(codePage), "UTF-8", text, length, "\xEF\xBF\xBD",
+                 [](const char *, size_t) { return size_t(1); }, replaced);
+}
+
+static std::string Encode(const char *text, size_t length, unsigned codePage,
+                          bool *replaced) {
+  // Skips a whole UTF-8 character (or one stray byte)
+  return Convert("UTF-8", IconvName(codePage), text, length, "?",
+                 [](const char *in, size_t left) {
+                   unsigned char lead = static_cast<unsigned char>(in[0]);
+                   size_t n = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3
+                              : lead >= 0xC0 ? 2 : 1;
+                   for (size_t i = 1; i < n && i < left; ++i) {
+                     if ((static_cast<unsigned char>(in[i]) & 0xC0) != 0x80)
+                       return i;
+                   }
+                   return n;
+                 },
+                 replaced);
+}
+
+#endif
+
+static bool Same(const std::string &converted, const char *text,
+                 size_t length) {
+  return converted.size() == length &&
+         (length == 0 || memcmp(converted.data(), text, length) == 0);
+}
+
+std::string CodePage::ToUtf8(const char *text, size_t length,
+                             unsigned codePage, bool *lossy) {
+  bool replaced = false;
+  std::string out = Decode(text, length, codePage, &replaced);
+  if (lossy && !*lossy) {
+    bool back = false;
+    *lossy = replaced ||
+             !Same(Encode(out.data(), out.size(), codePage, &back), text,
+                   length);
+  }
+  return out;
+}
+
+std::string CodePage::FromUtf8(const char *text, size_t length,
+                               unsigned codePage, bool *lossy) {
+  bool replaced = false;
+  std::string out = Encode(text, length, codePage, &replaced);
+  if (lossy && !*lossy) {
+    bool back = false;
+    *lossy = replaced ||
+             !Same(Decode(out.data(), out.size(), codePage, &back), text,
+                   length);
+  }
+  return out;
+}
@@ -0,0 +1,170 @@
+#include "../include/CodePageTranscoder.h"
+#include "../include/CodePage.h"
+#include <algorithm>
+#include <thread>
+
+struct CodePageTranscoder::Block {
+  size_t index = 0;
+  std::string text;
+};
+
+CodePageTranscoder::CodePageTranscoder(SpanSource source, size_t length,
+                                       unsigned codePage)
+    : m_source(std::move(source)), m_length(length), m_codePage(codePage),
+      m_sourceStarts(1, 0), m_blockStarts(1, 0) {
+  m_sourceStarts.push_back(length);
+}
+
+bool CodePageTranscoder::ReadBytes(size_t from, size_t count,
+                                   std::string &out) const {
+  while (count > 0) {
+    TextSpan span = m_source(from);
+    if (!span.data || from < span.offset || from >= span.offset + span.length)
+      return false;
+    size_t n = (std::min)(count, span.offset + span.length - from);
+    out.append(span.data + (from - span.offset), n);
+    from += n;
+    count -= n;
+  }
+  return true;
+}
+
+size_t CodePageTranscoder::NextBoundary(size_t from, size_t limit) const {
+  size_t at = from - 1; // the byte before 'from'
+  while (at < limit - 1) {
+    TextSpan span = m_source(at);
+    if (!span.data || at < span.offset || at >= span.offset + span.length)
+      return limit;
+    size_t end = (std::min)(span.offset + span.length, limit - 1);
+    for (; at < end; ++at) {
+      if (static_cast<unsigned char>(span.data[at - span.offset]) < 0x40)
+        return at + 1;
+    }
+  }
+  return limit;
+}
+
+bool CodePageTranscoder::BuildMap(bool &exact, const std::atomic<bool> *cancel,
+                                  size_t workers) {
+  // A stretch with no byte below 0x40 joins the block before it
+  std::vector<size_t> sourceStarts(1, 0);
+  for (size_t nominal = BLOCK_BYTES; nominal < m_length;
+       nominal += BLOCK_BYTES) {
+    if (cancel && *cancel)
+      return false;
+    size_t limit = (std::min)(m_length, nominal + BLOCK_BYTES);
+    size_t boundary = NextBoundary(nominal, limit);
+    if (boundary < limit)
+      sourceStarts.push_back(boundary);
+  }
+  sourceStarts.push_back(m_length);
+  size_t blocks = sourceStarts.size() - 1;
+
+  std::vector<size_t> lengths(blocks);
+  std::atomic<bool> failed(false), lossy(false);
+  auto countBlocks = [&](size_t first, size_t last) {
+    std::string bytes;
+    for (size_t b = first; b < last; ++b) {
+      if ((cancel && *cancel) || failed)
+        return;
+      bytes.clear();
+      if (!ReadBytes(sourceStarts[b], sourceStarts[b + 1] - sourceStarts[b],
+                     bytes)) {
+        failed = true;
+        return;
+      }
+      bool blockLossy = false;
+      lengths[b] = CodePage::ToUtf8(bytes.data(), bytes.size(), m_codePage,
+                                    &blockLossy)
+                       .size();
+      if (blockLossy)
+        lossy = true;
+    }
+  };
+
+  if (workers == 0) {
+    workers = (std::max)(1u, std::thread::hardware_concurrency());
+    workers = (std::min)(workers, m_length / PARALLEL_MAP_MIN_BYTES);
+  }
+  workers = (std::max)(size_t(1), (std::min)(workers, blocks));
+  if (workers <= 1) {
+    countBlocks(0, blocks);
+  } else {
+    size_t per = (blocks + workers - 1) / workers;
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers && i * per < blocks; ++i) {
+      threads.emplace_back([&, i]() {
+        countBlocks(i * per, (std::min)(blocks, (i + 1) * per));
+      });
+    }
+    countBlocks(0, (std::min)(blocks, per));
+    for (std::thread &t : threads)
+      t.join();
+  }
+  if ((cancel && *cancel) || failed)
+    return false;
+
+  std::vector<size_t> starts(blocks + 1, 0);
+  for (size_t b = 0; b < blocks; ++b)
+    starts[b + 1] = starts[b] + lengths[b];
+  m_sourceStarts.swap(sourceStarts);
+  m_blockStarts.swap(starts);
+  exact = !lossy;
+  std::lock_guard<std::mutex> lock(m_cacheMutex);
+  m_cache.clear();
+  return true;
+}
+
+size_t CodePageTranscoder::BlockOf(size_t offset) const {
+  return std::upper_bound(m_blockStarts.begin(), m_blockStarts.end(),
+                          offset) -
+         m_blockStarts.begin() - 1;
+}
+
+TextSpan CodePageTranscoder::GetSpan(size_t offset) const {
+  TextSpan span;
+  if (offset >= GetLength())
+    return span;
+  size_t b = BlockOf(offset);
+
+  std::shared_ptr<Block> block;
+  {
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    auto it = std::find_if(
+        m_cache.begin(), m_cache.end(),
+        [b](const std::shared_ptr<Block> &c) { return c->index == b; });
+    if (it != m_cache.end()) {
+      block = *it;
+      m_cache.erase(it);
+      m_cache.push_back(block);
+    }
+  }
+  if (!block) {
+    // Decoded outside the lock so that readers of other blocks never wait
+    std::string bytes;
+    if (!ReadBytes(m_sourceStarts[b], m_sourceStarts[b + 1] - m_sourceStarts[b],
+                   bytes))
+      return span;
+    block = std::make_shared<Block>();
+    block->index = b;
+    block->text = CodePage::ToUtf8(bytes.data(), bytes.size(), m_codePage);
+    // The same bytes decode the same way; the map is kept whatever happens
+    block->text.resize(m_blockStarts[b + 1] - m_blockStarts[b]);
+
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    m_cache.push_back(block);
+    // Evicted blocks stay alive until the spans pinning them are released
+    if (m_cache.size() > MAX_CACHED_BLOCKS)
+      m_cache.erase(m_cache.begin());
+  }
+  span.data = block->text.data();
+  span.offset = m_blockStarts[b];
+  span.length = block->text.size();
+  span.pin = block;
+  return span;
+}
+
+SpanSource
+CodePageTranscoder::MakeSource(std::shared_ptr<CodePageTranscoder> transcoder) {
+  return [transcoder](size_t offset) { return transcoder->GetSpan(offset); };
+}
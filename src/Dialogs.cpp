@@ -570,7 +570,7 @@ INT_PTR CALLBACK FindInFilesDlgProc(HWND hDlg, UINT message, WPARAM wParam,
       if (g_editor) {
         SettingsManager::Instance().SetFindStartDirectory(dir);
         SettingsManager::Instance().Save();
-        g_editor->FindInFiles(dir, pattern);
+        g_editor->StartFindInFiles(dir, pattern);
       }
       EndDialog(hDlg, IDOK);
       return (INT_PTR)TRUE;
@@ -0,0 +1,517 @@
+#include "../include/EditJournal.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Layout, little-endian:
+//   header: "ECJ1", u8 exists, u64 size, u64 modified, u32 path bytes,
+//           UTF-8 path, u32 CRC-32 of all of the above
+//   record: u32 payload bytes, u32 CRC-32 of the payload, then the payload:
+//           u8 op, u64 pos, u64 length, and for an insert 'length' bytes;
+//           a replace is u8 op, u32 change count, then per change u64 pos,
+//           u64 removed, u32 segment count (REPEAT_SEGMENTS for those of
+//           the change before) and per segment u8 kind, then u64 length
+//           and the bytes (SEGMENT_BYTES), or u64 start and u64 length
+//           (SEGMENT_ORIGINAL)
+static const char JOURNAL_MAGIC[4] = {'E', 'C', 'J', '1'};
+static const size_t RECORD_HEADER = 8;
+static const size_t RECORD_FIXED = 17; // op, pos, length
+static const uint32_t REPEAT_SEGMENTS = 0xFFFFFFFFu;
+static const uint8_t SEGMENT_BYTES = 0;
+static const uint8_t SEGMENT_ORIGINAL = 1;
+
+static uint32_t Crc32(const char *data, size_t length) {
+  static const auto table = [] {
+    std::array<uint32_t, 256> t{};
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k)
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      t[i] = c;
+    }
+    return t;
+  }();
+  uint32_t crc = 0xFFFFFFFFu;
+  for (size_t i = 0; i < length; ++i)
+    crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+  return crc ^ 0xFFFFFFFFu;
+}
+
+static void PutInt(std::string &out, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; ++i)
+    out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+}
+
+static uint64_t GetInt(const char *data, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i)
+    value |= static_cast<uint64_t>(static_cast<uint8_t>(data[i])) << (8 * i);
+  return value;
+}
+
+// Records are encoded with a zero CRC; the writer thread fills it in with
+// FillChecksums, so a large edit is not checksummed on the thread making it
+static void PutRecord(std::string &out, EditJournal::Op op, uint64_t pos,
+                      uint64_t length, const char *text, size_t textLength) {
+  PutInt(out, RECORD_FIXED + textLength, 4);
+  PutInt(out, 0, 4);
+  out.push_back(static_cast<char>(op));
+  PutInt(out, pos, 8);
+  PutInt(out, length, 8);
+  out.append(text, textLength);
+}
+
+static void PutReplace(std::string &out,
+                       const std::vector<EditJournal::Change> &changes) {
+  size_t start = out.size();
+  PutInt(out, 0, 4); // payload bytes, set below
+  PutInt(out, 0, 4);
+  out.push_back(static_cast<char>(EditJournal::Op::Replace));
+  PutInt(out, changes.size(), 4);
+  for (const auto &change : changes) {
+    PutInt(out, change.pos, 8);
+    PutInt(out, change.removed, 8);
+    if (change.repeat) {
+      PutInt(out, REPEAT_SEGMENTS, 4);
+      continue;
+    }
+    PutInt(out, change.segments.size(), 4);
+    for (const auto &segment : change.segments) {
+      if (segment.original) {
+        out.push_back(static_cast<char>(SEGMENT_ORIGINAL));
+        PutInt(out, segment.start, 8);
+        PutInt(out, segment.length, 8);
+      } else {
+        out.push_back(static_cast<char>(SEGMENT_BYTES));
+        PutInt(out, segment.bytes.size(), 8);
+        out += segment.bytes;
+      }
+    }
+  }
+  uint64_t payload = out.size() - start - RECORD_HEADER;
+  for (int i = 0; i < 4; ++i)
+    out[start + i] = static_cast<char>((payload >> (8 * i)) & 0xFF);
+}
+
+// Checksums the records of 'data' from offset 'from' on
+static void FillChecksums(std::string &data, size_t from) {
+  while (data.size() - from >= RECORD_HEADER) {
+    size_t payload = static_cast<size_t>(GetInt(data.data() + from, 4));
+    uint32_t crc = Crc32(data.data() + from + RECORD_HEADER, payload);
+    for (int i = 0; i < 4; ++i)
+      data[from + 4 + i] = static_cast<char>((crc >> (8 * i)) & 0xFF);
+    from += RECORD_HEADER + payload;
+  }
+}
+
+// Decodes the changes of a replace payload; false if it is malformed
+static bool ParseReplace(const char *p, size_t length,
+                         std::vector<EditJournal::Change> &changes) {
+  size_t at = 1; // op
+  auto take = [&](int bytes, uint64_t &value) {
+    if (length - at < static_cast<size_t>(bytes))
+      return false;
+    value = GetInt(p + at, bytes);
+    at += bytes;
+    return true;
+  };
+  uint64_t count = 0;
+  if (!take(4, count) || count == 0 || count > (length - at) / 20)
+    return false;
+  changes.resize(static_cast<size_t>(count));
+  for (auto &change : changes) {
+    uint64_t segments = 0;
+    if (!take(8, change.pos) || !take(8, change.removed) ||
+        !take(4, segments))
+      return false;
+    if (segments == REPEAT_SEGMENTS) {
+      if (&change == &changes.front())
+        return false; // nothing to repeat
+      change.repeat = true;
+      continue;
+    }
+    if (segments > length - at)
+      return false;
+    change.segments.resize(static_cast<size_t>(segments));
+    for (auto &segment : change.segments) {
+      if (at >= length)
+        return false;
+      uint8_t kind = static_cast<uint8_t>(p[at++]);
+      if (kind == SEGMENT_ORIGINAL) {
+        segment.original = true;
+        if (!take(8, segment.start) || !take(8, segment.length))
+          return false;
+      } else if (kind == SEGMENT_BYTES) {
+        if (!take(8, segment.length) || segment.length > length - at)
+          return false;
+        segment.bytes.assign(p + at, static_cast<size_t>(segment.length));
+        at += static_cast<size_t>(segment.length);
+      } else {
+        return false;
+      }
+    }
+  }
+  return at == length;
+}
+
+// Parses the header at the start of 'data'; returns its size, or 0
+static size_t ParseHeader(const std::string &data,
+                          EditJournal::Fingerprint &file) {
+  const size_t fixed = sizeof(JOURNAL_MAGIC) + 1 + 8 + 8 + 4;
+  if (data.size() < fixed + 4 ||
+      memcmp(data.data(), JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0)
+    return 0;
+  const char *p = data.data() + sizeof(JOURNAL_MAGIC);
+  uint64_t pathBytes = GetInt(p + 17, 4);
+  if (data.size() - fixed - 4 < pathBytes)
+    return 0;
+  size_t end = fixed + static_cast<size_t>(pathBytes);
+  if (Crc32(data.data(), end) != GetInt(data.data() + end, 4))
+    return 0;
+  file.exists = p[0] != 0;
+  file.size = GetInt(p + 1, 8);
+  file.modified = GetInt(p + 9, 8);
+  file.path =
+      std::filesystem::u8path(data.substr(fixed, static_cast<size_t>(pathBytes)))
+          .wstring();
+  return end + 4;
+}
+
+static bool ReadJournal(const std::wstring &path, std::string &data) {
+  std::ifstream in(std::filesystem::path(path), std::ios::binary);
+  if (!in)
+    return false;
+  data.assign(std::istreambuf_iterator<char>(in),
+              std::istreambuf_iterator<char>());
+  return true;
+}
+
+EditJournal::Fingerprint EditJournal::Take(const std::wstring &path) {
+  Fingerprint file;
+  file.path = path;
+  std::error_code ec;
+  std::filesystem::path p(path);
+  if (!path.empty() && std::filesystem::is_regular_file(p, ec)) {
+    file.exists = true;
+    file.size = std::filesystem::file_size(p, ec);
+    file.modified = static_cast<uint64_t>(
+        std::filesystem::last_write_time(p, ec).time_since_epoch().count());
+  }
+  return file;
+}
+
+std::string EditJournal::EncodeHeader(const Fingerprint &file) {
+  std::string path = std::filesystem::path(file.path).u8string();
+  std::string out(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+  out.push_back(file.exists ? 1 : 0);
+  PutInt(out, file.size, 8);
+  PutInt(out, file.modified, 8);
+  PutInt(out, path.size(), 4);
+  out += path;
+  PutInt(out, Crc32(out.data(), out.size()), 4);
+  return out;
+}
+
+EditJournal::EditJournal(unsigned flushMs) : m_flushMs(flushMs) {}
+
+EditJournal::~EditJournal() { Close(false); }
+
+bool EditJournal::Create(const std::wstring &path, const Fingerprint &file) {
+  m_path = path;
+  m_source = file;
+  if (!OpenJournal(path, 0) || !WriteOut(EncodeHeader(file)) || !Sync()) {
+    CloseJournal();
+    return false;
+  }
+  Start();
+  return true;
+}
+
+bool EditJournal::Resume(const std::wstring &path, const Fingerprint &file,
+                         const Visitor &visitor) {
+  std::string data;
+  Fingerprint recorded;
+  size_t pos = 0;
+  if (!ReadJournal(path, data) || (pos = ParseHeader(data, recorded)) == 0 ||
+      recorded != file)
+    return false;
+
+  // Replay up to the first record a crash tore or never finished
+  while (data.size() - pos >= RECORD_HEADER + RECORD_FIXED) {
+    uint64_t payload = GetInt(data.data() + pos, 4);
+    if (payload < RECORD_FIXED || data.size() - pos - RECORD_HEADER < payload)
+      break;
+    const char *p = data.data() + pos + RECORD_HEADER;
+    if (Crc32(p, static_cast<size_t>(payload)) !=
+        GetInt(data.data() + pos + 4, 4))
+      break;
+    Op op = static_cast<Op>(p[0]);
+    std::vector<Change> changes(1);
+    Change &change = changes.front();
+    change.pos = GetInt(p + 1, 8);
+    uint64_t length = GetInt(p + 9, 8);
+    if (op == Op::Insert && length == payload - RECORD_FIXED) {
+      change.segments.resize(1);
+      change.segments.front().length = length;
+      change.segments.front().bytes.assign(p + RECORD_FIXED,
+                                           static_cast<size_t>(length));
+    } else if (op == Op::Delete && payload == RECORD_FIXED) {
+      change.removed = length;
+    } else if (op != Op::Replace ||
+               !ParseReplace(p, static_cast<size_t>(payload), changes)) {
+      break;
+    }
+    visitor(changes);
+    pos += RECORD_HEADER + static_cast<size_t>(payload);
+  }
+
+  m_path = path;
+  m_source = file;
+  if (!OpenJournal(path, pos))
+    return false;
+  Start();
+  return true;
+}
+
+bool EditJournal::ReadHeader(const std::wstring &path, Fingerprint &file) {
+  std::string data;
+  return ReadJournal(path, data) && ParseHeader(data, file) != 0;
+}
+
+void EditJournal::Record(uint64_t pos, uint64_t removed,
+                         const std::string &inserted) {
+  std::string records;
+  if (removed > 0)
+    PutRecord(records, Op::Delete, pos, removed, nullptr, 0);
+  if (!inserted.empty())
+    PutRecord(records, Op::Insert, pos, inserted.size(), inserted.data(),
+              inserted.size());
+  Append(records);
+}
+
+void EditJournal::RecordChanges(const std::vector<Change> &changes) {
+  if (changes.empty())
+    return;
+  const Change &change = changes.front();
+  if (changes.size() == 1 && change.segments.size() <= 1 &&
+      (change.segments.empty() || !change.segments.front().original)) {
+    Record(change.pos, change.removed,
+           change.segments.empty() ? std::string()
+                                   : change.segments.front().bytes);
+    return;
+  }
+  std::string records;
+  PutReplace(records, changes);
+  Append(records);
+}
+
+void EditJournal::Append(const std::string &records) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_failed || m_stop)
+    return;
+  m_pending += records;
+  if (m_marked)
+    m_sinceMark += records;
+  m_wake.notify_one();
+}
+
+bool EditJournal::IsAgainst(const Fingerprint &file) const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return !m_marked && m_source == file;
+}
+
+void EditJournal::BeginCheckpoint() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_marked = true;
+  m_sinceMark.clear();
+}
+
+void EditJournal::EndCheckpoint(bool saved, const Fingerprint &file) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (saved && !m_stop) {
+    // Whatever was pending before the mark is in the saved file, and the
+    // rest is in m_sinceMark
+    m_restartData = EncodeHeader(file);
+    m_restartHeader = m_restartData.size();
+    m_restartData += m_sinceMark;
+    m_restart = true;
+    m_source = file;
+    m_pending.clear();
+    m_failed = false; // the rewrite starts a fresh file
+    m_wake.notify_one();
+  }
+  m_marked = false;
+  m_sinceMark.clear();
+  m_sinceMark.shrink_to_fit();
+}
+
+void EditJournal::Close(bool discard) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_one();
+  if (m_writer.joinable())
+    m_writer.join();
+  CloseJournal();
+  if (discard && !m_path.empty()) {
+    std::error_code ec;
+    std::filesystem::remove(std::filesystem::path(m_path), ec);
+  }
+}
+
+bool EditJournal::Failed() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_failed;
+}
+
+void EditJournal::Start() {
+  m_writer = std::thread([this]() { WriterLoop(); });
+}
+
+void EditJournal::WriterLoop() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    m_wake.wait(lock,
+                [&] { return m_stop || m_restart || !m_pending.empty(); });
+    // Edits arriving within the interval share one write and one sync
+    if (!m_stop && !m_restart)
+      m_wake.wait_for(lock, std::chrono::milliseconds(m_flushMs),
+                      [&] { return m_stop || m_restart; });
+    bool restart = m_restart;
+    size_t restartHeader = m_restartHeader;
+    std::string restartData, pending;
+    restartData.swap(m_restartData);
+    pending.swap(m_pending);
+    m_restart = false;
+    lock.unlock();
+
+    FillChecksums(pending, 0);
+    bool ok = true;
+    if (restart) {
+      FillChecksums(restartData, restartHeader);
+      ok = Rewrite(restartData);
+    }
+    if (ok && !pending.empty())
+      ok = WriteOut(pending) && Sync();
+
+    lock.lock();
+    if (!ok) {
+      m_failed = true;
+      m_pending.clear();
+    }
+    if (m_stop && !m_restart && m_pending.empty())
+      break;
+  }
+}
+
+bool EditJournal::Rewrite(const std::string &data) {
+  std::wstring temp = m_path + L".tmp";
+  CloseJournal();
+  bool ok = OpenJournal(temp, 0) && WriteOut(data) && Sync();
+  CloseJournal();
+  std::error_code ec;
+  if (ok)
+    std::filesystem::rename(std::filesystem::path(temp),
+                            std::filesystem::path(m_path), ec);
+  if (!ok || ec) {
+    std::filesystem::remove(std::filesystem::path(temp), ec);
+    return false;
+  }
+  return OpenJournal(m_path, data.size());
+}
+
+#ifdef _WIN32
+
+bool EditJournal::OpenJournal(const std::wstring &path, uint64_t keep) {
+  m_file = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                       OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (m_file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER at;
+  at.QuadPart = static_cast<LONGLONG>(keep);
+  if (!SetFilePointerEx(m_file, at, NULL, FILE_BEGIN) ||
+      !SetEndOfFile(m_file)) {
+    CloseJournal();
+    return false;
+  }
+  return true;
+}
+
+bool EditJournal::WriteOut(const std::string &data) {
+  const char *p = data.data();
+  size_t length = data.size();
+  while (length > 0) {
+    DWORD written = 0;
+    DWORD n = static_cast<DWORD>((std::min)(length, size_t(1) << 30));
+    if (!::WriteFile(m_file, p, n, &written, NULL) || written == 0)
+      return false;
+    p += written;
+    length -= written;
+  }
+  return true;
+}
+
+bool EditJournal::Sync() { return FlushFileBuffers(m_file) != 0; }
+
+void EditJournal::CloseJournal() {
+  if (m_file != INVALID_HANDLE_VALUE) {
+    CloseHandle(m_file);
+    m_file = INVALID_HANDLE_VALUE;
+  }
+}
+
+#else // POSIX
+
+bool EditJournal::OpenJournal(const std::wstring &path, uint64_t keep) {
+  std::string p = std::filesystem::path(path).string();
+  m_fd = ::open(p.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+  if (m_fd < 0)
+    return false;
+  if (::ftruncate(m_fd, static_cast<off_t>(keep)) != 0 ||
+      ::lseek(m_fd, 0, SEEK_END) < 0) {
+    CloseJournal();
+    return false;
+  }
+  return true;
+}
+
+bool EditJournal::WriteOut(const std::string &data) {
+  const char *p = data.data();
+  size_t length = data.size();
+  while (length > 0) {
+    ssize_t n = ::write(m_fd, p, length);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    length -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+bool EditJournal::Sync() {
+#ifdef __APPLE__
+  return ::fsync(m_fd) == 0;
+#else
+  return ::fdatasync(m_fd) == 0;
+#endif
+}
+
+void EditJournal::CloseJournal() {
+  if (m_fd >= 0) {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+}
+
+#endif
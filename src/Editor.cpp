@@ -2,19 +2,30 @@
 #include "../include/Process.h"
 #include "../include/SettingsManager.h"
 #include "../include/StringHelpers.h"
+#include "../include/Utf.h"
 #include "Globals.inl"
 
+#include <cwchar>
 #include <filesystem>
 // namespace fs alias is already in Globals.inl
 
 Editor::Editor() : m_activeBufferIndex(0) {}
-Editor::~Editor() {}
+Editor::~Editor() { CancelFindInFiles(); }
 
 size_t Editor::OpenFile(const std::wstring &path) {
   auto buffer = std::make_unique<Buffer>();
   if (m_progressCb)
     buffer->SetProgressCallback(m_progressCb);
+  // Large files finish indexing in the background; the window appends the
+  // rest when WM_BUFFER_INDEXED arrives
+  Buffer *raw = buffer.get();
+  WatchIndexing(raw);
   if (buffer->OpenFile(path)) {
+    StartJournal(raw);
+    if (!g_mainHwnd)
+      buffer->FinishIndexing(true);
+    else if (buffer->IsIndexing())
+      m_loading[raw] = nullptr;
     m_buffers.push_back(std::move(buffer));
     m_activeBufferIndex = m_buffers.size() - 1;
     return m_activeBufferIndex;
@@ -22,6 +33,212 @@ size_t Editor::OpenFile(const std::wstring &path) {
   return static_cast<size_t>(-1);
 }
 
+size_t Editor::OpenFileAsync(const std::wstring &path, OpenCallback done) {
+  if (!g_mainHwnd) { // nothing would deliver WM_BUFFER_INDEXED
+    size_t index = OpenFile(path);
+    if (done)
+      done(index, index != static_cast<size_t>(-1));
+    return index;
+  }
+  auto buffer = std::make_unique<Buffer>();
+  if (m_progressCb)
+    buffer->SetProgressCallback(m_progressCb);
+  Buffer *raw = buffer.get();
+  WatchIndexing(raw);
+  raw->OpenFileAsync(path);
+  StartJournal(raw);
+  m_loading[raw] = std::move(done);
+  m_buffers.push_back(std::move(buffer));
+  m_activeBufferIndex = m_buffers.size() - 1;
+  return m_activeBufferIndex;
+}
+
+void Editor::WatchIndexing(Buffer *buf) {
+  if (!g_mainHwnd)
+    return;
+  buf->SetIndexedCallback(
+      [buf]() { PostMessage(g_mainHwnd, WM_BUFFER_INDEXED, (WPARAM)buf, 0); });
+}
+
+size_t Editor::IndexOfBuffer(Buffer *buf) const {
+  for (size_t i = 0; i < m_buffers.size(); ++i) {
+    if (m_buffers[i].get() == buf)
+      return i;
+  }
+  return static_cast<size_t>(-1);
+}
+
+bool Editor::HandleBufferIndexed(Buffer *buf) {
+  auto it = m_loading.find(buf);
+  if (it == m_loading.end())
+    return false;
+  bool finished = buf->FinishIndexing(false);
+  if (m_progressCb)
+    m_progressCb(finished ? 0.0f : buf->GetIndexProgress());
+  if (!finished)
+    return true;
+
+  OpenCallback done = std::move(it->second);
+  m_loading.erase(it);
+  size_t index = IndexOfBuffer(buf);
+  if (buf->LoadFailed()) {
+    CloseBuffer(index);
+    index = static_cast<size_t>(-1);
+  }
+  if (done)
+    done(index, index != static_cast<size_t>(-1));
+  return true;
+}
+
+void Editor::SaveFileAsync(Buffer *buf, const std::wstring &path,
+                           SaveCallback done) {
+  if (!g_mainHwnd) { // nothing would deliver WM_BUFFER_SAVED
+    bool saved = buf->SaveFile(path);
+    if (done)
+      done(saved);
+    return;
+  }
+  auto saving = m_saving.find(buf);
+  if (saving != m_saving.end()) { // the new save waits for the old one
+    bool saved = false;
+    buf->FinishSave(true, &saved);
+    SaveCallback previous = std::move(saving->second);
+    m_saving.erase(saving);
+    if (previous)
+      previous(saved);
+  }
+  buf->SetSaveCallback(
+      [buf]() { PostMessage(g_mainHwnd, WM_BUFFER_SAVED, (WPARAM)buf, 0); });
+  m_saving[buf] = std::move(done);
+  buf->SaveFileAsync(path);
+}
+
+bool Editor::HandleBufferSaved(Buffer *buf) {
+  auto it = m_saving.find(buf);
+  if (it == m_saving.end())
+    return false;
+  bool saved = false;
+  bool finished = buf->FinishSave(false, &saved);
+  if (m_progressCb)
+    m_progressCb(finished ? 0.0f : buf->GetSaveProgress());
+  if (!finished)
+    return true;
+
+  SaveCallback done = std::move(it->second);
+  m_saving.erase(it);
+  if (done)
+    done(saved);
+  return true;
+}
+
+size_t Editor::EnableJournals(const std::wstring &dir, unsigned flushMs) {
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  m_journalDir = dir;
+  m_journalFlushMs = flushMs;
+  // Before any new journal, whose name could match a leftover one
+  size_t recovered = RecoverJournals();
+  for (const auto &buffer : m_buffers) {
+    const std::wstring &path = buffer->GetPath();
+    if (!buffer->IsJournaling() && !buffer->IsScratch() && !buffer->IsShell() &&
+        (path.empty() || path[0] != L'*'))
+      StartJournal(buffer.get());
+  }
+  return recovered;
+}
+
+void Editor::StartJournal(Buffer *buf) {
+  if (m_journalDir.empty())
+    return;
+  std::wstring name = std::to_wstring(GetCurrentProcessId()) + L"-" +
+                      std::to_wstring(++m_journalCount) + L".journal";
+  buf->StartJournal(m_journalDir + L"\\" + name, m_journalFlushMs);
+}
+
+// True if the journal at 'path' belongs to another running instance. Its
+// name starts with the writer's process ID (see StartJournal); a process
+// with that ID started after the journal was last written reuses the ID.
+static bool IsJournalLive(const fs::path &path) {
+  std::wstring stem = path.stem().wstring();
+  size_t dash = stem.find(L'-');
+  if (dash == 0 || dash == std::wstring::npos ||
+      stem.find_first_not_of(L"0123456789") != dash)
+    return false;
+  DWORD pid = static_cast<DWORD>(std::wcstoul(stem.c_str(), nullptr, 10));
+  if (pid == GetCurrentProcessId())
+    return false; // a leftover of an earlier process with this ID
+  HANDLE process =
+      OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+  if (!process)
+    return GetLastError() == ERROR_ACCESS_DENIED; // another user's, running
+  DWORD exitCode = 0;
+  FILETIME created, exited, kernel, user;
+  WIN32_FILE_ATTRIBUTE_DATA journal;
+  bool live = GetExitCodeProcess(process, &exitCode) &&
+              exitCode == STILL_ACTIVE;
+  if (live && GetProcessTimes(process, &created, &exited, &kernel, &user) &&
+      GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &journal))
+    live = CompareFileTime(&created, &journal.ftLastWriteTime) <= 0;
+  CloseHandle(process);
+  return live;
+}
+
+size_t Editor::RecoverJournals() {
+  std::vector<std::wstring> journals;
+  std::error_code ec;
+  for (const auto &entry : fs::directory_iterator(m_journalDir, ec)) {
+    // The directory is shared; another instance's journals are its own
+    if (entry.path().extension() == L".journal" &&
+        !IsJournalLive(entry.path()))
+      journals.push_back(entry.path().wstring());
+  }
+
+  size_t recovered = 0;
+  for (const std::wstring &journal : journals) {
+    EditJournal::Fingerprint file;
+    auto buffer = std::make_unique<Buffer>();
+    if (m_progressCb)
+      buffer->SetProgressCallback(m_progressCb);
+    Buffer *raw = buffer.get();
+    WatchIndexing(raw);
+    bool ok = EditJournal::ReadHeader(journal, file);
+    if (ok && file.exists)
+      ok = buffer->OpenFile(file.path);
+    else if (ok)
+      buffer->SetPath(file.path); // an untitled buffer
+    if (ok && buffer->RecoverJournal(journal, m_journalFlushMs)) {
+      LogMessage("Recovered unsaved edits of " + WStringToString(file.path));
+      // The replay indexed only what it needed; the rest loads as an
+      // opened file's does
+      if (!g_mainHwnd)
+        buffer->FinishIndexing(true);
+      else if (buffer->IsIndexing())
+        m_loading[raw] = nullptr;
+      m_buffers.push_back(std::move(buffer));
+      m_activeBufferIndex = m_buffers.size() - 1;
+      ++recovered;
+      continue;
+    }
+    // The file changed since, or the journal is unreadable: kept aside for
+    // the user rather than replayed onto the wrong text
+    LogMessage("Cannot recover journal " + WStringToString(journal));
+    fs::rename(journal, journal + L".stale", ec);
+  }
+  return recovered;
+}
+
+void Editor::CancelOpens() {
+  std::vector<Buffer *> loading;
+  for (const auto &entry : m_loading)
+    loading.push_back(entry.first);
+  for (Buffer *buf : loading) {
+    buf->CancelIndexing();
+    CloseBuffer(IndexOfBuffer(buf));
+  }
+  if (m_progressCb)
+    m_progressCb(0.0f);
+}
+
 void Editor::NewFile(const std::string &name) {
   auto buffer = std::make_unique<Buffer>();
   if (m_progressCb)
@@ -30,6 +247,7 @@ void Editor::NewFile(const std::string &name) {
   // Set the name if provided
   std::wstring wname = StringToWString(name);
   buffer->SetPath(wname);
+  StartJournal(buffer.get());
 
   // New file has empty original and added buffers
   m_buffers.push_back(std::move(buffer));
@@ -58,6 +276,11 @@ size_t Editor::OpenShell(const std::wstring &cmd) {
 
         PostMessage(g_mainHwnd, WM_SHELL_OUTPUT, (WPARAM)output, 0);
       })) {
+    buffer->SetShellEncoder([](const std::string &input) {
+      if (SettingsManager::Instance().GetShellEncoding() == 1) // Shift-JIS
+        return StringHelpers::Utf8ToShiftJis(input);
+      return input;
+    });
     buffer->SetShellProcess(std::move(process));
     m_buffers.push_back(std::move(buffer));
     m_activeBufferIndex = m_buffers.size() - 1;
@@ -80,7 +303,8 @@ size_t Editor::OpenJsShell() {
   return m_activeBufferIndex;
 }
 
-void Editor::FindInFiles(const std::wstring &dir, const std::wstring &pattern) {
+Buffer *Editor::PrepareFindResults(const std::wstring &dir,
+                                   const std::wstring &pattern) {
   // Create or clear *Find Results* buffer
   Buffer *resultsBuf = GetBufferByName(L"*Find Results*");
   if (!resultsBuf) {
@@ -106,30 +330,24 @@ void Editor::FindInFiles(const std::wstring &dir, const std::wstring &pattern) {
 
   resultsBuf->Insert(0, "Searching for \"" + patternUtf8 + "\" in " + dirUtf8 +
                             "...\n");
+  return resultsBuf;
+}
 
-  std::wstring searchDir = dir;
-
-  // Simple recursive search (blocking for now)
+void Editor::FindInFiles(const std::wstring &dir, const std::wstring &pattern,
+                         const SearchOptions &options,
+                         const FileSearchFilter &filter) {
+  CancelFindInFiles();
+  Buffer *resultsBuf = PrepareFindResults(dir, pattern);
+
+  // Workers deliver one batch at a time, and this thread only runs the
+  // search until Run returns, so the buffer is never edited concurrently
+  FileSearch search(dir, StringHelpers::Utf16ToUtf8(pattern), options);
+  search.SetFilter(filter);
+  search.SetResultCallback([resultsBuf](const std::string &text) {
+    resultsBuf->Insert(resultsBuf->GetTotalLength(), text);
+  });
   try {
-    if (fs::exists(searchDir) && fs::is_directory(searchDir)) {
-      for (const auto &entry : fs::recursive_directory_iterator(searchDir)) {
-        if (fs::is_regular_file(entry.status())) {
-          std::ifstream file(entry.path());
-          if (file) {
-            std::string line;
-            int lineNum = 0;
-            while (std::getline(file, line)) {
-              lineNum++;
-              if (line.find(patternUtf8) != std::string::npos) {
-                std::string out = entry.path().string() + "(" +
-                                  std::to_string(lineNum) + "): " + line + "\n";
-                resultsBuf->Insert(resultsBuf->GetTotalLength(), out);
-              }
-            }
-          }
-        }
-      }
-    }
+    search.Run();
   } catch (const std::exception &e) {
     DebugLog("Editor::FindInFiles - Exception: " + std::string(e.what()),
              LOG_ERROR);
@@ -142,14 +360,99 @@ void Editor::FindInFiles(const std::wstring &dir, const std::wstring &pattern) {
   resultsBuf->Insert(resultsBuf->GetTotalLength(), "Done.\n");
 }
 
+void Editor::StartFindInFiles(const std::wstring &dir,
+                              const std::wstring &pattern,
+                              const SearchOptions &options,
+                              const FileSearchFilter &filter) {
+  CancelFindInFiles();
+  PrepareFindResults(dir, pattern);
+
+  unsigned int searchId = ++m_fileSearchId;
+  auto search = std::make_shared<FileSearch>(
+      dir, StringHelpers::Utf16ToUtf8(pattern), options);
+  search->SetFilter(filter);
+  auto post = [searchId](std::string text, size_t scanned, size_t found,
+                         bool done, bool cancelled) {
+    FindResultsBatch *batch = new FindResultsBatch{
+        searchId, std::move(text), scanned, found, done, cancelled};
+    if (!PostMessage(g_mainHwnd, WM_FIND_RESULTS, (WPARAM)batch, 0))
+      delete batch;
+  };
+  // Both callbacks run under the search's delivery lock, results first
+  auto pending = std::make_shared<std::string>();
+  search->SetResultCallback(
+      [pending](const std::string &text) { pending->append(text); });
+  search->SetProgressCallback([pending, post](size_t scanned, size_t found) {
+    post(std::move(*pending), scanned, found, false, false);
+    pending->clear();
+  });
+
+  m_fileSearch = search;
+  m_fileSearchThread = std::thread([search, post]() {
+    try {
+      search->Run();
+    } catch (const std::exception &e) {
+      DebugLog("Editor::StartFindInFiles - Exception: " +
+                   std::string(e.what()),
+               LOG_ERROR);
+    } catch (...) {
+      DebugLog("Editor::StartFindInFiles - Unknown error", LOG_ERROR);
+    }
+    post(std::string(), 0, 0, true, search->IsCancelled());
+  });
+}
+
+void Editor::CancelFindInFiles() {
+  if (m_fileSearch)
+    m_fileSearch->Cancel();
+  if (m_fileSearchThread.joinable())
+    m_fileSearchThread.join();
+  m_fileSearch.reset();
+}
+
+bool Editor::HandleFindResults(const FindResultsBatch &batch) {
+  if (batch.searchId != m_fileSearchId)
+    return false;
+  Buffer *resultsBuf = GetBufferByName(L"*Find Results*");
+  if (!resultsBuf)
+    return false;
+  if (!batch.text.empty())
+    resultsBuf->Insert(resultsBuf->GetTotalLength(), batch.text);
+  if (batch.done) {
+    resultsBuf->Insert(resultsBuf->GetTotalLength(),
+                       batch.cancelled ? "Cancelled.\n" : "Done.\n");
+    if (m_fileSearchThread.joinable())
+      m_fileSearchThread.join();
+    m_fileSearch.reset();
+  }
+  return true;
+}
+
 void Editor::CloseBuffer(size_t index) {
   if (index < m_buffers.size()) {
+    OpenCallback done;
+    auto loading = m_loading.find(m_buffers[index].get());
+    if (loading != m_loading.end()) {
+      done = std::move(loading->second);
+      m_loading.erase(loading);
+    }
+    auto saving = m_saving.find(m_buffers[index].get());
+    if (saving != m_saving.end()) { // the file is written before it closes
+      bool saved = false;
+      m_buffers[index]->FinishSave(true, &saved);
+      SaveCallback savedCb = std::move(saving->second);
+      m_saving.erase(saving);
+      if (savedCb)
+        savedCb(saved);
+    }
     m_buffers.erase(m_buffers.begin() + index);
     if (m_activeBufferIndex >= m_buffers.size() && !m_buffers.empty()) {
       m_activeBufferIndex = m_buffers.size() - 1;
     } else if (m_buffers.empty()) {
       m_activeBufferIndex = 0;
     }
+    if (done) // the open never completed
+      done(static_cast<size_t>(-1), false);
   }
 }
 
@@ -202,12 +505,13 @@ void Editor::Copy(HWND hwnd) {
 
   if (OpenClipboard(hwnd)) {
     EmptyClipboard();
-    int len = MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, NULL, 0);
-    HGLOBAL hMem = GlobalAlloc(GMEM_MOVEABLE, len * sizeof(wchar_t));
+    // Sized for the worst case so the text converts in one pass
+    HGLOBAL hMem =
+        GlobalAlloc(GMEM_MOVEABLE, (text.size() + 1) * sizeof(wchar_t));
     if (hMem) {
       wchar_t *pMem = (wchar_t *)GlobalLock(hMem);
       if (pMem) {
-        MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, pMem, len);
+        pMem[Utf::Utf8ToWide(text.data(), text.size(), pMem)] = L'\0';
         GlobalUnlock(hMem);
         if (!SetClipboardData(CF_UNICODETEXT, hMem)) {
           DebugLog("Editor::Copy - SetClipboardData failed: " +
@@ -238,31 +542,30 @@ void Editor::Paste(HWND hwnd) {
     if (hData) {
       wchar_t *pMem = (wchar_t *)GlobalLock(hData);
       if (pMem) {
-        int len =
-            WideCharToMultiByte(CP_UTF8, 0, pMem, -1, NULL, 0, NULL, NULL);
-        std::vector<char> text(len);
-        WideCharToMultiByte(CP_UTF8, 0, pMem, -1, text.data(), len, NULL, NULL);
+        std::string text = Utf::FromWide(pMem, wcslen(pMem));
         GlobalUnlock(hData);
 
         Buffer *active = GetActiveBuffer();
         if (active) {
+          // Replacing the selection and a multi-line block paste are one
+          // undo step
+          active->BeginUndoGroup();
           if (active->HasSelection())
             active->DeleteSelection();
 
           if (active->GetSelectionMode() == SelectionMode::Box) {
             // Block paste logic: split clipboard text by lines and insert each
             // line into sequential lines starting at the caret row/column.
-            std::string clipText(text.data());
             std::vector<std::string> lines;
             size_t start = 0, end;
-            while ((end = clipText.find('\n', start)) != std::string::npos) {
-              std::string line = clipText.substr(start, end - start);
+            while ((end = text.find('\n', start)) != std::string::npos) {
+              std::string line = text.substr(start, end - start);
               if (!line.empty() && line.back() == '\r')
                 line.pop_back();
               lines.push_back(line);
               start = end + 1;
             }
-            lines.push_back(clipText.substr(start));
+            lines.push_back(text.substr(start));
 
             size_t startLine = active->GetLineAtOffset(active->GetCaretPos());
             size_t startCol =
@@ -281,9 +584,10 @@ void Editor::Paste(HWND hwnd) {
               active->Insert(insertPos, lines[i]);
             }
           } else {
-            active->Insert(active->GetCaretPos(), text.data());
-            active->MoveCaret(static_cast<int>(strlen(text.data())));
+            active->Insert(active->GetCaretPos(), text);
+            active->MoveCaret(static_cast<int>(text.size()));
           }
+          active->EndUndoGroup();
         }
       }
     } else {
@@ -2,7 +2,10 @@
 #include "../include/Buffer.h"
 #include "../include/Editor.h"
 #include "../include/Localization.h"
+#include "../include/Utf.h"
 #include <algorithm>
+#include <cmath>
+#include <limits>
 #include <vector>
 
 extern Editor *g_editor;
@@ -33,6 +36,7 @@ bool EditorBufferRenderer::Initialize(HWND hwnd) {
       DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, m_fontSize,
       L"", // locale
       &m_textFormat);
+  UpdateFontMetrics();
 
   return SUCCEEDED(hr);
 }
@@ -53,7 +57,9 @@ bool EditorBufferRenderer::CreateDeviceResources() {
 
   HRESULT hr = m_d2dFactory->CreateHwndRenderTarget(
       D2D1::RenderTargetProperties(),
-      D2D1::HwndRenderTargetProperties(m_hwnd, size), &m_renderTarget);
+      D2D1::HwndRenderTargetProperties(m_hwnd, size,
+                                       D2D1_PRESENT_OPTIONS_RETAIN_CONTENTS),
+      &m_renderTarget);
 
   if (SUCCEEDED(hr)) {
     m_renderTarget->CreateSolidColorBrush(m_theme.foreground, &m_brush);
@@ -72,6 +78,10 @@ bool EditorBufferRenderer::CreateDeviceResources() {
 }
 
 void EditorBufferRenderer::DiscardDeviceResources() {
+  // Cached layouts hold the old brushes as drawing effects
+  InvalidateLineLayouts();
+  m_frame = Frame();
+  m_overlayFormat.Reset();
   m_renderTarget.Reset();
   m_brush.Reset();
   m_bgBrush.Reset();
@@ -88,22 +98,29 @@ void EditorBufferRenderer::DiscardDeviceResources() {
 void EditorBufferRenderer::Resize(UINT width, UINT height) {
   if (m_renderTarget) {
     m_renderTarget->Resize(D2D1::SizeU(width, height));
+    m_frame.valid = false;
   }
 }
 
 size_t EditorBufferRenderer::GetPositionFromPoint(const std::string &text,
                                                   float x, float y,
                                                   size_t totalLinesInFile) {
-  // Convert UTF-8 to UTF-16
-  int len = MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, NULL, 0);
-  std::vector<wchar_t> wtext(len);
-  MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, wtext.data(), len);
-
-  float gutterWidth = val_LeftPadding;
-  if (m_showLineNumbers) {
-    int digits = (int)std::to_string(totalLinesInFile).length();
-    gutterWidth += (digits * 8.0f) + 15.0f;
+  float gutterWidth = val_LeftPadding + GetGutterWidth(totalLinesInFile);
+  float scrollX = 0.0f;
+  if (!m_wordWrap) {
+    Buffer *buf = g_editor->GetActiveBuffer();
+    if (buf)
+      scrollX = buf->GetScrollX();
   }
+  float adjustedX = (std::max)(0.0f, x - gutterWidth - 5.0f + scrollX);
+  float adjustedY = y - val_TopPadding;
+
+  size_t position;
+  if (UseMonospaceFastPath() &&
+      HitTestMonospace(text, adjustedX, adjustedY, position))
+    return position;
+
+  std::wstring wtext = Utf::ToWide(text);
 
   D2D1_SIZE_F size = {10000, 10000};
   if (m_renderTarget)
@@ -120,7 +137,7 @@ size_t EditorBufferRenderer::GetPositionFromPoint(const std::string &text,
   std::wstring locale = Localization::Instance().GetLocaleName();
   ComPtr<IDWriteTextLayout> textLayout;
   HRESULT hr = m_dwriteFactory->CreateTextLayout(
-      wtext.data(), static_cast<UINT32>(wtext.size() - 1), m_textFormat.Get(),
+      wtext.data(), static_cast<UINT32>(wtext.size()), m_textFormat.Get(),
       layoutWidth, 10000.0f, &textLayout);
 
   if (FAILED(hr))
@@ -131,34 +148,171 @@ size_t EditorBufferRenderer::GetPositionFromPoint(const std::string &text,
   BOOL isTrailingHit;
   BOOL isInside;
   DWRITE_HIT_TEST_METRICS metrics;
-  float scrollX = 0.0f;
-  if (!m_wordWrap) {
-    Buffer *buf = g_editor->GetActiveBuffer();
-    if (buf)
-      scrollX = buf->GetScrollX();
-  }
-  float adjustedX = (std::max)(0.0f, x - gutterWidth - 5.0f + scrollX);
-  float adjustedY = y - val_TopPadding;
   textLayout->HitTestPoint(adjustedX, adjustedY, &isTrailingHit, &isInside,
                            &metrics);
 
   int charIndex = metrics.textPosition + (isTrailingHit ? 1 : 0);
 
   // Convert char back to byte index
-  int byteIndex = WideCharToMultiByte(CP_UTF8, 0, wtext.data(), charIndex, NULL,
-                                      0, NULL, NULL);
-  return static_cast<size_t>(byteIndex);
+  charIndex = (std::min)(charIndex, static_cast<int>(wtext.size()));
+  return Utf::Utf8Length(wtext.data(), static_cast<size_t>(charIndex));
+}
+
+bool EditorBufferRenderer::HitTestMonospace(const std::string &text, float x,
+                                            float y, size_t &position) const {
+  // Row under the point as last drawn, since fallback fonts may make some
+  // rows taller; uniform rows until a frame exists. Like DirectWrite, points
+  // above or below the text snap to the first or last line.
+  size_t row = 0;
+  if (m_frame.valid && !m_frame.lines.empty()) {
+    while (row + 1 < m_frame.lines.size() &&
+           y + val_TopPadding >= m_frame.lines[row].bottom)
+      ++row;
+  } else if (y > 0.0f) {
+    row = static_cast<size_t>(y / m_metrics.lineHeight);
+  }
+
+  size_t lineStart = 0;
+  for (; row > 0; --row) {
+    size_t newline = text.find('\n', lineStart);
+    if (newline == std::string::npos)
+      break;
+    lineStart = newline + 1;
+  }
+  size_t lineEnd = text.find('\n', lineStart);
+  if (lineEnd == std::string::npos)
+    lineEnd = text.size();
+  if (lineEnd > lineStart && text[lineEnd - 1] == '\r')
+    --lineEnd;
+
+  size_t offset;
+  float left;
+  size_t length = lineEnd - lineStart;
+  if (!WalkMonospace(text.data() + lineStart, length, length, x, offset, left))
+    return false;
+  position = lineStart + offset;
+  return true;
+}
+
+// Decodes one UTF-8 sequence; malformed bytes decode one at a time as U+FFFD,
+// as Utf::ToWide does
+static size_t DecodeUtf8(const char *text, size_t length, uint32_t &codePoint) {
+  unsigned char lead = static_cast<unsigned char>(text[0]);
+  size_t bytes = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC2 ? 2 : 0;
+  codePoint = 0xFFFD;
+  if (bytes == 0 || bytes > length)
+    return 1;
+  uint32_t cp = lead & (0x7F >> bytes);
+  for (size_t i = 1; i < bytes; ++i) {
+    unsigned char c = static_cast<unsigned char>(text[i]);
+    if ((c & 0xC0) != 0x80)
+      return 1;
+    cp = (cp << 6) | (c & 0x3F);
+  }
+  if ((bytes == 3 && cp < 0x800) || (bytes == 4 && cp < 0x10000) ||
+      cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+    return 1;
+  codePoint = cp;
+  return bytes;
+}
+
+// Code points that render as one glyph at their own advance, whatever their
+// neighbours: Latin, Greek, Cyrillic, punctuation, symbols and CJK. Combining
+// marks, joiners, complex and right-to-left scripts, and emoji need shaping.
+static bool IsSimpleCodePoint(uint32_t cp) {
+  if (cp < 0x0300)
+    return true;
+  if (cp < 0x0370)
+    return false;
+  if (cp < 0x0483)
+    return true;
+  if (cp < 0x1E00)
+    return cp >= 0x048A && cp < 0x0590;
+  if (cp < 0x2000)
+    return true;
+  if (cp < 0x2010 || (cp >= 0x2028 && cp < 0x2030) ||
+      (cp >= 0x2060 && cp < 0x2070) || (cp >= 0x20D0 && cp < 0x2100))
+    return false;
+  if (cp < 0x2E80)
+    return true;
+  if ((cp >= 0x302A && cp < 0x3030) || cp == 0x3099 || cp == 0x309A)
+    return false;
+  if (cp < 0xA000)
+    return true;
+  if (cp < 0xAC00)
+    return false;
+  if (cp < 0xD7A4)
+    return true;
+  if (cp < 0xF900)
+    return false;
+  if (cp < 0xFB00)
+    return true;
+  return cp >= 0xFF00 && cp < 0xFFF0;
+}
+
+float EditorBufferRenderer::GetWideAdvance(uint32_t codePoint) const {
+  auto it = m_wideAdvances.find(codePoint);
+  if (it != m_wideAdvances.end())
+    return it->second;
+  // Measured through a layout so font fallback picks the same face it will
+  // draw with
+  wchar_t units[2];
+  UINT32 count = 1;
+  if (codePoint >= 0x10000 && sizeof(wchar_t) == 2) {
+    units[0] = static_cast<wchar_t>(0xD800 + ((codePoint - 0x10000) >> 10));
+    units[1] = static_cast<wchar_t>(0xDC00 + ((codePoint - 0x10000) & 0x3FF));
+    count = 2;
+  } else {
+    units[0] = static_cast<wchar_t>(codePoint);
+  }
+  float advance = MeasureWidth(units, count);
+  m_wideAdvances.emplace(codePoint, advance);
+  return advance;
+}
+
+bool EditorBufferRenderer::WalkMonospace(const char *text, size_t length,
+                                         size_t stopAt, float stopX,
+                                         size_t &offset, float &x) const {
+  offset = 0;
+  x = 0.0f;
+  stopAt = (std::min)(stopAt, length);
+  while (offset < stopAt) {
+    unsigned char c = static_cast<unsigned char>(text[offset]);
+    size_t bytes = 1;
+    float advance;
+    if (c == '\t') {
+      float tab = m_metrics.tabStop;
+      advance = (std::floor(x / tab) + 1.0f) * tab - x;
+    } else if (c < 0x80) {
+      advance = m_asciiAdvance[c];
+    } else {
+      uint32_t codePoint;
+      bytes = DecodeUtf8(text + offset, length - offset, codePoint);
+      if (!IsSimpleCodePoint(codePoint))
+        return false;
+      advance = GetWideAdvance(codePoint);
+    }
+    if (stopX < x + advance / 2.0f)
+      break;
+    x += advance;
+    offset += bytes;
+  }
+  return true;
+}
+
+bool EditorBufferRenderer::MonospaceX(const char *text, size_t length,
+                                      size_t stopAt, float &x) const {
+  size_t offset;
+  return WalkMonospace(text, length, stopAt,
+                       (std::numeric_limits<float>::max)(), offset, x);
 }
 
 bool EditorBufferRenderer::HitTestGutter(float x, float y,
                                          size_t totalLinesInFile,
                                          size_t &lineIndex) {
-  float gutterWidth = val_LeftPadding;
   if (!m_showLineNumbers)
     return false;
-
-  int digits = (int)std::to_string(totalLinesInFile).length();
-  gutterWidth += (digits * 8.0f) + 15.0f;
+  float gutterWidth = val_LeftPadding + GetGutterWidth(totalLinesInFile);
 
   if (x >= val_LeftPadding && x <= gutterWidth) {
     float adjustedY = y - val_TopPadding;
@@ -172,30 +326,105 @@ bool EditorBufferRenderer::HitTestGutter(float x, float y,
   return false;
 }
 
-float EditorBufferRenderer::GetLineHeight() const {
+float EditorBufferRenderer::GetGutterWidth(size_t maxLineNumber) const {
+  if (!m_showLineNumbers)
+    return 0.0f;
+  int digits = (maxLineNumber > 0) ? (int)std::to_string(maxLineNumber).length()
+                                   : 1;
+  return (digits * m_metrics.digitWidth) + 15.0f;
+}
+
+float EditorBufferRenderer::MeasureWidth(const wchar_t *text,
+                                         UINT32 length) const {
+  ComPtr<IDWriteTextLayout> textLayout;
+  m_dwriteFactory->CreateTextLayout(text, length, m_textFormat.Get(), 100000.0f,
+                                    1000.0f, &textLayout);
+  if (!textLayout)
+    return 0.0f;
+  DWRITE_TEXT_METRICS metrics;
+  textLayout->GetMetrics(&metrics);
+  return metrics.widthIncludingTrailingWhitespace;
+}
+
+void EditorBufferRenderer::UpdateFontMetrics() {
+  m_metrics = FontMetrics();
   if (!m_textFormat)
-    return 20.0f;
+    return;
 
+  static const wchar_t digits[] = L"0123456789";
   ComPtr<IDWriteTextLayout> textLayout;
-  m_dwriteFactory->CreateTextLayout(L" ", 1, m_textFormat.Get(), 100.0f, 100.0f,
-                                    &textLayout);
-  if (textLayout) {
-    DWRITE_LINE_METRICS metrics;
-    UINT32 count;
-    textLayout->GetLineMetrics(&metrics, 1, &count);
-    return metrics.height;
+  m_dwriteFactory->CreateTextLayout(digits, 10, m_textFormat.Get(), 100000.0f,
+                                    1000.0f, &textLayout);
+  if (!textLayout)
+    return;
+  DWRITE_LINE_METRICS line;
+  UINT32 count = 0;
+  textLayout->GetLineMetrics(&line, 1, &count);
+  if (count > 0) {
+    m_metrics.lineHeight = line.height;
+    m_metrics.ascent = line.baseline;
+  }
+  DWRITE_TEXT_METRICS text;
+  textLayout->GetMetrics(&text);
+  m_metrics.digitWidth = text.widthIncludingTrailingWhitespace / 10.0f;
+
+  m_metrics.tabStop = m_textFormat->GetIncrementalTabStop();
+
+  // Advances of printable ASCII from one layout; control characters draw
+  // nothing and tabs are resolved against the tab stop while walking
+  m_wideAdvances.clear();
+  std::fill(std::begin(m_asciiAdvance), std::end(m_asciiAdvance), 0.0f);
+  wchar_t printable[95];
+  for (UINT32 i = 0; i < 95; ++i)
+    printable[i] = static_cast<wchar_t>(0x20 + i);
+  ComPtr<IDWriteTextLayout> asciiLayout;
+  m_dwriteFactory->CreateTextLayout(printable, 95, m_textFormat.Get(),
+                                    100000.0f, 1000.0f, &asciiLayout);
+  if (!asciiLayout)
+    return;
+  float left = 0.0f;
+  for (UINT32 i = 0; i < 95; ++i) {
+    float right, top;
+    DWRITE_HIT_TEST_METRICS hit;
+    asciiLayout->HitTestTextPosition(i, TRUE, &right, &top, &hit);
+    m_asciiAdvance[0x20 + i] = right - left;
+    left = right;
   }
-  return 20.0f;
+
+  float letters = 0.0f;
+  for (char c = 'a'; c <= 'z'; ++c)
+    letters += m_asciiAdvance[static_cast<unsigned char>(c)];
+  m_metrics.advance = letters / 26.0f;
+  // Every printable character advances alike only in a fixed pitch font
+  auto range = std::minmax_element(m_asciiAdvance + 0x20, m_asciiAdvance + 0x7F);
+  m_metrics.monospace =
+      *range.first > 0.0f && *range.second - *range.first < 0.01f;
 }
 
 float EditorBufferRenderer::GetTextWidth(const std::string &text) {
-  int len = MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, NULL, 0);
-  std::vector<wchar_t> wtext(len);
-  MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, wtext.data(), len);
+  if (UseMonospaceFastPath()) {
+    // Widest line, as the layout below would report
+    float widest = 0.0f;
+    bool simple = true;
+    for (size_t lineStart = 0; simple && lineStart <= text.size();) {
+      size_t lineEnd = text.find('\n', lineStart);
+      if (lineEnd == std::string::npos)
+        lineEnd = text.size();
+      float width;
+      simple = MonospaceX(text.data() + lineStart, lineEnd - lineStart,
+                          lineEnd - lineStart, width);
+      widest = (std::max)(widest, width);
+      lineStart = lineEnd + 1;
+    }
+    if (simple)
+      return widest;
+  }
+
+  std::wstring wtext = Utf::ToWide(text);
 
   ComPtr<IDWriteTextLayout> textLayout;
   HRESULT hr = m_dwriteFactory->CreateTextLayout(
-      wtext.data(), static_cast<UINT32>(wtext.size() - 1), m_textFormat.Get(),
+      wtext.data(), static_cast<UINT32>(wtext.size()), m_textFormat.Get(),
       100000.0f, 1000.0f, &textLayout);
 
   if (SUCCEEDED(hr)) {
@@ -215,10 +444,12 @@ void EditorBufferRenderer::SetFont(const std::wstring &familyName,
 }
 
 void EditorBufferRenderer::UpdateFontFormat() {
+  InvalidateLineLayouts();
   m_textFormat.Reset();
   m_dwriteFactory->CreateTextFormat(
       m_fontFamily.c_str(), NULL, m_fontWeight, DWRITE_FONT_STYLE_NORMAL,
       DWRITE_FONT_STRETCH_NORMAL, m_fontSize, L"en-us", &m_textFormat);
+  UpdateFontMetrics();
 }
 
 void EditorBufferRenderer::ZoomIn() {
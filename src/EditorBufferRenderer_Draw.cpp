@@ -1,12 +1,126 @@
 #include "../include/Buffer.h"
 #include "../include/Editor.h"
 #include "../include/EditorBufferRenderer.h"
+#include "../include/FrameProfiler.h"
 #include "../include/Localization.h"
+#include "../include/Utf.h"
 #include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <vector>
 
 extern Editor *g_editor;
 
+// FNV-1a over everything a line layout depends on
+static uint64_t HashLine(const char *text, size_t length, float width,
+                         const std::vector<Buffer::HighlightRange> &spans) {
+  uint64_t hash = 14695981039346656037ull;
+  auto mix = [&hash](const void *data, size_t size) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i)
+      hash = (hash ^ bytes[i]) * 1099511628211ull;
+  };
+  mix(text, length);
+  mix(&width, sizeof(width));
+  for (const auto &span : spans) {
+    mix(&span.start, sizeof(span.start));
+    mix(&span.length, sizeof(span.length));
+    mix(&span.type, sizeof(span.type));
+  }
+  return hash;
+}
+
+ID2D1SolidColorBrush *EditorBufferRenderer::GetHighlightBrush(int type) const {
+  switch (type) {
+  case 1:
+    return this->m_keywordBrush.Get();
+  case 2:
+    return this->m_stringBrush.Get();
+  case 3:
+    return this->m_numberBrush.Get();
+  case 4:
+    return this->m_commentBrush.Get();
+  case 5:
+    return this->m_functionBrush.Get();
+  }
+  return nullptr;
+}
+
+const EditorBufferRenderer::LineLayout *EditorBufferRenderer::GetLineLayout(
+    const char *text, size_t length, float width,
+    const std::vector<Buffer::HighlightRange> &spans) {
+  uint64_t hash = HashLine(text, length, width, spans);
+  auto range = m_lineLayoutIndex.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    LineLayout &entry = *it->second;
+    if (entry.width == width && entry.spans == spans &&
+        entry.text.compare(0, std::string::npos, text, length) == 0) {
+      m_lineLayouts.splice(m_lineLayouts.begin(), m_lineLayouts, it->second);
+      ++m_layoutStats.hits;
+      return &entry;
+    }
+  }
+  ++m_layoutStats.misses;
+
+  std::wstring wtext = Utf::ToWide(text, length);
+  ComPtr<IDWriteTextLayout> textLayout;
+  HRESULT hr = this->m_dwriteFactory->CreateTextLayout(
+      wtext.data(), static_cast<UINT32>(wtext.size()),
+      this->m_textFormat.Get(), width, 10000.0f, &textLayout);
+  if (FAILED(hr))
+    return nullptr;
+
+  textLayout->SetLocaleName(m_layoutLocale.c_str(),
+                            {0, (UINT32)wtext.size()});
+
+  if (this->m_enableLigatures) {
+    Microsoft::WRL::ComPtr<IDWriteTypography> typography;
+    if (SUCCEEDED(this->m_dwriteFactory->CreateTypography(&typography))) {
+      DWRITE_FONT_FEATURE feature = {
+          DWRITE_FONT_FEATURE_TAG_STANDARD_LIGATURES, 1};
+      typography->AddFontFeature(feature);
+      textLayout->SetTypography(typography.Get(), {0, (UINT32)wtext.size()});
+    }
+  }
+
+  // Apply Syntax Highlighting
+  for (const auto &span : spans) {
+    ID2D1SolidColorBrush *hBrush = GetHighlightBrush(span.type);
+    if (hBrush) {
+      UINT32 startChar =
+          static_cast<UINT32>(Utf::Utf16Length(text, span.start));
+      UINT32 charCount = static_cast<UINT32>(
+          Utf::Utf16Length(text + span.start, span.length));
+      textLayout->SetDrawingEffect(hBrush, {startChar, charCount});
+    }
+  }
+
+  DWRITE_TEXT_METRICS metrics;
+  textLayout->GetMetrics(&metrics);
+
+  if (m_lineLayouts.size() >= LINE_LAYOUT_CACHE_SIZE) {
+    auto oldest = std::prev(m_lineLayouts.end());
+    auto stale = m_lineLayoutIndex.equal_range(oldest->hash);
+    for (auto it = stale.first; it != stale.second; ++it) {
+      if (it->second == oldest) {
+        m_lineLayoutIndex.erase(it);
+        break;
+      }
+    }
+    m_lineLayouts.pop_back();
+  }
+  m_lineLayouts.push_front(
+      {hash, width, std::string(text, length), spans, textLayout,
+       metrics.height});
+  m_lineLayoutIndex.emplace(hash, m_lineLayouts.begin());
+  return &m_lineLayouts.front();
+}
+
+static bool SameRect(const D2D1_RECT_F &a, const D2D1_RECT_F &b) {
+  return a.left == b.left && a.top == b.top && a.right == b.right &&
+         a.bottom == b.bottom;
+}
+
 void EditorBufferRenderer::DrawEditorLines(
     const std::string &text, size_t caretPos,
     const std::vector<Buffer::SelectionRange> *selectionRanges,
@@ -16,46 +130,12 @@ void EditorBufferRenderer::DrawEditorLines(
   if (!this->CreateDeviceResources())
     return;
 
-  this->m_renderTarget->BeginDraw();
-  this->m_renderTarget->Clear(this->m_theme.background);
-
-  // OPTIMIZATION #6: Cache UTF-8 to UTF-16 conversion
-  bool textChanged = false;
-  if (!m_isConversionCacheValid || m_lastUtf8Content != text) {
-    int len = MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, NULL, 0);
-    m_cachedWtext.resize(len);
-    MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, m_cachedWtext.data(),
-                        len);
-    m_lastUtf8Content = text;
-    m_isConversionCacheValid = true;
-    textChanged = true;
-  }
-
-  const std::vector<wchar_t> &wtext = m_cachedWtext;
-
-  // Find character index for caretPos (which is byte index)
-  int charIndex = 0;
-  if (caretPos > 0) {
-    charIndex = MultiByteToWideChar(CP_UTF8, 0, text.c_str(),
-                                    static_cast<int>(caretPos), NULL, 0);
-  }
-
+  FrameProfiler::Scope layoutTimer(FrameProfiler::Stage::Layout);
   D2D1_SIZE_F size = this->m_renderTarget->GetSize();
 
   // Calculate dynamic gutter width
-  float gutterWidth = 0.0f;
-  if (this->m_showLineNumbers) {
-    size_t maxNum = (std::max)(totalLinesEstimate, firstLineNumber);
-    int digits = (maxNum > 0) ? (int)std::to_string(maxNum).length() : 1;
-    gutterWidth = (digits * 8.0f) + 15.0f;
-  }
-
-  // Draw Gutter Line
-  if (this->m_showLineNumbers) {
-    this->m_renderTarget->DrawLine(
-        D2D1::Point2F(gutterWidth, this->val_TopPadding),
-        D2D1::Point2F(gutterWidth, size.height), this->m_lnBrush.Get(), 1.0f);
-  }
+  float gutterWidth =
+      GetGutterWidth((std::max)(totalLinesEstimate, firstLineNumber));
 
   float layoutWidth = 100000.0f;
   if (this->m_wordWrap) {
@@ -65,238 +145,389 @@ void EditorBufferRenderer::DrawEditorLines(
       layoutWidth = (std::max)(10.0f, size.width - gutterWidth - 10.0f);
   }
 
-  // OPTIMIZATION #9: Reuse TextLayout if possible
-  bool highlightsChanged = false;
-  if (highlights) {
-    if (*highlights != m_lastHighlights) {
-      highlightsChanged = true;
-      m_lastHighlights = *highlights;
-    }
-  } else if (!m_lastHighlights.empty()) {
-    highlightsChanged = true;
-    m_lastHighlights.clear();
+  std::wstring locale = Localization::Instance().GetLocaleName();
+  if (locale != m_layoutLocale) {
+    InvalidateLineLayouts();
+    m_layoutLocale = locale;
   }
-
-  if (!m_cachedTextLayout || textChanged || m_lastLayoutWidth != layoutWidth ||
-      m_lastLayoutHeight != size.height || highlightsChanged) {
-    std::wstring locale = Localization::Instance().GetLocaleName();
-    HRESULT hr = this->m_dwriteFactory->CreateTextLayout(
-        wtext.data(), static_cast<UINT32>(wtext.size() - 1),
-        this->m_textFormat.Get(), layoutWidth, size.height,
-        &m_cachedTextLayout);
-
-    if (SUCCEEDED(hr)) {
-      m_cachedTextLayout->SetLocaleName(locale.c_str(),
-                                        {0, (UINT32)wtext.size()});
-
-      if (this->m_enableLigatures) {
-        Microsoft::WRL::ComPtr<IDWriteTypography> typography;
-        if (SUCCEEDED(this->m_dwriteFactory->CreateTypography(&typography))) {
-          DWRITE_FONT_FEATURE feature = {
-              DWRITE_FONT_FEATURE_TAG_STANDARD_LIGATURES, 1};
-          typography->AddFontFeature(feature);
-          m_cachedTextLayout->SetTypography(typography.Get(),
-                                            {0, (UINT32)wtext.size()});
-        }
-      }
-
-      // Apply Syntax Highlighting
-      if (highlights && !highlights->empty()) {
-        for (const auto &hrange : *highlights) {
-          int startChar =
-              MultiByteToWideChar(CP_UTF8, 0, text.c_str(),
-                                  static_cast<int>(hrange.start), NULL, 0);
-          int endChar = MultiByteToWideChar(
-              CP_UTF8, 0, text.c_str(),
-              static_cast<int>(hrange.start + hrange.length), NULL, 0);
-
-          ID2D1SolidColorBrush *hBrush = nullptr;
-          switch (hrange.type) {
-          case 1:
-            hBrush = this->m_keywordBrush.Get();
-            break;
-          case 2:
-            hBrush = this->m_stringBrush.Get();
-            break;
-          case 3:
-            hBrush = this->m_numberBrush.Get();
-            break;
-          case 4:
-            hBrush = this->m_commentBrush.Get();
-            break;
-          case 5:
-            hBrush = this->m_functionBrush.Get();
-            break;
-          }
-          if (hBrush) {
-            m_cachedTextLayout->SetDrawingEffect(
-                hBrush, {(UINT32)startChar, (UINT32)(endChar - startChar)});
-          }
-        }
+  m_layoutStats = LayoutCacheStats();
+
+  Frame frame;
+  frame.valid = true;
+  frame.size = size;
+  frame.gutterWidth = gutterWidth;
+  frame.xOffset = gutterWidth + 5 - scrollX;
+  frame.lineHeight = this->GetLineHeight();
+  frame.caretStyle = m_caretStyle;
+  frame.caretShown = m_enableCaretBlinking ? this->m_bIsCaretVisibleVal : true;
+
+  // Lay out the viewport; text is exactly the viewport content, so it starts
+  // at the top
+  float yOffset = this->val_TopPadding;
+  float xOffset = frame.xOffset;
+  std::vector<Buffer::HighlightRange> spans;
+  std::vector<DWRITE_HIT_TEST_METRICS> hitTestMetrics;
+  const bool monospace = UseMonospaceFastPath();
+  size_t lineStart = 0;
+  for (size_t i = 0; lineStart <= text.size() && yOffset < size.height; ++i) {
+    size_t lineEnd = text.find('\n', lineStart);
+    if (lineEnd == std::string::npos)
+      lineEnd = text.size();
+    size_t nextLine = lineEnd + 1;
+    const char *line = text.data() + lineStart;
+    size_t length = lineEnd - lineStart;
+    if (length > 0 && line[length - 1] == '\r')
+      --length;
+
+    // Highlights relative to this line
+    spans.clear();
+    if (highlights) {
+      for (const auto &hrange : *highlights) {
+        size_t start = (std::max)(hrange.start, lineStart);
+        size_t end = (std::min)(hrange.start + hrange.length, lineStart + length);
+        if (end > start)
+          spans.push_back({start - lineStart, end - start, hrange.type});
       }
     }
-    m_lastLayoutWidth = layoutWidth;
-    m_lastLayoutHeight = size.height;
-  }
-
-  IDWriteTextLayout *textLayout = m_cachedTextLayout.Get();
-  if (!textLayout)
-    return; // Should not happen if CreateDeviceResources worked
 
-  {
-    HRESULT hr = S_OK;
-    float lineHeight = this->GetLineHeight();
-    float yOffset = this->val_TopPadding; // Text is exactly the viewport content, so draw from top
-    float xOffset = gutterWidth + 5 - scrollX;
+    FrameLine row = {};
+    row.top = yOffset;
+    row.bottom = yOffset + frame.lineHeight;
+    const LineLayout *entry = GetLineLayout(line, length, layoutWidth, spans);
+    if (entry) {
+      row.layout = entry->layout;
+      row.bottom = yOffset + entry->height;
+    }
+    IDWriteTextLayout *textLayout = row.layout.Get();
 
     // Selection Highlighting
-    if (selectionRanges && !selectionRanges->empty()) {
+    if (textLayout && selectionRanges) {
       for (const auto &range : *selectionRanges) {
-        int selStartChar = MultiByteToWideChar(
-            CP_UTF8, 0, text.c_str(), static_cast<int>(range.start), NULL, 0);
-        int selEndChar = MultiByteToWideChar(
-            CP_UTF8, 0, text.c_str(), static_cast<int>(range.end), NULL, 0);
+        size_t start = (std::max)(range.start, lineStart);
+        size_t end = (std::min)(range.end, lineStart + length);
+        if (end <= start)
+          continue;
+        float left, right;
+        if (monospace &&
+            MonospaceX(line, length, start - lineStart, left) &&
+            MonospaceX(line, length, end - lineStart, right)) {
+          row.selection.push_back(D2D1::RectF(left + xOffset, row.top,
+                                              right + xOffset, row.bottom));
+          continue;
+        }
+        UINT32 selStartChar = static_cast<UINT32>(
+            Utf::Utf16Length(line, start - lineStart));
+        UINT32 selCharCount = static_cast<UINT32>(
+            Utf::Utf16Length(text.data() + start, end - start));
 
         UINT32 actualHitTestCount = 0;
-        textLayout->HitTestTextRange(selStartChar, selEndChar - selStartChar, 0,
-                                     0, NULL, 0, &actualHitTestCount);
-
+        textLayout->HitTestTextRange(selStartChar, selCharCount, 0, 0, NULL, 0,
+                                     &actualHitTestCount);
         if (actualHitTestCount > 0) {
-          std::vector<DWRITE_HIT_TEST_METRICS> hitTestMetrics(
-              actualHitTestCount);
-          textLayout->HitTestTextRange(selStartChar, selEndChar - selStartChar,
-                                       0, 0, hitTestMetrics.data(),
+          hitTestMetrics.resize(actualHitTestCount);
+          textLayout->HitTestTextRange(selStartChar, selCharCount, 0, 0,
+                                       hitTestMetrics.data(),
                                        actualHitTestCount, &actualHitTestCount);
 
-          for (const auto &m : hitTestMetrics) {
-            this->m_renderTarget->FillRectangle(
-                D2D1::RectF(m.left + xOffset, m.top + yOffset,
-                            m.left + m.width + xOffset,
-                            m.top + m.height + yOffset),
-                this->m_selBrush.Get());
+          for (UINT32 k = 0; k < actualHitTestCount; ++k) {
+            const auto &m = hitTestMetrics[k];
+            row.selection.push_back(D2D1::RectF(
+                m.left + xOffset, m.top + yOffset, m.left + m.width + xOffset,
+                m.top + m.height + yOffset));
           }
         }
       }
     }
 
-    this->m_renderTarget->DrawTextLayout(D2D1::Point2F(xOffset, yOffset),
-                                         textLayout, this->m_brush.Get());
-
-    // Draw Line Numbers
+    // Line Numbers
     if (this->m_showLineNumbers) {
-      UINT32 lineCount = 0;
-      textLayout->GetLineMetrics(NULL, 0, &lineCount);
-      if (lineCount > 0) {
-        std::vector<DWRITE_LINE_METRICS> lineMetrics(lineCount);
-        textLayout->GetLineMetrics(lineMetrics.data(), lineCount, &lineCount);
-
-        float currentY = yOffset;
-        for (UINT32 i = 0; i < lineCount; ++i) {
-          if (currentY + lineMetrics[i].height > 0 && currentY < size.height) {
-            size_t displayNum = 0;
-            if (physicalLineNumbers && i < physicalLineNumbers->size()) {
-              size_t currentLog = (*physicalLineNumbers)[i];
-              // Only show number for the first visual line of a logical line
-              if (i == 0 ||
-                  (i > 0 && (*physicalLineNumbers)[i - 1] != currentLog)) {
-                displayNum = currentLog + 1;
-              }
-            } else {
-              // Fallback if no physical mapping (shouldn't happen for editor)
-              displayNum = i + firstLineNumber;
-            }
-
-            if (displayNum > 0) {
-              std::wstring lineNum = std::to_wstring(displayNum);
-              D2D1_RECT_F lineRect =
-                  D2D1::RectF(0, currentY, gutterWidth - 5,
-                              currentY + lineMetrics[i].height);
-              float tp = this->val_TopPadding;
-              if (lineRect.top >= tp) {
-                this->m_renderTarget->DrawText(
-                    lineNum.c_str(), static_cast<UINT32>(lineNum.length()),
-                    this->m_textFormat.Get(), lineRect, this->m_lnBrush.Get());
-
-                Buffer *buf = g_editor ? g_editor->GetActiveBuffer() : nullptr;
-                if (buf) {
-                  /*
-                  // Removed fold icons per user request
-                  size_t physicalLine =
-                      buf->GetPhysicalLine(i + firstLineNumber - 1);
-                  bool isFolded = buf->IsLineFolded(physicalLine);
-
-                  float boxSize = 8.0f;
-                  float boxX = gutterWidth - 12.0f;
-                  float boxY =
-                      currentY + (lineMetrics[i].height - boxSize) / 2.0f;
-                  D2D1_RECT_F boxRect =
-                      D2D1::RectF(boxX, boxY, boxX + boxSize, boxY + boxSize);
-                  this->m_renderTarget->DrawRectangle(
-                      boxRect, this->m_lnBrush.Get(), 1.0f);
-
-                  this->m_renderTarget->DrawLine(
-                      D2D1::Point2F(boxX + 2, boxY + boxSize / 2),
-                      D2D1::Point2F(boxX + boxSize - 2, boxY + boxSize / 2),
-                      this->m_lnBrush.Get(), 1.0f);
-
-                  if (isFolded) {
-                    this->m_renderTarget->DrawLine(
-                        D2D1::Point2F(boxX + boxSize / 2, boxY + 2),
-                        D2D1::Point2F(boxX + boxSize / 2, boxY + boxSize - 2),
-                        this->m_lnBrush.Get(), 1.0f);
-                  }
-                  */
-                }
-              }
-            }
-          }
-          currentY += lineMetrics[i].height;
-        }
+      if (physicalLineNumbers) {
+        if (i < physicalLineNumbers->size())
+          row.number = (*physicalLineNumbers)[i] + 1;
+      } else {
+        // Fallback if no physical mapping (shouldn't happen for editor)
+        row.number = i + firstLineNumber;
       }
     }
 
-    // Draw Caret
-    // Draw Caret
-    bool cv = m_enableCaretBlinking ? this->m_bIsCaretVisibleVal : true;
-    if (cv) {
-      DWRITE_HIT_TEST_METRICS metrics;
-      float caretX, caretY;
-      HRESULT hr = textLayout->HitTestTextPosition(charIndex, FALSE, &caretX,
-                                                   &caretY, &metrics);
-      if (SUCCEEDED(hr)) {
-        float width = metrics.width;
+    // Caret
+    if (textLayout && caretPos >= lineStart && caretPos < nextLine) {
+      size_t caretOffset = (std::min)(caretPos - lineStart, length);
+      float caretX = 0.0f, caretY = 0.0f, next = 0.0f;
+      float width = 0.0f, height = 0.0f;
+      bool placed = monospace &&
+                    MonospaceX(line, length, caretOffset, caretX) &&
+                    MonospaceX(line, length, caretOffset + 1, next);
+      if (placed) {
+        width = next - caretX;
+        height = row.bottom - row.top;
+      } else {
+        UINT32 charIndex =
+            static_cast<UINT32>(Utf::Utf16Length(line, caretOffset));
+        DWRITE_HIT_TEST_METRICS metrics = {};
+        placed = SUCCEEDED(textLayout->HitTestTextPosition(
+            charIndex, FALSE, &caretX, &caretY, &metrics));
+        width = metrics.width;
+        height = metrics.height;
+      }
+      if (placed) {
+        caretX += xOffset;
+        caretY += yOffset;
         if (width <= 0)
-          width = 8.0f;
+          width = m_metrics.advance;
 
         if (m_caretStyle == CaretStyle::Block) {
-          D2D1_RECT_F rect = D2D1::RectF(caretX + xOffset, caretY + yOffset,
-                                         caretX + xOffset + width,
-                                         caretY + metrics.height + yOffset);
-          this->m_lastCaretRect = rect;
-          m_caretBrush->SetOpacity(0.5f);
-          this->m_renderTarget->FillRectangle(rect, this->m_caretBrush.Get());
-          m_caretBrush->SetOpacity(1.0f);
+          row.caret =
+              D2D1::RectF(caretX, caretY, caretX + width, caretY + height);
         } else if (m_caretStyle == CaretStyle::Underline) {
-          float yPos = caretY + metrics.height + yOffset;
-          this->m_lastCaretRect = D2D1::RectF(caretX + xOffset, yPos - 2,
-                                              caretX + xOffset + width, yPos);
-          this->m_renderTarget->DrawLine(
-              D2D1::Point2F(caretX + xOffset, yPos),
-              D2D1::Point2F(caretX + xOffset + width, yPos),
-              this->m_caretBrush.Get(), 2.0f);
+          float yPos = caretY + height;
+          row.caret = D2D1::RectF(caretX, yPos - 2, caretX + width, yPos);
         } else { // Line
-          this->m_lastCaretRect = D2D1::RectF(
-              caretX + xOffset, caretY + yOffset, caretX + xOffset + 2,
-              caretY + metrics.height + yOffset);
-          this->m_renderTarget->DrawLine(
-              D2D1::Point2F(caretX + xOffset, caretY + yOffset),
-              D2D1::Point2F(caretX + xOffset,
-                            caretY + metrics.height + yOffset),
-              this->m_caretBrush.Get(), 2.0f);
+          row.caret = D2D1::RectF(caretX, caretY, caretX + 2, caretY + height);
         }
+        row.hasCaret = true;
+        this->m_lastCaretRect = row.caret;
       }
     }
+
+    yOffset = row.bottom;
+    frame.lines.push_back(std::move(row));
+    lineStart = nextLine;
+  }
+  m_layoutStats.cached = m_lineLayouts.size();
+
+  // Rows that differ from what is on screen. Anything that moves every row
+  // (size, gutter, horizontal scroll, caret style) repaints the whole target.
+  std::vector<std::pair<float, float>> dirty;
+  m_repaintedLines = 0;
+  if (!m_frame.valid || m_frame.size.width != size.width ||
+      m_frame.size.height != size.height ||
+      m_frame.gutterWidth != frame.gutterWidth ||
+      m_frame.xOffset != frame.xOffset ||
+      m_frame.lineHeight != frame.lineHeight ||
+      m_frame.caretStyle != frame.caretStyle) {
+    dirty.push_back({0.0f, size.height});
+    m_repaintedLines = frame.lines.size();
+  } else {
+    size_t count = (std::max)(frame.lines.size(), m_frame.lines.size());
+    for (size_t i = 0; i < count; ++i) {
+      const FrameLine *now = i < frame.lines.size() ? &frame.lines[i] : nullptr;
+      const FrameLine *was =
+          i < m_frame.lines.size() ? &m_frame.lines[i] : nullptr;
+      bool same = now && was && now->top == was->top &&
+                  now->bottom == was->bottom &&
+                  now->layout.Get() == was->layout.Get() &&
+                  now->number == was->number &&
+                  now->hasCaret == was->hasCaret &&
+                  now->selection.size() == was->selection.size();
+      for (size_t k = 0; same && k < now->selection.size(); ++k)
+        same = SameRect(now->selection[k], was->selection[k]);
+      if (same && now->hasCaret)
+        same = SameRect(now->caret, was->caret) &&
+               frame.caretShown == m_frame.caretShown;
+      if (same)
+        continue;
+      if (now) {
+        dirty.push_back({now->top, now->bottom});
+        ++m_repaintedLines;
+      }
+      if (was)
+        dirty.push_back({was->top, was->bottom});
+    }
+  }
+  m_frame = std::move(frame);
+
+  // The overlay shows new numbers every frame
+  if (m_showPerfOverlay) {
+    D2D1_RECT_F overlay = GetPerfOverlayRect();
+    dirty.push_back({overlay.top, overlay.bottom});
+  }
+
+  // Merge overlapping rows into bands
+  std::sort(dirty.begin(), dirty.end());
+  std::vector<std::pair<float, float>> bands;
+  for (const auto &row : dirty) {
+    if (!bands.empty() && row.first <= bands.back().second)
+      bands.back().second = (std::max)(bands.back().second, row.second);
+    else
+      bands.push_back(row);
+  }
+
+  layoutTimer.Stop();
+
+  FrameProfiler::Scope drawTimer(FrameProfiler::Stage::Draw);
+  this->m_renderTarget->BeginDraw();
+  for (const auto &band : bands)
+    DrawRows(band.first, band.second);
+  EndFrame();
+}
+
+void EditorBufferRenderer::DrawRows(float top, float bottom) {
+  D2D1_SIZE_F size = m_frame.size;
+  this->m_renderTarget->PushAxisAlignedClip(
+      D2D1::RectF(0, top, size.width, bottom), D2D1_ANTIALIAS_MODE_ALIASED);
+  this->m_renderTarget->Clear(this->m_theme.background);
+
+  // Draw Gutter Line
+  if (this->m_showLineNumbers) {
+    this->m_renderTarget->DrawLine(
+        D2D1::Point2F(m_frame.gutterWidth, this->val_TopPadding),
+        D2D1::Point2F(m_frame.gutterWidth, size.height), this->m_lnBrush.Get(),
+        1.0f);
+  }
+
+  for (const auto &line : m_frame.lines) {
+    if (line.bottom > top && line.top < bottom)
+      DrawFrameLine(line);
+  }
+
+  if (m_showPerfOverlay) {
+    D2D1_RECT_F overlay = GetPerfOverlayRect();
+    if (overlay.bottom > top && overlay.top < bottom)
+      DrawPerfOverlay();
+  }
+  this->m_renderTarget->PopAxisAlignedClip();
+}
+
+static const int OVERLAY_LINES = FrameProfiler::STAGE_COUNT + 2;
+static const float OVERLAY_LINE_HEIGHT = 14.0f;
+
+D2D1_RECT_F EditorBufferRenderer::GetPerfOverlayRect() const {
+  float width = 300.0f;
+  float left = (std::max)(0.0f, m_frame.size.width - width - 10.0f);
+  float top = this->val_TopPadding + 10.0f;
+  return D2D1::RectF(left, top, left + width,
+                     top + OVERLAY_LINES * OVERLAY_LINE_HEIGHT + 10.0f);
+}
+
+void EditorBufferRenderer::DrawPerfOverlay() {
+  if (!m_overlayFormat) {
+    m_dwriteFactory->CreateTextFormat(
+        L"Consolas", NULL, DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STYLE_NORMAL,
+        DWRITE_FONT_STRETCH_NORMAL, 11.0f, L"en-us", &m_overlayFormat);
+    if (!m_overlayFormat)
+      return;
+  }
+
+  // Percentiles in milliseconds, one stage per line
+  char line[128];
+  snprintf(line, sizeof(line), "%-12s %7s %7s %7s %7s\n", "ms", "p50", "p95",
+           "p99", "last");
+  std::string report = line;
+  for (size_t i = 0; i < FrameProfiler::STAGE_COUNT; ++i) {
+    FrameProfiler::Stage stage = static_cast<FrameProfiler::Stage>(i);
+    FrameProfiler::Percentiles p =
+        FrameProfiler::Instance().GetPercentiles(stage);
+    snprintf(line, sizeof(line), "%-12s %7.2f %7.2f %7.2f %7.2f\n",
+             FrameProfiler::GetStageName(stage), p.p50 / 1000.0,
+             p.p95 / 1000.0, p.p99 / 1000.0, p.last / 1000.0);
+    report += line;
+  }
+  snprintf(line, sizeof(line), "layouts %zu hit %zu miss, %zu lines drawn",
+           m_layoutStats.hits, m_layoutStats.misses, m_repaintedLines);
+  report += line;
+  std::wstring text = Utf::ToWide(report);
+
+  D2D1_RECT_F rect = GetPerfOverlayRect();
+  m_bgBrush->SetOpacity(0.85f);
+  this->m_renderTarget->FillRectangle(rect, this->m_bgBrush.Get());
+  m_bgBrush->SetOpacity(1.0f);
+  this->m_renderTarget->DrawRectangle(rect, this->m_lnBrush.Get(), 1.0f);
+  this->m_renderTarget->DrawText(
+      text.c_str(), static_cast<UINT32>(text.length()), m_overlayFormat.Get(),
+      D2D1::RectF(rect.left + 5.0f, rect.top + 5.0f, rect.right - 5.0f,
+                  rect.bottom - 5.0f),
+      this->m_brush.Get());
+}
+
+void EditorBufferRenderer::DrawFrameLine(const FrameLine &line) {
+  for (const auto &rect : line.selection)
+    this->m_renderTarget->FillRectangle(rect, this->m_selBrush.Get());
+
+  if (line.layout) {
+    this->m_renderTarget->DrawTextLayout(
+        D2D1::Point2F(m_frame.xOffset, line.top), line.layout.Get(),
+        this->m_brush.Get());
+  }
+
+  if (line.number > 0) {
+    std::wstring lineNum = std::to_wstring(line.number);
+    D2D1_RECT_F lineRect = D2D1::RectF(0, line.top, m_frame.gutterWidth - 5,
+                                       line.top + m_frame.lineHeight);
+    this->m_renderTarget->DrawText(
+        lineNum.c_str(), static_cast<UINT32>(lineNum.length()),
+        this->m_textFormat.Get(), lineRect, this->m_lnBrush.Get());
   }
 
-  this->m_renderTarget->EndDraw();
+  // Draw Caret
+  if (line.hasCaret && m_frame.caretShown) {
+    const D2D1_RECT_F &rect = line.caret;
+    if (m_frame.caretStyle == CaretStyle::Block) {
+      m_caretBrush->SetOpacity(0.5f);
+      this->m_renderTarget->FillRectangle(rect, this->m_caretBrush.Get());
+      m_caretBrush->SetOpacity(1.0f);
+    } else if (m_frame.caretStyle == CaretStyle::Underline) {
+      this->m_renderTarget->DrawLine(D2D1::Point2F(rect.left, rect.bottom),
+                                     D2D1::Point2F(rect.right, rect.bottom),
+                                     this->m_caretBrush.Get(), 2.0f);
+    } else { // Line
+      this->m_renderTarget->DrawLine(D2D1::Point2F(rect.left, rect.top),
+                                     D2D1::Point2F(rect.left, rect.bottom),
+                                     this->m_caretBrush.Get(), 2.0f);
+    }
+  }
+}
+
+void EditorBufferRenderer::EndFrame() {
+  if (this->m_renderTarget->EndDraw() == D2DERR_RECREATE_TARGET) {
+    DiscardDeviceResources();
+    InvalidateRect(m_hwnd, NULL, FALSE);
+  }
+}
+
+const EditorBufferRenderer::FrameLine *
+EditorBufferRenderer::GetCaretLine() const {
+  if (!m_frame.valid)
+    return nullptr;
+  for (const auto &line : m_frame.lines) {
+    if (line.hasCaret)
+      return &line;
+  }
+  return nullptr;
+}
+
+RECT EditorBufferRenderer::ToPixels(float top, float bottom) const {
+  float dpiX = 96.0f, dpiY = 96.0f;
+  m_renderTarget->GetDpi(&dpiX, &dpiY);
+  RECT rc = {0, static_cast<LONG>(std::floor(top * dpiY / 96.0f)),
+             static_cast<LONG>(std::ceil(m_frame.size.width * dpiX / 96.0f)),
+             static_cast<LONG>(std::ceil(bottom * dpiY / 96.0f))};
+  return rc;
+}
+
+void EditorBufferRenderer::InvalidateCaret() {
+  // No caret row means the caret is scrolled out of view, or the frame is
+  // stale and a full paint is already pending; a blink has nothing to show
+  const FrameLine *line = GetCaretLine();
+  if (!line)
+    return;
+  RECT rc = ToPixels(line->top, line->bottom);
+  InvalidateRect(m_hwnd, &rc, FALSE);
+}
+
+bool EditorBufferRenderer::RedrawCaret(const RECT &dirty) {
+  const FrameLine *line = GetCaretLine();
+  if (!line || !m_renderTarget)
+    return false;
+  RECT rc = ToPixels(line->top, line->bottom);
+  if (dirty.left < rc.left || dirty.right > rc.right || dirty.top < rc.top ||
+      dirty.bottom > rc.bottom)
+    return false;
+
+  m_frame.caretShown = m_enableCaretBlinking ? m_bIsCaretVisibleVal : true;
+  m_repaintedLines = 1;
+  this->m_renderTarget->BeginDraw();
+  DrawRows(line->top, line->bottom);
+  EndFrame();
+  return true;
 }
@@ -0,0 +1,353 @@
+#include "../include/EncodingDetector.h"
+#include "../include/Utf.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <emmintrin.h> // SSE2
+
+namespace {
+
+// What the samples look like under each candidate encoding
+struct Stats {
+  size_t bytes = 0;
+  size_t high = 0;          // bytes >= 0x80
+  size_t zeros[2] = {0, 0}; // NULs at even / odd file offsets
+  size_t utf8Sequences = 0; // well-formed multi-byte sequences
+  size_t utf8Errors = 0;
+  size_t units = 0;             // UTF-16 code units
+  size_t plausible[2] = {0, 0}; // units in common scripts, LE / BE
+  size_t sjisPairs = 0;
+  size_t sjisHighTrails = 0; // pairs whose trail byte is >= 0x80
+  size_t sjisKana = 0;       // half-width katakana
+  size_t sjisErrors = 0;
+};
+
+inline int PopCount16(unsigned v) {
+  v = v - ((v >> 1) & 0x5555);
+  v = (v & 0x3333) + ((v >> 2) & 0x3333);
+  v = (v + (v >> 4)) & 0x0F0F;
+  return static_cast<int>((v + (v >> 8)) & 0x1F);
+}
+
+// Length of the ASCII run at s[i], counted in whole registers
+inline size_t AsciiRun(const unsigned char *s, size_t i, size_t length) {
+  return Utf::AsciiRun(reinterpret_cast<const char *>(s + i), length - i);
+}
+
+void CountBytes(const unsigned char *s, size_t length, uint64_t offset,
+                Stats &stats) {
+  size_t i = 0;
+  // Parity of s[0] within the file decides which mask bits are even
+  int first = static_cast<int>(offset & 1);
+#if defined(_MSC_VER) || defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= length; i += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(s + i));
+    unsigned zeros =
+        static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, zero)));
+    stats.zeros[first] += PopCount16(zeros & 0x5555);
+    stats.zeros[first ^ 1] += PopCount16(zeros & 0xAAAA);
+    stats.high += PopCount16(
+        static_cast<unsigned>(_mm_movemask_epi8(chunk)));
+  }
+#endif
+  for (; i < length; ++i) {
+    if (s[i] == 0)
+      ++stats.zeros[(first + i) & 1];
+    else if (s[i] >= 0x80)
+      ++stats.high;
+  }
+  stats.bytes += length;
+}
+
+// A sample that starts inside the file may start inside a sequence, and
+// one that ends inside it may end inside one; neither counts as an error.
+// Gives up past 'maxErrors'.
+void ScanUtf8(const unsigned char *s, size_t length, bool atStart,
+              bool atEnd, size_t maxErrors, Stats &stats) {
+  size_t i = 0;
+  if (!atStart) {
+    while (i < 3 && i < length && (s[i] & 0xC0) == 0x80)
+      ++i;
+  }
+  while (i < length && stats.utf8Errors <= maxErrors) {
+    unsigned char c = s[i];
+    if (c < 0x80) {
+      i += 1 + AsciiRun(s, i + 1, length);
+      continue;
+    }
+    size_t need;
+    unsigned char lo = 0x80, hi = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF) {
+      need = 1;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+      need = 2;
+      if (c == 0xE0)
+        lo = 0xA0; // overlong
+      else if (c == 0xED)
+        hi = 0x9F; // surrogates
+    } else if (c >= 0xF0 && c <= 0xF4) {
+      need = 3;
+      if (c == 0xF0)
+        lo = 0x90; // overlong
+      else if (c == 0xF4)
+        hi = 0x8F; // past U+10FFFF
+    } else {
+      ++stats.utf8Errors;
+      ++i;
+      continue;
+    }
+    if (i + need >= length && !atEnd)
+      break; // cut off by the end of the sample
+    size_t k = 1;
+    for (; k <= need && i + k < length; ++k) {
+      if (s[i + k] < lo || s[i + k] > hi)
+        break;
+      lo = 0x80;
+      hi = 0xBF;
+    }
+    if (k > need) {
+      ++stats.utf8Sequences;
+      i += need + 1;
+    } else {
+      ++stats.utf8Errors;
+      i += k;
+    }
+  }
+}
+
+// One bit per UTF-16 code unit: set for the scripts that make up nearly
+// all real text
+const uint8_t *CommonUnits() {
+  static const std::vector<uint8_t> bits = [] {
+    static const struct {
+      unsigned first, last;
+    } ranges[] = {
+        {0x09, 0x0A},     {0x0D, 0x0D},     {0x20, 0x7E},
+        {0xA0, 0x24F},    // Latin
+        {0x370, 0x52F},   // Greek, Cyrillic
+        {0x2000, 0x206F}, // punctuation
+        {0x3000, 0x30FF}, // CJK punctuation, kana
+        {0x4E00, 0x9FFF}, // CJK ideographs
+        {0xAC00, 0xD7A3}, // Hangul
+        {0xFF00, 0xFFEF}, // full- and half-width forms
+    };
+    std::vector<uint8_t> b(0x10000 / 8);
+    for (const auto &r : ranges) {
+      for (unsigned u = r.first; u <= r.last; ++u)
+        b[u >> 3] |= static_cast<uint8_t>(1 << (u & 7));
+    }
+    return b;
+  }();
+  return bits.data();
+}
+
+// Gives up once both byte orders have missed more than 'maxMisses' units
+void ScanUtf16(const unsigned char *s, size_t length, uint64_t offset,
+               size_t maxMisses, Stats &stats) {
+  const uint8_t *common = CommonUnits();
+  size_t i = offset & 1;
+  while (i + 1 < length) {
+    size_t stop = (std::min)(length - 1, i + 256);
+    for (; i < stop; i += 2) {
+      unsigned le = s[i] | (s[i + 1] << 8);
+      unsigned be = (s[i] << 8) | s[i + 1];
+      stats.plausible[0] += (common[le >> 3] >> (le & 7)) & 1;
+      stats.plausible[1] += (common[be >> 3] >> (be & 7)) & 1;
+      ++stats.units;
+    }
+    if (stats.units - stats.plausible[0] > maxMisses &&
+        stats.units - stats.plausible[1] > maxMisses)
+      return;
+  }
+}
+
+// Lead bytes of the double-byte characters of code page 932, leaving out
+// the unassigned and user-defined rows
+inline bool IsSjisLead(unsigned char c) {
+  return (c >= 0x81 && c <= 0x84) || (c >= 0x87 && c <= 0x9F) ||
+         (c >= 0xE0 && c <= 0xEF) || (c >= 0xFA && c <= 0xFC);
+}
+
+void ScanShiftJis(const unsigned char *s, size_t length, bool atStart,
+                  bool atEnd, Stats &stats) {
+  // Trail bytes overlap lead bytes and ASCII, so a sample inside the file
+  // starts after a byte below 0x40, which is never a trail byte
+  size_t i = 0;
+  if (!atStart) {
+    while (i < length && i < 64 && s[i] >= 0x40)
+      ++i;
+    i = i < length && i < 64 ? i + 1 : 0;
+  }
+  while (i < length) {
+    unsigned char c = s[i];
+    if (c < 0x80) {
+      i += 1 + AsciiRun(s, i + 1, length);
+    } else if (c >= 0xA1 && c <= 0xDF) {
+      ++stats.sjisKana;
+      ++i;
+    } else if (IsSjisLead(c)) {
+      if (i + 1 >= length) {
+        if (atEnd)
+          ++stats.sjisErrors;
+        break;
+      }
+      unsigned char t = s[i + 1];
+      if (t >= 0x40 && t <= 0xFC && t != 0x7F) {
+        ++stats.sjisPairs;
+        stats.sjisHighTrails += t >= 0x80;
+        i += 2;
+      } else {
+        ++stats.sjisErrors;
+        ++i;
+      }
+    } else {
+      ++stats.sjisErrors;
+      ++i;
+    }
+  }
+}
+
+} // namespace
+
+EncodingDetector::Result EncodingDetector::Detect(uint64_t size,
+                                                  const Reader &read) {
+  uint64_t offsets[SAMPLES];
+  size_t lengths[SAMPLES];
+  size_t count = PlanSamples(size, offsets, lengths);
+  std::vector<char> storage(SAMPLES * SAMPLE_BYTES);
+  Sample samples[SAMPLES];
+  for (size_t i = 0; i < count; ++i) {
+    samples[i].data = storage.data() + i * SAMPLE_BYTES;
+    samples[i].length =
+        read(offsets[i], storage.data() + i * SAMPLE_BYTES, lengths[i]);
+    samples[i].offset = offsets[i];
+  }
+
+  Result result = DetectBom(samples[0].data, count ? samples[0].length : 0);
+  if (result.bomLength == 0)
+    result.encoding = Score(samples, count, size);
+  return result;
+}
+
+EncodingDetector::Result EncodingDetector::Detect(const char *data,
+                                                  size_t size) {
+  uint64_t offsets[SAMPLES];
+  size_t lengths[SAMPLES];
+  size_t count = PlanSamples(size, offsets, lengths);
+  Sample samples[SAMPLES];
+  for (size_t i = 0; i < count; ++i) {
+    samples[i].data = data + offsets[i];
+    samples[i].length = lengths[i];
+    samples[i].offset = offsets[i];
+  }
+
+  Result result = DetectBom(data, size);
+  if (result.bomLength == 0)
+    result.encoding = Score(samples, count, size);
+  return result;
+}
+
+size_t EncodingDetector::PlanSamples(uint64_t size, uint64_t offsets[SAMPLES],
+                                     size_t lengths[SAMPLES]) {
+  if (size <= SAMPLES * SAMPLE_BYTES) {
+    offsets[0] = 0;
+    lengths[0] = static_cast<size_t>(size);
+    return size > 0 ? 1 : 0;
+  }
+  // Even offsets keep UTF-16 code units whole
+  offsets[0] = 0;
+  offsets[1] = (size / 2 - SAMPLE_BYTES / 2) & ~uint64_t(1);
+  offsets[2] = (size - SAMPLE_BYTES) & ~uint64_t(1);
+  for (size_t i = 0; i < SAMPLES; ++i)
+    lengths[i] = SAMPLE_BYTES;
+  return SAMPLES;
+}
+
+EncodingDetector::Result EncodingDetector::DetectBom(const char *head,
+                                                     size_t length) {
+  const unsigned char *bom = reinterpret_cast<const unsigned char *>(head);
+  Result result;
+  if (length >= 2 && bom[0] == 0xFF && bom[1] == 0xFE) {
+    result.encoding = Encoding::UTF16LE;
+    result.bomLength = 2;
+  } else if (length >= 2 && bom[0] == 0xFE && bom[1] == 0xFF) {
+    result.encoding = Encoding::UTF16BE;
+    result.bomLength = 2;
+  } else if (length >= 3 && bom[0] == 0xEF && bom[1] == 0xBB &&
+             bom[2] == 0xBF) {
+    result.bomLength = 3; // UTF8 with BOM
+  }
+  return result;
+}
+
+Encoding EncodingDetector::Score(const Sample *samples, size_t count,
+                                 uint64_t size) {
+  Stats stats;
+  for (size_t i = 0; i < count; ++i) {
+    const unsigned char *s =
+        reinterpret_cast<const unsigned char *>(samples[i].data);
+    CountBytes(s, samples[i].length, samples[i].offset, stats);
+  }
+  if (stats.bytes == 0)
+    return Encoding::UTF8;
+
+  // UTF-16 holding ASCII or Latin text: a NUL in every other byte
+  size_t zeros = stats.zeros[0] + stats.zeros[1];
+  if (zeros >= stats.bytes / 32 && zeros > 0) {
+    if (stats.zeros[1] > 4 * stats.zeros[0])
+      return Encoding::UTF16LE; // high bytes at odd offsets
+    if (stats.zeros[0] > 4 * stats.zeros[1])
+      return Encoding::UTF16BE;
+  }
+  if (stats.high == 0)
+    return Encoding::UTF8; // ASCII
+
+  for (size_t i = 0; i < count; ++i) {
+    const unsigned char *s =
+        reinterpret_cast<const unsigned char *>(samples[i].data);
+    bool atEnd = samples[i].offset + samples[i].length >= size;
+    // Past this many errors not even a sequence every two bytes would do
+    ScanUtf8(s, samples[i].length, samples[i].offset == 0, atEnd,
+             stats.bytes / 200, stats);
+  }
+  // A stray bad byte in real UTF-8 text should not switch code pages
+  if (stats.utf8Sequences > 0 &&
+      stats.utf8Errors * 100 <= stats.utf8Sequences)
+    return Encoding::UTF8;
+
+  // UTF-16 without NULs, such as CJK text: nearly every code unit lands in
+  // a common script read one way round, and far fewer the other
+  for (size_t i = 0; i < count; ++i) {
+    const unsigned char *s =
+        reinterpret_cast<const unsigned char *>(samples[i].data);
+    ScanUtf16(s, samples[i].length, samples[i].offset, stats.bytes / 20,
+              stats);
+  }
+  if (stats.units >= 16) {
+    size_t le = stats.plausible[0], be = stats.plausible[1];
+    if (le * 10 >= stats.units * 9 && le > be &&
+        (le - be) * 5 >= stats.units)
+      return Encoding::UTF16LE;
+    if (be * 10 >= stats.units * 9 && be > le &&
+        (be - le) * 5 >= stats.units)
+      return Encoding::UTF16BE;
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    const unsigned char *s =
+        reinterpret_cast<const unsigned char *>(samples[i].data);
+    bool atEnd = samples[i].offset + samples[i].length >= size;
+    ScanShiftJis(s, samples[i].length, samples[i].offset == 0, atEnd, stats);
+  }
+  // Japanese text is mostly double-byte, and many of its trail bytes are
+  // high (every hiragana); a Latin code page gives isolated high bytes
+  // followed by ASCII
+  size_t characters = stats.sjisPairs + stats.sjisKana;
+  if (stats.sjisPairs > 0 && stats.sjisErrors * 100 <= characters &&
+      stats.sjisHighTrails * 4 >= stats.sjisPairs &&
+      stats.sjisPairs >= stats.sjisKana)
+    return Encoding::ShiftJIS;
+
+  return Encoding::ANSI;
+}
@@ -0,0 +1,524 @@
+#include "../include/FileSearch.h"
+#include "../include/MemoryMappedFile.h"
+#include "../include/PieceTable.h"
+#include "../include/RegexSearch.h"
+#include "../include/TextSearch.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+// Large files are searched in blocks of this size so Cancel takes effect
+// quickly even when a file has no matches
+static const size_t SCAN_BLOCK = 4 * 1024 * 1024;
+// Smaller files are read into a reused buffer; setting up and tearing down a
+// mapping costs more than copying a few pages
+static const size_t MAP_MIN_BYTES = 256 * 1024;
+
+// Rules from the ignore files of one directory, chained to those of its
+// parent directories
+struct FileSearch::IgnoreList {
+  struct Rule {
+    std::string glob;
+    bool negate = false;        // "!pattern" re-includes
+    bool directoryOnly = false; // "pattern/"
+    bool anchored = false;      // contains a '/', so matches the whole path
+  };
+  std::shared_ptr<const IgnoreList> parent;
+  std::string base; // directory holding the ignore files, relative to the root
+  std::vector<Rule> rules;
+
+  void Load(const fs::path &file);
+  // 1 if ignored, 0 if re-included, -1 if no rule applies
+  int Match(const std::string &relative, bool directory) const;
+};
+
+struct FileSearch::Task {
+  fs::path path;
+  std::string relative; // '/'-separated path from the root, UTF-8
+  bool directory = false;
+  std::shared_ptr<const IgnoreList> ignore;
+};
+
+struct FileSearch::Worker {
+  std::mutex mutex; // guards 'tasks', which other workers steal from
+  std::deque<Task> tasks;
+  std::string output; // result lines not yet delivered
+  std::vector<FileSearchMatch> matches; // the same, for m_matchCb
+  size_t batchBytes = 0; // path and text bytes not yet delivered
+  std::vector<char> buffer; // contents of the current small file
+  std::chrono::steady_clock::time_point lastDelivery =
+      std::chrono::steady_clock::now();
+};
+
+struct FileSearch::Matcher {
+  std::unique_ptr<TextSearcher> text;
+  std::shared_ptr<const RegexSearcher> regex;
+};
+
+// ----------------------------------------------------------------------------
+// Globs and ignore files
+// ----------------------------------------------------------------------------
+
+static char FoldCase(char c) {
+  return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+// Matches a [...] class at 'g' against 'c'. Returns the position after the
+// class, or nullptr if the class is not closed.
+static const char *MatchClass(const char *g, const char *ge, char c,
+                              bool &matched) {
+  ++g; // '['
+  bool negate = g < ge && (*g == '!' || *g == '^');
+  if (negate)
+    ++g;
+  matched = false;
+  bool first = true;
+  while (g < ge && (*g != ']' || first)) {
+    first = false;
+    char lo = *g++;
+    char hi = lo;
+    if (g + 1 < ge && *g == '-' && g[1] != ']') {
+      hi = g[1];
+      g += 2;
+    }
+    char f = FoldCase(c);
+    if ((c >= lo && c <= hi) || (f >= FoldCase(lo) && f <= FoldCase(hi)))
+      matched = true;
+  }
+  if (g == ge)
+    return nullptr;
+  matched = matched != negate;
+  return g + 1;
+}
+
+static bool GlobMatchAt(const char *g, const char *ge, const char *s,
+                        const char *se) {
+  while (g < ge) {
+    char c = *g;
+    if (c == '*') {
+      if (g + 1 < ge && g[1] == '*') {
+        g += 2;
+        if (g < ge && *g == '/') {
+          // "**/" matches zero or more whole directories
+          ++g;
+          for (const char *t = s;;) {
+            if (GlobMatchAt(g, ge, t, se))
+              return true;
+            const char *slash =
+                static_cast<const char *>(memchr(t, '/', se - t));
+            if (!slash)
+              return false;
+            t = slash + 1;
+          }
+        }
+        for (const char *t = s; t <= se; ++t)
+          if (GlobMatchAt(g, ge, t, se))
+            return true;
+        return false;
+      }
+      ++g;
+      for (const char *t = s;; ++t) {
+        if (GlobMatchAt(g, ge, t, se))
+          return true;
+        if (t == se || *t == '/')
+          return false;
+      }
+    }
+    if (s == se)
+      return false;
+    if (c == '?') {
+      if (*s == '/')
+        return false;
+      ++g;
+      ++s;
+      continue;
+    }
+    if (c == '[') {
+      bool matched;
+      const char *next = MatchClass(g, ge, *s, matched);
+      if (next) {
+        if (!matched || *s == '/')
+          return false;
+        g = next;
+        ++s;
+        continue;
+      }
+      // An unclosed '[' is literal
+    }
+    if (c == '\\' && g + 1 < ge)
+      c = *++g;
+    if (FoldCase(c) != FoldCase(*s))
+      return false;
+    ++g;
+    ++s;
+  }
+  return s == se;
+}
+
+bool FileSearch::GlobMatch(const std::string &glob, const std::string &path) {
+  return GlobMatchAt(glob.data(), glob.data() + glob.size(), path.data(),
+                     path.data() + path.size());
+}
+
+// A glob without a '/' is matched against the last path component
+static bool MatchesPath(const std::string &glob, bool anchored,
+                        const std::string &path) {
+  if (anchored)
+    return FileSearch::GlobMatch(glob, path);
+  size_t slash = path.rfind('/');
+  return FileSearch::GlobMatch(
+      glob, slash == std::string::npos ? path : path.substr(slash + 1));
+}
+
+void FileSearch::IgnoreList::Load(const fs::path &file) {
+  std::ifstream in(file, std::ios::binary);
+  std::string line;
+  while (std::getline(in, line)) {
+    while (!line.empty() && (line.back() == '\r' || line.back() == ' ' ||
+                             line.back() == '\t'))
+      line.pop_back();
+    if (line.empty() || line[0] == '#')
+      continue;
+    Rule rule;
+    size_t start = 0;
+    if (line[0] == '!') {
+      rule.negate = true;
+      start = 1;
+    } else if (line[0] == '\\' && line.size() > 1 &&
+               (line[1] == '#' || line[1] == '!')) {
+      start = 1;
+    }
+    rule.glob = line.substr(start);
+    if (!rule.glob.empty() && rule.glob.back() == '/') {
+      rule.directoryOnly = true;
+      rule.glob.pop_back();
+    }
+    if (!rule.glob.empty() && rule.glob[0] == '/') {
+      rule.anchored = true;
+      rule.glob.erase(0, 1);
+    }
+    if (rule.glob.find('/') != std::string::npos)
+      rule.anchored = true;
+    if (!rule.glob.empty())
+      rules.push_back(std::move(rule));
+  }
+}
+
+int FileSearch::IgnoreList::Match(const std::string &relative,
+                                  bool directory) const {
+  // The last matching rule wins, and deeper ignore files override outer ones
+  for (const IgnoreList *list = this; list; list = list->parent.get()) {
+    if (list->rules.empty())
+      continue;
+    std::string sub = list->base.empty()
+                          ? relative
+                          : relative.substr(list->base.size() + 1);
+    for (auto it = list->rules.rbegin(); it != list->rules.rend(); ++it) {
+      if (it->directoryOnly && !directory)
+        continue;
+      if (MatchesPath(it->glob, it->anchored, sub))
+        return it->negate ? 0 : 1;
+    }
+  }
+  return -1;
+}
+
+// ----------------------------------------------------------------------------
+// FileSearch
+// ----------------------------------------------------------------------------
+
+FileSearch::FileSearch(const std::wstring &root, const std::string &pattern,
+                       const SearchOptions &options)
+    : m_root(root), m_pattern(pattern), m_options(options),
+      m_matcher(new Matcher()) {
+  if (m_pattern.empty())
+    return;
+  if (m_options.useRegex)
+    m_matcher->regex = RegexSearcher::Get(m_pattern, m_options.matchCase);
+  else
+    m_matcher->text.reset(new TextSearcher(m_pattern, m_options.matchCase));
+}
+
+FileSearch::~FileSearch() {}
+
+size_t FileSearch::Run() {
+  std::error_code ec;
+  if ((!m_matcher->text && !m_matcher->regex) || !fs::is_directory(m_root, ec))
+    return 0;
+
+  size_t threads = m_threadCount;
+  if (threads == 0)
+    threads = (std::max)(1u, std::thread::hardware_concurrency());
+  m_workers.clear();
+  for (size_t i = 0; i < threads; ++i)
+    m_workers.emplace_back(new Worker());
+
+  Task root;
+  root.path = fs::path(m_root);
+  root.directory = true;
+  Push(0, std::move(root));
+
+  // The calling thread is worker 0
+  std::vector<std::thread> pool;
+  for (size_t i = 1; i < threads; ++i)
+    pool.emplace_back(&FileSearch::WorkerLoop, this, i);
+  WorkerLoop(0);
+  for (std::thread &t : pool)
+    t.join();
+  return m_matchingLines;
+}
+
+void FileSearch::WorkerLoop(size_t index) {
+  Worker &worker = *m_workers[index];
+  Task task;
+  while (!m_cancelled) {
+    if (!TakeTask(index, task)) {
+      // Tasks are counted before they are queued, so zero means the walk
+      // is complete rather than that another worker is about to push more
+      if (m_pending == 0)
+        break;
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      continue;
+    }
+    if (task.directory) {
+      ScanDirectory(index, task);
+    } else {
+      ScanFile(worker, task);
+      m_filesScanned++;
+    }
+    m_pending--;
+    Deliver(worker, false);
+  }
+  Deliver(worker, true);
+}
+
+bool FileSearch::TakeTask(size_t index, Task &task) {
+  // Newest task from our own deque (depth first, warm directory entries)...
+  {
+    Worker &own = *m_workers[index];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      return true;
+    }
+  }
+  // ...otherwise the oldest task of another worker, usually a directory
+  // high up in the tree that expands into plenty of work
+  for (size_t k = 1; k < m_workers.size(); ++k) {
+    Worker &victim = *m_workers[(index + k) % m_workers.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void FileSearch::Push(size_t index, Task task) {
+  m_pending++;
+  Worker &worker = *m_workers[index];
+  std::lock_guard<std::mutex> lock(worker.mutex);
+  worker.tasks.push_back(std::move(task));
+}
+
+void FileSearch::ScanDirectory(size_t index, const Task &task) {
+  // Entries are listed before any is queued so that the ignore files of the
+  // directory apply to all of them
+  struct Entry {
+    fs::path path;
+    std::string name;
+    bool directory;
+  };
+  std::vector<Entry> entries;
+  bool hasIgnoreFile = false;
+  std::error_code ec;
+  fs::directory_iterator it(task.path,
+                            fs::directory_options::skip_permission_denied, ec);
+  for (fs::directory_iterator end; !ec && it != end; it.increment(ec)) {
+    if (m_cancelled)
+      return;
+    const fs::directory_entry &entry = *it;
+    std::error_code statEc;
+    Entry e;
+    // Like recursive_directory_iterator, directory symlinks are not followed
+    if (entry.is_directory(statEc) && !entry.is_symlink(statEc))
+      e.directory = true;
+    else if (entry.is_regular_file(statEc))
+      e.directory = false;
+    else
+      continue;
+    if (!m_filter.maxFileSize || e.directory ||
+        entry.file_size(statEc) <= m_filter.maxFileSize) {
+      e.path = entry.path();
+      e.name = e.path.filename().u8string();
+      if (m_filter.useIgnoreFiles) {
+        if (e.directory && (e.name == ".git" || e.name == ".hg" ||
+                            e.name == ".svn"))
+          continue;
+        if (!e.directory && (e.name == ".gitignore" || e.name == ".ecodeignore"))
+          hasIgnoreFile = true;
+      }
+      entries.push_back(std::move(e));
+    }
+  }
+
+  std::shared_ptr<const IgnoreList> ignore = task.ignore;
+  if (hasIgnoreFile) {
+    auto list = std::make_shared<IgnoreList>();
+    list->parent = task.ignore;
+    list->base = task.relative;
+    list->Load(task.path / ".gitignore");
+    list->Load(task.path / ".ecodeignore");
+    ignore = list;
+  }
+
+  for (Entry &e : entries) {
+    Task child;
+    child.relative =
+        task.relative.empty() ? e.name : task.relative + '/' + e.name;
+    if (ignore && ignore->Match(child.relative, e.directory) == 1)
+      continue;
+    if (Excluded(child.relative, e.directory))
+      continue;
+    child.path = std::move(e.path);
+    child.directory = e.directory;
+    if (e.directory)
+      child.ignore = ignore;
+    else
+      m_filesFound++;
+    Push(index, std::move(child));
+  }
+}
+
+bool FileSearch::Excluded(const std::string &relative, bool directory) const {
+  for (const std::string &glob : m_filter.exclude)
+    if (MatchesPath(glob, glob.find('/') != std::string::npos, relative))
+      return true;
+  if (directory || m_filter.include.empty())
+    return false;
+  for (const std::string &glob : m_filter.include)
+    if (MatchesPath(glob, glob.find('/') != std::string::npos, relative))
+      return false;
+  return true;
+}
+
+void FileSearch::ScanFile(Worker &worker, const Task &task) {
+  std::error_code ec;
+  uintmax_t fileSize = fs::file_size(task.path, ec);
+  if (ec || fileSize == 0)
+    return;
+  MemoryMappedFile file;
+  const char *data;
+  size_t size;
+  if (fileSize < MAP_MIN_BYTES) {
+    std::ifstream in(task.path, std::ios::binary);
+    worker.buffer.resize(static_cast<size_t>(fileSize));
+    if (!in.read(worker.buffer.data(), worker.buffer.size()) &&
+        in.gcount() == 0)
+      return;
+    data = worker.buffer.data();
+    size = static_cast<size_t>(in.gcount());
+  } else {
+    if (!file.Open(task.path.wstring()) || file.GetSize() == 0 ||
+        !file.GetData())
+      return;
+    data = file.GetData();
+    size = file.GetSize();
+  }
+  if (m_filter.skipBinary &&
+      memchr(data, 0, (std::min)(size, BINARY_SNIFF_BYTES)))
+    return;
+
+  // The regex engine reads through a piece table; over an unedited mapping
+  // that is a single piece, so nothing is copied
+  PieceTable table;
+  if (m_matcher->regex)
+    table.LoadOriginal(data, size);
+
+  std::string name;
+  size_t line = 1;    // line number at 'counted'
+  size_t counted = 0; // newlines before this offset are in 'line'
+  size_t pos = 0;
+  while (pos < size && !m_cancelled) {
+    size_t blockEnd = (std::min)(size, pos + SCAN_BLOCK);
+    size_t found;
+    if (m_matcher->text) {
+      // A match starting in the block may end past it
+      size_t length =
+          (std::min)(size, blockEnd + m_matcher->text->Length() - 1) - pos;
+      found = m_matcher->text->FindFirst(data + pos, length);
+      if (found != std::string::npos)
+        found += pos;
+    } else {
+      found = m_matcher->regex->FindForward(table, pos, nullptr, blockEnd - 1);
+    }
+    if (found == std::string::npos) {
+      pos = blockEnd;
+      continue;
+    }
+
+    // Report the whole line once, then continue on the next line
+    line += std::count(data + counted, data + found, '\n');
+    size_t lineStart = found;
+    while (lineStart > counted && data[lineStart - 1] != '\n')
+      --lineStart;
+    const char *newline = static_cast<const char *>(
+        memchr(data + found, '\n', size - found));
+    size_t lineEnd = newline ? newline - data : size;
+    size_t textEnd = lineEnd;
+    if (textEnd > lineStart && data[textEnd - 1] == '\r')
+      --textEnd;
+
+    if (name.empty())
+      name = task.path.u8string();
+    if (m_resultCb) {
+      worker.output += name;
+      worker.output += '(';
+      worker.output += std::to_string(line);
+      worker.output += "): ";
+      worker.output.append(data + lineStart, textEnd - lineStart);
+      worker.output += '\n';
+    }
+    if (m_matchCb) {
+      FileSearchMatch match;
+      match.path = name;
+      match.line = line;
+      match.text.assign(data + lineStart, textEnd - lineStart);
+      worker.matches.push_back(std::move(match));
+    }
+    worker.batchBytes += name.size() + (textEnd - lineStart);
+    m_matchingLines++;
+
+    counted = lineEnd;
+    pos = lineEnd + 1;
+  }
+}
+
+void FileSearch::Deliver(Worker &worker, bool force) {
+  auto now = std::chrono::steady_clock::now();
+  if (!force && worker.batchBytes < BATCH_BYTES &&
+      now - worker.lastDelivery <
+          std::chrono::milliseconds(BATCH_INTERVAL_MS))
+    return;
+  worker.lastDelivery = now;
+
+  std::lock_guard<std::mutex> lock(m_deliverMutex);
+  if (!worker.output.empty() && m_resultCb)
+    m_resultCb(worker.output);
+  if (!worker.matches.empty() && m_matchCb)
+    m_matchCb(worker.matches);
+  worker.output.clear();
+  worker.matches.clear();
+  worker.batchBytes = 0;
+  if (m_progressCb)
+    m_progressCb(m_filesScanned, m_filesFound);
+}
@@ -0,0 +1,258 @@
+#include "../include/FileWriter.h"
+#include "../include/MemoryMappedFile.h"
+#include <algorithm>
+#include <cstring>
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+// Buffer alignment: a page, and a sector on every disk
+static const size_t BUFFER_ALIGNMENT = 4096;
+// Largest single write request (WriteFile takes a DWORD)
+static const size_t MAX_WRITE = 1024 * 1024 * 1024;
+
+FileWriter::FileWriter() {
+  m_storage.resize(BUFFER_SIZE + BUFFER_ALIGNMENT);
+  size_t misalign =
+      reinterpret_cast<uintptr_t>(m_storage.data()) % BUFFER_ALIGNMENT;
+  m_buffer = m_storage.data() + (misalign ? BUFFER_ALIGNMENT - misalign : 0);
+}
+
+FileWriter::~FileWriter() {
+  CloseFile();
+  if (!m_committed && !m_tempPath.empty()) {
+#ifdef _WIN32
+    DeleteFileW(m_tempPath.c_str());
+#else
+    std::error_code ec;
+    std::filesystem::remove(m_tempPath, ec);
+#endif
+  }
+}
+
+bool FileWriter::Write(const char *data, size_t length) {
+  if (m_failed)
+    return false;
+  m_written += length;
+  while (length > 0) {
+    if (m_used == 0 && length >= BUFFER_SIZE) {
+      // Whole blocks go out straight from the caller's memory
+      size_t direct = length / BUFFER_SIZE * BUFFER_SIZE;
+      if (!WriteOut(data, direct))
+        return false;
+      data += direct;
+      length -= direct;
+      continue;
+    }
+    size_t n = (std::min)(BUFFER_SIZE - m_used, length);
+    memcpy(m_buffer + m_used, data, n);
+    m_used += n;
+    data += n;
+    length -= n;
+    if (m_used == BUFFER_SIZE && !Flush())
+      return false;
+  }
+  return true;
+}
+
+bool FileWriter::Flush() {
+  if (m_used == 0)
+    return !m_failed;
+  size_t used = m_used;
+  m_used = 0;
+  return WriteOut(m_buffer, used);
+}
+
+bool FileWriter::Fail(const std::string &error) {
+  if (!m_failed)
+    m_error = error;
+  m_failed = true;
+  return false;
+}
+
+#ifdef _WIN32
+
+bool FileWriter::Open(const std::wstring &targetPath) {
+  m_targetPath = targetPath;
+  m_tempPath = targetPath + L".tmp";
+  m_file = CreateFileW(m_tempPath.c_str(), GENERIC_WRITE, 0, NULL,
+                       CREATE_ALWAYS,
+                       FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (m_file == INVALID_HANDLE_VALUE) {
+    m_tempPath.clear();
+    return Fail("CreateFileW failed: error " + std::to_string(GetLastError()));
+  }
+  return true;
+}
+
+bool FileWriter::WriteOut(const char *data, size_t length) {
+  while (length > 0) {
+    DWORD n = static_cast<DWORD>((std::min)(length, MAX_WRITE));
+    DWORD written = 0;
+    ++m_calls;
+    if (!WriteFile(m_file, data, n, &written, NULL) || written == 0)
+      return Fail("WriteFile failed: error " + std::to_string(GetLastError()));
+    data += written;
+    length -= written;
+  }
+  return true;
+}
+
+bool FileWriter::CopyFrom(const MemoryMappedFile &, uint64_t, size_t) {
+  // No kernel copy between arbitrary handles; the mapped bytes go through
+  // the write buffer instead
+  return m_failed;
+}
+
+void FileWriter::CloseFile() {
+  if (m_file != INVALID_HANDLE_VALUE) {
+    CloseHandle(m_file);
+    m_file = INVALID_HANDLE_VALUE;
+  }
+}
+
+bool FileWriter::Commit() {
+  Flush();
+  CloseFile();
+  if (m_failed)
+    return false;
+
+  // Atomic-ish rename
+  if (!ReplaceFileW(m_targetPath.c_str(), m_tempPath.c_str(), NULL,
+                    REPLACEFILE_IGNORE_MERGE_ERRORS, NULL, NULL)) {
+    DWORD err = GetLastError();
+    // Fallback for new files
+    if (err != ERROR_FILE_NOT_FOUND)
+      return Fail("ReplaceFileW failed: error " + std::to_string(err));
+    if (!MoveFileExW(m_tempPath.c_str(), m_targetPath.c_str(),
+                     MOVEFILE_REPLACE_EXISTING))
+      return Fail("MoveFileExW failed: error " +
+                  std::to_string(GetLastError()));
+  }
+  m_committed = true;
+  return true;
+}
+
+#else // POSIX
+
+static std::string ErrorText(const char *call) {
+  return std::string(call) + " failed: " + strerror(errno);
+}
+
+bool FileWriter::Open(const std::wstring &targetPath) {
+  m_targetPath = targetPath;
+  m_tempPath = targetPath + L".tmp";
+  std::string temp = std::filesystem::path(m_tempPath).string();
+  m_fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (m_fd < 0) {
+    m_tempPath.clear();
+    return Fail(ErrorText("open"));
+  }
+  // A replaced file keeps its permissions
+  struct stat st;
+  std::string target = std::filesystem::path(targetPath).string();
+  if (stat(target.c_str(), &st) == 0)
+    fchmod(m_fd, st.st_mode & 07777);
+  return true;
+}
+
+bool FileWriter::WriteOut(const char *data, size_t length) {
+  while (length > 0) {
+    ++m_calls;
+    ssize_t n = ::write(m_fd, data, (std::min)(length, MAX_WRITE));
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return Fail(ErrorText("write"));
+    }
+    data += n;
+    length -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+bool FileWriter::CopyFrom(const MemoryMappedFile &file, uint64_t offset,
+                          size_t length) {
+  if (m_failed)
+    return true; // nothing more is written either way
+  int in = file.GetDescriptor();
+  if (m_copyUnsupported || length < MIN_COPY_BYTES || in < 0)
+    return false;
+#ifdef __linux__
+  // Copies land at the file position, so the buffer goes first
+  if (!Flush())
+    return true;
+  // copy_file_range shares extents or copies in the page cache; sendfile
+  // covers kernels and file systems without it
+  bool useSendfile = false;
+  size_t done = 0;
+  while (done < length) {
+    ssize_t n;
+    ++m_calls;
+    if (useSendfile) {
+      off_t pos = static_cast<off_t>(offset + done);
+      n = sendfile(m_fd, in, &pos, length - done);
+    } else {
+      loff_t pos = static_cast<loff_t>(offset + done);
+      n = copy_file_range(in, &pos, m_fd, nullptr, length - done, 0);
+    }
+    if (n > 0) {
+      done += static_cast<size_t>(n);
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && done == 0 && !useSendfile &&
+        (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+         errno == EOPNOTSUPP || errno == EPERM)) {
+      useSendfile = true;
+      continue;
+    }
+    if (n < 0 && done == 0 && (errno == ENOSYS || errno == EINVAL)) {
+      m_copyUnsupported = true;
+      return false;
+    }
+    Fail(n == 0 ? std::string("copy source ended early")
+                : ErrorText(useSendfile ? "sendfile" : "copy_file_range"));
+    return true;
+  }
+  m_written += length;
+  m_copied += length;
+  return true;
+#else
+  (void)offset;
+  return false;
+#endif
+}
+
+void FileWriter::CloseFile() {
+  if (m_fd >= 0) {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+}
+
+bool FileWriter::Commit() {
+  Flush();
+  if (m_fd >= 0 && ::close(m_fd) != 0)
+    Fail(ErrorText("close"));
+  m_fd = -1;
+  if (m_failed)
+    return false;
+
+  std::string temp = std::filesystem::path(m_tempPath).string();
+  std::string target = std::filesystem::path(m_targetPath).string();
+  if (::rename(temp.c_str(), target.c_str()) != 0)
+    return Fail(ErrorText("rename"));
+  m_committed = true;
+  return true;
+}
+
+#endif
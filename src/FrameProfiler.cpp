@@ -0,0 +1,75 @@
+#include "../include/FrameProfiler.h"
+#include <algorithm>
+#include <cmath>
+
+FrameProfiler &FrameProfiler::Instance() {
+  static FrameProfiler instance;
+  return instance;
+}
+
+FrameProfiler::FrameProfiler() {
+  for (auto &stage : m_stages)
+    stage.ring.reserve(WINDOW);
+}
+
+const char *FrameProfiler::GetStageName(Stage stage) {
+  switch (stage) {
+  case Stage::Frame:
+    return "frame";
+  case Stage::Buffer:
+    return "buffer";
+  case Stage::Highlights:
+    return "highlights";
+  case Stage::Layout:
+    return "layout";
+  case Stage::Draw:
+    return "draw";
+  }
+  return "";
+}
+
+void FrameProfiler::Scope::Stop() {
+  if (!m_running)
+    return;
+  m_running = false;
+  std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - m_start;
+  FrameProfiler::Instance().Record(m_stage, elapsed.count());
+}
+
+void FrameProfiler::Record(Stage stage, double microseconds) {
+  Samples &samples = m_stages[static_cast<size_t>(stage)];
+  if (samples.ring.size() < WINDOW)
+    samples.ring.push_back(microseconds);
+  else
+    samples.ring[samples.next] = microseconds;
+  samples.next = (samples.next + 1) % WINDOW;
+}
+
+FrameProfiler::Percentiles FrameProfiler::GetPercentiles(Stage stage) const {
+  const Samples &samples = m_stages[static_cast<size_t>(stage)];
+  Percentiles result;
+  result.samples = samples.ring.size();
+  if (samples.ring.empty())
+    return result;
+
+  result.last = samples.ring[(samples.next + WINDOW - 1) % WINDOW];
+  std::vector<double> sorted = samples.ring;
+  std::sort(sorted.begin(), sorted.end());
+  // Nearest rank
+  auto rank = [&sorted](double p) {
+    size_t index = static_cast<size_t>(std::ceil(p * sorted.size()));
+    return sorted[(std::max)(index, (size_t)1) - 1];
+  };
+  result.p50 = rank(0.50);
+  result.p95 = rank(0.95);
+  result.p99 = rank(0.99);
+  return result;
+}
+
+void FrameProfiler::Reset() {
+  for (auto &stage : m_stages) {
+    stage.ring.clear();
+    stage.next = 0;
+  }
+}
@@ -37,10 +37,12 @@ namespace fs = std::filesystem;
 #include "../include/Dialogs.h"
 #include "../include/Editor.h"
 #include "../include/EditorBufferRenderer.h"
+#include "../include/FrameProfiler.h"
 #include "../include/Localization.h"
 #include "../include/LspClient.h"
 #include "../include/ScriptEngine.h"
 #include "../include/SettingsManager.h"
+#include "../include/Utf.h"
 
 // Forward declarations
 class Buffer;
@@ -134,6 +136,9 @@ void HandleDestroy(HWND hwnd);
 #define IDM_HELP_KEYBINDINGS 804
 
 #define WM_SHELL_OUTPUT (WM_USER + 101)
+#define WM_FIND_RESULTS (WM_USER + 102) // wParam: FindResultsBatch *
+#define WM_BUFFER_INDEXED (WM_USER + 103) // wParam: Buffer *
+#define WM_BUFFER_SAVED (WM_USER + 104)   // wParam: Buffer *
 
 struct ShellOutput {
   Buffer *buffer;
@@ -173,23 +178,13 @@ extern WNDPROC g_oldMinibufferProc;
 inline std::string WStringToString(const std::wstring &ws) {
   if (ws.empty())
     return "";
-  int size_needed = WideCharToMultiByte(CP_UTF8, 0, &ws[0], (int)ws.size(),
-                                        NULL, 0, NULL, NULL);
-  std::string strTo(size_needed, 0);
-  WideCharToMultiByte(CP_UTF8, 0, &ws[0], (int)ws.size(), &strTo[0],
-                      size_needed, NULL, NULL);
-  return strTo;
+  return Utf::FromWide(ws);
 }
 
 inline std::wstring StringToWString(const std::string &s) {
   if (s.empty())
     return L"";
-  int size_needed =
-      MultiByteToWideChar(CP_UTF8, 0, &s[0], (int)s.size(), NULL, 0);
-  std::wstring wstrTo(size_needed, 0);
-  MultiByteToWideChar(CP_UTF8, 0, &s[0], (int)s.size(), &wstrTo[0],
-                      size_needed);
-  return wstrTo;
+  return Utf::ToWide(s);
 }
 
 inline std::string GetWin32ErrorString(DWORD errorCode) {
@@ -53,6 +53,56 @@ static duk_ret_t js_editor_show_physical_line_numbers(duk_context *ctx) {
   return 1;
 }
 
+static duk_ret_t js_editor_show_perf_overlay(duk_context *ctx) {
+  bool show = duk_get_boolean(ctx, 0);
+  if (g_renderer) {
+    bool old = g_renderer->SetShowPerfOverlay(show);
+    InvalidateRect(g_mainHwnd, NULL, FALSE);
+    duk_push_boolean(ctx, old);
+    return 1;
+  }
+  duk_push_boolean(ctx, false);
+  return 1;
+}
+
+static duk_ret_t js_editor_get_perf_stats(duk_context *ctx) {
+  duk_push_object(ctx);
+  for (size_t i = 0; i < FrameProfiler::STAGE_COUNT; ++i) {
+    FrameProfiler::Stage stage = static_cast<FrameProfiler::Stage>(i);
+    FrameProfiler::Percentiles p =
+        FrameProfiler::Instance().GetPercentiles(stage);
+    duk_push_object(ctx);
+    duk_push_number(ctx, p.p50 / 1000.0);
+    duk_put_prop_string(ctx, -2, "p50");
+    duk_push_number(ctx, p.p95 / 1000.0);
+    duk_put_prop_string(ctx, -2, "p95");
+    duk_push_number(ctx, p.p99 / 1000.0);
+    duk_put_prop_string(ctx, -2, "p99");
+    duk_push_number(ctx, p.last / 1000.0);
+    duk_put_prop_string(ctx, -2, "last");
+    duk_push_number(ctx, (double)p.samples);
+    duk_put_prop_string(ctx, -2, "samples");
+    duk_put_prop_string(ctx, -2, FrameProfiler::GetStageName(stage));
+  }
+
+  if (g_renderer) {
+    EditorBufferRenderer::LayoutCacheStats cache =
+        g_renderer->GetLayoutCacheStats();
+    duk_push_object(ctx);
+    duk_push_number(ctx, (double)cache.hits);
+    duk_put_prop_string(ctx, -2, "hits");
+    duk_push_number(ctx, (double)cache.misses);
+    duk_put_prop_string(ctx, -2, "misses");
+    duk_push_number(ctx, (double)cache.cached);
+    duk_put_prop_string(ctx, -2, "cached");
+    duk_put_prop_string(ctx, -2, "layoutCache");
+
+    duk_push_number(ctx, (double)g_renderer->GetRepaintedLines());
+    duk_put_prop_string(ctx, -2, "repaintedLines");
+  }
+  return 1;
+}
+
 static D2D1_COLOR_F ParseColor(const char *hex) {
   if (!hex || hex[0] == '\0')
     return {0, 0, 0, 1};
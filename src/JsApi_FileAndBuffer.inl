@@ -1,7 +1,8 @@
 // =============================================================================
 // JsApi_FileAndBuffer.inl
-// JS API: File open/close/new, buffer switching, find, getBuffers,
-//         line info, key bindings, jump-to-line, script loading, logging
+// JS API: File open/close/new, buffer switching, find, find in files,
+//         getBuffers, line info, key bindings, jump-to-line, script loading,
+//         logging
 // Included by ScriptEngine.cpp
 // =============================================================================
 
@@ -88,6 +89,71 @@ static duk_ret_t js_editor_open(duk_context *ctx) {
   return 1;
 }
 
+// Editor.openAsync(path, callback): callback(index, ok) runs once the file is
+// fully loaded. The callback may be a function or a global function's name.
+static duk_ret_t js_editor_open_async(duk_context *ctx) {
+  const char *path = duk_get_string(ctx, 0);
+  if (!path || !g_editor) {
+    duk_push_int(ctx, -1);
+    return 1;
+  }
+
+  // The callback stays reachable from the stash until it has run
+  static unsigned int s_openAsyncId = 0;
+  std::string key;
+  if (duk_is_function(ctx, 1) || duk_is_string(ctx, 1)) {
+    key = "__open_async_" + std::to_string(++s_openAsyncId);
+    duk_push_global_stash(ctx);
+    if (duk_is_function(ctx, 1))
+      duk_dup(ctx, 1);
+    else
+      duk_get_global_string(ctx, duk_get_string(ctx, 1));
+    duk_put_prop_string(ctx, -2, key.c_str());
+    duk_pop(ctx);
+  }
+  Editor::OpenCallback done;
+  if (!key.empty()) {
+    done = [ctx, key](size_t index, bool ok) {
+      ScriptUndoScope undoScope;
+      duk_push_global_stash(ctx);
+      duk_get_prop_string(ctx, -1, key.c_str());
+      duk_del_prop_string(ctx, -2, key.c_str());
+      if (duk_is_function(ctx, -1)) {
+        duk_push_number(ctx, index == static_cast<size_t>(-1) ? -1.0
+                                                              : (double)index);
+        duk_push_boolean(ctx, ok);
+        if (duk_pcall(ctx, 2) != 0) {
+          DebugLog("Error in openAsync callback: " +
+                       std::string(duk_safe_to_string(ctx, -1)),
+                   LOG_ERROR);
+        }
+      }
+      duk_pop_2(ctx); // result and stash
+    };
+  }
+
+  std::wstring wpath = StringToWString(path);
+  size_t index = static_cast<size_t>(-1);
+  Buffer *existing = g_editor->GetBufferByName(wpath);
+  if (existing) {
+    const auto &buffers = g_editor->GetBuffers();
+    for (size_t i = 0; i < buffers.size(); ++i) {
+      if (buffers[i].get() == existing)
+        index = i;
+    }
+    g_editor->SwitchToBuffer(index);
+    if (done)
+      done(index, true);
+  } else {
+    index = g_editor->OpenFileAsync(wpath, done);
+  }
+  UpdateMenu(g_mainHwnd);
+  InvalidateRect(g_mainHwnd, NULL, FALSE);
+  duk_push_number(ctx, index == static_cast<size_t>(-1) ? -1.0
+                                                        : (double)index);
+  return 1;
+}
+
 static duk_ret_t js_editor_write_file(duk_context *ctx) {
   const char *path = duk_get_string(ctx, 0);
   const char *content = duk_get_string(ctx, 1);
@@ -126,6 +192,134 @@ static duk_ret_t js_editor_find(duk_context *ctx) {
   return 1;
 }
 
+static duk_ret_t js_editor_replace_all(duk_context *ctx) {
+  const char *query = duk_get_string(ctx, 0);
+  const char *replacement = duk_get_string(ctx, 1);
+  SearchOptions options;
+  options.useRegex = duk_get_boolean(ctx, 2);
+  options.matchCase = duk_get_boolean(ctx, 3);
+
+  Buffer *buf = g_editor ? g_editor->GetActiveBuffer() : nullptr;
+  size_t count = 0;
+  if (buf && query)
+    count = buf->ReplaceAll(query, replacement ? replacement : "", options);
+  duk_push_number(ctx, (double)count);
+  return 1;
+}
+
+static duk_ret_t js_editor_find_all(duk_context *ctx) {
+  const char *query = duk_get_string(ctx, 0);
+  SearchOptions options;
+  options.useRegex = duk_get_boolean(ctx, 1);
+  options.matchCase = duk_get_boolean(ctx, 2);
+
+  Buffer *buf = g_editor ? g_editor->GetActiveBuffer() : nullptr;
+  std::vector<size_t> offsets;
+  if (buf && query)
+    offsets = buf->FindAll(query, options);
+
+  // Float64Array: offsets past 4GB stay exact
+  double *data = static_cast<double *>(
+      duk_push_fixed_buffer(ctx, offsets.size() * sizeof(double)));
+  for (size_t i = 0; i < offsets.size(); ++i)
+    data[i] = (double)offsets[i];
+  duk_push_buffer_object(ctx, -1, 0, offsets.size() * sizeof(double),
+                         DUK_BUFOBJ_FLOAT64ARRAY);
+  return 1;
+}
+
+// Reads the optional options object of findInFiles / searchFiles
+static void GetFileSearchOptions(duk_context *ctx, duk_idx_t idx,
+                                 SearchOptions &options,
+                                 FileSearchFilter &filter) {
+  if (!duk_is_object(ctx, idx))
+    return;
+
+  auto GetBool = [&](const char *prop, bool &out) {
+    if (duk_get_prop_string(ctx, idx, prop) && duk_is_boolean(ctx, -1))
+      out = duk_get_boolean(ctx, -1) != 0;
+    duk_pop(ctx);
+  };
+  // A single glob string or an array of them
+  auto GetGlobs = [&](const char *prop, std::vector<std::string> &out) {
+    if (duk_get_prop_string(ctx, idx, prop)) {
+      if (duk_is_string(ctx, -1)) {
+        out.push_back(duk_get_string(ctx, -1));
+      } else if (duk_is_array(ctx, -1)) {
+        duk_size_t n = duk_get_length(ctx, -1);
+        for (duk_size_t i = 0; i < n; i++) {
+          duk_get_prop_index(ctx, -1, (duk_uarridx_t)i);
+          if (duk_is_string(ctx, -1))
+            out.push_back(duk_get_string(ctx, -1));
+          duk_pop(ctx);
+        }
+      }
+    }
+    duk_pop(ctx);
+  };
+
+  GetBool("useRegex", options.useRegex);
+  GetBool("matchCase", options.matchCase);
+  GetBool("skipBinary", filter.skipBinary);
+  GetBool("useIgnoreFiles", filter.useIgnoreFiles);
+  GetGlobs("include", filter.include);
+  GetGlobs("exclude", filter.exclude);
+  if (duk_get_prop_string(ctx, idx, "maxFileSize") && duk_is_number(ctx, -1))
+    filter.maxFileSize = (uint64_t)duk_get_number(ctx, -1);
+  duk_pop(ctx);
+}
+
+static duk_ret_t js_editor_find_in_files(duk_context *ctx) {
+  const char *dir = duk_get_string(ctx, 0);
+  const char *pattern = duk_get_string(ctx, 1);
+  SearchOptions options;
+  FileSearchFilter filter;
+  GetFileSearchOptions(ctx, 2, options, filter);
+
+  if (g_editor && dir && pattern) {
+    g_editor->StartFindInFiles(StringToWString(dir), StringToWString(pattern),
+                               options, filter);
+    UpdateMenu(g_mainHwnd);
+    InvalidateRect(g_mainHwnd, NULL, FALSE);
+    duk_push_boolean(ctx, true);
+    return 1;
+  }
+  duk_push_boolean(ctx, false);
+  return 1;
+}
+
+static duk_ret_t js_editor_search_files(duk_context *ctx) {
+  const char *dir = duk_get_string(ctx, 0);
+  const char *pattern = duk_get_string(ctx, 1);
+  SearchOptions options;
+  FileSearchFilter filter;
+  GetFileSearchOptions(ctx, 2, options, filter);
+
+  std::vector<FileSearchMatch> matches;
+  if (dir && pattern) {
+    FileSearch search(StringToWString(dir), pattern, options);
+    search.SetFilter(filter);
+    search.SetMatchCallback(
+        [&matches](const std::vector<FileSearchMatch> &batch) {
+          matches.insert(matches.end(), batch.begin(), batch.end());
+        });
+    search.Run();
+  }
+
+  duk_push_array(ctx);
+  for (size_t i = 0; i < matches.size(); ++i) {
+    duk_push_object(ctx);
+    duk_push_lstring(ctx, matches[i].path.data(), matches[i].path.size());
+    duk_put_prop_string(ctx, -2, "path");
+    duk_push_number(ctx, static_cast<double>(matches[i].line));
+    duk_put_prop_string(ctx, -2, "line");
+    duk_push_lstring(ctx, matches[i].text.data(), matches[i].text.size());
+    duk_put_prop_string(ctx, -2, "text");
+    duk_put_prop_index(ctx, -2, static_cast<duk_uarridx_t>(i));
+  }
+  return 1;
+}
+
 static duk_ret_t js_editor_get_buffers(duk_context *ctx) {
   if (!g_editor)
     return 0;
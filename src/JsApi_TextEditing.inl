@@ -364,3 +364,25 @@ static duk_ret_t js_editor_redo(duk_context *ctx) {
   duk_push_boolean(ctx, false);
   return 1;
 }
+
+static duk_ret_t js_editor_begin_undo_group(duk_context *ctx) {
+  Buffer *buf = g_editor ? g_editor->GetActiveBuffer() : nullptr;
+  if (buf) {
+    buf->BeginUndoGroup();
+    s_scriptUndoGroups.push_back(buf);
+    duk_push_boolean(ctx, true);
+    return 1;
+  }
+  duk_push_boolean(ctx, false);
+  return 1;
+}
+
+static duk_ret_t js_editor_end_undo_group(duk_context *ctx) {
+  if (!s_scriptUndoGroups.empty()) {
+    EndScriptUndoGroups(s_scriptUndoGroups.size() - 1);
+    duk_push_boolean(ctx, true);
+    return 1;
+  }
+  duk_push_boolean(ctx, false);
+  return 1;
+}
@@ -0,0 +1,282 @@
+#include "../include/MatchIndex.h"
+#include "../include/PieceTable.h"
+#include "../include/RegexSearch.h"
+#include "../include/TextSearch.h"
+#include <algorithm>
+#include <regex>
+#include <thread>
+
+// By default each worker thread gets at least this much of the document, so
+// small documents are searched on the calling thread alone.
+static const size_t PARALLEL_MIN_BYTES = 4 * 1024 * 1024;
+
+// ----------------------------------------------------------------------------
+// Matcher: the search engine chosen for a query
+// ----------------------------------------------------------------------------
+
+struct MatchIndex::Matcher {
+  std::string query;
+  SearchOptions options;
+  std::unique_ptr<TextSearcher> text;
+  std::shared_ptr<const RegexSearcher> regex;
+
+  Matcher(const std::string &q, const SearchOptions &o) : query(q), options(o) {
+    if (!options.useRegex)
+      text.reset(new TextSearcher(query, options.matchCase));
+    else
+      regex = RegexSearcher::Get(query, options.matchCase);
+  }
+
+  // False for patterns that need std::regex over a copy of the document
+  bool Streams() const { return text || regex; }
+  // Edits can be applied by rescanning a bounded region
+  bool Incremental() const {
+    return text || (regex && !regex->CanMatchNewline());
+  }
+
+  // First match starting in [pos, lastStart], or npos
+  size_t Next(const PieceTable &table, size_t pos, size_t lastStart,
+              size_t *length) const {
+    if (text) {
+      *length = text->Length();
+      return text->FindForward(table, pos, lastStart);
+    }
+    return regex->FindForward(table, pos, length, lastStart);
+  }
+
+  MatchList CollectCopy(const PieceTable &table) const {
+    MatchList matches;
+    try {
+      // multiline keeps ^ and $ line anchors, as in RegexSearcher
+      std::regex_constants::syntax_option_type flags =
+          std::regex_constants::ECMAScript | std::regex_constants::multiline;
+      if (!options.matchCase)
+        flags |= std::regex_constants::icase;
+      std::regex re(query, flags);
+      std::string text = table.GetText(0, table.GetTotalLength());
+      for (std::sregex_iterator it(text.begin(), text.end(), re), end;
+           it != end; ++it) {
+        if (it->length() > 0)
+          matches.emplace_back(it->position(), it->length());
+      }
+    } catch (...) {
+      matches.clear();
+    }
+    return matches;
+  }
+};
+
+// Matches are collected as a chain: each search resumes where the previous
+// match ended (one byte on, after an empty match, which is not recorded).
+// Because the next match depends only on where the search resumes, two
+// chains over the same text are identical from the first match they share.
+
+// Chain from 'pos' over the matches that start before 'end'
+static void CollectRange(const MatchIndex::Matcher &matcher,
+                         const PieceTable &table, size_t pos, size_t end,
+                         MatchList &out) {
+  size_t lastStart = end >= table.GetTotalLength() ? std::string::npos
+                                                   : end - 1;
+  size_t length = 0;
+  while (pos <= table.GetTotalLength()) {
+    size_t found = matcher.Next(table, pos, lastStart, &length);
+    if (found == std::string::npos)
+      break;
+    if (length == 0) {
+      pos = found + 1;
+      continue;
+    }
+    out.emplace_back(found, length);
+    pos = found + length;
+  }
+}
+
+// Continues a chain from 'pos' until it meets one of 'candidates[first..]'
+// (an older chain, each start moved by 'shift'), appending the new matches to
+// 'out'. Returns the index of the candidate it met, or candidates.size() if it
+// met none: the older chain found nothing at or after 'quiet', so neither does
+// this one once it gets there.
+static size_t Resync(const MatchIndex::Matcher &matcher,
+                     const PieceTable &table, size_t pos,
+                     const MatchList &candidates, size_t first,
+                     ptrdiff_t shift, size_t quiet, MatchList &out) {
+  size_t k = first;
+  const size_t n = candidates.size();
+  size_t length = 0;
+  for (;;) {
+    // Candidates the new chain has stepped over are gone
+    while (k < n && candidates[k].first + shift < pos)
+      ++k;
+    if (k == n && pos >= quiet)
+      return n;
+    size_t next = k < n ? candidates[k].first + shift : std::string::npos;
+    size_t found =
+        matcher.Next(table, pos, k < n ? next : quiet - 1, &length);
+    if (found == std::string::npos) {
+      if (k == n)
+        return n;
+      pos = next + 1; // the candidate no longer matches
+      continue;
+    }
+    if (found == next && length == candidates[k].second)
+      return k;
+    if (length == 0) {
+      pos = found + 1;
+      continue;
+    }
+    out.emplace_back(found, length);
+    pos = found + length;
+  }
+}
+
+// ----------------------------------------------------------------------------
+// MatchIndex
+// ----------------------------------------------------------------------------
+
+MatchIndex::MatchIndex() {}
+
+MatchIndex::~MatchIndex() {}
+
+MatchList MatchIndex::Collect(const PieceTable &table,
+                              const std::string &query,
+                              const SearchOptions &options, size_t workers) {
+  MatchList matches;
+  size_t total = table.GetTotalLength();
+  if (query.empty() || total == 0)
+    return matches;
+
+  Matcher matcher(query, options);
+  if (!matcher.Streams())
+    return matcher.CollectCopy(table);
+
+  if (workers == 0) {
+    workers = (std::max)(1u, std::thread::hardware_concurrency());
+    workers = (std::min)(workers, total / PARALLEL_MIN_BYTES);
+  }
+  workers = (std::min)(workers, total);
+  if (workers <= 1) {
+    CollectRange(matcher, table, 0, total, matches);
+    return matches;
+  }
+
+  // Each worker chains the matches starting in its own range as if a search
+  // resumed at the range start. Reading the piece table concurrently is
+  // safe; nothing edits it during the call.
+  std::vector<size_t> bounds(workers + 1);
+  for (size_t i = 0; i <= workers; ++i)
+    bounds[i] = total / workers * i;
+  bounds[workers] = total;
+  std::vector<MatchList> parts(workers);
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < workers; ++i) {
+    threads.emplace_back([&, i]() {
+      CollectRange(matcher, table, bounds[i], bounds[i + 1], parts[i]);
+    });
+  }
+  CollectRange(matcher, table, 0, bounds[1], parts[0]);
+  for (std::thread &t : threads)
+    t.join();
+
+  // Stitch the ranges in order. A match that runs past a range boundary
+  // makes the true chain resume inside the next range; it is continued there
+  // until it rejoins that range's own chain (usually at its first match).
+  matches.swap(parts[0]);
+  for (size_t i = 1; i < workers; ++i) {
+    const MatchList &part = parts[i];
+    size_t pos = matches.empty() ? 0
+                                 : matches.back().first + matches.back().second;
+    size_t quiet = part.empty() ? bounds[i]
+                                : part.back().first + part.back().second;
+    size_t joined = 0;
+    if (pos > bounds[i])
+      joined = Resync(matcher, table, pos, part, 0, 0, quiet, matches);
+    matches.insert(matches.end(), part.begin() + joined, part.end());
+  }
+  return matches;
+}
+
+void MatchIndex::SetQuery(const std::string &query,
+                          const SearchOptions &options) {
+  if (query == m_query && options.matchCase == m_options.matchCase &&
+      options.useRegex == m_options.useRegex)
+    return;
+  m_query = query;
+  m_options = options;
+  m_matcher.reset(query.empty() ? nullptr : new Matcher(query, options));
+  Invalidate();
+}
+
+void MatchIndex::Invalidate() {
+  m_stale = true;
+  MatchList().swap(m_matches);
+}
+
+void MatchIndex::OnEdit(const PieceTable &table, size_t pos, size_t removed,
+                        size_t inserted) {
+  if (m_stale || !m_matcher)
+    return;
+  if (!m_matcher->Incremental()) {
+    Invalidate();
+    return;
+  }
+
+  const size_t oldEnd = pos + removed; // edit end before the splice
+  const size_t newEnd = pos + inserted; // and after it
+
+  // Matches before 'keep' cannot have changed, and the chain is rescanned
+  // from 'from'. A literal match is unaffected if it ends at or before pos.
+  // A single-line regex may look at its whole line, so the line of pos is
+  // rescanned from its start.
+  size_t keep, from;
+  if (m_matcher->text) {
+    size_t m = m_matcher->text->Length();
+    keep = std::partition_point(m_matches.begin(), m_matches.end(),
+                                [&](const std::pair<size_t, size_t> &match) {
+                                  return match.first + match.second <= pos;
+                                }) -
+           m_matches.begin();
+    from = pos >= m - 1 ? pos - (m - 1) : 0;
+    if (keep > 0)
+      from = (std::max)(from, m_matches[keep - 1].first +
+                                  m_matches[keep - 1].second);
+  } else {
+    from = table.GetLineOffset(table.GetLineAtOffset(pos));
+    keep = std::partition_point(m_matches.begin(), m_matches.end(),
+                                [&](const std::pair<size_t, size_t> &match) {
+                                  return match.first < from;
+                                }) -
+           m_matches.begin();
+  }
+
+  // Old matches that start after the edit are where the chains can rejoin
+  size_t tail = std::partition_point(m_matches.begin() + keep, m_matches.end(),
+                                     [&](const std::pair<size_t, size_t> &m) {
+                                       return m.first < oldEnd;
+                                     }) -
+                m_matches.begin();
+  ptrdiff_t shift =
+      static_cast<ptrdiff_t>(inserted) - static_cast<ptrdiff_t>(removed);
+  size_t quiet = newEnd + 1;
+  if (!m_matches.empty()) {
+    size_t lastEnd = m_matches.back().first + m_matches.back().second;
+    if (lastEnd >= oldEnd)
+      quiet = (std::max)(quiet, lastEnd + shift);
+  }
+
+  MatchList rescanned;
+  size_t joined = Resync(*m_matcher, table, from, m_matches, tail, shift,
+                         quiet, rescanned);
+  for (size_t i = joined; i < m_matches.size(); ++i)
+    m_matches[i].first += shift;
+  m_matches.erase(m_matches.begin() + keep, m_matches.begin() + joined);
+  m_matches.insert(m_matches.begin() + keep, rescanned.begin(),
+                   rescanned.end());
+}
+
+const MatchList &MatchIndex::Get(const PieceTable &table) {
+  if (m_stale && m_matcher) {
+    m_matches = Collect(table, m_query, m_options);
+    m_stale = false;
+  }
+  return m_matches;
+}
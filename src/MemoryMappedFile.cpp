@@ -1,13 +1,69 @@
 #include "../include/MemoryMappedFile.h"
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Files that cannot be mapped are read in chunks of this size
+static const size_t READ_CHUNK = 1024 * 1024;
+// Advise(Sequential) prefetches at most this much of the view; the kernel's
+// read-ahead covers the rest without evicting everything else first
+static const size_t PREFETCH_BYTES = 256 * 1024 * 1024;
+// Window offsets must be multiples of the allocation granularity on Windows
+// (and of the page size elsewhere)
+static const size_t WINDOW_ALIGNMENT = 64 * 1024;
+
+// One mapped window of the Windowed backend, unmapped when the last View
+// pinning it is released
+struct MemoryMappedFile::Window {
+  void *view = nullptr;
+  size_t offset = 0;
+  size_t length = 0;
+  ~Window();
+};
+
+#ifdef _WIN32
+
+MemoryMappedFile::Window::~Window() {
+  if (view)
+    UnmapViewOfFile(view);
+}
 
 MemoryMappedFile::MemoryMappedFile()
     : m_fileHandle(INVALID_HANDLE_VALUE), m_mappingHandle(NULL),
-      m_mappedView(nullptr), m_fileSize(0) {}
+      m_mappedView(nullptr), m_fileSize(0), m_backend(Backend::None) {}
 
 MemoryMappedFile::~MemoryMappedFile() { Close(); }
 
-bool MemoryMappedFile::Open(const std::wstring &filePath) {
+// Reads from the current position to the end (pipes report no size)
+static bool ReadAll(HANDLE file, std::vector<char> &out) {
+  size_t used = 0;
+  for (;;) {
+    out.resize(used + READ_CHUNK);
+    DWORD read = 0;
+    if (!ReadFile(file, out.data() + used, static_cast<DWORD>(READ_CHUNK),
+                  &read, NULL)) {
+      if (GetLastError() != ERROR_BROKEN_PIPE) // writer closed: end of data
+        return false;
+      read = 0;
+    }
+    if (read == 0)
+      break;
+    used += read;
+  }
+  out.resize(used);
+  out.shrink_to_fit();
+  return true;
+}
+
+bool MemoryMappedFile::Open(const std::wstring &filePath, Backend backend) {
   Close();
 
   m_fileHandle = CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ,
@@ -16,35 +72,53 @@ bool MemoryMappedFile::Open(const std::wstring &filePath) {
     return false;
   }
 
-  LARGE_INTEGER size;
-  if (!GetFileSizeEx(m_fileHandle, &size)) {
-    Close();
-    return false;
-  }
-  m_fileSize = static_cast<size_t>(size.QuadPart);
+  if (backend != Backend::Read &&
+      GetFileType(m_fileHandle) == FILE_TYPE_DISK) {
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_fileHandle, &size)) {
+      Close();
+      return false;
+    }
+    m_fileSize = static_cast<size_t>(size.QuadPart);
 
-  if (m_fileSize == 0) {
-    // Mapping zero-sized file is not allowed
-    return true;
-  }
+    if (m_fileSize == 0) {
+      // Mapping zero-sized file is not allowed
+      m_backend = Backend::Mapped;
+      return true;
+    }
 
-  m_mappingHandle =
-      CreateFileMappingW(m_fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
-  if (m_mappingHandle == NULL) {
-    Close();
-    return false;
+    m_mappingHandle =
+        CreateFileMappingW(m_fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m_mappingHandle != NULL) {
+      if (backend == Backend::Windowed) {
+        // The mapping object costs no address space; views come later
+        m_backend = Backend::Windowed;
+        return true;
+      }
+      m_mappedView = MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0);
+      if (m_mappedView != nullptr) {
+        m_backend = Backend::Mapped;
+        return true;
+      }
+      CloseHandle(m_mappingHandle);
+      m_mappingHandle = NULL;
+    }
   }
 
-  m_mappedView = MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0);
-  if (m_mappedView == nullptr) {
+  if (!ReadAll(m_fileHandle, m_readData)) {
     Close();
     return false;
   }
-
+  m_fileSize = m_readData.size();
+  m_backend = Backend::Read;
   return true;
 }
 
 void MemoryMappedFile::Close() {
+  {
+    std::lock_guard<std::mutex> lock(m_windowMutex);
+    m_windows.clear();
+  }
   if (m_mappedView) {
     UnmapViewOfFile(m_mappedView);
     m_mappedView = nullptr;
@@ -57,15 +131,236 @@ void MemoryMappedFile::Close() {
     CloseHandle(m_fileHandle);
     m_fileHandle = INVALID_HANDLE_VALUE;
   }
+  std::vector<char>().swap(m_readData);
+  m_fileSize = 0;
+  m_backend = Backend::None;
+  m_sequential = false;
+}
+
+std::shared_ptr<MemoryMappedFile::Window>
+MemoryMappedFile::MapWindow(size_t offset) const {
+  auto window = std::make_shared<Window>();
+  window->offset = offset;
+  window->length = (std::min)(m_windowSize, m_fileSize - offset);
+  uint64_t offset64 = offset;
+  window->view = MapViewOfFile(
+      m_mappingHandle, FILE_MAP_READ, static_cast<DWORD>(offset64 >> 32),
+      static_cast<DWORD>(offset64 & 0xFFFFFFFF), window->length);
+  if (!window->view)
+    return nullptr;
+#if _WIN32_WINNT >= 0x0602
+  if (m_sequential) {
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = window->view;
+    range.NumberOfBytes = window->length;
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+  }
+#endif
+  return window;
+}
+
+void MemoryMappedFile::Advise(Access access) {
+  m_sequential = access == Access::Sequential;
+  if (!m_mappedView || access != Access::Sequential)
+    return;
+#if _WIN32_WINNT >= 0x0602
+  // Windows has no read-ahead hint for views; prefetching brings the first
+  // pages in with large I/Os instead of one fault at a time
+  WIN32_MEMORY_RANGE_ENTRY range;
+  range.VirtualAddress = m_mappedView;
+  range.NumberOfBytes = (std::min)(m_fileSize, PREFETCH_BYTES);
+  PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+}
+
+#else // POSIX
+
+MemoryMappedFile::Window::~Window() {
+  if (view)
+    munmap(view, length);
+}
+
+MemoryMappedFile::MemoryMappedFile()
+    : m_fd(-1), m_mappedView(nullptr), m_fileSize(0),
+      m_backend(Backend::None) {}
+
+MemoryMappedFile::~MemoryMappedFile() { Close(); }
+
+// Reads to the end of the file. Seekable files are read with pread at
+// explicit offsets; pipes and character devices with read.
+static bool ReadAll(int fd, bool seekable, size_t sizeHint,
+                    std::vector<char> &out) {
+  out.reserve(sizeHint);
+  size_t used = 0;
+  for (;;) {
+    out.resize(used + READ_CHUNK);
+    ssize_t n = seekable ? pread(fd, out.data() + used, READ_CHUNK,
+                                 static_cast<off_t>(used))
+                         : read(fd, out.data() + used, READ_CHUNK);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    if (n == 0)
+      break;
+    used += static_cast<size_t>(n);
+  }
+  out.resize(used);
+  out.shrink_to_fit();
+  return true;
+}
+
+bool MemoryMappedFile::Open(const std::wstring &filePath, Backend backend) {
+  Close();
+
+  std::string path = std::filesystem::path(filePath).string();
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || S_ISDIR(st.st_mode)) {
+    ::close(fd);
+    return false;
+  }
+
+  // Regular files of size zero are read: files under /proc report zero
+  // but have contents, and an empty file costs nothing to read
+  if (backend != Backend::Read && S_ISREG(st.st_mode) && st.st_size > 0) {
+    size_t size = static_cast<size_t>(st.st_size);
+    if (backend == Backend::Windowed) {
+      m_fd = fd;
+      m_fileSize = size;
+      m_backend = Backend::Windowed;
+      return true;
+    }
+    void *view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view != MAP_FAILED) {
+      m_fd = fd;
+      m_mappedView = view;
+      m_fileSize = size;
+      m_backend = Backend::Mapped;
+      return true;
+    }
+  }
+
+  bool seekable = S_ISREG(st.st_mode) || S_ISBLK(st.st_mode);
+  bool ok = ReadAll(fd, seekable,
+                    S_ISREG(st.st_mode) ? static_cast<size_t>(st.st_size) : 0,
+                    m_readData);
+  ::close(fd);
+  if (!ok) {
+    Close();
+    return false;
+  }
+  m_fileSize = m_readData.size();
+  m_backend = Backend::Read;
+  return true;
+}
+
+void MemoryMappedFile::Close() {
+  {
+    std::lock_guard<std::mutex> lock(m_windowMutex);
+    m_windows.clear();
+  }
+  if (m_mappedView) {
+    munmap(m_mappedView, m_fileSize);
+    m_mappedView = nullptr;
+  }
+  if (m_fd >= 0) {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+  std::vector<char>().swap(m_readData);
   m_fileSize = 0;
+  m_backend = Backend::None;
+  m_sequential = false;
+}
+
+std::shared_ptr<MemoryMappedFile::Window>
+MemoryMappedFile::MapWindow(size_t offset) const {
+  auto window = std::make_shared<Window>();
+  window->offset = offset;
+  window->length = (std::min)(m_windowSize, m_fileSize - offset);
+  void *view = mmap(nullptr, window->length, PROT_READ, MAP_PRIVATE, m_fd,
+                    static_cast<off_t>(offset));
+  if (view == MAP_FAILED)
+    return nullptr;
+  window->view = view;
+  if (m_sequential) {
+    madvise(view, window->length, MADV_SEQUENTIAL);
+    madvise(view, window->length, MADV_WILLNEED);
+  }
+  return window;
+}
+
+void MemoryMappedFile::Advise(Access access) {
+  m_sequential = access == Access::Sequential;
+  if (!m_mappedView)
+    return;
+  if (access == Access::Sequential) {
+    madvise(m_mappedView, m_fileSize, MADV_SEQUENTIAL);
+    madvise(m_mappedView, (std::min)(m_fileSize, PREFETCH_BYTES),
+            MADV_WILLNEED);
+  } else {
+    madvise(m_mappedView, m_fileSize, MADV_NORMAL);
+  }
+}
+
+#endif
+
+MemoryMappedFile::View MemoryMappedFile::GetView(size_t offset) const {
+  View view;
+  if (m_backend != Backend::Windowed) {
+    view.data = GetData();
+    view.length = m_fileSize;
+    return view;
+  }
+  if (offset >= m_fileSize)
+    return view;
+
+  size_t start = offset / m_windowSize * m_windowSize;
+  std::shared_ptr<Window> window;
+  {
+    std::lock_guard<std::mutex> lock(m_windowMutex);
+    auto it = std::find_if(m_windows.begin(), m_windows.end(),
+                           [start](const std::shared_ptr<Window> &w) {
+                             return w->offset == start;
+                           });
+    if (it != m_windows.end()) {
+      window = *it;
+      m_windows.erase(it);
+    } else {
+      window = MapWindow(start);
+      if (!window)
+        return view;
+    }
+    m_windows.push_back(window);
+    // Evicted windows stay mapped until the Views pinning them are released
+    if (m_windows.size() > m_maxWindows)
+      m_windows.erase(m_windows.begin());
+  }
+  view.data = static_cast<const char *>(window->view);
+  view.offset = window->offset;
+  view.length = window->length;
+  view.pin = window;
+  return view;
+}
+
+void MemoryMappedFile::SetWindowing(size_t windowSize, size_t maxWindows) {
+  m_windowSize = (std::max)(WINDOW_ALIGNMENT,
+                            (windowSize + WINDOW_ALIGNMENT - 1) /
+                                WINDOW_ALIGNMENT * WINDOW_ALIGNMENT);
+  m_maxWindows = (std::max)(size_t(1), maxWindows);
 }
 
 const char *MemoryMappedFile::GetData() const {
+  if (m_backend == Backend::Read)
+    return m_readData.data();
   return static_cast<const char *>(m_mappedView);
 }
 
 size_t MemoryMappedFile::GetSize() const { return m_fileSize; }
 
-bool MemoryMappedFile::IsOpen() const {
-  return m_fileHandle != INVALID_HANDLE_VALUE;
-}
+bool MemoryMappedFile::IsOpen() const { return m_backend != Backend::None; }
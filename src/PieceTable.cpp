@@ -1,29 +1,65 @@
 #include "../include/PieceTable.h"
 #include <algorithm>
+#include <cstring>
+#include <thread>
 #include <emmintrin.h> // SSE2
-#include <intrin.h>    // __popcnt
+#ifdef _MSC_VER
+#include <intrin.h> // __popcnt
+#endif
 
-// OPTIMIZATION #2: SIMD-optimized newline counting (4-8x faster)
-size_t CountNewlines(const char *data, size_t length) {
-  size_t count = 0;
+// OPTIMIZATION #2: SIMD-optimized newline scan (4-8x faster). Appends the
+// absolute offset (base + i) of every '\n' in data to 'out'.
+static void CollectNewlines(const char *data, size_t length, size_t base,
+                            std::vector<size_t> &out) {
   size_t i = 0;
 
-#ifdef _MSC_VER // Use SSE2 on MSVC
+#if defined(_MSC_VER) || defined(__SSE2__) // Use SSE2 where available
   // Process 16 bytes at a time with SSE2
   __m128i newline = _mm_set1_epi8('\n');
   for (; i + 16 <= length; i += 16) {
-    __m128i chunk = _mm_loadu_si128((__m128i *)(data + i));
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
     __m128i cmp = _mm_cmpeq_epi8(chunk, newline);
     int mask = _mm_movemask_epi8(cmp);
-    // Safer bit counting to avoid CPU feature dependency issues
-    for (int b = 0; b < 16; ++b) {
-      if ((mask >> b) & 1)
-        count++;
+    // Safer bit scanning to avoid CPU feature dependency issues
+    while (mask != 0) {
+      int b = 0;
+      while (((mask >> b) & 1) == 0)
+        b++;
+      out.push_back(base + i + b);
+      mask &= mask - 1;
     }
   }
 #endif
 
   // Handle remaining bytes
+  for (; i < length; ++i) {
+    if (data[i] == '\n')
+      out.push_back(base + i);
+  }
+}
+
+// Number of '\n' bytes in data
+static size_t CountNewlines(const char *data, size_t length) {
+  size_t count = 0;
+  size_t i = 0;
+
+#if defined(_MSC_VER) || defined(__SSE2__)
+  // Per-byte match counters, summed with SAD before any of them can wrap
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i zero = _mm_setzero_si128();
+  while (i + 16 <= length) {
+    __m128i counters = zero;
+    size_t end = (std::min)(length - 15, i + 255 * 16);
+    for (; i < end; i += 16) {
+      __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+      counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(chunk, newline));
+    }
+    __m128i sums = _mm_sad_epu8(counters, zero);
+    count += static_cast<size_t>(_mm_cvtsi128_si32(sums)) +
+             static_cast<size_t>(_mm_extract_epi16(sums, 4));
+  }
+#endif
+
   for (; i < length; ++i) {
     if (data[i] == '\n')
       count++;
@@ -31,230 +67,622 @@ size_t CountNewlines(const char *data, size_t length) {
   return count;
 }
 
+void AddedText::Append(const char *data, size_t length) {
+  if (length == 0)
+    return;
+  if (m_blocks.empty() ||
+      m_size + length > m_blocks.back().start + m_blocks.back().capacity) {
+    // The rest of a full block goes unused; its bytes must not move
+    size_t capacity = (std::max)(
+        length, (std::min)((std::max)(m_size, MIN_BLOCK), MAX_BLOCK));
+    m_blocks.push_back({m_size, capacity,
+                        std::shared_ptr<char>(new char[capacity],
+                                              std::default_delete<char[]>())});
+  }
+  Block &block = m_blocks.back();
+  memcpy(block.data.get() + (m_size - block.start), data, length);
+  m_size += length;
+}
+
+TextSpan AddedText::Span(size_t offset) const {
+  TextSpan span;
+  if (offset >= m_size)
+    return span;
+  auto block = std::upper_bound(
+      m_blocks.begin(), m_blocks.end(), offset,
+      [](size_t at, const Block &b) { return at < b.start; });
+  --block;
+  span.data = block->data.get();
+  span.offset = block->start;
+  span.length = (std::min)(block->capacity, m_size - block->start);
+  return span;
+}
+
 PieceTable::PieceTable()
     : m_originalData(nullptr), m_originalLength(0), m_totalLength(0),
       m_totalLines(1) {}
 
 PieceTable::~PieceTable() {}
 
-void PieceTable::LoadOriginal(const char *data, size_t length) {
+void PieceTable::LoadOriginal(const char *data, size_t length,
+                              size_t prefix) {
   m_originalData = data;
+  m_originalSource = nullptr;
+  ResetOriginal(length);
+  LoadPrefix(prefix);
+}
+
+void PieceTable::LoadOriginal(SpanSource source, size_t length,
+                              size_t prefix) {
+  m_originalData = nullptr;
+  m_originalSource = std::move(source);
+  ResetOriginal(length);
+  // Entry i counts the newlines before byte i * NEWLINE_BLOCK, up to the
+  // block holding the end of the loaded text
+  m_originalBlockNewlines.assign(1, 0);
+  m_originalBlockNewlines.reserve(length / NEWLINE_BLOCK + 1);
+  LoadPrefix(prefix);
+}
+
+void PieceTable::ResetOriginal(size_t length) {
   m_originalLength = length;
-  size_t originalLines = 0;
-  if (length > 0) {
-    originalLines = CountNewlines(data, length);
-    m_pieces.emplace_back(BufferType::Original, 0, length, originalLines);
-  }
-  m_totalLength = length;
-  m_totalLines = originalLines + 1;
-  InvalidateLineCache(); // OPTIMIZATION: Invalidate cache on load
+  m_originalLoaded = 0;
+  m_pieces.Clear();
+  std::vector<size_t>().swap(m_originalNewlines);
+  std::vector<size_t>().swap(m_originalBlockNewlines);
+  m_totalLength = 0;
+  m_totalLines = 1;
+
+  // Undo records and added text describe the old document; replaying them
+  // on the new one would splice stale pieces into it
+  m_added = AddedText();
+  std::vector<size_t>().swap(m_addedNewlines);
+  m_undoStack.clear();
+  m_redoStack.clear();
+  m_groupDepth = 0;
+  m_groupOpen = false;
+  m_editsSinceCompaction = 0;
 }
 
-const char *PieceTable::GetPieceData(const Piece &p) const {
-  if (p.bufferType == BufferType::Original) {
-    return m_originalData + p.start;
-  } else {
-    return m_addedBuffer.data() + p.start;
+void PieceTable::LoadPrefix(size_t prefix) {
+  size_t end = m_originalLength;
+  if (prefix == 0) {
+    end = 0;
+  } else if (prefix < m_originalLength) {
+    end = prefix - 1;
+    VisitBuffer(BufferType::Original, end, m_originalLength - end,
+                [&](const char *data, size_t length) {
+                  const void *newline = memchr(data, '\n', length);
+                  if (!newline) {
+                    end += length;
+                    return true;
+                  }
+                  end += static_cast<const char *>(newline) - data + 1;
+                  return false;
+                });
   }
+  AppendOriginal(IndexOriginal(0, end));
+}
+
+void PieceTable::IndexRange(size_t begin, size_t end,
+                            const std::atomic<bool> *cancel,
+                            OriginalIndex &out) const {
+  out.begin = begin;
+  out.end = end;
+  size_t pos = begin;
+  // Block by block, so cancellation is noticed quickly and a SpanSource
+  // original gets its per-block counts
+  VisitBuffer(BufferType::Original, begin, end - begin,
+              [&](const char *data, size_t count) {
+                while (count > 0) {
+                  if (cancel && *cancel)
+                    return false;
+                  size_t blockEnd = (pos / NEWLINE_BLOCK + 1) * NEWLINE_BLOCK;
+                  size_t take = (std::min)(count, blockEnd - pos);
+                  if (m_originalSource) {
+                    out.newlines += CountNewlines(data, take);
+                  } else {
+                    CollectNewlines(data, take, pos, out.offsets);
+                    out.newlines = out.offsets.size();
+                  }
+                  data += take;
+                  count -= take;
+                  pos += take;
+                  if (pos == blockEnd && m_originalSource)
+                    out.blockNewlines.push_back(out.newlines);
+                }
+                return true;
+              });
 }
 
-PieceTable::PieceInfo PieceTable::FindPiecePosition(size_t pos) const {
-  size_t accumulated = 0;
-  for (size_t i = 0; i < m_pieces.size(); ++i) {
-    if (pos < accumulated + m_pieces[i].length) {
-      return {i, pos - accumulated};
+PieceTable::OriginalIndex
+PieceTable::IndexOriginal(size_t begin, size_t end,
+                          const std::atomic<bool> *cancel,
+                          size_t workers) const {
+  OriginalIndex index;
+  index.begin = index.end = begin;
+  if (end <= begin)
+    return index;
+
+  if (workers == 0) {
+    workers = (std::max)(1u, std::thread::hardware_concurrency());
+    workers = (std::min)(workers, (end - begin) / PARALLEL_INDEX_MIN_BYTES);
+  }
+  if (workers <= 1) {
+    IndexRange(begin, end, cancel, index);
+  } else {
+    // Chunk bounds fall on block boundaries, so every block is counted by
+    // exactly one worker
+    size_t chunk = ((end - begin) / workers + NEWLINE_BLOCK - 1) /
+                   NEWLINE_BLOCK * NEWLINE_BLOCK;
+    std::vector<size_t> bounds(1, begin);
+    while (bounds.back() < end) {
+      size_t next = (bounds.back() + chunk) / NEWLINE_BLOCK * NEWLINE_BLOCK;
+      bounds.push_back((std::min)(end, next));
+    }
+    std::vector<OriginalIndex> parts(bounds.size() - 1);
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < parts.size(); ++i) {
+      threads.emplace_back([&, i]() {
+        IndexRange(bounds[i], bounds[i + 1], cancel, parts[i]);
+      });
+    }
+    IndexRange(bounds[0], bounds[1], cancel, parts[0]);
+    for (std::thread &t : threads)
+      t.join();
+
+    // Newline offsets are absolute already; block counts are shifted by the
+    // newlines of the chunks before
+    index = std::move(parts[0]);
+    for (size_t i = 1; i < parts.size(); ++i) {
+      OriginalIndex &part = parts[i];
+      index.offsets.insert(index.offsets.end(), part.offsets.begin(),
+                           part.offsets.end());
+      std::vector<size_t>().swap(part.offsets);
+      for (size_t n : part.blockNewlines)
+        index.blockNewlines.push_back(index.newlines + n);
+      index.newlines += part.newlines;
+      index.end = part.end;
     }
-    accumulated += m_pieces[i].length;
   }
-  // Handle position at the very end
-  if (pos == accumulated && !m_pieces.empty()) {
-    return {m_pieces.size() - 1, m_pieces.back().length};
+
+  if (cancel && *cancel) {
+    index = OriginalIndex();
+    index.begin = index.end = begin;
   }
-  return {0, 0};
+  return index;
 }
 
-void PieceTable::Insert(size_t pos, const std::string &text) {
-  if (text.empty())
+void PieceTable::AppendOriginal(OriginalIndex index) {
+  if (index.begin != m_originalLoaded || index.end <= index.begin)
     return;
+  size_t length = index.end - index.begin;
+  if (m_originalSource) {
+    size_t before = OriginalNewlinesBefore(index.begin);
+    for (size_t n : index.blockNewlines)
+      m_originalBlockNewlines.push_back(before + n);
+  } else if (m_originalNewlines.empty()) {
+    m_originalNewlines = std::move(index.offsets);
+  } else {
+    m_originalNewlines.insert(m_originalNewlines.end(), index.offsets.begin(),
+                              index.offsets.end());
+  }
+  m_originalLoaded = index.end;
+
+  size_t pos = m_totalLength;
+  m_pieces.InsertBefore(nullptr, Piece(BufferType::Original, index.begin,
+                                       length, index.newlines));
+  m_totalLength += length;
+  m_totalLines += index.newlines;
+  // The initial load is not an edit; a later tail is, for indexes over the
+  // document
+  if (index.begin > 0 && m_editListener)
+    m_editListener(pos, 0, length);
+}
 
-  SaveState();
+template <typename F>
+bool PieceTable::VisitBuffer(BufferType type, size_t start, size_t length,
+                             F &&f) const {
+  if (length == 0)
+    return true;
+  if (type == BufferType::Original && !m_originalSource)
+    return f(m_originalData + start, length);
+  while (length > 0) {
+    TextSpan span = type == BufferType::Added ? m_added.Span(start)
+                                              : m_originalSource(start);
+    if (!span.data || start < span.offset ||
+        start >= span.offset + span.length)
+      return false; // the source could not supply the bytes
+    size_t count = (std::min)(length, span.offset + span.length - start);
+    if (!f(span.data + (start - span.offset), count))
+      return false;
+    start += count;
+    length -= count;
+  }
+  return true;
+}
 
-  size_t addedStart = m_addedBuffer.length();
-  m_addedBuffer += text;
+template <typename F>
+bool PieceTable::VisitBufferReverse(BufferType type, size_t start,
+                                    size_t length, F &&f) const {
+  if (type == BufferType::Original && !m_originalSource)
+    return VisitBuffer(type, start, length, std::forward<F>(f));
+  size_t end = start + length;
+  while (end > start) {
+    TextSpan span = type == BufferType::Added ? m_added.Span(end - 1)
+                                              : m_originalSource(end - 1);
+    if (!span.data || end - 1 < span.offset ||
+        end - 1 >= span.offset + span.length)
+      return false;
+    size_t from = (std::max)(start, span.offset);
+    if (!f(span.data + (from - span.offset), end - from))
+      return false;
+    end = from;
+  }
+  return true;
+}
 
-  if (m_pieces.empty()) {
-    size_t lines = CountNewlines(text.data(), text.length());
-    m_pieces.emplace_back(BufferType::Added, addedStart, text.length(), lines);
-    m_totalLength = text.length();
-    m_totalLines = lines + 1;
-    InvalidateLineCache();
-    return;
+size_t PieceTable::CountNewlinesIn(BufferType type, size_t start,
+                                   size_t length) const {
+  if (length == 0)
+    return 0;
+  if (type == BufferType::Original)
+    return OriginalNewlinesBefore(start + length) -
+           OriginalNewlinesBefore(start);
+  auto first =
+      std::lower_bound(m_addedNewlines.begin(), m_addedNewlines.end(), start);
+  auto last = std::lower_bound(first, m_addedNewlines.end(), start + length);
+  return static_cast<size_t>(last - first);
+}
+
+size_t PieceTable::OriginalNewlinesBefore(size_t offset) const {
+  if (!m_originalSource) {
+    return static_cast<size_t>(std::lower_bound(m_originalNewlines.begin(),
+                                                m_originalNewlines.end(),
+                                                offset) -
+                               m_originalNewlines.begin());
   }
+  size_t block = offset / NEWLINE_BLOCK;
+  size_t blockStart = block * NEWLINE_BLOCK;
+  size_t count = m_originalBlockNewlines[block];
+  VisitBuffer(BufferType::Original, blockStart, offset - blockStart,
+              [&](const char *data, size_t length) {
+                count += CountNewlines(data, length);
+                return true;
+              });
+  return count;
+}
 
-  if (pos >= m_totalLength) {
-    // Append to the end
-    size_t lines = CountNewlines(text.data(), text.length());
-    m_pieces.emplace_back(BufferType::Added, addedStart, text.length(), lines);
-    m_totalLength += text.length();
-    m_totalLines += lines;
-    return;
+size_t PieceTable::FindOriginalNewline(size_t index) const {
+  if (!m_originalSource)
+    return m_originalNewlines[index];
+
+  // The last block with at most 'index' newlines before it holds the newline
+  size_t block = static_cast<size_t>(
+      std::upper_bound(m_originalBlockNewlines.begin(),
+                       m_originalBlockNewlines.end(), index) -
+      m_originalBlockNewlines.begin() - 1);
+  size_t skip = index - m_originalBlockNewlines[block];
+  size_t at = block * NEWLINE_BLOCK;
+  size_t found = m_originalLength;
+  VisitBuffer(BufferType::Original, at,
+              (std::min)(NEWLINE_BLOCK, m_originalLength - at),
+              [&](const char *data, size_t length) {
+                const char *end = data + length;
+                for (const char *p = data;
+                     (p = static_cast<const char *>(
+                          memchr(p, '\n', end - p))) != nullptr;
+                     ++p) {
+                  if (skip-- == 0) {
+                    found = at + (p - data);
+                    return false;
+                  }
+                }
+                at += length;
+                return true;
+              });
+  return found;
+}
+
+PieceTree::Position PieceTable::FindPiecePosition(size_t pos) const {
+  return m_pieces.FindByOffset(pos);
+}
+
+// True if 'text' is exactly one UTF-8 encoded character
+static bool IsSingleCodePoint(const std::string &text) {
+  unsigned char c = static_cast<unsigned char>(text[0]);
+  size_t expected = 1;
+  if ((c & 0xE0) == 0xC0)
+    expected = 2;
+  else if ((c & 0xF0) == 0xE0)
+    expected = 3;
+  else if ((c & 0xF8) == 0xF0)
+    expected = 4;
+  return text.length() == expected;
+}
+
+static size_t TotalPieceLength(const std::vector<Piece> &pieces) {
+  size_t length = 0;
+  for (const auto &p : pieces)
+    length += p.length;
+  return length;
+}
+
+PieceTree::Node *PieceTable::SplitAt(size_t pos) {
+  if (pos >= m_pieces.TotalLength())
+    return nullptr;
+
+  PieceTree::Position info = FindPiecePosition(pos);
+  if (info.offsetInPiece == 0)
+    return info.node;
+
+  // Shrink the piece to its first part in place and insert the rest after it
+  Piece &piece = info.node->piece;
+  size_t part1LineCount =
+      CountNewlinesIn(piece.bufferType, piece.start, info.offsetInPiece);
+  Piece part2(piece.bufferType, piece.start + info.offsetInPiece,
+              piece.length - info.offsetInPiece,
+              piece.lineCount - part1LineCount);
+  piece.length = info.offsetInPiece;
+  piece.lineCount = part1LineCount;
+  m_pieces.Update(info.node);
+  return m_pieces.InsertAfter(info.node, part2);
+}
+
+std::vector<Piece> PieceTable::SplicePieces(size_t pos, size_t removeLength,
+                                            const std::vector<Piece> &pieces) {
+  std::vector<Piece> removed;
+  PieceTree::Node *first = SplitAt(pos);
+  // Splitting at the end boundary only ever shrinks 'first' in place, so
+  // the node returned above stays the first piece of the range.
+  PieceTree::Node *end = removeLength > 0 ? SplitAt(pos + removeLength) : first;
+
+  // Bulk splices (replace-all and its undo/redo) touch a large share of the
+  // tree; rebuilding it in O(n) beats O(log n) per erased/inserted node.
+  const size_t BULK_SPLICE_PIECES = 1024;
+  if (pieces.size() >= BULK_SPLICE_PIECES ||
+      m_pieces.Size() >= BULK_SPLICE_PIECES) {
+    size_t firstIndex = first ? m_pieces.IndexOf(first) : m_pieces.Size();
+    size_t endIndex = end ? m_pieces.IndexOf(end) : m_pieces.Size();
+    size_t touched = (endIndex - firstIndex) + pieces.size();
+    if (touched >= BULK_SPLICE_PIECES && touched * 4 >= m_pieces.Size()) {
+      std::vector<Piece> all = m_pieces.ToVector();
+      removed.assign(all.begin() + firstIndex, all.begin() + endIndex);
+      all.erase(all.begin() + firstIndex, all.begin() + endIndex);
+      all.insert(all.begin() + firstIndex, pieces.begin(), pieces.end());
+      m_pieces.Build(all);
+      m_totalLength = m_pieces.TotalLength();
+      m_totalLines = m_pieces.TotalLines() + 1;
+      if (m_spliceListener)
+        m_spliceListener(pos, removed, pieces);
+      if (m_editListener)
+        m_editListener(pos, removeLength, TotalPieceLength(pieces));
+      return removed;
+    }
   }
 
-  PieceInfo info = FindPiecePosition(pos);
-  Piece target = m_pieces[info.pieceIndex];
-
-  // Split target piece into two if necessary
-  if (info.offsetInPiece == 0) {
-    // Insert before this piece
-    m_pieces.insert(m_pieces.begin() + info.pieceIndex,
-                    Piece(BufferType::Added, addedStart, text.length(),
-                          CountNewlines(text.data(), text.length())));
-  } else if (info.offsetInPiece == target.length) {
-    // Insert after this piece
-    m_pieces.insert(m_pieces.begin() + info.pieceIndex + 1,
-                    Piece(BufferType::Added, addedStart, text.length(),
-                          CountNewlines(text.data(), text.length())));
-  } else {
-    // Split in the middle
-    size_t part1LineCount =
-        CountNewlines(GetPieceData(target), info.offsetInPiece);
-    Piece part1(target.bufferType, target.start, info.offsetInPiece,
-                part1LineCount);
-    Piece part2(target.bufferType, target.start + info.offsetInPiece,
-                target.length - info.offsetInPiece,
-                target.lineCount - part1LineCount);
-    Piece newPart(BufferType::Added, addedStart, text.length(),
-                  CountNewlines(text.data(), text.length()));
-
-    m_pieces.erase(m_pieces.begin() + info.pieceIndex);
-    m_pieces.insert(m_pieces.begin() + info.pieceIndex, part2);
-    m_pieces.insert(m_pieces.begin() + info.pieceIndex, newPart);
-    m_pieces.insert(m_pieces.begin() + info.pieceIndex, part1);
-  }
-
-  size_t linesInText = CountNewlines(text.data(), text.length());
-  m_totalLength += text.length();
-  m_totalLines += linesInText;
-  InvalidateLineCache(); // OPTIMIZATION: Invalidate cache after insert
-
-  // OPTIMIZATION #5: Automatic compaction
-  m_editsSinceCompaction++;
-  if (m_editsSinceCompaction > 100 || m_pieces.size() > 1000) {
-    CompactPieces();
+  for (PieceTree::Node *node = first; node && node != end;) {
+    PieceTree::Node *next = m_pieces.Next(node);
+    removed.push_back(node->piece);
+    m_pieces.Erase(node);
+    node = next;
   }
+
+  for (const auto &p : pieces)
+    m_pieces.InsertBefore(end, p);
+
+  // Totals are maintained by the tree aggregates
+  m_totalLength = m_pieces.TotalLength();
+  m_totalLines = m_pieces.TotalLines() + 1;
+  if (m_spliceListener)
+    m_spliceListener(pos, removed, pieces);
+  if (m_editListener)
+    m_editListener(pos, removeLength, TotalPieceLength(pieces));
+  return removed;
+}
+
+void PieceTable::Insert(size_t pos, const std::string &text) {
+  if (text.empty())
+    return;
+  if (pos > m_totalLength)
+    pos = m_totalLength;
+
+  size_t addedStart = m_added.size();
+  m_added.Append(text.data(), text.length());
+
+  // Only the inserted text is scanned; the added line table is append-only
+  size_t newlinesBefore = m_addedNewlines.size();
+  CollectNewlines(text.data(), text.length(), addedStart, m_addedNewlines);
+  size_t linesInText = m_addedNewlines.size() - newlinesBefore;
+
+  UndoRecord record;
+  record.pos = pos;
+  record.inserted.emplace_back(BufferType::Added, addedStart, text.length(),
+                               linesInText);
+  SplicePieces(pos, 0, record.inserted);
+  PushUndo(std::move(record), linesInText == 0 && IsSingleCodePoint(text));
+
+  MaybeCompact();
 }
 
 void PieceTable::Delete(size_t pos, size_t length) {
   if (length == 0 || pos >= m_totalLength)
     return;
 
-  SaveState();
-
   if (pos + length > m_totalLength)
     length = m_totalLength - pos;
 
-  size_t oldTotalLines = m_totalLines;
-
-  // Implementation can be complex as it might span multiple pieces
-  // For now, a simplified version that handles basic cases:
-  size_t remainingToDelete = length;
-  while (remainingToDelete > 0) {
-    PieceInfo info = FindPiecePosition(pos);
-    Piece &target = m_pieces[info.pieceIndex];
-
-    size_t deleteInThisPiece =
-        std::min(remainingToDelete, target.length - info.offsetInPiece);
-
-    size_t linesInDeletedPart = CountNewlines(
-        GetPieceData(target) + info.offsetInPiece, deleteInThisPiece);
-
-    if (info.offsetInPiece == 0 && deleteInThisPiece == target.length) {
-      // Remove entire piece
-      m_pieces.erase(m_pieces.begin() + info.pieceIndex);
-    } else if (info.offsetInPiece == 0) {
-      // Shrink from start
-      target.start += deleteInThisPiece;
-      target.length -= deleteInThisPiece;
-      target.lineCount -= linesInDeletedPart;
-    } else if (info.offsetInPiece + deleteInThisPiece == target.length) {
-      // Shrink from end
-      target.length -= deleteInThisPiece;
-      target.lineCount -= linesInDeletedPart;
-    } else {
-      // Split piece and remove middle
-      // We already have target split - need to count lines in part1
-      size_t linesInPart1 =
-          CountNewlines(GetPieceData(target), info.offsetInPiece);
-      Piece part1(target.bufferType, target.start, info.offsetInPiece,
-                  linesInPart1);
-      Piece part2(target.bufferType,
-                  target.start + info.offsetInPiece + deleteInThisPiece,
-                  target.length - (info.offsetInPiece + deleteInThisPiece),
-                  target.lineCount - (linesInPart1 + linesInDeletedPart));
-
-      m_pieces.erase(m_pieces.begin() + info.pieceIndex);
-      m_pieces.insert(m_pieces.begin() + info.pieceIndex, part2);
-      m_pieces.insert(m_pieces.begin() + info.pieceIndex, part1);
-    }
+  UndoRecord record;
+  record.pos = pos;
+  record.removed = SplicePieces(pos, length, {});
+  PushUndo(std::move(record));
+
+  MaybeCompact();
+}
+
+void PieceTable::ReplaceRanges(
+    const std::vector<std::pair<size_t, size_t>> &ranges,
+    const std::string &text) {
+  if (ranges.empty())
+    return;
+  size_t spanStart = ranges.front().first;
+  size_t spanEnd = ranges.back().first + ranges.back().second;
+  if (spanEnd > m_totalLength)
+    return;
 
-    m_totalLines -= linesInDeletedPart;
-    remainingToDelete -= deleteInThisPiece;
+  Piece replacement(BufferType::Added, m_added.size(), text.length());
+  if (!text.empty()) {
+    m_added.Append(text.data(), text.length());
+    size_t newlinesBefore = m_addedNewlines.size();
+    CollectNewlines(text.data(), text.length(), replacement.start,
+                    m_addedNewlines);
+    replacement.lineCount = m_addedNewlines.size() - newlinesBefore;
+  }
+
+  // Walk the pieces of the span once, keeping the text between matches
+  UndoRecord record;
+  record.pos = spanStart;
+  PieceTree::Position info = FindPiecePosition(spanStart);
+  PieceTree::Node *node = info.node;
+  size_t nodeStart = info.pieceStart;
+  auto keep = [&](size_t from, size_t to) {
+    while (from < to) {
+      while (nodeStart + node->piece.length <= from) {
+        nodeStart += node->piece.length;
+        node = m_pieces.Next(node);
+      }
+      const Piece &piece = node->piece;
+      size_t start = piece.start + (from - nodeStart);
+      size_t length = (std::min)(nodeStart + piece.length, to) - from;
+      record.inserted.emplace_back(
+          piece.bufferType, start, length,
+          CountNewlinesIn(piece.bufferType, start, length));
+      from += length;
+    }
+  };
+
+  size_t cursor = spanStart;
+  for (const auto &range : ranges) {
+    keep(cursor, range.first);
+    if (replacement.length > 0)
+      record.inserted.push_back(replacement);
+    cursor = range.first + range.second;
   }
 
-  m_totalLength -= length;
+  record.removed =
+      SplicePieces(spanStart, spanEnd - spanStart, record.inserted);
+  PushUndo(std::move(record));
 
-  InvalidateLineCache(); // OPTIMIZATION: Invalidate cache after delete
+  MaybeCompact();
+}
 
-  // OPTIMIZATION #5: Automatic compaction
+// OPTIMIZATION #5: Automatic compaction. Compaction is O(pieces), so it is
+// amortised against the number of edits rather than run on every edit once
+// the document is fragmented.
+void PieceTable::MaybeCompact() {
   m_editsSinceCompaction++;
-  if (m_editsSinceCompaction > 100 || m_pieces.size() > 1000) {
+  if (m_editsSinceCompaction > 100 &&
+      m_editsSinceCompaction > m_pieces.Size()) {
     CompactPieces();
   }
 }
 
-void PieceTable::SaveState() {
+void PieceTable::PushUndo(UndoRecord record, bool singleChar) {
   // OPTIMIZATION #8: Limit undo stack size to prevent unbounded growth
   const size_t MAX_UNDO_LEVELS = 1000;
 
-  m_undoStack.push_back(m_pieces);
+  m_redoStack.clear();
+
+  if (m_groupDepth > 0 && m_groupOpen) {
+    m_undoStack.back().records.push_back(std::move(record));
+    return;
+  }
+
+  // Extend the current typing run when this character directly follows the
+  // previous one, both in the document and in the added buffer.
+  if (singleChar && m_groupDepth == 0 && !m_undoStack.empty() &&
+      m_undoStack.back().typingRun) {
+    UndoRecord &last = m_undoStack.back().records.back();
+    Piece &lastPiece = last.inserted.back();
+    const Piece &piece = record.inserted.back();
+    if (last.pos + lastPiece.length == record.pos &&
+        lastPiece.start + lastPiece.length == piece.start) {
+      lastPiece.length += piece.length;
+      return;
+    }
+  }
+
+  UndoGroup group;
+  group.records.push_back(std::move(record));
+  group.typingRun = singleChar && m_groupDepth == 0;
+  m_undoStack.push_back(std::move(group));
+  if (m_groupDepth > 0)
+    m_groupOpen = true;
   if (m_undoStack.size() > MAX_UNDO_LEVELS) {
-    m_undoStack.erase(m_undoStack.begin());
+    m_undoStack.pop_front();
   }
-  m_redoStack.clear();
+}
+
+void PieceTable::BeginUndoGroup() { m_groupDepth++; }
+
+void PieceTable::EndUndoGroup() {
+  if (m_groupDepth == 0)
+    return;
+  if (--m_groupDepth == 0)
+    m_groupOpen = false;
 }
 
 void PieceTable::Undo() {
   if (m_undoStack.empty())
     return;
 
-  m_redoStack.push_back(m_pieces);
-  m_pieces = m_undoStack.back();
+  // Edits made after an undo inside a transaction start a new step
+  m_groupOpen = false;
+  UndoGroup group = std::move(m_undoStack.back());
   m_undoStack.pop_back();
-
-  // Recalculate total length and lines
-  m_totalLength = 0;
-  m_totalLines = 1;
-  for (const auto &p : m_pieces) {
-    m_totalLength += p.length;
-    m_totalLines += p.lineCount;
+  for (auto it = group.records.rbegin(); it != group.records.rend(); ++it) {
+    SplicePieces(it->pos, TotalPieceLength(it->inserted), it->removed);
   }
+  m_redoStack.push_back(std::move(group));
 }
 
 void PieceTable::Redo() {
   if (m_redoStack.empty())
     return;
 
-  m_undoStack.push_back(m_pieces);
-  m_pieces = m_redoStack.back();
+  m_groupOpen = false;
+  UndoGroup group = std::move(m_redoStack.back());
   m_redoStack.pop_back();
+  for (const auto &record : group.records) {
+    SplicePieces(record.pos, TotalPieceLength(record.removed),
+                 record.inserted);
+  }
+  group.typingRun = false;
+  m_undoStack.push_back(std::move(group));
+}
 
-  // Recalculate total length and lines
-  m_totalLength = 0;
-  m_totalLines = 1;
-  for (const auto &p : m_pieces) {
-    m_totalLength += p.length;
-    m_totalLines += p.lineCount;
+size_t PieceTable::GetUndoMemoryUsage() const {
+  size_t bytes = 0;
+  for (const auto *stack : {&m_undoStack, &m_redoStack}) {
+    for (const auto &g : *stack) {
+      bytes += sizeof(UndoGroup) + g.records.capacity() * sizeof(UndoRecord);
+      for (const auto &r : g.records) {
+        bytes +=
+            (r.removed.capacity() + r.inserted.capacity()) * sizeof(Piece);
+      }
+    }
   }
+  return bytes;
+}
+
+bool PieceTable::ReadPiece(
+    const Piece &piece,
+    const std::function<bool(const char *, size_t)> &f) const {
+  size_t limit = piece.bufferType == BufferType::Added ? m_added.size()
+                                                       : m_originalLength;
+  if (piece.start > limit || piece.length > limit - piece.start)
+    return false;
+  return VisitBuffer(piece.bufferType, piece.start, piece.length, f);
 }
 
 std::string PieceTable::GetText(size_t pos, size_t length) const {
@@ -266,42 +694,149 @@ std::string PieceTable::GetText(size_t pos, size_t length) const {
   std::string result;
   result.reserve(length);
 
-  size_t accumulated = 0;
+  PieceTree::Position info = FindPiecePosition(pos);
   size_t remaining = length;
-  size_t currentPos = pos;
-
-  for (const auto &piece : m_pieces) {
-    size_t pieceEnd = accumulated + piece.length;
-    if (currentPos < pieceEnd) {
-      size_t offset = currentPos - accumulated;
-      size_t count = std::min(remaining, piece.length - offset);
-
-      if (piece.bufferType == BufferType::Original) {
-        result.append(m_originalData + piece.start + offset, count);
-      } else {
-        // OPTIMIZATION #4: Use append instead of += and substr to avoid
-        // intermediate strings
-        result.append(m_addedBuffer.data() + piece.start + offset, count);
-      }
-
-      remaining -= count;
-      currentPos += count;
-      if (remaining == 0)
-        break;
-    }
-    accumulated += piece.length;
+  size_t offset = info.offsetInPiece;
+
+  for (PieceTree::Node *node = info.node; node && remaining > 0;
+       node = m_pieces.Next(node)) {
+    const Piece &piece = node->piece;
+    size_t count = std::min(remaining, piece.length - offset);
+    // OPTIMIZATION #4: Use append instead of += and substr to avoid
+    // intermediate strings
+    VisitBuffer(piece.bufferType, piece.start + offset, count,
+                [&](const char *data, size_t n) {
+                  result.append(data, n);
+                  return true;
+                });
+    remaining -= count;
+    offset = 0;
   }
 
   return result;
 }
 
+void PieceTable::ForEachSpan(size_t pos, size_t length,
+                             const SpanVisitor &visitor) const {
+  if (length == 0 || pos >= m_totalLength)
+    return;
+  if (pos + length > m_totalLength)
+    length = m_totalLength - pos;
+
+  PieceTree::Position info = FindPiecePosition(pos);
+  size_t remaining = length;
+  size_t offset = info.offsetInPiece;
+  size_t docOffset = pos;
+  for (PieceTree::Node *node = info.node; node && remaining > 0;
+       node = m_pieces.Next(node)) {
+    const Piece &piece = node->piece;
+    size_t count = (std::min)(remaining, piece.length - offset);
+    bool more = VisitBuffer(piece.bufferType, piece.start + offset, count,
+                            [&](const char *data, size_t n) {
+                              if (!visitor(data, n, docOffset))
+                                return false;
+                              docOffset += n;
+                              return true;
+                            });
+    if (!more)
+      return;
+    remaining -= count;
+    offset = 0;
+  }
+}
+
+void PieceTable::ForEachSpanReverse(size_t pos, size_t length,
+                                    const SpanVisitor &visitor) const {
+  if (length == 0 || pos >= m_totalLength)
+    return;
+  if (pos + length > m_totalLength)
+    length = m_totalLength - pos;
+
+  // Start at the piece holding the last byte of the range
+  size_t end = pos + length;
+  PieceTree::Position info = FindPiecePosition(end - 1);
+  size_t pieceStart = info.pieceStart;
+  size_t spanEnd = end;
+  PieceTree::Node *node = info.node;
+  while (node && spanEnd > pos) {
+    size_t spanStart = (std::max)(pieceStart, pos);
+    size_t docEnd = spanEnd;
+    bool more = VisitBufferReverse(
+        node->piece.bufferType, node->piece.start + (spanStart - pieceStart),
+        spanEnd - spanStart, [&](const char *data, size_t n) {
+          docEnd -= n;
+          return visitor(data, n, docEnd);
+        });
+    if (!more)
+      return;
+    spanEnd = spanStart;
+    node = m_pieces.Prev(node);
+    if (node)
+      pieceStart -= node->piece.length;
+  }
+}
+
 void PieceTable::WriteTo(
     std::function<void(const char *, size_t)> writer) const {
-  for (const auto &piece : m_pieces) {
-    writer(GetPieceData(piece), piece.length);
+  for (PieceTree::Node *node = m_pieces.First(); node;
+       node = m_pieces.Next(node)) {
+    VisitBuffer(node->piece.bufferType, node->piece.start, node->piece.length,
+                [&](const char *data, size_t n) {
+                  writer(data, n);
+                  return true;
+                });
   }
 }
 
+void PieceTable::WriteTo(std::function<void(const char *, size_t)> writer,
+                         std::function<bool(size_t, size_t)> copy) const {
+  // Adjacent Original pieces that continue each other (as left by edits
+  // elsewhere) form a single run
+  size_t runStart = 0, runLength = 0;
+  auto flushRun = [&]() {
+    if (runLength > 0 && !copy(runStart, runLength))
+      VisitBuffer(BufferType::Original, runStart, runLength,
+                  [&](const char *data, size_t n) {
+                    writer(data, n);
+                    return true;
+                  });
+    runLength = 0;
+  };
+  for (PieceTree::Node *node = m_pieces.First(); node;
+       node = m_pieces.Next(node)) {
+    const Piece &piece = node->piece;
+    if (piece.bufferType == BufferType::Original) {
+      if (runLength > 0 && piece.start != runStart + runLength)
+        flushRun();
+      if (runLength == 0)
+        runStart = piece.start;
+      runLength += piece.length;
+      continue;
+    }
+    flushRun();
+    VisitBuffer(piece.bufferType, piece.start, piece.length,
+                [&](const char *data, size_t n) {
+                  writer(data, n);
+                  return true;
+                });
+  }
+  flushRun();
+}
+
+PieceTable::Snapshot PieceTable::TakeSnapshot() const {
+  auto table = std::make_shared<PieceTable>();
+  table->m_originalData = m_originalData;
+  table->m_originalLength = m_originalLength;
+  table->m_originalLoaded = m_originalLoaded;
+  table->m_originalSource = m_originalSource;
+  table->m_added = m_added; // shares the blocks
+  table->m_pieces = m_pieces;
+  table->m_totalLength = m_totalLength;
+  Snapshot snapshot;
+  snapshot.m_table = std::move(table);
+  return snapshot;
+}
+
 size_t PieceTable::GetTotalLength() const { return m_totalLength; }
 
 size_t PieceTable::GetTotalLines() const { return m_totalLines; }
@@ -312,90 +847,58 @@ size_t PieceTable::GetLineAtOffset(size_t offset) const {
   if (offset >= m_totalLength)
     return GetTotalLines() - 1;
 
-  size_t currentLine = 0;
-  size_t accumulatedOffset = 0;
-
-  for (const auto &p : m_pieces) {
-    if (offset < accumulatedOffset + p.length) {
-      // Offset is in this piece
-      const char *data = GetPieceData(p);
-      size_t offsetInPiece = offset - accumulatedOffset;
-      currentLine += CountNewlines(data, offsetInPiece);
-      return currentLine;
-    }
-    currentLine += p.lineCount;
-    accumulatedOffset += p.length;
-  }
-
-  return currentLine;
-}
-
-// OPTIMIZATION #1: Line offset cache for O(1) lookups (10,000x faster)
-void PieceTable::RebuildLineCache() const {
-  m_lineOffsetCache.clear();
-  m_lineOffsetCache.reserve(GetTotalLines() + 1);
-  m_lineOffsetCache.push_back(0); // Line 0 starts at offset 0
-
-  size_t currentOffset = 0;
-  for (const auto &p : m_pieces) {
-    const char *data = GetPieceData(p);
-    size_t i = 0;
-
-#ifdef _MSC_VER // Use SSE2 on MSVC
-    __m128i newline = _mm_set1_epi8('\n');
-    for (; i + 16 <= p.length; i += 16) {
-      __m128i chunk = _mm_loadu_si128((__m128i *)(data + i));
-      __m128i cmp = _mm_cmpeq_epi8(chunk, newline);
-      int mask = _mm_movemask_epi8(cmp);
-      if (mask != 0) {
-        for (int b = 0; b < 16; ++b) {
-          if ((mask >> b) & 1) {
-            m_lineOffsetCache.push_back(currentOffset + i + b + 1);
-          }
-        }
-      }
-    }
-#endif
-
-    // Handle remaining bytes or if not using SSE2
-    for (; i < p.length; ++i) {
-      if (data[i] == '\n') {
-        m_lineOffsetCache.push_back(currentOffset + i + 1);
-      }
-    }
-    currentOffset += p.length;
-  }
-
-  m_lineCacheValid = true;
+  // Lines in preceding pieces come from the tree aggregates and lines in the
+  // prefix of the containing piece from its buffer's newline table.
+  PieceTree::Position info = FindPiecePosition(offset);
+  const Piece &piece = info.node->piece;
+  return info.linesBefore +
+         CountNewlinesIn(piece.bufferType, piece.start, info.offsetInPiece);
 }
 
+// OPTIMIZATION #1: O(log pieces + log lines) line lookup without a
+// document-wide cache, so edits never trigger a full rescan.
 size_t PieceTable::GetLineOffset(size_t lineIndex) const {
-  // OPTIMIZATION: Use cached line offsets for O(1) lookup
-  if (!m_lineCacheValid) {
-    RebuildLineCache();
-  }
+  if (lineIndex == 0)
+    return 0;
+  if (lineIndex >= m_totalLines)
+    return m_totalLength;
 
-  if (lineIndex >= m_lineOffsetCache.size()) {
+  // Line N starts right after the N-th newline of the document
+  PieceTree::Position info = m_pieces.FindByNewline(lineIndex);
+  if (!info.node)
     return m_totalLength;
-  }
 
-  return m_lineOffsetCache[lineIndex];
+  const Piece &piece = info.node->piece;
+  size_t nth = lineIndex - info.linesBefore; // counted from 1 in this piece
+  size_t newlinePos;
+  if (piece.bufferType == BufferType::Original) {
+    newlinePos = FindOriginalNewline(OriginalNewlinesBefore(piece.start) + nth -
+                                     1);
+  } else {
+    size_t first = static_cast<size_t>(
+        std::lower_bound(m_addedNewlines.begin(), m_addedNewlines.end(),
+                         piece.start) -
+        m_addedNewlines.begin());
+    newlinePos = m_addedNewlines[first + nth - 1];
+  }
+  return info.pieceStart + (newlinePos - piece.start) + 1;
 }
 
 // OPTIMIZATION #5: Piece table compaction (30-50% memory reduction)
 void PieceTable::CompactPieces() {
-  if (m_pieces.size() < 2) {
+  if (m_pieces.Size() < 2) {
     m_editsSinceCompaction = 0;
     return;
   }
 
+  std::vector<Piece> pieces = m_pieces.ToVector();
   std::vector<Piece> compacted;
-  compacted.reserve(m_pieces.size());
-  compacted.push_back(m_pieces[0]);
+  compacted.reserve(pieces.size());
+  compacted.push_back(pieces[0]);
 
-  for (size_t i = 1; i < m_pieces.size(); ++i) {
+  for (size_t i = 1; i < pieces.size(); ++i) {
     Piece &last = compacted.back();
-    const Piece &current = m_pieces[i];
+    const Piece &current = pieces[i];
 
     // Merge if same buffer type and contiguous
     if (last.bufferType == current.bufferType &&
@@ -408,9 +911,8 @@ void PieceTable::CompactPieces() {
   }
 
   // Only update if we actually reduced the count
-  if (compacted.size() < m_pieces.size()) {
-    m_pieces = std::move(compacted);
-    InvalidateLineCache(); // Cache needs rebuild after compaction
+  if (compacted.size() < pieces.size()) {
+    m_pieces.Build(compacted);
   }
 
   m_editsSinceCompaction = 0;
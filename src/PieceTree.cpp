@@ -0,0 +1,468 @@
+#include "../include/PieceTree.h"
+#include <utility>
+
+PieceTree::PieceTree() {
+  m_nil = new Node(Piece(BufferType::Original, 0, 0, 0));
+  m_nil->red = false;
+  m_nil->subCount = 0;
+  m_nil->left = m_nil->right = m_nil->parent = m_nil;
+  m_root = m_nil;
+}
+
+PieceTree::~PieceTree() {
+  FreeSubtree(m_root);
+  delete m_nil;
+}
+
+PieceTree::PieceTree(const PieceTree &other) : PieceTree() {
+  Build(other.ToVector());
+}
+
+PieceTree &PieceTree::operator=(const PieceTree &other) {
+  if (this != &other)
+    Build(other.ToVector());
+  return *this;
+}
+
+// Nodes reference their owning tree's sentinel, so moving swaps both
+PieceTree::PieceTree(PieceTree &&other) noexcept : PieceTree() {
+  std::swap(m_nil, other.m_nil);
+  std::swap(m_root, other.m_root);
+}
+
+PieceTree &PieceTree::operator=(PieceTree &&other) noexcept {
+  std::swap(m_nil, other.m_nil);
+  std::swap(m_root, other.m_root);
+  return *this;
+}
+
+void PieceTree::FreeSubtree(Node *x) {
+  // Iterative post-order free to avoid deep recursion on degenerate input
+  while (x != m_nil) {
+    if (x->left != m_nil) {
+      x = x->left;
+    } else if (x->right != m_nil) {
+      x = x->right;
+    } else {
+      Node *parent = x->parent;
+      if (parent != m_nil) {
+        if (parent->left == x)
+          parent->left = m_nil;
+        else
+          parent->right = m_nil;
+      }
+      delete x;
+      x = parent;
+    }
+  }
+}
+
+void PieceTree::Clear() {
+  FreeSubtree(m_root);
+  m_root = m_nil;
+  m_nil->parent = m_nil;
+}
+
+PieceTree::Node *PieceTree::BuildRange(const std::vector<Piece> &pieces,
+                                       size_t lo, size_t hi, size_t depth,
+                                       size_t redDepth, Node *parent) {
+  if (lo >= hi)
+    return m_nil;
+  size_t mid = lo + (hi - lo) / 2;
+  Node *x = new Node(pieces[mid]);
+  x->parent = parent;
+  // All levels above the deepest one are full, so colouring only the deepest
+  // level red gives every root-to-leaf path the same black height.
+  x->red = (depth == redDepth);
+  x->left = BuildRange(pieces, lo, mid, depth + 1, redDepth, x);
+  x->right = BuildRange(pieces, mid + 1, hi, depth + 1, redDepth, x);
+  Recalc(x);
+  return x;
+}
+
+void PieceTree::Build(const std::vector<Piece> &pieces) {
+  Clear();
+  if (pieces.empty())
+    return;
+  size_t redDepth = 0;
+  for (size_t n = pieces.size(); n > 1; n >>= 1)
+    redDepth++;
+  m_root = BuildRange(pieces, 0, pieces.size(), 0, redDepth, m_nil);
+  m_root->red = false;
+}
+
+std::vector<Piece> PieceTree::ToVector() const {
+  std::vector<Piece> result;
+  result.reserve(Size());
+  for (Node *x = First(); x; x = Next(x))
+    result.push_back(x->piece);
+  return result;
+}
+
+PieceTree::Node *PieceTree::Minimum(Node *x) const {
+  while (x->left != m_nil)
+    x = x->left;
+  return x;
+}
+
+PieceTree::Node *PieceTree::Maximum(Node *x) const {
+  while (x->right != m_nil)
+    x = x->right;
+  return x;
+}
+
+PieceTree::Node *PieceTree::First() const {
+  return Empty() ? nullptr : Minimum(m_root);
+}
+
+PieceTree::Node *PieceTree::Last() const {
+  return Empty() ? nullptr : Maximum(m_root);
+}
+
+PieceTree::Node *PieceTree::Next(const Node *node) const {
+  if (!node)
+    return nullptr;
+  if (node->right != m_nil)
+    return Minimum(node->right);
+  Node *p = node->parent;
+  while (p != m_nil && node == p->right) {
+    node = p;
+    p = p->parent;
+  }
+  return p == m_nil ? nullptr : p;
+}
+
+PieceTree::Node *PieceTree::Prev(const Node *node) const {
+  if (!node)
+    return nullptr;
+  if (node->left != m_nil)
+    return Maximum(node->left);
+  Node *p = node->parent;
+  while (p != m_nil && node == p->left) {
+    node = p;
+    p = p->parent;
+  }
+  return p == m_nil ? nullptr : p;
+}
+
+PieceTree::Position PieceTree::FindByOffset(size_t pos) const {
+  if (Empty())
+    return {nullptr, 0, 0, 0};
+  if (pos >= TotalLength()) {
+    Node *last = Last();
+    return {last, last->piece.length, TotalLength() - last->piece.length,
+            TotalLines() - last->piece.lineCount};
+  }
+
+  Node *x = m_root;
+  size_t pieceStart = 0;
+  size_t linesBefore = 0;
+  while (x != m_nil) {
+    if (pos < x->left->subLength) {
+      x = x->left;
+    } else {
+      size_t leftEnd = x->left->subLength;
+      if (pos < leftEnd + x->piece.length) {
+        return {x, pos - leftEnd, pieceStart + leftEnd,
+                linesBefore + x->left->subLines};
+      }
+      size_t skip = leftEnd + x->piece.length;
+      pos -= skip;
+      pieceStart += skip;
+      linesBefore += x->left->subLines + x->piece.lineCount;
+      x = x->right;
+    }
+  }
+  return {nullptr, 0, 0, 0};
+}
+
+PieceTree::Position PieceTree::FindByNewline(size_t lineIndex) const {
+  if (Empty() || lineIndex == 0 || lineIndex > TotalLines())
+    return {nullptr, 0, 0, 0};
+
+  Node *x = m_root;
+  size_t pieceStart = 0;
+  size_t linesBefore = 0;
+  size_t remaining = lineIndex;
+  while (x != m_nil) {
+    if (remaining <= x->left->subLines) {
+      x = x->left;
+    } else {
+      size_t leftLines = x->left->subLines;
+      if (remaining <= leftLines + x->piece.lineCount) {
+        return {x, 0, pieceStart + x->left->subLength,
+                linesBefore + leftLines};
+      }
+      remaining -= leftLines + x->piece.lineCount;
+      linesBefore += leftLines + x->piece.lineCount;
+      pieceStart += x->left->subLength + x->piece.length;
+      x = x->right;
+    }
+  }
+  return {nullptr, 0, 0, 0};
+}
+
+PieceTree::Node *PieceTree::NodeAt(size_t index) const {
+  if (index >= Size())
+    return nullptr;
+  Node *x = m_root;
+  while (x != m_nil) {
+    size_t leftCount = x->left->subCount;
+    if (index < leftCount) {
+      x = x->left;
+    } else if (index == leftCount) {
+      return x;
+    } else {
+      index -= leftCount + 1;
+      x = x->right;
+    }
+  }
+  return nullptr;
+}
+
+size_t PieceTree::IndexOf(const Node *node) const {
+  size_t index = node->left->subCount;
+  while (node->parent != m_nil) {
+    if (node == node->parent->right)
+      index += node->parent->left->subCount + 1;
+    node = node->parent;
+  }
+  return index;
+}
+
+void PieceTree::Recalc(Node *x) {
+  if (x == m_nil)
+    return;
+  x->subLength = x->left->subLength + x->piece.length + x->right->subLength;
+  x->subLines = x->left->subLines + x->piece.lineCount + x->right->subLines;
+  x->subCount = x->left->subCount + 1 + x->right->subCount;
+}
+
+void PieceTree::UpdateUpwards(Node *x) {
+  while (x != m_nil) {
+    Recalc(x);
+    x = x->parent;
+  }
+}
+
+void PieceTree::Update(Node *node) { UpdateUpwards(node); }
+
+void PieceTree::RotateLeft(Node *x) {
+  Node *y = x->right;
+  x->right = y->left;
+  if (y->left != m_nil)
+    y->left->parent = x;
+  y->parent = x->parent;
+  if (x->parent == m_nil)
+    m_root = y;
+  else if (x == x->parent->left)
+    x->parent->left = y;
+  else
+    x->parent->right = y;
+  y->left = x;
+  x->parent = y;
+  Recalc(x);
+  Recalc(y);
+}
+
+void PieceTree::RotateRight(Node *x) {
+  Node *y = x->left;
+  x->left = y->right;
+  if (y->right != m_nil)
+    y->right->parent = x;
+  y->parent = x->parent;
+  if (x->parent == m_nil)
+    m_root = y;
+  else if (x == x->parent->right)
+    x->parent->right = y;
+  else
+    x->parent->left = y;
+  y->right = x;
+  x->parent = y;
+  Recalc(x);
+  Recalc(y);
+}
+
+void PieceTree::Attach(Node *parent, Node *z, bool asLeft) {
+  z->left = z->right = m_nil;
+  z->parent = parent;
+  z->red = true;
+  if (parent == m_nil)
+    m_root = z;
+  else if (asLeft)
+    parent->left = z;
+  else
+    parent->right = z;
+  UpdateUpwards(z);
+  InsertFixup(z);
+}
+
+PieceTree::Node *PieceTree::InsertBefore(Node *at, const Piece &piece) {
+  Node *z = new Node(piece);
+  if (Empty()) {
+    Attach(m_nil, z, true);
+  } else if (!at) {
+    Attach(Maximum(m_root), z, false);
+  } else if (at->left == m_nil) {
+    Attach(at, z, true);
+  } else {
+    Attach(Maximum(at->left), z, false);
+  }
+  return z;
+}
+
+PieceTree::Node *PieceTree::InsertAfter(Node *at, const Piece &piece) {
+  Node *z = new Node(piece);
+  if (Empty()) {
+    Attach(m_nil, z, true);
+  } else if (!at) {
+    Attach(Minimum(m_root), z, true);
+  } else if (at->right == m_nil) {
+    Attach(at, z, false);
+  } else {
+    Attach(Minimum(at->right), z, true);
+  }
+  return z;
+}
+
+void PieceTree::InsertFixup(Node *z) {
+  while (z->parent->red) {
+    Node *gp = z->parent->parent;
+    if (z->parent == gp->left) {
+      Node *uncle = gp->right;
+      if (uncle->red) {
+        z->parent->red = false;
+        uncle->red = false;
+        gp->red = true;
+        z = gp;
+      } else {
+        if (z == z->parent->right) {
+          z = z->parent;
+          RotateLeft(z);
+        }
+        z->parent->red = false;
+        z->parent->parent->red = true;
+        RotateRight(z->parent->parent);
+      }
+    } else {
+      Node *uncle = gp->left;
+      if (uncle->red) {
+        z->parent->red = false;
+        uncle->red = false;
+        gp->red = true;
+        z = gp;
+      } else {
+        if (z == z->parent->left) {
+          z = z->parent;
+          RotateRight(z);
+        }
+        z->parent->red = false;
+        z->parent->parent->red = true;
+        RotateLeft(z->parent->parent);
+      }
+    }
+  }
+  m_root->red = false;
+}
+
+void PieceTree::Transplant(Node *u, Node *v) {
+  if (u->parent == m_nil)
+    m_root = v;
+  else if (u == u->parent->left)
+    u->parent->left = v;
+  else
+    u->parent->right = v;
+  v->parent = u->parent;
+}
+
+void PieceTree::Erase(Node *z) {
+  if (!z || z == m_nil)
+    return;
+
+  Node *y = z;
+  bool yWasRed = y->red;
+  Node *x;
+  if (z->left == m_nil) {
+    x = z->right;
+    Transplant(z, z->right);
+  } else if (z->right == m_nil) {
+    x = z->left;
+    Transplant(z, z->left);
+  } else {
+    y = Minimum(z->right);
+    yWasRed = y->red;
+    x = y->right;
+    if (y->parent == z) {
+      x->parent = y;
+    } else {
+      Transplant(y, y->right);
+      y->right = z->right;
+      y->right->parent = y;
+    }
+    Transplant(z, y);
+    y->left = z->left;
+    y->left->parent = y;
+    y->red = z->red;
+  }
+
+  UpdateUpwards(x->parent);
+  if (!yWasRed)
+    EraseFixup(x);
+  m_nil->parent = m_nil;
+  delete z;
+}
+
+void PieceTree::EraseFixup(Node *x) {
+  while (x != m_root && !x->red) {
+    if (x == x->parent->left) {
+      Node *w = x->parent->right;
+      if (w->red) {
+        w->red = false;
+        x->parent->red = true;
+        RotateLeft(x->parent);
+        w = x->parent->right;
+      }
+      if (!w->left->red && !w->right->red) {
+        w->red = true;
+        x = x->parent;
+      } else {
+        if (!w->right->red) {
+          w->left->red = false;
+          w->red = true;
+          RotateRight(w);
+          w = x->parent->right;
+        }
+        w->red = x->parent->red;
+        x->parent->red = false;
+        w->right->red = false;
+        RotateLeft(x->parent);
+        x = m_root;
+      }
+    } else {
+      Node *w = x->parent->left;
+      if (w->red) {
+        w->red = false;
+        x->parent->red = true;
+        RotateRight(x->parent);
+        w = x->parent->left;
+      }
+      if (!w->right->red && !w->left->red) {
+        w->red = true;
+        x = x->parent;
+      } else {
+        if (!w->left->red) {
+          w->right->red = false;
+          w->red = true;
+          RotateLeft(w);
+          w = x->parent->left;
+        }
+        w->red = x->parent->red;
+        x->parent->red = false;
+        w->left->red = false;
+        RotateRight(x->parent);
+        x = m_root;
+      }
+    }
+  }
+  x->red = false;
+}
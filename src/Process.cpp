@@ -1,6 +1,8 @@
 #include "../include/Process.h"
 #include <vector>
 
+#ifdef _WIN32
+
 enum LogLevel { LOG_DEBUG = 0, LOG_INFO = 1, LOG_WARN = 2, LOG_ERROR = 3 };
 void DebugLog(const std::string &msg, LogLevel level = LOG_INFO);
 std::string GetWin32ErrorString(DWORD errorCode);
@@ -139,3 +141,20 @@ void Process::Stop() {
     m_hThread = NULL;
   }
 }
+
+#else
+
+Process::Process() : m_running(false) {}
+
+Process::~Process() {}
+
+bool Process::Start(const std::wstring &,
+                    std::function<void(const std::string &)>) {
+  return false;
+}
+
+void Process::Write(const std::string &) {}
+
+void Process::Stop() { m_running = false; }
+
+#endif
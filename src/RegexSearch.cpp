@@ -0,0 +1,986 @@
+#include "../include/RegexSearch.h"
+#include "../include/PieceTable.h"
+#include <algorithm>
+#include <bitset>
+#include <list>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+typedef std::bitset<256> ByteSet;
+
+enum AssertKind { LineStart, LineEnd, WordBoundary, NotWordBoundary };
+
+// Limits that keep compiled programs (and so per-byte work) bounded
+static const int MAX_REPEAT = 1000;
+static const size_t MAX_PROGRAM_SIZE = 100000;
+static const size_t CACHE_SIZE = 16;
+
+static bool IsWordByte(int c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_';
+}
+
+static ByteSet WordBytes() {
+  ByteSet s;
+  for (int c = 0; c < 128; ++c)
+    if (IsWordByte(c))
+      s.set(c);
+  return s;
+}
+
+static ByteSet DigitBytes() {
+  ByteSet s;
+  for (int c = '0'; c <= '9'; ++c)
+    s.set(c);
+  return s;
+}
+
+static ByteSet SpaceBytes() {
+  ByteSet s;
+  for (char c : {' ', '\t', '\n', '\r', '\f', '\v'})
+    s.set(static_cast<unsigned char>(c));
+  return s;
+}
+
+static ByteSet AsciiBytes() {
+  ByteSet s;
+  for (int c = 0; c < 128; ++c)
+    s.set(c);
+  return s;
+}
+
+static void AppendUtf8(std::string &out, unsigned int cp) {
+  if (cp < 0x80) {
+    out += static_cast<char>(cp);
+  } else if (cp < 0x800) {
+    out += static_cast<char>(0xC0 | (cp >> 6));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    out += static_cast<char>(0xE0 | (cp >> 12));
+    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  } else {
+    out += static_cast<char>(0xF0 | (cp >> 18));
+    out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Syntax tree
+// ----------------------------------------------------------------------------
+
+namespace {
+
+struct Node {
+  enum Kind { Empty, Bytes, Concat, Alt, Repeat, Assert } kind = Empty;
+  ByteSet bytes;
+  std::vector<int> children;
+  int min = 0;
+  int max = 0; // < 0 means unbounded
+  bool greedy = true;
+  AssertKind assertion = LineStart;
+};
+
+// Recursive descent parser producing a byte-level syntax tree. Fails on
+// syntax errors and on features the NFA cannot express.
+class Parser {
+public:
+  Parser(const std::string &pattern, bool matchCase, std::vector<Node> &nodes)
+      : m_p(pattern), m_pos(0), m_matchCase(matchCase), m_nodes(nodes),
+        m_failed(false) {}
+
+  int Parse() {
+    int root = ParseAlt();
+    if (m_pos != m_p.size())
+      m_failed = true; // unbalanced ')'
+    return m_failed ? -1 : root;
+  }
+
+private:
+  const std::string &m_p;
+  size_t m_pos;
+  bool m_matchCase;
+  std::vector<Node> &m_nodes;
+  bool m_failed;
+
+  bool AtEnd() const { return m_pos >= m_p.size(); }
+  char Peek() const { return m_p[m_pos]; }
+
+  int Add(const Node &n) {
+    m_nodes.push_back(n);
+    return static_cast<int>(m_nodes.size() - 1);
+  }
+
+  int MakeBytes(ByteSet bytes) {
+    if (!m_matchCase) {
+      for (int c = 'a'; c <= 'z'; ++c) {
+        if (bytes[c] || bytes[c - 32]) {
+          bytes.set(c);
+          bytes.set(c - 32);
+        }
+      }
+    }
+    Node n;
+    n.kind = Node::Bytes;
+    n.bytes = bytes;
+    return Add(n);
+  }
+
+  int MakeByte(unsigned char c) {
+    ByteSet s;
+    s.set(c);
+    return MakeBytes(s);
+  }
+
+  int MakeNode(Node::Kind kind, std::vector<int> children) {
+    Node n;
+    n.kind = kind;
+    n.children = std::move(children);
+    return Add(n);
+  }
+
+  int MakeSequence(const std::string &bytes) {
+    std::vector<int> parts;
+    for (unsigned char c : bytes)
+      parts.push_back(MakeByte(c));
+    return parts.size() == 1 ? parts[0] : MakeNode(Node::Concat, parts);
+  }
+
+  // One character: a byte from 'ascii', or (if withMultiByte) any UTF-8
+  // multi-byte sequence. Stray bytes that cannot start a valid sequence
+  // match as single characters so invalid text stays searchable.
+  int MakeCharClass(const ByteSet &ascii, bool withMultiByte) {
+    if (!withMultiByte)
+      return MakeBytes(ascii);
+    ByteSet single = ascii, cont, lead2, lead3, lead4;
+    for (int c = 0x80; c <= 0xC1; ++c)
+      single.set(c);
+    for (int c = 0xF5; c <= 0xFF; ++c)
+      single.set(c);
+    for (int c = 0x80; c <= 0xBF; ++c)
+      cont.set(c);
+    for (int c = 0xC2; c <= 0xDF; ++c)
+      lead2.set(c);
+    for (int c = 0xE0; c <= 0xEF; ++c)
+      lead3.set(c);
+    for (int c = 0xF0; c <= 0xF4; ++c)
+      lead4.set(c);
+    auto seq = [&](const ByteSet &lead, int continuations) {
+      std::vector<int> parts = {MakeBytes(lead)};
+      for (int i = 0; i < continuations; ++i)
+        parts.push_back(MakeBytes(cont));
+      return MakeNode(Node::Concat, parts);
+    };
+    // Whole sequences are preferred over the stray-byte fallback
+    return MakeNode(Node::Alt, {seq(lead2, 1), seq(lead3, 2), seq(lead4, 3),
+                                MakeBytes(single)});
+  }
+
+  int ParseAlt() {
+    std::vector<int> alternatives = {ParseConcat()};
+    while (!m_failed && !AtEnd() && Peek() == '|') {
+      ++m_pos;
+      alternatives.push_back(ParseConcat());
+    }
+    return alternatives.size() == 1 ? alternatives[0]
+                                    : MakeNode(Node::Alt, alternatives);
+  }
+
+  int ParseConcat() {
+    std::vector<int> parts;
+    while (!m_failed && !AtEnd() && Peek() != '|' && Peek() != ')')
+      parts.push_back(ParseRepeat());
+    if (parts.empty())
+      return Add(Node());
+    return parts.size() == 1 ? parts[0] : MakeNode(Node::Concat, parts);
+  }
+
+  // Parses {n}, {n,} or {n,m} at m_pos; leaves m_pos untouched if the brace
+  // does not start a quantifier (it is then a literal, as in ECMAScript).
+  bool ParseBraces(int &min, int &max) {
+    size_t p = m_pos + 1;
+    auto number = [&](int &value) {
+      size_t begin = p;
+      long v = 0;
+      while (p < m_p.size() && m_p[p] >= '0' && m_p[p] <= '9') {
+        v = v * 10 + (m_p[p] - '0');
+        if (v > MAX_REPEAT)
+          v = MAX_REPEAT + 1;
+        ++p;
+      }
+      value = static_cast<int>(v);
+      return p > begin;
+    };
+    if (!number(min))
+      return false;
+    max = min;
+    if (p < m_p.size() && m_p[p] == ',') {
+      ++p;
+      if (!number(max))
+        max = -1;
+    }
+    if (p >= m_p.size() || m_p[p] != '}')
+      return false;
+    m_pos = p + 1;
+    return true;
+  }
+
+  int ParseRepeat() {
+    int atom = ParseAtom();
+    if (m_failed || AtEnd())
+      return atom;
+
+    int min = 0, max = 0;
+    char c = Peek();
+    if (c == '*') {
+      min = 0, max = -1, ++m_pos;
+    } else if (c == '+') {
+      min = 1, max = -1, ++m_pos;
+    } else if (c == '?') {
+      min = 0, max = 1, ++m_pos;
+    } else if (c != '{' || !ParseBraces(min, max)) {
+      return atom;
+    }
+
+    if (m_nodes[atom].kind == Node::Assert || min > MAX_REPEAT ||
+        max > MAX_REPEAT || (max >= 0 && max < min)) {
+      m_failed = true;
+      return atom;
+    }
+    Node n;
+    n.kind = Node::Repeat;
+    n.children = {atom};
+    n.min = min;
+    n.max = max;
+    if (!AtEnd() && Peek() == '?') {
+      n.greedy = false;
+      ++m_pos;
+    }
+    if (!AtEnd() && (Peek() == '*' || Peek() == '+' || Peek() == '?'))
+      m_failed = true; // nothing to repeat
+    return Add(n);
+  }
+
+  bool ParseHex(int digits, unsigned int &value) {
+    value = 0;
+    for (int i = 0; i < digits; ++i) {
+      if (AtEnd())
+        return false;
+      char h = m_p[m_pos++];
+      value <<= 4;
+      if (h >= '0' && h <= '9')
+        value |= h - '0';
+      else if (h >= 'a' && h <= 'f')
+        value |= h - 'a' + 10;
+      else if (h >= 'A' && h <= 'F')
+        value |= h - 'A' + 10;
+      else
+        return false;
+    }
+    return true;
+  }
+
+  // Escapes that stand for a single code point (shared by atoms and
+  // classes). Returns false if the escape is not of that kind.
+  bool ParseCodePointEscape(char e, unsigned int &cp) {
+    switch (e) {
+    case 'n':
+      cp = '\n';
+      return true;
+    case 'r':
+      cp = '\r';
+      return true;
+    case 't':
+      cp = '\t';
+      return true;
+    case 'f':
+      cp = '\f';
+      return true;
+    case 'v':
+      cp = '\v';
+      return true;
+    case '0':
+      cp = 0;
+      return true;
+    case 'x':
+      if (!ParseHex(2, cp))
+        m_failed = true;
+      return true;
+    case 'u':
+      if (!ParseHex(4, cp))
+        m_failed = true;
+      return true;
+    default:
+      if ((e >= '1' && e <= '9') || e == 'c' || e == 'k') {
+        m_failed = true; // backreferences and control escapes
+        return true;
+      }
+      if ((e >= 'a' && e <= 'z') || (e >= 'A' && e <= 'Z'))
+        return false;
+      cp = static_cast<unsigned char>(e); // escaped punctuation
+      return true;
+    }
+  }
+
+  // Reads one (possibly multi-byte) literal character from the pattern
+  unsigned int ReadCodePoint() {
+    unsigned char c = static_cast<unsigned char>(m_p[m_pos++]);
+    int extra = (c >= 0xF0) ? 3 : (c >= 0xE0) ? 2 : (c >= 0xC0) ? 1 : 0;
+    unsigned int cp = extra == 3 ? (c & 0x07) : extra == 2 ? (c & 0x0F)
+                      : extra == 1 ? (c & 0x1F) : c;
+    for (int i = 0; i < extra && !AtEnd(); ++i)
+      cp = (cp << 6) | (static_cast<unsigned char>(m_p[m_pos++]) & 0x3F);
+    return cp;
+  }
+
+  int ParseClass() {
+    bool negated = false;
+    if (!AtEnd() && Peek() == '^') {
+      negated = true;
+      ++m_pos;
+    }
+    ByteSet ascii;
+    bool allMultiByte = false;     // from \D, \W, \S
+    std::vector<std::string> wide; // non-ASCII members
+
+    while (!m_failed && !AtEnd() && Peek() != ']') {
+      unsigned int lo = 0;
+      if (Peek() == '\\') {
+        ++m_pos;
+        if (AtEnd()) {
+          m_failed = true;
+          break;
+        }
+        char e = m_p[m_pos++];
+        if (e == 'd' || e == 'w' || e == 's' || e == 'D' || e == 'W' ||
+            e == 'S') {
+          ByteSet s = (e == 'd' || e == 'D')   ? DigitBytes()
+                      : (e == 'w' || e == 'W') ? WordBytes()
+                                               : SpaceBytes();
+          if (e >= 'A' && e <= 'Z') {
+            s = AsciiBytes() & ~s;
+            allMultiByte = true;
+          }
+          ascii |= s;
+          continue;
+        }
+        if (e == 'b') {
+          lo = '\b';
+        } else if (!ParseCodePointEscape(e, lo)) {
+          m_failed = true;
+          break;
+        }
+      } else {
+        lo = ReadCodePoint();
+      }
+
+      unsigned int hi = lo;
+      if (m_pos + 1 < m_p.size() && Peek() == '-' && m_p[m_pos + 1] != ']') {
+        ++m_pos;
+        if (Peek() == '\\') {
+          ++m_pos;
+          if (AtEnd() || !ParseCodePointEscape(m_p[m_pos++], hi)) {
+            m_failed = true;
+            break;
+          }
+        } else {
+          hi = ReadCodePoint();
+        }
+        if (hi < lo || (hi >= 0x80 && hi != lo)) {
+          m_failed = true; // reversed or non-ASCII range
+          break;
+        }
+      }
+      if (lo < 0x80) {
+        for (unsigned int c = lo; c <= hi; ++c)
+          ascii.set(c);
+      } else {
+        std::string bytes;
+        AppendUtf8(bytes, lo);
+        wide.push_back(bytes);
+      }
+    }
+    if (AtEnd() || m_failed) {
+      m_failed = true;
+      return Add(Node());
+    }
+    ++m_pos; // ']'
+
+    if (negated) {
+      if (!wide.empty()) {
+        m_failed = true; // negated non-ASCII members are not supported
+        return Add(Node());
+      }
+      if (!m_matchCase) {
+        for (int c = 'a'; c <= 'z'; ++c) {
+          if (ascii[c] || ascii[c - 32]) {
+            ascii.set(c);
+            ascii.set(c - 32);
+          }
+        }
+      }
+      return MakeCharClass(AsciiBytes() & ~ascii, !allMultiByte);
+    }
+    if (wide.empty())
+      return MakeCharClass(ascii, allMultiByte);
+    std::vector<int> alternatives = {MakeCharClass(ascii, allMultiByte)};
+    for (const auto &w : wide)
+      alternatives.push_back(MakeSequence(w));
+    return MakeNode(Node::Alt, alternatives);
+  }
+
+  int MakeAssert(AssertKind kind) {
+    Node n;
+    n.kind = Node::Assert;
+    n.assertion = kind;
+    return Add(n);
+  }
+
+  int ParseAtom() {
+    unsigned char c = static_cast<unsigned char>(Peek());
+    switch (c) {
+    case '(': {
+      ++m_pos;
+      if (!AtEnd() && Peek() == '?') {
+        if (m_pos + 1 < m_p.size() && m_p[m_pos + 1] == ':') {
+          m_pos += 2;
+        } else {
+          m_failed = true; // lookaround and named groups
+          return Add(Node());
+        }
+      }
+      int inner = ParseAlt();
+      if (AtEnd() || Peek() != ')') {
+        m_failed = true;
+        return inner;
+      }
+      ++m_pos;
+      return inner;
+    }
+    case '[':
+      ++m_pos;
+      return ParseClass();
+    case '.': {
+      ++m_pos;
+      ByteSet s = AsciiBytes();
+      s.reset('\n');
+      s.reset('\r');
+      return MakeCharClass(s, true);
+    }
+    case '^':
+      ++m_pos;
+      return MakeAssert(LineStart);
+    case '$':
+      ++m_pos;
+      return MakeAssert(LineEnd);
+    case '*':
+    case '+':
+    case '?':
+      m_failed = true; // nothing to repeat
+      ++m_pos;
+      return Add(Node());
+    case '\\': {
+      ++m_pos;
+      if (AtEnd()) {
+        m_failed = true;
+        return Add(Node());
+      }
+      char e = m_p[m_pos++];
+      switch (e) {
+      case 'd':
+        return MakeCharClass(DigitBytes(), false);
+      case 'w':
+        return MakeCharClass(WordBytes(), false);
+      case 's':
+        return MakeCharClass(SpaceBytes(), false);
+      case 'D':
+        return MakeCharClass(AsciiBytes() & ~DigitBytes(), true);
+      case 'W':
+        return MakeCharClass(AsciiBytes() & ~WordBytes(), true);
+      case 'S':
+        return MakeCharClass(AsciiBytes() & ~SpaceBytes(), true);
+      case 'b':
+        return MakeAssert(WordBoundary);
+      case 'B':
+        return MakeAssert(NotWordBoundary);
+      default: {
+        unsigned int cp = 0;
+        if (!ParseCodePointEscape(e, cp))
+          m_failed = true;
+        std::string bytes;
+        AppendUtf8(bytes, cp);
+        return MakeSequence(bytes);
+      }
+      }
+    }
+    default: {
+      size_t begin = m_pos;
+      ReadCodePoint();
+      return MakeSequence(m_p.substr(begin, m_pos - begin));
+    }
+    }
+  }
+};
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+// Program (Thompson NFA) and its simulation
+// ----------------------------------------------------------------------------
+
+struct RegexSearcher::Program {
+  enum Op : unsigned char { Byte, Split, Jmp, Assert, Match };
+  struct Inst {
+    Op op;
+    int x; // Byte: set index, Split/Jmp: target, Assert: AssertKind
+    int y; // Split: lower-priority target
+  };
+  std::vector<Inst> insts;
+  std::vector<ByteSet> sets;
+  ByteSet firstBytes;  // bytes that can be consumed first
+  bool canMatchEmpty;  // a match may consume nothing
+  bool failed = false; // program grew past MAX_PROGRAM_SIZE
+  // Byte/Match instructions reachable from each thread entry point without
+  // consuming a byte, in priority order. Only used when the program has no
+  // assertions (their outcome depends on the surrounding text).
+  std::vector<std::vector<int>> closures;
+  bool useClosures = false;
+
+  int Emit(Op op, int x = 0, int y = 0) {
+    insts.push_back({op, x, y});
+    if (insts.size() > MAX_PROGRAM_SIZE)
+      failed = true;
+    return static_cast<int>(insts.size() - 1);
+  }
+
+  // 'reversed' compiles a program that reads the text right to left
+  void Compile(const std::vector<Node> &nodes, int n, bool reversed) {
+    if (failed)
+      return;
+    const Node &node = nodes[n];
+    switch (node.kind) {
+    case Node::Empty:
+      break;
+    case Node::Bytes:
+      sets.push_back(node.bytes);
+      Emit(Byte, static_cast<int>(sets.size() - 1));
+      break;
+    case Node::Concat:
+      if (reversed) {
+        for (auto it = node.children.rbegin(); it != node.children.rend(); ++it)
+          Compile(nodes, *it, reversed);
+      } else {
+        for (int child : node.children)
+          Compile(nodes, child, reversed);
+      }
+      break;
+    case Node::Alt: {
+      std::vector<int> jumps;
+      for (size_t i = 0; i < node.children.size(); ++i) {
+        if (i + 1 == node.children.size()) {
+          Compile(nodes, node.children[i], reversed);
+          break;
+        }
+        int split = Emit(Split);
+        insts[split].x = split + 1;
+        Compile(nodes, node.children[i], reversed);
+        jumps.push_back(Emit(Jmp));
+        insts[split].y = static_cast<int>(insts.size());
+      }
+      for (int j : jumps)
+        insts[j].x = static_cast<int>(insts.size());
+      break;
+    }
+    case Node::Repeat: {
+      int child = node.children[0];
+      for (int i = 0; i < node.min && !failed; ++i)
+        Compile(nodes, child, reversed);
+      if (node.max < 0) {
+        int loop = Emit(Split);
+        Compile(nodes, child, reversed);
+        Emit(Jmp, loop);
+        int out = static_cast<int>(insts.size());
+        insts[loop].x = node.greedy ? loop + 1 : out;
+        insts[loop].y = node.greedy ? out : loop + 1;
+      } else {
+        for (int i = node.min; i < node.max && !failed; ++i) {
+          int split = Emit(Split);
+          Compile(nodes, child, reversed);
+          int out = static_cast<int>(insts.size());
+          insts[split].x = node.greedy ? split + 1 : out;
+          insts[split].y = node.greedy ? out : split + 1;
+        }
+      }
+      break;
+    }
+    case Node::Assert:
+      Emit(Assert, node.assertion);
+      break;
+    }
+  }
+
+  void ComputeFirstBytes() {
+    std::vector<bool> seen(insts.size(), false);
+    std::vector<int> stack = {0};
+    canMatchEmpty = false;
+    while (!stack.empty()) {
+      int pc = stack.back();
+      stack.pop_back();
+      if (seen[pc])
+        continue;
+      seen[pc] = true;
+      const Inst &inst = insts[pc];
+      switch (inst.op) {
+      case Byte:
+        firstBytes |= sets[inst.x];
+        break;
+      case Match:
+        canMatchEmpty = true;
+        break;
+      case Split:
+        stack.push_back(inst.y);
+        stack.push_back(inst.x);
+        break;
+      case Jmp:
+        stack.push_back(inst.x);
+        break;
+      case Assert: // assertions are ignored: firstBytes is a superset
+        stack.push_back(pc + 1);
+        break;
+      }
+    }
+  }
+
+  void ComputeClosures() {
+    const size_t MAX_CLOSURE_ENTRIES = 1 << 22;
+    for (const Inst &inst : insts)
+      if (inst.op == Assert)
+        return;
+
+    closures.assign(insts.size(), std::vector<int>());
+    std::vector<unsigned int> seen(insts.size(), 0);
+    unsigned int generation = 0;
+    size_t entries = 0;
+    std::vector<int> stack;
+    for (size_t entry = 0; entry < insts.size(); ++entry) {
+      // Threads start at pc 0 and continue after each Byte instruction
+      if (entry != 0 && insts[entry - 1].op != Byte)
+        continue;
+      ++generation;
+      stack.push_back(static_cast<int>(entry));
+      while (!stack.empty()) {
+        int pc = stack.back();
+        stack.pop_back();
+        if (seen[pc] == generation)
+          continue;
+        seen[pc] = generation;
+        const Inst &inst = insts[pc];
+        if (inst.op == Split) {
+          stack.push_back(inst.y);
+          stack.push_back(inst.x);
+        } else if (inst.op == Jmp) {
+          stack.push_back(inst.x);
+        } else {
+          closures[entry].push_back(pc);
+        }
+      }
+      entries += closures[entry].size();
+      if (entries > MAX_CLOSURE_ENTRIES) {
+        closures.clear();
+        return;
+      }
+    }
+    useClosures = true;
+  }
+
+  static bool CheckAssert(int kind, int prev, int next) {
+    switch (kind) {
+    case LineStart:
+      return prev < 0 || prev == '\n';
+    case LineEnd:
+      return next < 0 || next == '\n' || next == '\r';
+    case WordBoundary:
+      return IsWordByte(prev) != IsWordByte(next);
+    default:
+      return IsWordByte(prev) == IsWordByte(next);
+    }
+  }
+};
+
+namespace {
+
+struct Thread {
+  int pc;
+  size_t start;
+};
+
+// Pike VM state. 'closure' holds the threads at the current position in
+// priority order; 'pending' holds threads that just consumed a byte.
+struct Simulation {
+  typedef RegexSearcher::Program Program;
+
+  const Program &prog;
+  std::vector<Thread> pending;
+  std::vector<Thread> closure;
+  std::vector<unsigned int> mark; // generation that last added each pc
+  unsigned int generation;
+  std::vector<int> stack;
+
+  explicit Simulation(const Program &p)
+      : prog(p), mark(p.insts.size(), 0), generation(0) {}
+
+  void BeginClosure() {
+    closure.clear();
+    if (++generation == 0) { // wrapped: reset marks
+      std::fill(mark.begin(), mark.end(), 0);
+      generation = 1;
+    }
+  }
+
+  // Adds pc and everything reachable from it without consuming a byte, in
+  // priority order
+  void AddThread(int pc0, size_t start, int prev, int next) {
+    if (prog.useClosures) {
+      for (int pc : prog.closures[pc0]) {
+        if (mark[pc] != generation) {
+          mark[pc] = generation;
+          closure.push_back({pc, start});
+        }
+      }
+      return;
+    }
+    stack.push_back(pc0);
+    while (!stack.empty()) {
+      int pc = stack.back();
+      stack.pop_back();
+      if (mark[pc] == generation)
+        continue;
+      mark[pc] = generation;
+      const Program::Inst &inst = prog.insts[pc];
+      switch (inst.op) {
+      case Program::Jmp:
+        stack.push_back(inst.x);
+        break;
+      case Program::Split:
+        stack.push_back(inst.y);
+        stack.push_back(inst.x);
+        break;
+      case Program::Assert:
+        if (Program::CheckAssert(inst.x, prev, next))
+          stack.push_back(pc + 1);
+        break;
+      default:
+        closure.push_back({pc, start});
+        break;
+      }
+    }
+  }
+};
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+// RegexSearcher
+// ----------------------------------------------------------------------------
+
+RegexSearcher::RegexSearcher() {}
+
+RegexSearcher::~RegexSearcher() {}
+
+std::shared_ptr<const RegexSearcher>
+RegexSearcher::Get(const std::string &pattern, bool matchCase) {
+  // Small LRU of compiled patterns; failures are cached too so an invalid
+  // pattern typed into the find box is not re-parsed on every keystroke.
+  static std::mutex cacheMutex;
+  static std::list<std::pair<std::string, std::shared_ptr<const RegexSearcher>>>
+      cache;
+  std::string key = (matchCase ? "c:" : "i:") + pattern;
+
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  for (auto it = cache.begin(); it != cache.end(); ++it) {
+    if (it->first == key) {
+      cache.splice(cache.begin(), cache, it);
+      return cache.front().second;
+    }
+  }
+
+  std::shared_ptr<RegexSearcher> compiled;
+  std::vector<Node> nodes;
+  int root = Parser(pattern, matchCase, nodes).Parse();
+  if (root >= 0) {
+    compiled.reset(new RegexSearcher());
+    compiled->m_forward.reset(new Program());
+    compiled->m_reverse.reset(new Program());
+    for (bool reversed : {false, true}) {
+      Program &prog = reversed ? *compiled->m_reverse : *compiled->m_forward;
+      prog.Compile(nodes, root, reversed);
+      prog.Emit(Program::Match);
+      prog.ComputeFirstBytes();
+      prog.ComputeClosures();
+      if (prog.failed)
+        compiled.reset();
+      if (!compiled)
+        break;
+    }
+  }
+  if (compiled) {
+    compiled->m_matchesNewline = false;
+    for (const ByteSet &set : compiled->m_forward->sets)
+      if (set['\n'])
+        compiled->m_matchesNewline = true;
+  }
+
+  cache.emplace_front(key, compiled);
+  if (cache.size() > CACHE_SIZE)
+    cache.pop_back();
+  return compiled;
+}
+
+size_t RegexSearcher::FindForward(const PieceTable &table, size_t startPos,
+                                  size_t *matchLength,
+                                  size_t lastStart) const {
+  const Program &prog = *m_forward;
+  size_t total = table.GetTotalLength();
+  if (startPos > total)
+    return std::string::npos;
+
+  Simulation sim(prog);
+  int prev = -1;
+  if (startPos > 0)
+    prev = static_cast<unsigned char>(table.GetText(startPos - 1, 1)[0]);
+  size_t matchStart = std::string::npos, matchEnd = 0;
+
+  // Closure at 'pos' (whose byte is 'c', or -1 at the end of the text), then
+  // consume c. Returns false once the match can no longer change.
+  auto step = [&](int c, size_t pos) {
+    sim.BeginClosure();
+    for (const Thread &t : sim.pending)
+      sim.AddThread(t.pc, t.start, prev, c);
+    // A new attempt starts here, unless it could not consume c anyway
+    if (matchStart == std::string::npos && pos <= lastStart &&
+        (prog.canMatchEmpty || (c >= 0 && prog.firstBytes[c])))
+      sim.AddThread(0, pos, prev, c);
+    sim.pending.clear();
+    for (const Thread &t : sim.closure) {
+      const Program::Inst &inst = prog.insts[t.pc];
+      if (inst.op == Program::Match) {
+        // Lower-priority threads can only produce less preferred matches
+        matchStart = t.start;
+        matchEnd = pos;
+        break;
+      }
+      if (c >= 0 && prog.sets[inst.x][c])
+        sim.pending.push_back({t.pc + 1, t.start});
+    }
+    prev = c;
+    return matchStart == std::string::npos || !sim.pending.empty();
+  };
+
+  bool finished = false;
+  table.ForEachSpan(
+      startPos, total - startPos,
+      [&](const char *data, size_t length, size_t docOffset) {
+        size_t k = 0;
+        while (k < length) {
+          if (sim.pending.empty() && matchStart == std::string::npos &&
+              docOffset + k > lastStart) {
+            finished = true; // no attempt is alive and none may start
+            return false;
+          }
+          if (sim.pending.empty() && matchStart == std::string::npos &&
+              !prog.canMatchEmpty) {
+            // No live thread: skip bytes that cannot begin a match
+            size_t j = k;
+            while (j < length &&
+                   !prog.firstBytes[static_cast<unsigned char>(data[j])])
+              ++j;
+            if (j > k) {
+              prev = static_cast<unsigned char>(data[j - 1]);
+              k = j;
+              if (k == length)
+                break;
+            }
+          }
+          if (!step(static_cast<unsigned char>(data[k]), docOffset + k)) {
+            finished = true;
+            return false;
+          }
+          ++k;
+        }
+        return true;
+      });
+  if (!finished)
+    step(-1, total);
+
+  if (matchStart != std::string::npos && matchLength)
+    *matchLength = matchEnd - matchStart;
+  return matchStart;
+}
+
+size_t RegexSearcher::FindBackward(const PieceTable &table,
+                                   size_t startPos) const {
+  // The reversed program reads right to left from startPos with a new attempt
+  // at every position. The first position at which any thread reaches Match
+  // is the largest start of a match ending at or before startPos.
+  const Program &prog = *m_reverse;
+  size_t total = table.GetTotalLength();
+  if (startPos > total)
+    startPos = total;
+
+  Simulation sim(prog);
+  int next = -1;
+  if (startPos < total)
+    next = static_cast<unsigned char>(table.GetText(startPos, 1)[0]);
+
+  // Closure at position 'pos' (preceded by byte 'c', or -1 at the start of
+  // the text), then consume c. Returns true if a match starts at pos.
+  auto step = [&](int c, size_t pos) {
+    sim.BeginClosure();
+    for (const Thread &t : sim.pending)
+      sim.AddThread(t.pc, pos, c, next);
+    if (prog.canMatchEmpty || (c >= 0 && prog.firstBytes[c]))
+      sim.AddThread(0, pos, c, next);
+    sim.pending.clear();
+    for (const Thread &t : sim.closure) {
+      const Program::Inst &inst = prog.insts[t.pc];
+      if (inst.op == Program::Match)
+        return true;
+      if (c >= 0 && prog.sets[inst.x][c])
+        sim.pending.push_back({t.pc + 1, pos});
+    }
+    next = c;
+    return false;
+  };
+
+  size_t found = std::string::npos;
+  table.ForEachSpanReverse(
+      0, startPos, [&](const char *data, size_t length, size_t docOffset) {
+        size_t k = length;
+        while (k > 0) {
+          if (sim.pending.empty() && !prog.canMatchEmpty) {
+            size_t j = k;
+            while (j > 0 &&
+                   !prog.firstBytes[static_cast<unsigned char>(data[j - 1])])
+              --j;
+            if (j < k) {
+              next = static_cast<unsigned char>(data[j]);
+              k = j;
+              if (k == 0)
+                break;
+            }
+          }
+          --k;
+          if (step(static_cast<unsigned char>(data[k]), docOffset + k + 1)) {
+            found = docOffset + k + 1;
+            return false;
+          }
+        }
+        return true;
+      });
+  if (found == std::string::npos && step(-1, 0))
+    found = 0;
+  return found;
+}
@@ -6,6 +6,42 @@ void EnsureCaretVisible(HWND hwnd);
 void UpdateScrollbars(HWND hwnd);
 void UpdateMenu(HWND hwnd);
 
+// =============================================================================
+// Undo groups opened by scripts
+// =============================================================================
+
+// Buffers a script called beginUndoGroup on, innermost last. endUndoGroup
+// ends the group on the buffer that began it, even after a buffer switch.
+static std::vector<Buffer *> s_scriptUndoGroups;
+
+// Ends the script groups opened after the first 'depth', skipping buffers
+// that were closed in the meantime
+static void EndScriptUndoGroups(size_t depth) {
+  while (s_scriptUndoGroups.size() > depth) {
+    Buffer *buf = s_scriptUndoGroups.back();
+    s_scriptUndoGroups.pop_back();
+    if (!g_editor)
+      continue;
+    for (const auto &open : g_editor->GetBuffers()) {
+      if (open.get() == buf) {
+        buf->EndUndoGroup();
+        break;
+      }
+    }
+  }
+}
+
+// Held around every call into script code: groups the script left open by
+// throwing, returning early or forgetting endUndoGroup are ended on return
+class ScriptUndoScope {
+public:
+  ScriptUndoScope() : m_depth(s_scriptUndoGroups.size()) {}
+  ~ScriptUndoScope() { EndScriptUndoGroups(m_depth); }
+
+private:
+  size_t m_depth;
+};
+
 // =============================================================================
 // JS-to-C++ Bridge Functions (organized into .inl modules)
 // =============================================================================
@@ -46,6 +82,14 @@ bool ScriptEngine::Initialize() {
   duk_put_prop_string(m_ctx, -2, "getLength");
   duk_push_c_function(m_ctx, js_editor_find, 5);
   duk_put_prop_string(m_ctx, -2, "find");
+  duk_push_c_function(m_ctx, js_editor_replace_all, 4);
+  duk_put_prop_string(m_ctx, -2, "replaceAll");
+  duk_push_c_function(m_ctx, js_editor_find_all, 3);
+  duk_put_prop_string(m_ctx, -2, "findAll");
+  duk_push_c_function(m_ctx, js_editor_find_in_files, 3);
+  duk_put_prop_string(m_ctx, -2, "findInFiles");
+  duk_push_c_function(m_ctx, js_editor_search_files, 3);
+  duk_put_prop_string(m_ctx, -2, "searchFiles");
   duk_push_c_function(m_ctx, js_editor_set_key_binding, 2);
   duk_put_prop_string(m_ctx, -2, "setKeyBinding");
   duk_push_c_function(m_ctx, js_editor_set_capture_keyboard, 1);
@@ -100,6 +144,10 @@ bool ScriptEngine::Initialize() {
   duk_put_prop_string(m_ctx, -2, "undo");
   duk_push_c_function(m_ctx, js_editor_redo, 0);
   duk_put_prop_string(m_ctx, -2, "redo");
+  duk_push_c_function(m_ctx, js_editor_begin_undo_group, 0);
+  duk_put_prop_string(m_ctx, -2, "beginUndoGroup");
+  duk_push_c_function(m_ctx, js_editor_end_undo_group, 0);
+  duk_put_prop_string(m_ctx, -2, "endUndoGroup");
   duk_push_c_function(m_ctx, js_editor_show_line_numbers, 1);
   duk_put_prop_string(m_ctx, -2, "showLineNumbers");
   duk_push_c_function(m_ctx, js_editor_show_physical_line_numbers, 1);
@@ -118,6 +166,10 @@ bool ScriptEngine::Initialize() {
   duk_put_prop_string(m_ctx, -2, "toggleFullscreen");
   duk_push_c_function(m_ctx, js_editor_set_highlights, 1);
   duk_put_prop_string(m_ctx, -2, "setHighlights");
+  duk_push_c_function(m_ctx, js_editor_show_perf_overlay, 1);
+  duk_put_prop_string(m_ctx, -2, "showPerfOverlay");
+  duk_push_c_function(m_ctx, js_editor_get_perf_stats, 0);
+  duk_put_prop_string(m_ctx, -2, "getPerfStats");
   duk_push_c_function(m_ctx, js_editor_show_tabs, 1);
   duk_put_prop_string(m_ctx, -2, "showTabs");
   duk_push_c_function(m_ctx, js_editor_show_status_bar, 1);
@@ -128,6 +180,8 @@ bool ScriptEngine::Initialize() {
   duk_put_prop_string(m_ctx, -2, "setOpacity");
   duk_push_c_function(m_ctx, js_editor_open, 1);
   duk_put_prop_string(m_ctx, -2, "open");
+  duk_push_c_function(m_ctx, js_editor_open_async, 2);
+  duk_put_prop_string(m_ctx, -2, "openAsync");
   duk_push_c_function(m_ctx, js_editor_get_total_lines, 0);
   duk_put_prop_string(m_ctx, -2, "getTotalLines");
   duk_push_c_function(m_ctx, js_editor_get_line_at_offset, 1);
@@ -276,6 +330,7 @@ void ScriptEngine::LoadDefaultBindings() {
 std::string ScriptEngine::Evaluate(const std::string &code) {
   if (!m_ctx)
     return "Error: no script context";
+  ScriptUndoScope undoScope;
 
   // Push error handler
   duk_push_c_function(
@@ -308,6 +363,7 @@ std::string ScriptEngine::Evaluate(const std::string &code) {
 bool ScriptEngine::RunFile(const std::wstring &path) {
   if (!m_ctx)
     return false;
+  ScriptUndoScope undoScope;
 
   std::wstring bytecodePath = path + L"b";
   bool useBytecode = false;
@@ -433,6 +489,7 @@ bool ScriptEngine::RunFile(const std::wstring &path) {
 bool ScriptEngine::HandleKeyEvent(const std::string &key, bool isChar) {
   if (m_keyHandler.empty())
     return false;
+  ScriptUndoScope undoScope;
 
   if (m_keyHandler == "__JS_FUNCTION__") {
     duk_push_global_stash(m_ctx);
@@ -477,6 +534,7 @@ bool ScriptEngine::HandleBinding(const std::string &chord) {
   }
 
   DebugLog("  Found binding -> " + it->second, LOG_INFO);
+  ScriptUndoScope undoScope;
   duk_get_global_string(m_ctx, it->second.c_str());
   if (duk_is_function(m_ctx, -1)) {
     if (duk_pcall(m_ctx, 0) != 0) {
@@ -532,6 +590,7 @@ void ScriptEngine::CallGlobalFunction(const std::string &name,
                                       const std::string &arg) {
   if (!m_ctx)
     return;
+  ScriptUndoScope undoScope;
   duk_push_global_object(m_ctx);
   if (duk_get_prop_string(m_ctx, -1, name.c_str())) {
     duk_push_string(m_ctx, arg.c_str());
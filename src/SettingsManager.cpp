@@ -71,6 +71,8 @@ void SettingsManager::Load() {
       GetPrivateProfileIntW(L"Editor", L"CaretStyle", 0, path.c_str());
   m_shellEncoding =
       GetPrivateProfileIntW(L"Editor", L"ShellEncoding", 0, path.c_str());
+  m_journalFlushMs =
+      GetPrivateProfileIntW(L"Editor", L"JournalFlushMs", 1000, path.c_str());
 
   wchar_t projDirBuf[MAX_PATH];
   if (GetPrivateProfileStringW(L"Editor", L"ProjectDirectory", L"", projDirBuf,
@@ -161,6 +163,7 @@ void SettingsManager::Save() {
   WriteInt(L"Editor", L"CaretBlinking", m_caretBlinking ? 1 : 0);
   WriteInt(L"Editor", L"CaretStyle", m_caretStyle);
   WriteInt(L"Editor", L"ShellEncoding", m_shellEncoding);
+  WriteInt(L"Editor", L"JournalFlushMs", m_journalFlushMs);
   if (!m_projectDirectory.empty()) {
     WritePrivateProfileStringW(L"Editor", L"ProjectDirectory",
                                m_projectDirectory.c_str(), path.c_str());
@@ -0,0 +1,319 @@
+#include "../include/TextSearch.h"
+#include "../include/PieceTable.h"
+#include <algorithm>
+#include <cstring>
+#include <emmintrin.h> // SSE2
+#if defined(__AVX2__)
+#include <immintrin.h> // AVX2
+#endif
+#ifdef _MSC_VER
+#include <intrin.h> // _BitScanForward / _BitScanReverse
+#endif
+
+static inline unsigned char FoldByte(unsigned char c) {
+  return (c >= 'A' && c <= 'Z') ? static_cast<unsigned char>(c + 32) : c;
+}
+
+static inline unsigned char UpperByte(unsigned char c) {
+  return (c >= 'a' && c <= 'z') ? static_cast<unsigned char>(c - 32) : c;
+}
+
+static inline int LowestBit(unsigned int mask) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
+static inline int HighestBit(unsigned int mask) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanReverse(&index, mask);
+  return static_cast<int>(index);
+#else
+  return 31 - __builtin_clz(mask);
+#endif
+}
+
+TextSearcher::TextSearcher(const std::string &needle, bool matchCase)
+    : m_needle(needle), m_matchCase(matchCase), m_first{0, 0}, m_last{0, 0} {
+  if (m_needle.empty())
+    return;
+  if (!m_matchCase) {
+    std::transform(m_needle.begin(), m_needle.end(), m_needle.begin(),
+                   [](unsigned char c) { return FoldByte(c); });
+  }
+  unsigned char first = static_cast<unsigned char>(m_needle.front());
+  unsigned char last = static_cast<unsigned char>(m_needle.back());
+  m_first[0] = m_first[1] = first;
+  m_last[0] = m_last[1] = last;
+  if (!m_matchCase) {
+    m_first[1] = UpperByte(first);
+    m_last[1] = UpperByte(last);
+  }
+}
+
+bool TextSearcher::Verify(const char *candidate) const {
+  if (m_matchCase)
+    return memcmp(candidate, m_needle.data(), m_needle.size()) == 0;
+  for (size_t i = 0; i < m_needle.size(); ++i) {
+    if (FoldByte(static_cast<unsigned char>(candidate[i])) !=
+        static_cast<unsigned char>(m_needle[i]))
+      return false;
+  }
+  return true;
+}
+
+#if defined(_MSC_VER) || defined(__SSE2__)
+// Bit i is set if start offset i of the 16 at 'p' has an acceptable first
+// byte at p[i] and last byte at p[i + m - 1]
+template <bool Fold>
+static inline unsigned int CandidateMask16(const char *p, size_t m,
+                                           const __m128i (&first)[2],
+                                           const __m128i (&last)[2]) {
+  __m128i a = _mm_loadu_si128((const __m128i *)p);
+  __m128i b = _mm_loadu_si128((const __m128i *)(p + m - 1));
+  __m128i fa = _mm_cmpeq_epi8(a, first[0]);
+  __m128i lb = _mm_cmpeq_epi8(b, last[0]);
+  if (Fold) {
+    fa = _mm_or_si128(fa, _mm_cmpeq_epi8(a, first[1]));
+    lb = _mm_or_si128(lb, _mm_cmpeq_epi8(b, last[1]));
+  }
+  return static_cast<unsigned int>(_mm_movemask_epi8(_mm_and_si128(fa, lb)));
+}
+#endif
+
+#if defined(__AVX2__)
+template <bool Fold>
+static inline unsigned int CandidateMask32(const char *p, size_t m,
+                                           const __m256i (&first)[2],
+                                           const __m256i (&last)[2]) {
+  __m256i a = _mm256_loadu_si256((const __m256i *)p);
+  __m256i b = _mm256_loadu_si256((const __m256i *)(p + m - 1));
+  __m256i fa = _mm256_cmpeq_epi8(a, first[0]);
+  __m256i lb = _mm256_cmpeq_epi8(b, last[0]);
+  if (Fold) {
+    fa = _mm256_or_si256(fa, _mm256_cmpeq_epi8(a, first[1]));
+    lb = _mm256_or_si256(lb, _mm256_cmpeq_epi8(b, last[1]));
+  }
+  return static_cast<unsigned int>(
+      _mm256_movemask_epi8(_mm256_and_si256(fa, lb)));
+}
+#endif
+
+template <bool Fold>
+size_t TextSearcher::ScanForward(const char *data, size_t length) const {
+  const size_t m = m_needle.size();
+  const size_t candidates = length - m + 1; // valid start offsets
+  size_t i = 0;
+
+  // Compare the first needle byte at i and the last at i + m - 1 for a
+  // whole register of start offsets at once; only survivors are verified.
+#if defined(__AVX2__)
+  {
+    const __m256i first[2] = {_mm256_set1_epi8((char)m_first[0]),
+                              _mm256_set1_epi8((char)m_first[1])};
+    const __m256i last[2] = {_mm256_set1_epi8((char)m_last[0]),
+                             _mm256_set1_epi8((char)m_last[1])};
+    for (; i + 32 <= candidates; i += 32) {
+      unsigned int mask = CandidateMask32<Fold>(data + i, m, first, last);
+      while (mask != 0) {
+        int bit = LowestBit(mask);
+        if (Verify(data + i + bit))
+          return i + bit;
+        mask &= mask - 1;
+      }
+    }
+  }
+#endif
+
+#if defined(_MSC_VER) || defined(__SSE2__)
+  {
+    const __m128i first[2] = {_mm_set1_epi8((char)m_first[0]),
+                              _mm_set1_epi8((char)m_first[1])};
+    const __m128i last[2] = {_mm_set1_epi8((char)m_last[0]),
+                             _mm_set1_epi8((char)m_last[1])};
+    for (; i + 32 <= candidates; i += 32) {
+      // Two registers per iteration; most blocks have no candidate at all
+      unsigned int mask = CandidateMask16<Fold>(data + i, m, first, last) |
+                          (CandidateMask16<Fold>(data + i + 16, m, first, last)
+                           << 16);
+      while (mask != 0) {
+        int bit = LowestBit(mask);
+        if (Verify(data + i + bit))
+          return i + bit;
+        mask &= mask - 1;
+      }
+    }
+  }
+#endif
+
+  for (; i < candidates; ++i) {
+    unsigned char c = static_cast<unsigned char>(data[i]);
+    if ((c == m_first[0] || c == m_first[1]) && Verify(data + i))
+      return i;
+  }
+  return std::string::npos;
+}
+
+template <bool Fold>
+size_t TextSearcher::ScanBackward(const char *data, size_t length) const {
+  const size_t m = m_needle.size();
+  size_t end = length - m + 1; // candidates left are [0, end)
+
+#if defined(__AVX2__)
+  {
+    const __m256i first[2] = {_mm256_set1_epi8((char)m_first[0]),
+                              _mm256_set1_epi8((char)m_first[1])};
+    const __m256i last[2] = {_mm256_set1_epi8((char)m_last[0]),
+                             _mm256_set1_epi8((char)m_last[1])};
+    for (; end >= 32; end -= 32) {
+      size_t i = end - 32;
+      unsigned int mask = CandidateMask32<Fold>(data + i, m, first, last);
+      while (mask != 0) {
+        int bit = HighestBit(mask);
+        if (Verify(data + i + bit))
+          return i + bit;
+        mask &= ~(1u << bit);
+      }
+    }
+  }
+#endif
+
+#if defined(_MSC_VER) || defined(__SSE2__)
+  {
+    const __m128i first[2] = {_mm_set1_epi8((char)m_first[0]),
+                              _mm_set1_epi8((char)m_first[1])};
+    const __m128i last[2] = {_mm_set1_epi8((char)m_last[0]),
+                             _mm_set1_epi8((char)m_last[1])};
+    for (; end >= 32; end -= 32) {
+      size_t i = end - 32;
+      unsigned int mask = CandidateMask16<Fold>(data + i, m, first, last) |
+                          (CandidateMask16<Fold>(data + i + 16, m, first, last)
+                           << 16);
+      while (mask != 0) {
+        int bit = HighestBit(mask);
+        if (Verify(data + i + bit))
+          return i + bit;
+        mask &= ~(1u << bit);
+      }
+    }
+  }
+#endif
+
+  while (end > 0) {
+    --end;
+    unsigned char c = static_cast<unsigned char>(data[end]);
+    if ((c == m_first[0] || c == m_first[1]) && Verify(data + end))
+      return end;
+  }
+  return std::string::npos;
+}
+
+size_t TextSearcher::FindFirst(const char *data, size_t length) const {
+  if (m_needle.empty() || length < m_needle.size())
+    return std::string::npos;
+  return m_matchCase ? ScanForward<false>(data, length)
+                     : ScanForward<true>(data, length);
+}
+
+size_t TextSearcher::FindLast(const char *data, size_t length) const {
+  if (m_needle.empty() || length < m_needle.size())
+    return std::string::npos;
+  return m_matchCase ? ScanBackward<false>(data, length)
+                     : ScanBackward<true>(data, length);
+}
+
+size_t TextSearcher::FindForward(const PieceTable &table, size_t startPos,
+                                 size_t lastStart) const {
+  const size_t m = m_needle.size();
+  size_t total = table.GetTotalLength();
+  if (m == 0 || startPos >= total || total - startPos < m)
+    return std::string::npos;
+  // Only bytes a match starting at or before lastStart can cover
+  size_t end = total;
+  if (lastStart < total - m)
+    end = lastStart + m;
+  if (end - startPos < m)
+    return std::string::npos;
+
+  // 'carry' holds the last m - 1 bytes already scanned. A match that
+  // straddles a span boundary must start inside it, so it is found in a
+  // small stitch of carry + the head of the next span.
+  std::string carry, stitch;
+  size_t carryStart = startPos;
+  size_t result = std::string::npos;
+  table.ForEachSpan(
+      startPos, end - startPos,
+      [&](const char *data, size_t length, size_t docOffset) {
+        if (!carry.empty()) {
+          stitch.assign(carry);
+          stitch.append(data, (std::min)(m - 1, length));
+          size_t found = FindFirst(stitch.data(), stitch.size());
+          if (found != std::string::npos && found < carry.size()) {
+            result = carryStart + found;
+            return false;
+          }
+        }
+        size_t found = FindFirst(data, length);
+        if (found != std::string::npos) {
+          result = docOffset + found;
+          return false;
+        }
+        if (length >= m - 1) {
+          carry.assign(data + length - (m - 1), m - 1);
+        } else {
+          carry.append(data, length);
+          if (carry.size() > m - 1)
+            carry.erase(0, carry.size() - (m - 1));
+        }
+        carryStart = docOffset + length - carry.size();
+        return true;
+      });
+  return result;
+}
+
+size_t TextSearcher::FindBackward(const PieceTable &table,
+                                  size_t startPos) const {
+  const size_t m = m_needle.size();
+  size_t total = table.GetTotalLength();
+  if (m == 0 || total < m)
+    return std::string::npos;
+  // A match starting at or before startPos ends at or before startPos + m
+  size_t rangeEnd = startPos >= total - m ? total : startPos + m;
+
+  // Mirror image of FindForward: 'carry' holds the first m - 1 bytes after
+  // the current span.
+  std::string carry, stitch;
+  size_t result = std::string::npos;
+  table.ForEachSpanReverse(
+      0, rangeEnd, [&](const char *data, size_t length, size_t docOffset) {
+        if (!carry.empty()) {
+          size_t tail = (std::min)(m - 1, length);
+          stitch.assign(data + length - tail, tail);
+          stitch.append(carry);
+          size_t found = FindLast(stitch.data(), stitch.size());
+          if (found != std::string::npos) {
+            result = docOffset + length - tail + found;
+            return false;
+          }
+        }
+        size_t found = FindLast(data, length);
+        if (found != std::string::npos) {
+          result = docOffset + found;
+          return false;
+        }
+        if (length >= m - 1) {
+          carry.assign(data, m - 1);
+        } else {
+          carry.insert(0, data, length);
+          if (carry.size() > m - 1)
+            carry.resize(m - 1);
+        }
+        return true;
+      });
+  return result;
+}
@@ -50,6 +50,8 @@ void UpdateScrollbars(HWND hwnd) {
   int availableHeight = rc.bottom - tabHeight - statusHeight;
   int visibleLines = (lineHeight > 0) ? (int)(availableHeight / lineHeight) : 1;
   int totalLines = (int)buf->GetVisibleLineCount();
+  if (buf->IsIndexing()) // refined when indexing finishes
+    totalLines += (int)(buf->GetEstimatedTotalLines() - buf->GetTotalLines());
 
   SCROLLINFO si = {0};
   si.cbSize = sizeof(si);
@@ -67,7 +69,7 @@ void UpdateScrollbars(HWND hwnd) {
       buf->GetViewportText(scrollLine, viewportLineCount, actualLines);
 
   float textWidth = g_renderer->GetTextWidth(viewportContent);
-  float gutterWidth = 50.0f;
+  float gutterWidth = g_renderer->GetGutterWidth(buf->GetTotalLines());
   int totalWidth = (int)(textWidth + gutterWidth + 20.0f);
   int visibleWidth = rc.right;
 
@@ -0,0 +1,259 @@
+#include "../include/Utf.h"
+#include <cstdint>
+#include <emmintrin.h> // SSE2
+#if defined(__AVX2__)
+#include <immintrin.h> // AVX2
+#endif
+
+static inline bool IsHighSurrogate(uint32_t c) {
+  return c >= 0xD800 && c <= 0xDBFF;
+}
+static inline bool IsLowSurrogate(uint32_t c) {
+  return c >= 0xDC00 && c <= 0xDFFF;
+}
+
+// Decodes the sequence at p, whose lead byte is not ASCII, with 'n' bytes
+// available. Returns the bytes consumed: the whole sequence, or for
+// ill-formed input the maximal subpart, which decodes to U+FFFD.
+static inline size_t DecodeSequence(const unsigned char *p, size_t n,
+                                    uint32_t &cp, bool &valid) {
+  unsigned char c = p[0];
+  unsigned char lo = 0x80, hi = 0xBF;
+  size_t need;
+  if (c >= 0xC2 && c <= 0xDF) {
+    need = 1;
+    cp = c & 0x1F;
+  } else if (c >= 0xE0 && c <= 0xEF) {
+    need = 2;
+    cp = c & 0x0F;
+    if (c == 0xE0)
+      lo = 0xA0; // overlong
+    else if (c == 0xED)
+      hi = 0x9F; // surrogates
+  } else if (c >= 0xF0 && c <= 0xF4) {
+    need = 3;
+    cp = c & 0x07;
+    if (c == 0xF0)
+      lo = 0x90; // overlong
+    else if (c == 0xF4)
+      hi = 0x8F; // past U+10FFFF
+  } else {
+    cp = 0xFFFD;
+    valid = false;
+    return 1;
+  }
+  for (size_t k = 1; k <= need; ++k) {
+    if (k >= n || p[k] < lo || p[k] > hi) {
+      cp = 0xFFFD;
+      valid = false;
+      return k;
+    }
+    cp = (cp << 6) | (p[k] & 0x3F);
+    lo = 0x80;
+    hi = 0xBF;
+  }
+  valid = true;
+  return need + 1;
+}
+
+size_t Utf::AsciiRun(const char *text, size_t length) {
+  const unsigned char *s = reinterpret_cast<const unsigned char *>(text);
+  size_t i = 0;
+#if defined(__AVX2__)
+  while (i + 32 <= length &&
+         _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)(s + i))) ==
+             0)
+    i += 32;
+#endif
+#if defined(_MSC_VER) || defined(__SSE2__)
+  while (i + 16 <= length &&
+         _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i))) == 0)
+    i += 16;
+#endif
+  return i;
+}
+
+size_t Utf::Utf8ToUtf16(const char *utf8, size_t length, char16_t *out) {
+  const unsigned char *s = reinterpret_cast<const unsigned char *>(utf8);
+  size_t i = 0, n = 0;
+  while (i < length) {
+    // Widen ASCII a register at a time
+#if defined(__AVX2__)
+    for (; i + 32 <= length; i += 32, n += 32) {
+      __m256i chunk = _mm256_loadu_si256((const __m256i *)(s + i));
+      if (_mm256_movemask_epi8(chunk) != 0)
+        break;
+      _mm256_storeu_si256((__m256i *)(out + n),
+                          _mm256_cvtepu8_epi16(_mm256_castsi256_si128(chunk)));
+      _mm256_storeu_si256(
+          (__m256i *)(out + n + 16),
+          _mm256_cvtepu8_epi16(_mm256_extracti128_si256(chunk, 1)));
+    }
+#endif
+#if defined(_MSC_VER) || defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16, n += 16) {
+      __m128i chunk = _mm_loadu_si128((const __m128i *)(s + i));
+      if (_mm_movemask_epi8(chunk) != 0)
+        break;
+      _mm_storeu_si128((__m128i *)(out + n), _mm_unpacklo_epi8(chunk, zero));
+      _mm_storeu_si128((__m128i *)(out + n + 8),
+                       _mm_unpackhi_epi8(chunk, zero));
+    }
+#endif
+    // Then up to the next register's worth one character at a time
+    size_t stop = length - i > 16 ? i + 16 : length;
+    while (i < stop) {
+      if (s[i] < 0x80) {
+        out[n++] = s[i++];
+        continue;
+      }
+      uint32_t cp;
+      bool valid;
+      i += DecodeSequence(s + i, length - i, cp, valid);
+      if (cp >= 0x10000) {
+        out[n++] = static_cast<char16_t>(0xD800 + ((cp - 0x10000) >> 10));
+        out[n++] = static_cast<char16_t>(0xDC00 + (cp & 0x3FF));
+      } else {
+        out[n++] = static_cast<char16_t>(cp);
+      }
+    }
+  }
+  return n;
+}
+
+size_t Utf::Utf16Length(const char *utf8, size_t length) {
+  const unsigned char *s = reinterpret_cast<const unsigned char *>(utf8);
+  size_t i = 0, n = 0;
+  while (i < length) {
+    size_t run = AsciiRun(utf8 + i, length - i);
+    i += run;
+    n += run;
+    size_t stop = length - i > 16 ? i + 16 : length;
+    while (i < stop) {
+      if (s[i] < 0x80) {
+        ++i;
+        ++n;
+        continue;
+      }
+      uint32_t cp;
+      bool valid;
+      i += DecodeSequence(s + i, length - i, cp, valid);
+      n += cp >= 0x10000 ? 2 : 1;
+    }
+  }
+  return n;
+}
+
+bool Utf::IsValidUtf8(const char *utf8, size_t length) {
+  const unsigned char *s = reinterpret_cast<const unsigned char *>(utf8);
+  size_t i = 0;
+  while (i < length) {
+    i += AsciiRun(utf8 + i, length - i);
+    size_t stop = length - i > 16 ? i + 16 : length;
+    while (i < stop) {
+      if (s[i] < 0x80) {
+        ++i;
+        continue;
+      }
+      uint32_t cp;
+      bool valid;
+      i += DecodeSequence(s + i, length - i, cp, valid);
+      if (!valid)
+        return false;
+    }
+  }
+  return true;
+}
+
+// Length of the ASCII run at s[i], counted in whole registers
+static inline size_t AsciiUnits(const char16_t *s, size_t i, size_t length) {
+  size_t start = i;
+#if defined(__AVX2__)
+  const __m256i high256 = _mm256_set1_epi16(static_cast<short>(0xFF80));
+  while (i + 16 <= length &&
+         _mm256_testz_si256(_mm256_loadu_si256((const __m256i *)(s + i)),
+                            high256))
+    i += 16;
+#endif
+#if defined(_MSC_VER) || defined(__SSE2__)
+  const __m128i high = _mm_set1_epi16(static_cast<short>(0xFF80));
+  const __m128i zero = _mm_setzero_si128();
+  while (i + 8 <= length &&
+         _mm_movemask_epi8(_mm_cmpeq_epi16(
+             _mm_and_si128(_mm_loadu_si128((const __m128i *)(s + i)), high),
+             zero)) == 0xFFFF)
+    i += 8;
+#endif
+  return i - start;
+}
+
+size_t Utf::Utf16ToUtf8(const char16_t *utf16, size_t length, char *out) {
+  size_t i = 0, n = 0;
+  while (i < length) {
+    // Narrow ASCII a register at a time
+#if defined(_MSC_VER) || defined(__SSE2__)
+    const __m128i high = _mm_set1_epi16(static_cast<short>(0xFF80));
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= length; i += 8, n += 8) {
+      __m128i units = _mm_loadu_si128((const __m128i *)(utf16 + i));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(units, high),
+                                            zero)) != 0xFFFF)
+        break;
+      _mm_storel_epi64((__m128i *)(out + n), _mm_packus_epi16(units, units));
+    }
+#endif
+    size_t stop = length - i > 8 ? i + 8 : length;
+    while (i < stop) {
+      uint32_t cp = utf16[i++];
+      if (cp < 0x80) {
+        out[n++] = static_cast<char>(cp);
+        continue;
+      }
+      if (cp < 0x800) {
+        out[n++] = static_cast<char>(0xC0 | (cp >> 6));
+        out[n++] = static_cast<char>(0x80 | (cp & 0x3F));
+        continue;
+      }
+      if (IsHighSurrogate(cp) && i < length && IsLowSurrogate(utf16[i])) {
+        cp = 0x10000 + ((cp - 0xD800) << 10) + (utf16[i++] - 0xDC00);
+        out[n++] = static_cast<char>(0xF0 | (cp >> 18));
+        out[n++] = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        out[n++] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out[n++] = static_cast<char>(0x80 | (cp & 0x3F));
+        continue;
+      }
+      if (IsHighSurrogate(cp) || IsLowSurrogate(cp))
+        cp = 0xFFFD;
+      out[n++] = static_cast<char>(0xE0 | (cp >> 12));
+      out[n++] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+      out[n++] = static_cast<char>(0x80 | (cp & 0x3F));
+    }
+  }
+  return n;
+}
+
+size_t Utf::Utf8Length(const char16_t *utf16, size_t length) {
+  size_t i = 0, n = 0;
+  while (i < length) {
+    size_t run = AsciiUnits(utf16, i, length);
+    i += run;
+    n += run;
+    size_t stop = length - i > 8 ? i + 8 : length;
+    while (i < stop) {
+      uint32_t cp = utf16[i++];
+      if (cp < 0x80) {
+        n += 1;
+      } else if (cp < 0x800) {
+        n += 2;
+      } else if (IsHighSurrogate(cp) && i < length &&
+                 IsLowSurrogate(utf16[i])) {
+        ++i;
+        n += 4;
+      } else {
+        n += 3;
+      }
+    }
+  }
+  return n;
+}
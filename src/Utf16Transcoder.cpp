@@ -0,0 +1,254 @@
+#include "../include/Utf16Transcoder.h"
+#include "../include/Utf.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+struct Utf16Transcoder::Block {
+  size_t index = 0;
+  std::string text;
+};
+
+static inline bool IsHighSurrogate(char16_t c) {
+  return c >= 0xD800 && c <= 0xDBFF;
+}
+static inline bool IsLowSurrogate(char16_t c) {
+  return c >= 0xDC00 && c <= 0xDFFF;
+}
+
+// Decodes the character at units[i]: sets 'cp' and 'used' (code units
+// consumed) and returns its UTF-8 length. The low half of a pair whose high
+// half precedes 'i' is consumed with length 0, as it was encoded with the
+// high half.
+static inline size_t NextChar(const char16_t *units, size_t count, size_t i,
+                              uint32_t &cp, size_t &used) {
+  char16_t c = units[i];
+  used = 1;
+  cp = c;
+  if (c < 0x80)
+    return 1;
+  if (c < 0x800)
+    return 2;
+  if (IsHighSurrogate(c)) {
+    if (i + 1 < count && IsLowSurrogate(units[i + 1])) {
+      cp = 0x10000 + ((uint32_t(c) - 0xD800) << 10) +
+           (uint32_t(units[i + 1]) - 0xDC00);
+      used = 2;
+      return 4;
+    }
+    cp = 0xFFFD;
+  } else if (IsLowSurrogate(c)) {
+    if (i > 0 && IsHighSurrogate(units[i - 1]))
+      return 0;
+    cp = 0xFFFD;
+  }
+  return 3;
+}
+
+Utf16Transcoder::Utf16Transcoder(SpanSource source, size_t length,
+                                 bool bigEndian)
+    : m_source(std::move(source)), m_units(length / 2),
+      m_bigEndian(bigEndian), m_blockStarts(1, 0) {}
+
+size_t Utf16Transcoder::Transcode(const char16_t *units, size_t count,
+                                  size_t begin, size_t end, char *out) {
+  // A pair split by the block boundary belongs to the block holding its
+  // high half
+  if (begin > 0 && begin < end && IsLowSurrogate(units[begin]) &&
+      IsHighSurrogate(units[begin - 1]))
+    ++begin;
+  if (end > begin && end < count && IsHighSurrogate(units[end - 1]) &&
+      IsLowSurrogate(units[end]))
+    ++end;
+  return out ? Utf::Utf16ToUtf8(units + begin, end - begin, out)
+             : Utf::Utf8Length(units + begin, end - begin);
+}
+
+size_t Utf16Transcoder::ReadUnits(size_t first, size_t count,
+                                  char16_t *out) const {
+  if (first >= m_units)
+    return 0;
+  count = (std::min)(count, m_units - first);
+  char *dest = reinterpret_cast<char *>(out);
+  size_t pos = first * 2;
+  size_t remaining = count * 2;
+  while (remaining > 0) {
+    TextSpan span = m_source(pos);
+    if (!span.data || pos < span.offset || pos >= span.offset + span.length)
+      break;
+    size_t n = (std::min)(remaining, span.offset + span.length - pos);
+    memcpy(dest, span.data + (pos - span.offset), n);
+    dest += n;
+    pos += n;
+    remaining -= n;
+  }
+  size_t read = (count * 2 - remaining) / 2;
+  if (m_bigEndian) {
+    for (size_t i = 0; i < read; ++i)
+      out[i] = static_cast<char16_t>((out[i] << 8) | (out[i] >> 8));
+  }
+  return read;
+}
+
+bool Utf16Transcoder::ReadBlock(size_t block, std::vector<char16_t> &units,
+                                size_t &begin) const {
+  size_t start = block * BLOCK_UNITS;
+  size_t end = (std::min)(m_units, start + BLOCK_UNITS);
+  size_t from = start > 0 ? start - 1 : 0;
+  size_t to = (std::min)(m_units, end + 1);
+  units.resize(to - from);
+  begin = start - from;
+  return ReadUnits(from, to - from, units.data()) == to - from;
+}
+
+bool Utf16Transcoder::BuildMap(const std::atomic<bool> *cancel,
+                               size_t workers) {
+  size_t blocks = (m_units + BLOCK_UNITS - 1) / BLOCK_UNITS;
+  std::vector<size_t> lengths(blocks);
+  std::atomic<bool> failed(false);
+
+  auto countBlocks = [&](size_t first, size_t last) {
+    std::vector<char16_t> units;
+    for (size_t b = first; b < last; ++b) {
+      if ((cancel && *cancel) || failed)
+        return;
+      size_t begin;
+      if (!ReadBlock(b, units, begin)) {
+        failed = true;
+        return;
+      }
+      size_t blockUnits = (std::min)(BLOCK_UNITS, m_units - b * BLOCK_UNITS);
+      lengths[b] = Transcode(units.data(), units.size(), begin,
+                             begin + blockUnits, nullptr);
+    }
+  };
+
+  if (workers == 0) {
+    workers = (std::max)(1u, std::thread::hardware_concurrency());
+    workers = (std::min)(workers, m_units * 2 / PARALLEL_MAP_MIN_BYTES);
+  }
+  workers = (std::max)(size_t(1), (std::min)(workers, blocks));
+  if (workers <= 1) {
+    countBlocks(0, blocks);
+  } else {
+    size_t per = (blocks + workers - 1) / workers;
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers && i * per < blocks; ++i) {
+      threads.emplace_back([&, i]() {
+        countBlocks(i * per, (std::min)(blocks, (i + 1) * per));
+      });
+    }
+    countBlocks(0, (std::min)(blocks, per));
+    for (std::thread &t : threads)
+      t.join();
+  }
+  if ((cancel && *cancel) || failed)
+    return false;
+
+  std::vector<size_t> starts(blocks + 1, 0);
+  for (size_t b = 0; b < blocks; ++b)
+    starts[b + 1] = starts[b] + lengths[b];
+  m_blockStarts.swap(starts);
+  std::lock_guard<std::mutex> lock(m_cacheMutex);
+  m_cache.clear();
+  return true;
+}
+
+size_t Utf16Transcoder::BlockOf(size_t offset) const {
+  return std::upper_bound(m_blockStarts.begin(), m_blockStarts.end(),
+                          offset) -
+         m_blockStarts.begin() - 1;
+}
+
+TextSpan Utf16Transcoder::GetSpan(size_t offset) const {
+  TextSpan span;
+  if (offset >= GetLength())
+    return span;
+  size_t b = BlockOf(offset);
+
+  std::shared_ptr<Block> block;
+  {
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    auto it = std::find_if(
+        m_cache.begin(), m_cache.end(),
+        [b](const std::shared_ptr<Block> &c) { return c->index == b; });
+    if (it != m_cache.end()) {
+      block = *it;
+      m_cache.erase(it);
+      m_cache.push_back(block);
+    }
+  }
+  if (!block) {
+    // Converted outside the lock so that readers of other blocks never
+    // wait; two threads missing on the same block both convert it
+    std::vector<char16_t> units;
+    size_t begin;
+    if (!ReadBlock(b, units, begin))
+      return span;
+    block = std::make_shared<Block>();
+    block->index = b;
+    block->text.resize(m_blockStarts[b + 1] - m_blockStarts[b]);
+    size_t blockUnits = (std::min)(BLOCK_UNITS, m_units - b * BLOCK_UNITS);
+    Transcode(units.data(), units.size(), begin, begin + blockUnits,
+              &block->text[0]);
+
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    m_cache.push_back(block);
+    // Evicted blocks stay alive until the spans pinning them are released
+    if (m_cache.size() > MAX_CACHED_BLOCKS)
+      m_cache.erase(m_cache.begin());
+  }
+  span.data = block->text.data();
+  span.offset = m_blockStarts[b];
+  span.length = block->text.size();
+  span.pin = block;
+  return span;
+}
+
+SpanSource
+Utf16Transcoder::MakeSource(std::shared_ptr<Utf16Transcoder> transcoder) {
+  return [transcoder](size_t offset) { return transcoder->GetSpan(offset); };
+}
+
+size_t Utf16Transcoder::ToSourceOffset(size_t offset) const {
+  if (offset >= GetLength())
+    return GetSourceLength();
+  size_t b = BlockOf(offset);
+  std::vector<char16_t> units;
+  size_t begin;
+  if (!ReadBlock(b, units, begin))
+    return GetSourceLength();
+  size_t blockUnits = (std::min)(BLOCK_UNITS, m_units - b * BLOCK_UNITS);
+  size_t pos = m_blockStarts[b];
+  for (size_t i = begin; i < begin + blockUnits;) {
+    uint32_t cp;
+    size_t used;
+    size_t len = NextChar(units.data(), units.size(), i, cp, used);
+    if (pos + len > offset)
+      return (b * BLOCK_UNITS + i - begin) * 2;
+    pos += len;
+    i += used;
+  }
+  return GetSourceLength();
+}
+
+size_t Utf16Transcoder::ToUtf8Offset(size_t sourceOffset) const {
+  size_t unit = sourceOffset / 2;
+  if (unit >= m_units)
+    return GetLength();
+  size_t b = unit / BLOCK_UNITS;
+  std::vector<char16_t> units;
+  size_t begin;
+  if (!ReadBlock(b, units, begin))
+    return GetLength();
+  size_t pos = m_blockStarts[b];
+  size_t target = begin + (unit - b * BLOCK_UNITS);
+  for (size_t i = begin; i < target;) {
+    uint32_t cp;
+    size_t used;
+    pos += NextChar(units.data(), units.size(), i, cp, used);
+    i += used;
+  }
+  return pos;
+}
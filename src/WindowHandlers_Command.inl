@@ -4,6 +4,12 @@
 // Included by main.cpp
 // =============================================================================
 
+// Completion of a background save started from the File menu
+static void ReportSaved(bool saved) {
+  SendMessage(g_statusHwnd, SB_SETTEXT, 0,
+              (LPARAM)(saved ? L"Saved" : L"Could not save file"));
+}
+
 static LRESULT HandleCommand(HWND hwnd, WPARAM wParam, LPARAM lParam) {
   switch (LOWORD(wParam)) {
   case IDM_FILE_NEW:
@@ -46,7 +52,7 @@ static LRESULT HandleCommand(HWND hwnd, WPARAM wParam, LPARAM lParam) {
   case IDM_FILE_OPEN: {
     std::wstring path = Dialogs::OpenFileDialog(hwnd);
     if (!path.empty()) {
-      g_editor->OpenFile(path);
+      g_editor->OpenFileAsync(path);
       SettingsManager::Instance().AddRecentFile(path);
       UpdateMenu(hwnd);
     }
@@ -55,13 +61,11 @@ static LRESULT HandleCommand(HWND hwnd, WPARAM wParam, LPARAM lParam) {
   case IDM_FILE_SAVE: {
     Buffer *buf = g_editor->GetActiveBuffer();
     if (buf) {
-      if (buf->GetPath().empty()) {
-        std::wstring path = Dialogs::SaveFileDialog(hwnd);
-        if (!path.empty())
-          buf->SaveFile(path);
-      } else {
-        buf->SaveFile(buf->GetPath());
-      }
+      std::wstring path = buf->GetPath();
+      if (path.empty())
+        path = Dialogs::SaveFileDialog(hwnd);
+      if (!path.empty())
+        g_editor->SaveFileAsync(buf, path, ReportSaved);
     }
     break;
   }
@@ -70,7 +74,7 @@ static LRESULT HandleCommand(HWND hwnd, WPARAM wParam, LPARAM lParam) {
     if (buf) {
       std::wstring path = Dialogs::SaveFileDialog(hwnd);
       if (!path.empty()) {
-        buf->SaveFile(path);
+        g_editor->SaveFileAsync(buf, path, ReportSaved);
         SettingsManager::Instance().AddRecentFile(path);
         UpdateMenu(hwnd);
       }
@@ -318,7 +322,7 @@ static LRESULT HandleCommand(HWND hwnd, WPARAM wParam, LPARAM lParam) {
       size_t index = LOWORD(wParam) - IDM_RECENT_START;
       const auto &recent = SettingsManager::Instance().GetRecentFiles();
       if (index < recent.size()) {
-        g_editor->OpenFile(recent[index]);
+        g_editor->OpenFileAsync(recent[index]);
         SettingsManager::Instance().AddRecentFile(recent[index]);
         UpdateMenu(hwnd);
       }
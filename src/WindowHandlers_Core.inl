@@ -190,12 +190,7 @@ static LRESULT HandleFindReplace(HWND hwnd, LPARAM lParam) {
   auto WToUTF8 = [](LPCWSTR wstr) -> std::string {
     if (!wstr)
       return "";
-    int len = WideCharToMultiByte(CP_UTF8, 0, wstr, -1, NULL, 0, NULL, NULL);
-    if (len <= 0)
-      return "";
-    std::string res(len - 1, 0);
-    WideCharToMultiByte(CP_UTF8, 0, wstr, -1, &res[0], len, NULL, NULL);
-    return res;
+    return Utf::FromWide(wstr, wcslen(wstr));
   };
 
   if (lpfr->Flags & FR_DIALOGTERM)
@@ -222,8 +217,22 @@ static LRESULT HandleFindReplace(HWND hwnd, LPARAM lParam) {
     }
     size_t pos = buf->Find(findWhat, startPos, forward, useRegex, matchCase);
     if (pos != std::string::npos) {
+      // The match index follows later edits, so "N of M" stays cheap
+      SearchOptions options;
+      options.useRegex = useRegex;
+      options.matchCase = matchCase;
+      buf->SetMatchQuery(findWhat, options);
+      size_t number = buf->GetMatchNumber(pos);
+      size_t length = findWhat.length();
+      if (number > 0) {
+        const MatchList &matches = buf->GetMatches();
+        length = matches[number - 1].second;
+        std::wstring status = L"Match " + std::to_wstring(number) + L" of " +
+                              std::to_wstring(matches.size());
+        SendMessage(g_statusHwnd, SB_SETTEXT, 0, (LPARAM)status.c_str());
+      }
       buf->SetSelectionAnchor(pos);
-      buf->SetCaretPos(pos + findWhat.length());
+      buf->SetCaretPos(pos + length);
       EnsureCaretVisible(hwnd);
       InvalidateRect(hwnd, NULL, FALSE);
     } else
@@ -242,24 +251,10 @@ static LRESULT HandleFindReplace(HWND hwnd, LPARAM lParam) {
   } else if (lpfr->Flags & FR_REPLACEALL) {
     std::string findWhat = WToUTF8(lpfr->lpstrFindWhat);
     std::string replaceWith = WToUTF8(lpfr->lpstrReplaceWith);
-    bool matchCase = (lpfr->Flags & FR_MATCHCASE) != 0;
-    size_t count = 0, total = 0, tempPos = 0;
-    while ((tempPos = buf->Find(findWhat, tempPos, true, false, matchCase)) !=
-           std::string::npos) {
-      total++;
-      tempPos += findWhat.length();
-    }
-    size_t pos = 0;
-    while ((pos = buf->Find(findWhat, pos, true, false, matchCase)) !=
-           std::string::npos) {
-      buf->Replace(pos, pos + findWhat.length(), replaceWith);
-      pos += replaceWith.length();
-      count++;
-      if (total > 0)
-        SendMessage(g_progressHwnd, PBM_SETPOS,
-                    (int)((float)count / total * 100), 0);
-    }
-    SendMessage(g_progressHwnd, PBM_SETPOS, 0, 0);
+    SearchOptions options;
+    options.matchCase = (lpfr->Flags & FR_MATCHCASE) != 0;
+    // One scan and one splice; the whole operation is a single undo step
+    size_t count = buf->ReplaceAll(findWhat, replaceWith, options);
     if (count > 0) {
       UpdateScrollbars(hwnd);
       InvalidateRect(hwnd, NULL, FALSE);
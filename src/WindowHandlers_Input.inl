@@ -7,8 +7,16 @@
 static LRESULT HandlePaint(HWND hwnd) {
   PAINTSTRUCT ps;
   BeginPaint(hwnd, &ps);
+  // A caret blink dirties only the caret row, which the renderer repaints
+  // from its last frame without going back to the buffer
+  if (g_renderer->RedrawCaret(ps.rcPaint)) {
+    EndPaint(hwnd, &ps);
+    return 0;
+  }
+  FrameProfiler::Scope frameTimer(FrameProfiler::Stage::Frame);
   Buffer *activeBuffer = g_editor->GetActiveBuffer();
   if (activeBuffer) {
+    FrameProfiler::Scope bufferTimer(FrameProfiler::Stage::Buffer);
     size_t scrollLine = activeBuffer->GetScrollLine();
     size_t viewportLineCount = g_renderer->CalculateVisibleLineCount();
     size_t actualLines = 0;
@@ -37,7 +45,9 @@ static LRESULT HandlePaint(HWND hwnd) {
       physicalLineNumbers.push_back(
           activeBuffer->GetPhysicalLine(scrollLine + i));
     }
+    bufferTimer.Stop();
 
+    FrameProfiler::Scope highlightsTimer(FrameProfiler::Stage::Highlights);
     auto highlights = activeBuffer->GetHighlights();
     std::vector<Buffer::HighlightRange> viewportHighlights;
     for (const auto &h : highlights) {
@@ -81,12 +91,14 @@ static LRESULT HandlePaint(HWND hwnd) {
         }
       }
     }
+    highlightsTimer.Stop();
 
     g_renderer->DrawEditorLines(
         content, viewportRelativeCaret, &viewportSelections,
         &viewportHighlights, scrollLine + 1, activeBuffer->GetScrollX(),
         &physicalLineNumbers, activeBuffer->GetTotalLines());
   }
+  frameTimer.Stop();
   EndPaint(hwnd, &ps);
   return 0;
 }
@@ -94,12 +106,7 @@ static LRESULT HandlePaint(HWND hwnd) {
 static LRESULT HandleChar(HWND hwnd, WPARAM wParam) {
   if (g_scriptEngine->IsKeyboardCaptured()) {
     wchar_t wc = static_cast<wchar_t>(wParam);
-    std::string s;
-    int len = WideCharToMultiByte(CP_UTF8, 0, &wc, 1, NULL, 0, NULL, NULL);
-    if (len > 0) {
-      s.resize(len);
-      WideCharToMultiByte(CP_UTF8, 0, &wc, 1, &s[0], len, NULL, NULL);
-    }
+    std::string s = Utf::FromWide(&wc, 1);
     if (g_scriptEngine->HandleKeyEvent(s, true)) {
       InvalidateRect(hwnd, NULL, FALSE);
       return 0;
@@ -118,11 +125,7 @@ static LRESULT HandleChar(HWND hwnd, WPARAM wParam) {
         s = "\t";
       else {
         wchar_t wc = static_cast<wchar_t>(wParam);
-        int len = WideCharToMultiByte(CP_UTF8, 0, &wc, 1, NULL, 0, NULL, NULL);
-        if (len > 0) {
-          s.resize(len);
-          WideCharToMultiByte(CP_UTF8, 0, &wc, 1, &s[0], len, NULL, NULL);
-        }
+        s = Utf::FromWide(&wc, 1);
       }
       if (!s.empty()) {
         activeBuffer->Insert(activeBuffer->GetCaretPos(), s);
@@ -244,6 +247,12 @@ static LRESULT HandleKeyDown(HWND hwnd, WPARAM wParam, LPARAM lParam) {
     }
     s_inEscapeSequence = false;
     s_inCtrlX = false; // Reset prefix
+    if (g_editor->IsFindInFilesRunning())
+      g_editor->CancelFindInFiles();
+    if (g_editor->IsOpening()) {
+      g_editor->CancelOpens();
+      UpdateMenu(hwnd);
+    }
 
     Buffer *buf = g_editor->GetActiveBuffer();
     if (buf)
@@ -657,9 +666,7 @@ LRESULT HandleMouseDown(HWND hwnd, LPARAM lParam) {
                                   visualLineIndex)) {
       size_t physicalLine = activeBuffer->GetPhysicalLine(
           visualLineIndex + activeBuffer->GetScrollLine());
-      int digits =
-          (totalLines > 0) ? (int)std::to_string(totalLines).length() : 1;
-      float gutterWidth = (digits * 8.0f) + 15.0f;
+      float gutterWidth = g_renderer->GetGutterWidth(totalLines);
       if (x > gutterWidth - 15.0f)
         activeBuffer->ToggleFold(physicalLine);
       else
@@ -0,0 +1,11 @@
+#include <iostream>
+#include <string>
+
+// DebugLog for the headless test targets, which link the text engine
+// without the editor globals (TestGlobals.cpp, FileUtils.cpp)
+enum LogLevel { LOG_DEBUG = 0, LOG_INFO = 1, LOG_WARN = 2, LOG_ERROR = 3 };
+
+void DebugLog(const std::string &msg, LogLevel level) {
+  if (level >= LOG_WARN)
+    std::cerr << msg << std::endl;
+}
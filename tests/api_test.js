@@ -26,6 +26,18 @@ function test_js_apis() {
     // Test: Search
     var findPos = Editor.find("API TEST", 0, true, false, true);
     assertEqual(findPos, 0, "Line 26: Find 'API TEST' failed");
+    var all = Editor.findAll("t", false, true);
+    assertEqual(all.length > 0, true, "FindAll found nothing");
+    assertEqual(Editor.find("t", 0, true, false, true), all[0], "FindAll first offset mismatch");
+    var hits = Editor.searchFiles(".", "no such text anywhere", { include: "*.none" });
+    assertEqual(hits.length, 0, "searchFiles matched an excluded file");
+
+    // Test: Asynchronous open
+    Editor.writeFile("api_test_async.txt", "async line 1\nasync line 2\n");
+    var asyncIndex = Editor.openAsync("api_test_async.txt", function (index, ok) {
+        assertEqual(ok, true, "openAsync reported failure");
+    });
+    assertEqual(asyncIndex >= 0, true, "openAsync returned no buffer");
 
     Editor.setStatusText("JS API Tests Completed.");
     return "SUCCESS";
@@ -1,9 +1,25 @@
 #include "../include/Buffer.h"
+#include "../include/FileSearch.h"
 #include "../include/PieceTable.h"
+#include "../include/RegexSearch.h"
+#include "../include/TextSearch.h"
+#include "../include/Utf.h"
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <random>
+#include <regex>
 #include <string>
+#include <thread>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#endif
 
 class Timer {
 public:
@@ -31,20 +47,26 @@ void BenchmarkLineIndex() {
   for (int i = 0; i < 100000; ++i) {
     largeText += "Line " + std::to_string(i) + "\n";
   }
-  pt.LoadOriginal(largeText.c_str(), largeText.length());
+  {
+    Timer t("LoadOriginal + line index (100k lines - SIMD)");
+    pt.LoadOriginal(largeText.c_str(), largeText.length());
+  }
 
   {
-    Timer t("GetLineOffset (1000 random looks - Cached)");
+    Timer t("GetLineOffset (1000 random looks - Indexed)");
     for (int i = 0; i < 1000; ++i) {
       pt.GetLineOffset(rand() % 100000);
     }
   }
 
-  // To show speedup, we could invalidate cache and measure first rebuild
-  pt.InvalidateLineCache();
+  // Edits only touch the piece tree, so lookups stay cheap afterwards
   {
-    Timer t("RebuildLineCache (100k lines - SIMD)");
-    pt.GetLineOffset(0); // Triggers rebuild
+    Timer t("Insert + GetLineOffset (1000 edits)");
+    for (int i = 0; i < 1000; ++i) {
+      size_t line = rand() % 100000;
+      pt.Insert(pt.GetLineOffset(line), "x\n");
+      pt.GetLineOffset(line + 1);
+    }
   }
 }
 
@@ -71,6 +93,54 @@ void BenchmarkCompaction() {
             << std::endl;
 }
 
+void BenchmarkPieceScaling() {
+  std::cout << "\n--- Piece Count Scaling Benchmarks ---" << std::endl;
+
+  std::string original;
+  for (int i = 0; i < 200000; ++i) {
+    original += "Original line " + std::to_string(i) + "\n";
+  }
+
+  const size_t pieceTargets[] = {1000, 10000, 100000};
+  for (size_t target : pieceTargets) {
+    PieceTable pt;
+    pt.LoadOriginal(original.data(), original.length());
+    std::mt19937 rng(1234);
+
+    // Scattered inserts never coalesce, so each adds up to two pieces
+    while (pt.GetPieceCount() < target) {
+      pt.Insert(rng() % pt.GetTotalLength(), "x");
+    }
+    std::cout << "Pieces: " << pt.GetPieceCount() << std::endl;
+
+    std::string label = std::to_string(target) + " pieces";
+    {
+      Timer t("  1000 inserts near end (" + label + ")");
+      for (int i = 0; i < 1000; ++i) {
+        pt.Insert(pt.GetTotalLength() - 10 - (rng() % 1000), "y");
+      }
+    }
+    {
+      Timer t("  1000 deletes near end (" + label + ")");
+      for (int i = 0; i < 1000; ++i) {
+        pt.Delete(pt.GetTotalLength() - 10 - (rng() % 1000), 1);
+      }
+    }
+    {
+      Timer t("  1000 GetText(64) random (" + label + ")");
+      for (int i = 0; i < 1000; ++i) {
+        pt.GetText(rng() % (pt.GetTotalLength() - 64), 64);
+      }
+    }
+    {
+      Timer t("  1000 GetLineAtOffset random (" + label + ")");
+      for (int i = 0; i < 1000; ++i) {
+        pt.GetLineAtOffset(rng() % pt.GetTotalLength());
+      }
+    }
+  }
+}
+
 void BenchmarkViewport() {
   std::cout << "\n--- Viewport Extraction Benchmarks ---" << std::endl;
 
@@ -97,24 +167,612 @@ void BenchmarkViewport() {
   }
 }
 
+// Document of 'lines' lines where every 'stride'-th line contains "needle"
+static std::string MakeReplaceDocument(size_t lines, size_t stride) {
+  std::string data;
+  for (size_t i = 0; i < lines; ++i) {
+    data += (i % stride == 0) ? "needle in line " : "plain text line ";
+    data += std::to_string(i) + "\n";
+  }
+  return data;
+}
+
+void BenchmarkReplaceAll() {
+  std::cout << "\n--- Replace All Benchmarks ---" << std::endl;
+
+  // Same document through both paths
+  {
+    std::string data = MakeReplaceDocument(400000, 40); // ~10k matches
+    Buffer sequential, bulk;
+    sequential.Insert(0, data);
+    bulk.Insert(0, data);
+    std::cout << "Document: " << data.size() / (1024 * 1024) << " MB"
+              << std::endl;
+    {
+      Timer t("Sequential Find+Replace (10k matches)");
+      size_t pos = 0;
+      while ((pos = sequential.Find("needle", pos)) != std::string::npos) {
+        sequential.Replace(pos, pos + 6, "thread");
+        pos += 6;
+      }
+    }
+    {
+      Timer t("ReplaceAll (10k matches)");
+      bulk.ReplaceAll("needle", "thread");
+    }
+    if (bulk.GetText(0, bulk.GetTotalLength()) !=
+        sequential.GetText(0, sequential.GetTotalLength()))
+      std::cout << "  ERROR: results differ" << std::endl;
+  }
+
+  // 100k replacements in a larger document
+  {
+    std::string data = MakeReplaceDocument(4000000, 40);
+    Buffer buf;
+    buf.Insert(0, data);
+    std::cout << "Document: " << data.size() / (1024 * 1024) << " MB"
+              << std::endl;
+    size_t count = 0;
+    {
+      Timer t("ReplaceAll (100k matches)");
+      count = buf.ReplaceAll("needle", "thread");
+    }
+    std::cout << "Replaced: " << count << std::endl;
+    {
+      Timer t("Undo ReplaceAll (100k matches)");
+      buf.Undo();
+    }
+  }
+}
+
+// Runs 'search' once and prints its throughput over 'bytes'
+static size_t MeasureSearch(const std::string &name, size_t bytes,
+                            const std::function<size_t()> &search) {
+  auto start = std::chrono::high_resolution_clock::now();
+  size_t result = search();
+  auto end = std::chrono::high_resolution_clock::now();
+  double seconds = std::chrono::duration<double>(end - start).count();
+  std::cout << std::left << std::setw(40) << name << ": " << std::right
+            << std::setw(10) << std::fixed << std::setprecision(2)
+            << (bytes / (1024.0 * 1024.0 * 1024.0)) / seconds << " GB/s"
+            << std::endl;
+  return result;
+}
+
 void BenchmarkSearch() {
   std::cout << "\n--- Search Benchmarks ---" << std::endl;
 
-  Buffer buf;
-  // Create a 10MB buffer with a needle at the end
+  // ~256MB document with the needle at the very end
+  const size_t targetSize = 256 * 1024 * 1024;
   std::string largeData;
-  largeData.reserve(10 * 1024 * 1024);
-  for (int i = 0; i < 100000; ++i) {
+  largeData.reserve(targetSize + 64);
+  for (int i = 0; largeData.size() < targetSize; ++i) {
     largeData += "Some data line " + std::to_string(i) + "\n";
   }
   std::string needle = "TARGET_NEEDLE_123";
   largeData += needle;
+  const size_t size = largeData.size();
 
   PieceTable pt;
   pt.LoadOriginal(largeData.data(), largeData.length());
-  // Since Buffer::Find uses m_pieceTable which is private, we'll just test the
-  // logic here Or we could add a test method to Buffer for searching. For now,
-  // let's keep it simple.
+  std::cout << "Document: " << size / (1024 * 1024) << " MB" << std::endl;
+
+  // The previous Buffer::Find: 64KB chunk copies + std::string::find
+  size_t expected = MeasureSearch("Chunk copy + std::string::find", size, [&] {
+    const size_t CHUNK_SIZE = 64 * 1024;
+    for (size_t pos = 0; pos < size; pos += CHUNK_SIZE) {
+      std::string chunk = pt.GetText(pos, CHUNK_SIZE + needle.size() - 1);
+      size_t found = chunk.find(needle);
+      if (found != std::string::npos)
+        return pos + found;
+    }
+    return std::string::npos;
+  });
+  MeasureSearch("Chunk copy + lowercase copies + find", size, [&] {
+    const size_t CHUNK_SIZE = 64 * 1024;
+    std::string lowerNeedle = needle;
+    std::transform(lowerNeedle.begin(), lowerNeedle.end(),
+                   lowerNeedle.begin(), ::tolower);
+    for (size_t pos = 0; pos < size; pos += CHUNK_SIZE) {
+      std::string chunk = pt.GetText(pos, CHUNK_SIZE + needle.size() - 1);
+      std::string lowerChunk = chunk;
+      std::transform(lowerChunk.begin(), lowerChunk.end(), lowerChunk.begin(),
+                     ::tolower);
+      size_t found = lowerChunk.find(lowerNeedle);
+      if (found != std::string::npos)
+        return pos + found;
+    }
+    return std::string::npos;
+  });
+
+  TextSearcher exact(needle, true);
+  TextSearcher folded("target_needle_123", false);
+  TextSearcher first("Some data line 0\n", true);
+  size_t found = MeasureSearch("SIMD in-place (match case)", size, [&] {
+    return exact.FindForward(pt, 0);
+  });
+  if (found != expected)
+    std::cout << "  ERROR: SIMD result differs" << std::endl;
+  MeasureSearch("SIMD in-place (ignore case)", size, [&] {
+    return folded.FindForward(pt, 0);
+  });
+  MeasureSearch("SIMD in-place backward", size, [&] {
+    return first.FindBackward(pt, size);
+  });
+
+  // Streaming regex: no document copy, linear in the bytes scanned
+  std::shared_ptr<const RegexSearcher> regex =
+      RegexSearcher::Get("TARGET_[A-Z]+_\\d+", true);
+  found = MeasureSearch("Streaming regex (selective)", size, [&] {
+    return regex->FindForward(pt, 0);
+  });
+  if (found != expected)
+    std::cout << "  ERROR: regex result differs" << std::endl;
+  std::shared_ptr<const RegexSearcher> busy =
+      RegexSearcher::Get("line \\d+x", true);
+  MeasureSearch("Streaming regex (frequent candidates)", size, [&] {
+    return busy->FindForward(pt, 0);
+  });
+  {
+    // std::regex needs the text as one string; measured on 16MB only
+    const size_t sample = 16 * 1024 * 1024;
+    std::string text = pt.GetText(size - sample, sample);
+    std::regex re("TARGET_[A-Z]+_\\d+");
+    MeasureSearch("std::regex on a copy (16MB)", sample, [&] {
+      std::smatch m;
+      return std::regex_search(text, m, re) ? (size_t)m.position()
+                                              : std::string::npos;
+    });
+  }
+
+  // Matches are unaffected by fragmentation; spans are visited in place
+  std::mt19937 rng(5);
+  while (pt.GetPieceCount() < 10000) {
+    pt.Insert(rng() % (size - needle.size()), "x");
+  }
+  MeasureSearch("SIMD in-place (10000 pieces)", size, [&] {
+    return exact.FindForward(pt, 0);
+  });
+}
+
+void BenchmarkFindAll() {
+  std::cout << "\n--- Find All Benchmarks ---" << std::endl;
+
+  std::string data = MakeReplaceDocument(4000000, 40); // ~100k matches
+  Buffer buf;
+  buf.Insert(0, data);
+  std::cout << "Document: " << data.size() / (1024 * 1024) << " MB"
+            << std::endl;
+  {
+    Timer t("Find loop (100k matches)");
+    size_t pos = 0, count = 0;
+    while ((pos = buf.Find("needle", pos)) != std::string::npos) {
+      ++count;
+      pos += 6;
+    }
+  }
+  {
+    Timer t("FindAll, one thread");
+    buf.FindAll("needle", SearchOptions(), false);
+  }
+  {
+    Timer t("FindAll, parallel");
+    buf.FindAll("needle", SearchOptions(), true);
+  }
+
+  // Keeping "N of M" current while typing
+  buf.SetMatchQuery("needle");
+  buf.GetMatches();
+  std::mt19937 rng(5);
+  size_t matches = 0;
+  {
+    Timer t("Match index, 1000 edits");
+    for (int i = 0; i < 1000; ++i) {
+      size_t pos = rng() % buf.GetTotalLength();
+      buf.Insert(pos, (i % 2) ? "needle" : "x");
+      matches = buf.GetMatches().size();
+    }
+  }
+  {
+    Timer t("Full recount, 10 edits");
+    for (int i = 0; i < 10; ++i) {
+      size_t pos = rng() % buf.GetTotalLength();
+      buf.Insert(pos, "x");
+      matches = buf.FindAll("needle", SearchOptions(), false).size();
+    }
+  }
+  std::cout << "Matches after edits: " << matches << std::endl;
+}
+
+void BenchmarkFindInFiles() {
+  std::cout << "\n--- Find in Files Benchmarks ---" << std::endl;
+
+  // 100k small source-like files in 1000 directories, 1 in 50 with a match
+  namespace fs = std::filesystem;
+  fs::path root = fs::temp_directory_path() / "ecode_fif_bench";
+  fs::remove_all(root);
+  std::string body;
+  for (int i = 0; i < 40; ++i)
+    body += "int value_" + std::to_string(i) + " = compute(input, " +
+            std::to_string(i) + ");\n";
+  for (int d = 0; d < 1000; ++d) {
+    fs::path dir = root / ("dir" + std::to_string(d / 100)) /
+                   ("sub" + std::to_string(d));
+    fs::create_directories(dir);
+    for (int f = 0; f < 100; ++f) {
+      std::ofstream out(dir / ("file" + std::to_string(f) + ".cpp"),
+                        std::ios::binary);
+      out << body;
+      if ((d * 100 + f) % 50 == 0)
+        out << "// needle\n";
+    }
+  }
+  std::cout << "Tree: 100000 files" << std::endl;
+
+  {
+    Timer t("ifstream + getline (old)");
+    size_t count = 0;
+    for (const auto &entry : fs::recursive_directory_iterator(root)) {
+      if (!entry.is_regular_file())
+        continue;
+      std::ifstream file(entry.path());
+      std::string line;
+      while (std::getline(file, line))
+        if (line.find("needle") != std::string::npos)
+          ++count;
+    }
+  }
+  {
+    Timer t("FileSearch, one thread");
+    FileSearch search(root.wstring(), "needle");
+    search.SetThreadCount(1);
+    search.Run();
+  }
+  {
+    Timer t("FileSearch, " +
+            std::to_string((std::max)(1u, std::thread::hardware_concurrency())) +
+            " threads");
+    FileSearch search(root.wstring(), "needle");
+    search.Run();
+  }
+  fs::remove_all(root);
+}
+
+void BenchmarkFileBackends() {
+  std::cout << "\n--- File Backend Benchmarks ---" << std::endl;
+
+  namespace fs = std::filesystem;
+  fs::path path = fs::temp_directory_path() / "ecode_backend_bench.txt";
+  {
+    std::ofstream out(path, std::ios::binary);
+    std::string block;
+    for (int i = 0; i < 10000; ++i)
+      block += "2024-01-01 12:00:00 INFO request " + std::to_string(i) +
+               " handled in 12ms\n";
+    while (static_cast<size_t>(out.tellp()) < 256u * 1024 * 1024)
+      out << block;
+  }
+  std::cout << "File: " << fs::file_size(path) / (1024 * 1024) << " MB"
+            << std::endl;
+
+  // Open plus the line-counting pass of LoadOriginal
+  auto load = [&](const std::string &name, MemoryMappedFile::Backend backend,
+                  bool advise) {
+    Timer t(name);
+    MemoryMappedFile file;
+    file.Open(path.wstring(), backend);
+    if (advise)
+      file.Advise(MemoryMappedFile::Access::Sequential);
+    PieceTable pt;
+    pt.LoadOriginal(file.GetData(), file.GetSize());
+    pt.GetTotalLines();
+  };
+  load("Mapped, no advice", MemoryMappedFile::Backend::Mapped, false);
+  load("Mapped, sequential advice", MemoryMappedFile::Backend::Mapped, true);
+  load("Read", MemoryMappedFile::Backend::Read, false);
+  {
+    MemoryMappedFile file;
+    file.Open(path.wstring());
+    PieceTable pt;
+    pt.LoadOriginal(file.GetData(), file.GetSize(), 0);
+    size_t threads = (std::max)(1u, std::thread::hardware_concurrency());
+    {
+      Timer t("IndexOriginal, one thread");
+      pt.IndexOriginal(0, file.GetSize(), nullptr, 1);
+    }
+    {
+      Timer t("IndexOriginal, " + std::to_string(threads) + " threads");
+      pt.IndexOriginal(0, file.GetSize(), nullptr, threads);
+    }
+  }
+  {
+    Buffer buf;
+    {
+      Timer t("Buffer::OpenFile (first screen)");
+      buf.OpenFile(path.wstring());
+    }
+    Timer t("Buffer::OpenFile (fully indexed)");
+    buf.FinishIndexing(true);
+  }
+  {
+    Buffer buf;
+    {
+      Timer t("Buffer::OpenFileAsync (returns)");
+      buf.OpenFileAsync(path.wstring());
+    }
+    Timer t("Buffer::OpenFileAsync (fully indexed)");
+    buf.FinishIndexing(true);
+  }
+  fs::remove(path);
+}
+
+void BenchmarkUtf16Open() {
+  std::cout << "\n--- UTF-16 Open Benchmarks ---" << std::endl;
+
+  // The same log as UTF-8 and as UTF-16LE; ECODE_BENCH_UTF16_MB sets the
+  // UTF-16 size
+  namespace fs = std::filesystem;
+  uint64_t mb = 512;
+  if (const char *env = std::getenv("ECODE_BENCH_UTF16_MB"))
+    mb = std::strtoull(env, nullptr, 10);
+  fs::path utf8Path = fs::temp_directory_path() / "ecode_utf8_bench.txt";
+  fs::path utf16Path = fs::temp_directory_path() / "ecode_utf16_bench.txt";
+  {
+    std::string block;
+    for (int i = 0; i < 10000; ++i)
+      block += "2024-01-01 12:00:00 INFO request " + std::to_string(i) +
+               " handled in 12ms\n";
+    std::string wide;
+    for (char c : block) {
+      wide += c;
+      wide += '\0';
+    }
+    std::ofstream out8(utf8Path, std::ios::binary);
+    std::ofstream out16(utf16Path, std::ios::binary);
+    out16 << "\xFF\xFE";
+    while (static_cast<uint64_t>(out16.tellp()) < mb * 1024 * 1024) {
+      out8 << block;
+      out16 << wide;
+    }
+  }
+  std::cout << "File: " << fs::file_size(utf16Path) / (1024 * 1024)
+            << " MB UTF-16" << std::endl;
+
+  for (const fs::path &path : {utf8Path, utf16Path}) {
+    std::string name = path == utf8Path ? "UTF-8" : "UTF-16";
+    Buffer buf;
+    {
+      Timer t(name + " OpenFile (first screen)");
+      buf.OpenFile(path.wstring());
+    }
+    {
+      Timer t(name + " OpenFile (fully indexed)");
+      buf.FinishIndexing(true);
+    }
+    Timer t(name + " read every line");
+    for (size_t line = 0; line < buf.GetTotalLines(); line += 1000)
+      buf.GetText(buf.GetLineOffset(line), 64);
+  }
+  fs::remove(utf8Path);
+  fs::remove(utf16Path);
+}
+
+void BenchmarkUtf() {
+  std::cout << "\n--- UTF Conversion Benchmarks ---" << std::endl;
+
+  // ~64MB each of ASCII source, Japanese prose and a mix of the two
+  const size_t targetSize = 64 * 1024 * 1024;
+  const std::pair<const char *, std::string> samples[] = {
+      {"ASCII", "for (size_t i = 0; i < count; ++i) total += values[i];\n"},
+      {"CJK", "\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E\xE3\x81\xAE"
+              "\xE6\x96\x87\xE7\xAB\xA0\xE3\x81\xA7\xE3\x81\x99"
+              "\xE3\x80\x82\n"},
+      {"Mixed", "// \xE8\xA8\xAD\xE5\xAE\x9A\xE3\x82\x92\xE8\xAA"
+                "\xAD\xE3\x82\x80 load settings\n"}};
+  for (const auto &sample : samples) {
+    std::string text;
+    text.reserve(targetSize + sample.second.size());
+    while (text.size() < targetSize)
+      text += sample.second;
+    std::string name = sample.first;
+    std::u16string wide(text.size(), u'\0');
+
+#ifdef _WIN32
+    // The previous path: measure, then convert
+    MeasureSearch(name + " MultiByteToWideChar x2", text.size(), [&] {
+      int len = MultiByteToWideChar(CP_UTF8, 0, text.data(),
+                                    static_cast<int>(text.size()), NULL, 0);
+      return static_cast<size_t>(MultiByteToWideChar(
+          CP_UTF8, 0, text.data(), static_cast<int>(text.size()),
+          reinterpret_cast<wchar_t *>(&wide[0]), len));
+    });
+#endif
+    size_t units = MeasureSearch(name + " Utf::Utf8ToUtf16", text.size(), [&] {
+      return Utf::Utf8ToUtf16(text.data(), text.size(), &wide[0]);
+    });
+    MeasureSearch(name + " Utf::Utf16Length", text.size(), [&] {
+      return Utf::Utf16Length(text.data(), text.size());
+    });
+    MeasureSearch(name + " Utf::IsValidUtf8", text.size(), [&] {
+      return static_cast<size_t>(Utf::IsValidUtf8(text.data(), text.size()));
+    });
+
+    std::string back(units * 3, '\0');
+#ifdef _WIN32
+    MeasureSearch(name + " WideCharToMultiByte x2", text.size(), [&] {
+      const wchar_t *w = reinterpret_cast<const wchar_t *>(wide.data());
+      int len = WideCharToMultiByte(CP_UTF8, 0, w, static_cast<int>(units),
+                                    NULL, 0, NULL, NULL);
+      return static_cast<size_t>(
+          WideCharToMultiByte(CP_UTF8, 0, w, static_cast<int>(units),
+                              &back[0], len, NULL, NULL));
+    });
+#endif
+    MeasureSearch(name + " Utf::Utf16ToUtf8", text.size(), [&] {
+      return Utf::Utf16ToUtf8(wide.data(), units, &back[0]);
+    });
+  }
+}
+
+// Resident set size of this process in bytes, 0 if unknown
+static size_t ResidentBytes() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return counters.WorkingSetSize;
+  return 0;
+#else
+  std::ifstream statm("/proc/self/statm");
+  size_t pages = 0, resident = 0;
+  if (statm >> pages >> resident)
+    return resident * 4096;
+  return 0;
+#endif
+}
+
+void BenchmarkHugeFile() {
+  std::cout << "\n--- Huge File Benchmarks ---" << std::endl;
+
+  // ECODE_BENCH_HUGE_GB overrides the size; 0 skips the benchmark
+  namespace fs = std::filesystem;
+  uint64_t gb = 20;
+  if (const char *env = std::getenv("ECODE_BENCH_HUGE_GB"))
+    gb = std::strtoull(env, nullptr, 10);
+  uint64_t bytes = gb * 1024 * 1024 * 1024;
+  fs::path path = fs::temp_directory_path() / "ecode_huge_bench.txt";
+  std::error_code ec;
+  if (gb == 0 ||
+      fs::space(path.parent_path(), ec).available < bytes + bytes / 10) {
+    std::cout << "Skipped: needs " << gb << " GB free in "
+              << path.parent_path().string() << std::endl;
+    return;
+  }
+  {
+    Timer t("Write " + std::to_string(gb) + " GB");
+    std::ofstream out(path, std::ios::binary);
+    std::string block;
+    for (int i = 0; i < 10000; ++i)
+      block += "2024-01-01 12:00:00 INFO request " + std::to_string(i) +
+               " handled in 12ms\n";
+    for (uint64_t written = 0; written < bytes; written += block.size())
+      out << block;
+  }
+
+  Buffer buf;
+  buf.SetWindowedOpenThreshold(1); // also when the size was overridden
+  {
+    Timer t("Buffer::OpenFile (windowed)");
+    buf.OpenFile(path.wstring());
+  }
+  std::cout << "Estimated lines: " << buf.GetEstimatedTotalLines()
+            << std::endl;
+  {
+    Timer t("Background indexing");
+    buf.FinishIndexing(true);
+  }
+  std::cout << "Lines: " << buf.GetTotalLines()
+            << ", RSS after open: " << ResidentBytes() / (1024 * 1024) << " MB"
+            << std::endl;
+
+  // Jump to a position and read the first screen, then scroll a page at a
+  // time; each jump lands in windows that are not mapped yet
+  const size_t screenLines = 50;
+  auto screen = [&](size_t line) {
+    size_t start = buf.GetLineOffset(line);
+    size_t end = buf.GetLineOffset(line + screenLines);
+    return buf.GetText(start, end - start).size();
+  };
+  size_t lines = buf.GetTotalLines();
+  struct Position {
+    const char *name;
+    size_t line;
+  } positions[] = {{"begin", 0},
+                   {"middle", lines / 2},
+                   {"end", lines - screenLines - 1}};
+  size_t sink = 0;
+  for (const Position &pos : positions) {
+    {
+      Timer t(std::string("First screen at ") + pos.name);
+      sink += screen(pos.line);
+    }
+    {
+      Timer t(std::string("Scroll 100 pages at ") + pos.name);
+      size_t line = pos.line >= 100 * screenLines ? pos.line - 100 * screenLines
+                                                  : pos.line;
+      for (int page = 0; page < 100; ++page, line += screenLines)
+        sink += screen(line);
+    }
+  }
+  std::cout << "RSS after scrolling: " << ResidentBytes() / (1024 * 1024)
+            << " MB (" << sink << " bytes shown)" << std::endl;
+  fs::remove(path);
+}
+
+void BenchmarkSave() {
+  std::cout << "\n--- Save Benchmarks ---" << std::endl;
+
+  // ECODE_BENCH_SAVE_MB overrides the size; 0 skips the benchmark
+  namespace fs = std::filesystem;
+  uint64_t mb = 5 * 1024;
+  if (const char *env = std::getenv("ECODE_BENCH_SAVE_MB"))
+    mb = std::strtoull(env, nullptr, 10);
+  uint64_t bytes = mb * 1024 * 1024;
+  fs::path path = fs::temp_directory_path() / "ecode_save_bench.txt";
+  fs::path target = fs::temp_directory_path() / "ecode_save_bench_out.txt";
+  std::error_code ec;
+  if (mb == 0 ||
+      fs::space(path.parent_path(), ec).available < 3 * bytes + bytes / 10) {
+    std::cout << "Skipped: needs " << 3 * mb << " MB free in "
+              << path.parent_path().string() << std::endl;
+    return;
+  }
+  {
+    std::ofstream out(path, std::ios::binary);
+    std::string block;
+    for (int i = 0; i < 10000; ++i)
+      block += "2024-01-01 12:00:00 INFO request " + std::to_string(i) +
+               " handled in 12ms\n";
+    for (uint64_t written = 0; written < bytes; written += block.size())
+      out << block;
+  }
+
+  // 1000 scattered edits, plus a fragmented region of 10000 small inserts,
+  // made to the buffer and to a bare table over the same file
+  Buffer buf;
+  buf.SetBackgroundIndexThreshold(0);
+  buf.OpenFile(path.wstring());
+  MemoryMappedFile file;
+  file.Open(path.wstring());
+  PieceTable pt;
+  pt.LoadOriginal(file.GetData(), file.GetSize());
+  std::mt19937_64 rng(7);
+  for (int i = 0; i < 11000; ++i) {
+    size_t pos = i < 1000 ? rng() % buf.GetTotalLength() : 1000 + i * 7;
+    const char *text = i < 1000 ? "EDIT" : "x";
+    buf.Insert(pos, text);
+    pt.Insert(pos, text);
+  }
+  size_t size = buf.GetTotalLength();
+  std::cout << "Document: " << size / (1024 * 1024) << " MB" << std::endl;
+
+  // The previous save: one unbuffered write per piece
+  MeasureSearch("One write per piece", size, [&] {
+    FILE *out = fopen(target.string().c_str(), "wb");
+    if (!out)
+      return size_t(0);
+    setvbuf(out, nullptr, _IONBF, 0);
+    size_t writes = 0;
+    pt.WriteTo([&](const char *data, size_t len) {
+      fwrite(data, 1, len, out);
+      ++writes;
+    });
+    fclose(out);
+    return writes;
+  });
+  MeasureSearch("Buffer::SaveFile", size,
+                [&] { return buf.SaveFile(target.wstring()) ? size : 0; });
+  fs::remove(target);
+  fs::remove(path);
 }
 
 int main() {
@@ -123,8 +781,17 @@ int main() {
 
   BenchmarkLineIndex();
   BenchmarkCompaction();
+  BenchmarkPieceScaling();
   BenchmarkViewport();
-  // BenchmarkSearch();
+  BenchmarkReplaceAll();
+  BenchmarkSearch();
+  BenchmarkFindAll();
+  BenchmarkFindInFiles();
+  BenchmarkFileBackends();
+  BenchmarkUtf16Open();
+  BenchmarkUtf();
+  BenchmarkHugeFile();
+  BenchmarkSave();
 
   std::cout << "\nBenchmarks completed." << std::endl;
   return 0;
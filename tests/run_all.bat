@@ -71,6 +71,38 @@ if %ERRORLEVEL% NEQ 0 (
     exit /b %ERRORLEVEL%
 )
 
+echo.
+echo Running UTF Conversion Tests...
+..\bin\Debug\test_utf.exe
+if %ERRORLEVEL% NEQ 0 (
+    echo UTF Conversion Tests FAILED
+    exit /b %ERRORLEVEL%
+)
+
+echo.
+echo Running UTF-16 Transcoder Tests...
+..\bin\Debug\test_utf16_transcoder.exe
+if %ERRORLEVEL% NEQ 0 (
+    echo UTF-16 Transcoder Tests FAILED
+    exit /b %ERRORLEVEL%
+)
+
+echo.
+echo Running Encoding Detection Tests...
+..\bin\Debug\test_encoding_detector.exe
+if %ERRORLEVEL% NEQ 0 (
+    echo Encoding Detection Tests FAILED
+    exit /b %ERRORLEVEL%
+)
+
+echo.
+echo Running Frame Profiler Tests...
+..\bin\Debug\test_frame_profiler.exe
+if %ERRORLEVEL% NEQ 0 (
+    echo Frame Profiler Tests FAILED
+    exit /b %ERRORLEVEL%
+)
+
 echo.
 echo Running PieceTable Stress Test...
 ..\bin\Debug\test_piecetable_stress.exe
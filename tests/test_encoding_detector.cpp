@@ -0,0 +1,326 @@
+#include "../include/EncodingDetector.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#define VERIFY(cond, msg)                                                      \
+  if (!(cond)) {                                                               \
+    std::cerr << "FAILURE at line " << __LINE__ << ": " << msg << std::endl;   \
+    exit(1);                                                                   \
+  }
+
+// Decodes the UTF-8 the corpus is written in
+static std::u32string Decode(const std::string &utf8) {
+  std::u32string out;
+  for (size_t i = 0; i < utf8.size();) {
+    unsigned char c = utf8[i];
+    int extra = c < 0x80 ? 0 : c < 0xE0 ? 1 : c < 0xF0 ? 2 : 3;
+    uint32_t cp = extra == 0 ? c : c & (0x3F >> extra);
+    for (int k = 1; k <= extra; ++k)
+      cp = (cp << 6) | (utf8[i + k] & 0x3F);
+    out += cp;
+    i += extra + 1;
+  }
+  return out;
+}
+
+static std::string ToUtf16(const std::u32string &text, bool bigEndian) {
+  std::string out;
+  auto unit = [&](uint32_t u) {
+    char lo = static_cast<char>(u & 0xFF), hi = static_cast<char>(u >> 8);
+    out += bigEndian ? hi : lo;
+    out += bigEndian ? lo : hi;
+  };
+  for (uint32_t cp : text) {
+    if (cp >= 0x10000) {
+      unit(0xD800 + ((cp - 0x10000) >> 10));
+      unit(0xDC00 + (cp & 0x3FF));
+    } else {
+      unit(cp);
+    }
+  }
+  return out;
+}
+
+// Shift-JIS for the characters the Japanese corpus uses
+static std::string ToShiftJis(const std::u32string &text) {
+  static const struct {
+    uint32_t cp;
+    uint16_t sjis;
+  } kanji[] = {{0x65E5, 0x93FA}, {0x672C, 0x967B}, {0x8A9E, 0x8CEA},
+               {0x6771, 0x938C}, {0x4EAC, 0x8B9E}, {0x4E2D, 0x9286},
+               {0x4EBA, 0x906C}, {0x5927, 0x91E5}, {0x5E74, 0x944E},
+               {0x6708, 0x8C8E}, {0x6642, 0x8E9E}, {0x9593, 0x8AD4},
+               {0x5206, 0x95AA}, {0x4E0A, 0x8FE3}, {0x4E0B, 0x89BA},
+               {0x51FA, 0x8F6F}, {0x5165, 0x93FC}, {0x529B, 0x97CD},
+               {0x6587, 0x95B6}, {0x5B57, 0x8E9A}, {0x3001, 0x8141},
+               {0x3002, 0x8142}, {0x30FC, 0x815B}};
+  std::string out;
+  for (uint32_t cp : text) {
+    uint16_t code = 0;
+    if (cp < 0x80) {
+      out += static_cast<char>(cp);
+      continue;
+    } else if (cp >= 0xFF61 && cp <= 0xFF9F) {
+      out += static_cast<char>(0xA1 + (cp - 0xFF61));
+      continue;
+    } else if (cp >= 0x3041 && cp <= 0x3093) {
+      code = static_cast<uint16_t>(0x829F + (cp - 0x3041));
+    } else if (cp >= 0x30A1 && cp <= 0x30DF) {
+      code = static_cast<uint16_t>(0x8340 + (cp - 0x30A1));
+    } else if (cp >= 0x30E0 && cp <= 0x30F6) {
+      code = static_cast<uint16_t>(0x8380 + (cp - 0x30E0));
+    } else {
+      for (const auto &k : kanji) {
+        if (k.cp == cp)
+          code = k.sjis;
+      }
+    }
+    VERIFY(code != 0, "No Shift-JIS for U+" << std::hex << cp);
+    out += static_cast<char>(code >> 8);
+    out += static_cast<char>(code & 0xFF);
+  }
+  return out;
+}
+
+static std::string ToLatin1(const std::u32string &text) {
+  std::string out;
+  for (uint32_t cp : text) {
+    VERIFY(cp < 0x100, "No Latin-1 for U+" << std::hex << cp);
+    out += static_cast<char>(cp);
+  }
+  return out;
+}
+
+struct Text {
+  const char *name;
+  std::vector<std::string> lines; // UTF-8
+  bool japanese;                  // encodable as Shift-JIS
+  bool latin1;                    // encodable as Latin-1
+};
+
+static std::vector<Text> Corpus() {
+  return {
+      {"English log",
+       {"2024-05-01 12:00:01 [INFO] Server started on port 8080\n",
+        "2024-05-01 12:00:02 [WARN] Cache miss for key user:42\n",
+        "2024-05-01 12:00:03 [ERROR] Connection reset by peer\n"},
+       false,
+       true},
+      {"English prose",
+       {"\xE2\x80\x9CIt\xE2\x80\x99s done,\xE2\x80\x9D she said \xE2\x80\x94 "
+        "and it was.\n",
+        "The caf\xC3\xA9 opened at nine; the r\xC3\xA9sum\xC3\xA9 was "
+        "ready.\n"},
+       false,
+       false},
+      {"French and German",
+       {"Le caf\xC3\xA9 \xC3\xA9tait tr\xC3\xA8s agr\xC3\xA9"
+        "able \xC3\xA0 No\xC3\xABl.\n",
+        "\xC3\x9C"
+        "ber die Stra\xC3\x9F"
+        "e, gro\xC3\x9F"
+        "e \xC3\x84pfel und K\xC3\xA4se.\n",
+        "O\xC3\xB9 est la biblioth\xC3\xA8que ? \xC3\x80 c\xC3\xB4t\xC3\xA9 "
+        "du ch\xC3\xA2teau.\n"},
+       false,
+       true},
+      {"Russian",
+       {"\xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82, "
+        "\xD0\xBC\xD0\xB8\xD1\x80! "
+        "\xD0\xAD\xD1\x82\xD0\xBE \xD1\x82\xD0\xB5\xD1\x81\xD1\x82.\n"},
+       false,
+       false},
+      {"Japanese prose",
+       {"\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E\xE3\x81\xAE\xE6\x96\x87\xE5"
+        "\xAD\x97\xE3\x82\x92\xE5\x87\xBA\xE5\x8A\x9B\xE3\x81\x97\xE3\x81"
+        "\xBE\xE3\x81\x99\xE3\x80\x82\n",
+        "\xE6\x9D\xB1\xE4\xBA\xAC\xE3\x81\xA7\xE5\xA4\xA7\xE4\xBA\xBA\xE3"
+        "\x81\x8C\xE5\x85\xA5\xE5\x8A\x9B\xE3\x81\x97\xE3\x81\x9F\xE3\x80"
+        "\x82\n",
+        "\xE3\x81\x93\xE3\x82\x8C\xE3\x81\xAF\xE3\x83\x86\xE3\x82\xB9\xE3"
+        "\x83\x88\xE3\x81\xA7\xE3\x81\x99\xE3\x80\x81\xE3\x82\xA8\xE3\x83"
+        "\xA9\xE3\x83\xBC\xE3\x81\x8C\xE5\x87\xBA\xE3\x81\xBE\xE3\x81\x97"
+        "\xE3\x81\x9F\xE3\x80\x82\n"},
+       true,
+       false},
+      {"Japanese log",
+       {"2024-05-01 12:00:01 [INFO] \xE3\x82\xB5\xE3\x83\xBC\xE3\x83\x90"
+        "\xE3\x83\xBC\xE3\x82\x92\xE9\x96\x8B\xE5\xA7\x8B\n",
+        "2024-05-01 12:00:02 [WARN] \xE6\x9D\xB1\xE4\xBA\xAC "
+        "\xE6\x99\x82\xE9\x96\x93 10\xE5\x88\x86\n",
+        "2024-05-01 12:00:03 [ERROR] \xE5\x85\xA5\xE5\x8A\x9B\xE3\x82\xA8"
+        "\xE3\x83\xA9\xE3\x83\xBC: id=42\n"},
+       false,
+       false},
+      {"Japanese log (Shift-JIS subset)",
+       {"2024-05-01 12:00:01 [INFO] \xE3\x82\xB5\xE3\x83\xBC\xE3\x83\x90"
+        "\xE3\x83\xBC\xE3\x82\x92\xE5\x87\xBA\xE5\x8A\x9B\n",
+        "2024-05-01 12:00:02 [WARN] \xE6\x9D\xB1\xE4\xBA\xAC "
+        "\xE6\x99\x82\xE9\x96\x93 10\xE5\x88\x86\n",
+        "2024-05-01 12:00:03 [ERROR] \xE5\x85\xA5\xE5\x8A\x9B\xE3\x82\xA8"
+        "\xE3\x83\xA9\xE3\x83\xBC: id=42 \xEF\xBD\xB1\xEF\xBD\xB2\n"},
+       true,
+       false},
+      {"Chinese",
+       {"\xE4\xB8\xAD\xE6\x96\x87\xE7\xBD\x91\xE9\xA1\xB5\xE6\xB5\x8F\xE8"
+        "\xA7\x88\xE5\x99\xA8\xE6\xAD\xA3\xE5\x9C\xA8\xE5\x8A\xA0\xE8\xBD"
+        "\xBD\xE3\x80\x82\n"},
+       false,
+       false},
+      {"Korean",
+       {"\xED\x95\x9C\xEA\xB5\xAD\xEC\x96\xB4 \xED\x85\x8D\xEC\x8A\xA4"
+        "\xED\x8A\xB8\xEC\x9E\x85\xEB\x8B\x88\xEB\x8B\xA4.\n"},
+       false,
+       false},
+  };
+}
+
+// Lines of 'text' in a random order until 'size' bytes of UTF-8
+static std::u32string Compose(const Text &text, size_t size,
+                              std::mt19937 &rng) {
+  std::string utf8;
+  while (utf8.size() < size) {
+    const std::string &line = text.lines[rng() % text.lines.size()];
+    utf8 += line;
+  }
+  return Decode(utf8);
+}
+
+static const char *Name(Encoding encoding) {
+  switch (encoding) {
+  case Encoding::UTF8:
+    return "UTF-8";
+  case Encoding::UTF16LE:
+    return "UTF-16LE";
+  case Encoding::UTF16BE:
+    return "UTF-16BE";
+  case Encoding::ANSI:
+    return "ANSI";
+  case Encoding::ShiftJIS:
+    return "Shift-JIS";
+  }
+  return "?";
+}
+
+static std::string ToUtf8(const std::u32string &text) {
+  std::string out;
+  for (uint32_t cp : text) {
+    if (cp < 0x80) {
+      out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+      out += static_cast<char>(0xC0 | (cp >> 6));
+      out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+      out += static_cast<char>(0xE0 | (cp >> 12));
+      out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+      out += static_cast<char>(0xF0 | (cp >> 18));
+      out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+      out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+  }
+  return out;
+}
+
+void TestCorpus() {
+  std::mt19937 rng(20240501);
+  size_t cases = 0, correct = 0;
+  auto check = [&](const std::string &name, const std::string &bytes,
+                   Encoding expected, size_t bom) {
+    EncodingDetector::Result result =
+        EncodingDetector::Detect(bytes.data(), bytes.size());
+    // The sampled path must agree with the in-memory one
+    EncodingDetector::Result read = EncodingDetector::Detect(
+        bytes.size(), [&](uint64_t offset, char *out, size_t length) {
+          size_t n = (std::min)(length, bytes.size() - (size_t)offset);
+          memcpy(out, bytes.data() + offset, n);
+          return n;
+        });
+    ++cases;
+    if (result.encoding == expected && result.bomLength == bom &&
+        read.encoding == result.encoding && read.bomLength == bom) {
+      ++correct;
+    } else {
+      std::cerr << "  " << name << ": detected " << Name(result.encoding)
+                << " (BOM " << result.bomLength << "), expected "
+                << Name(expected) << std::endl;
+    }
+  };
+
+  // Short files (a few lines) and long ones, where the middle and tail
+  // are sampled too
+  for (size_t size : {size_t(200), size_t(2000), size_t(300 * 1024)}) {
+    for (const Text &text : Corpus()) {
+      std::u32string chars = Compose(text, size, rng);
+      std::string label = std::string(text.name) + " / " +
+                          std::to_string(size) + " bytes / ";
+      std::string utf8 = ToUtf8(chars);
+      check(label + "UTF-8", utf8, Encoding::UTF8, 0);
+      check(label + "UTF-8 BOM", "\xEF\xBB\xBF" + utf8, Encoding::UTF8, 3);
+      for (bool be : {false, true}) {
+        Encoding utf16 = be ? Encoding::UTF16BE : Encoding::UTF16LE;
+        std::string units = ToUtf16(chars, be);
+        check(label + Name(utf16), units, utf16, 0);
+        check(label + Name(utf16) + " BOM",
+              (be ? "\xFE\xFF" : "\xFF\xFE") + units, utf16, 2);
+      }
+      if (text.japanese)
+        check(label + "Shift-JIS", ToShiftJis(chars), Encoding::ShiftJIS, 0);
+      if (text.latin1 && utf8.size() != chars.size())
+        check(label + "Latin-1", ToLatin1(chars), Encoding::ANSI, 0);
+    }
+  }
+
+  // A stray invalid byte keeps a large UTF-8 file UTF-8
+  std::string damaged = ToUtf8(Compose(Corpus()[4], 300 * 1024, rng));
+  damaged[damaged.size() / 2] = '\xFF';
+  check("Damaged UTF-8", damaged, Encoding::UTF8, 0);
+  check("Empty", std::string(), Encoding::UTF8, 0);
+
+  std::cout << "Corpus accuracy: " << correct << " / " << cases << std::endl;
+  VERIFY(correct == cases, "Misdetected " << cases - correct << " files");
+  std::cout << "Test 1 Passed: Corpus accuracy" << std::endl;
+}
+
+void TestSpeed() {
+  // Detection reads only the samples, so a huge file costs what a small
+  // one does
+  std::mt19937 rng(7);
+  std::string small = ToShiftJis(Compose(Corpus()[4], 64 * 1024, rng));
+  std::string huge;
+  while (huge.size() < 256 * 1024 * 1024)
+    huge += small;
+
+  for (const std::string *bytes : {&small, &huge}) {
+    const int runs = 200;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < runs; ++i) {
+      VERIFY(EncodingDetector::Detect(bytes->data(), bytes->size()).encoding ==
+                 Encoding::ShiftJIS,
+             "Shift-JIS misdetected");
+    }
+    double us = std::chrono::duration<double, std::micro>(
+                    std::chrono::high_resolution_clock::now() - start)
+                    .count() /
+                runs;
+    std::cout << "  " << bytes->size() / 1024 << " KB: " << us
+              << " us per detection" << std::endl;
+    VERIFY(us < 5000, "Detection too slow: " << us << " us");
+  }
+  std::cout << "Test 2 Passed: Speed" << std::endl;
+}
+
+int main() {
+  TestCorpus();
+  TestSpeed();
+  std::cout << "All encoding detection tests passed!" << std::endl;
+  return 0;
+}
@@ -1,11 +1,20 @@
 #include "../include/Buffer.h"
+#include "../include/CodePage.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <functional>
 #include <iostream>
+#include <iterator>
 #include <string>
+#include <thread>
 #include <vector>
-#include <windows.h>
 
-// Mock SafeSave/SafeSaveStreaming is NOT used here.
+// Mock SafeSave/FileWriter is NOT used here.
 // We link with FileUtils.cpp and PieceTable.cpp for real logic.
 
 #define VERIFY(cond, msg)                                                      \
@@ -70,7 +79,567 @@ void TestFileIO() {
            "Large file content mismatch at midpoint");
   }
 
-  DeleteFileW(testFile.c_str());
+  // 4. Mapped and read backends see the same bytes
+  {
+    MemoryMappedFile mapped, read;
+    VERIFY(mapped.Open(testFile), "Failed to map file");
+    VERIFY(read.Open(testFile, MemoryMappedFile::Backend::Read),
+           "Failed to read file");
+    VERIFY(mapped.GetBackend() == MemoryMappedFile::Backend::Mapped,
+           "Regular file was not mapped");
+    VERIFY(read.GetBackend() == MemoryMappedFile::Backend::Read,
+           "Read backend not used");
+    VERIFY(mapped.GetSize() == read.GetSize() && mapped.GetSize() > 0,
+           "Backend sizes differ");
+    VERIFY(memcmp(mapped.GetData(), read.GetData(), read.GetSize()) == 0,
+           "Backend contents differ");
+    mapped.Advise(MemoryMappedFile::Access::Sequential);
+    mapped.Advise(MemoryMappedFile::Access::Normal);
+    mapped.Close();
+    read.Close();
+    VERIFY(!mapped.IsOpen() && mapped.GetSize() == 0, "Close");
+
+    Buffer empty;
+    VERIFY(empty.SaveFile(testFile), "Failed to save empty file");
+    VERIFY(read.Open(testFile, MemoryMappedFile::Backend::Read) &&
+               read.GetSize() == 0,
+           "Empty file read");
+    VERIFY(mapped.Open(testFile) && mapped.GetSize() == 0 && mapped.IsOpen(),
+           "Empty file map");
+  }
+
+  // 5. Windowed mapping: small windows, few of them resident
+  {
+    std::cout << "Testing Windowed Mapping..." << std::endl;
+    std::string content = "\xEF\xBB\xBF"; // BOM, skipped by Buffer
+    for (int i = 0; content.size() < 6 * 1024 * 1024; ++i)
+      content += "Line " + std::to_string(i) + std::string(i % 61, '.') + "\n";
+    {
+      Buffer buf;
+      buf.Insert(0, content);
+      VERIFY(buf.SaveFile(testFile), "Failed to save windowed test file");
+    }
+
+    MemoryMappedFile windowed;
+    windowed.SetWindowing(64 * 1024, 2);
+    VERIFY(windowed.Open(testFile, MemoryMappedFile::Backend::Windowed) &&
+               windowed.GetBackend() == MemoryMappedFile::Backend::Windowed,
+           "Windowed backend not used");
+    VERIFY(windowed.GetData() == nullptr &&
+               windowed.GetSize() == content.size(),
+           "Windowed size");
+    MemoryMappedFile::View pinned = windowed.GetView(100);
+    for (size_t pos = 0; pos < content.size(); pos += 40000) {
+      MemoryMappedFile::View view = windowed.GetView(pos);
+      VERIFY(view.data && view.offset <= pos &&
+                 pos < view.offset + view.length &&
+                 view.length <= 64 * 1024,
+             "Window does not cover offset " << pos);
+      VERIFY(memcmp(view.data, content.data() + view.offset, view.length) ==
+                 0,
+             "Window contents differ at " << view.offset);
+    }
+    // The first window was evicted long ago but is still pinned
+    VERIFY(memcmp(pinned.data, content.data(), pinned.length) == 0,
+           "Pinned window unmapped");
+    VERIFY(!windowed.GetView(content.size()).data, "View past the end");
+    pinned = MemoryMappedFile::View();
+    windowed.Close();
+
+    Buffer flat, buf;
+    buf.SetWindowedOpenThreshold(1);
+    VERIFY(flat.OpenFile(testFile) && buf.OpenFile(testFile),
+           "Failed to open windowed file");
+    std::string text = content.substr(3);
+    VERIFY(buf.GetTotalLength() == text.size() &&
+               buf.GetText(0, text.size()) == text,
+           "Windowed buffer content mismatch");
+    VERIFY(buf.GetTotalLines() == flat.GetTotalLines(),
+           "Windowed line count mismatch");
+    for (size_t line = 0; line < flat.GetTotalLines(); line += 997) {
+      VERIFY(buf.GetLineOffset(line) == flat.GetLineOffset(line),
+             "Windowed line offset mismatch at line " << line);
+    }
+    std::string needle = "Line 40000.";
+    VERIFY(buf.Find(needle, 0, true) == text.find(needle),
+           "Windowed find mismatch");
+    buf.Insert(10, "edit\n");
+    VERIFY(buf.GetTotalLines() == flat.GetTotalLines() + 1 &&
+               buf.GetText(0, 20) == text.substr(0, 10) + "edit\n" +
+                                         text.substr(10, 5),
+           "Windowed edit mismatch");
+
+    // Background indexing: the first lines open at once, the rest follows
+    for (bool windowed : {false, true}) {
+      Buffer partial;
+      partial.SetBackgroundIndexThreshold(1);
+      partial.SetWindowedOpenThreshold(windowed ? 1 : 0);
+      bool indexed = false;
+      partial.SetIndexedCallback([&]() { indexed = true; });
+      VERIFY(partial.OpenFile(testFile), "Failed to open partially");
+      size_t first = partial.GetTotalLength();
+      VERIFY(partial.IsIndexing() && first >= Buffer::INITIAL_INDEX_BYTES &&
+                 first < text.size() &&
+                 partial.GetText(0, first) == text.substr(0, first),
+             "First chunk mismatch");
+      size_t estimate = partial.GetEstimatedTotalLines();
+      VERIFY(estimate > flat.GetTotalLines() * 3 / 4 &&
+                 estimate < flat.GetTotalLines() * 5 / 4,
+             "Line estimate " << estimate << " too far off");
+      // Edits stay editable while the rest loads; the rest goes after them
+      partial.Insert(0, "x");
+      partial.Insert(first + 1, "y");
+      VERIFY(partial.FinishIndexing(true) && indexed && !partial.IsIndexing(),
+             "Indexing did not finish");
+      VERIFY(partial.GetText(0, text.size() + 2) ==
+                 "x" + text.substr(0, first) + "y" + text.substr(first),
+             "Edit at the end of the indexed part misplaced");
+      partial.Undo();
+      VERIFY(partial.GetTotalLength() == text.size() + 1 &&
+                 partial.GetTotalLines() == flat.GetTotalLines() &&
+                 partial.GetText(0, text.size() + 1) == "x" + text,
+             "Indexed content mismatch");
+      VERIFY(partial.GetLineOffset(flat.GetTotalLines() - 1) ==
+                 flat.GetLineOffset(flat.GetTotalLines() - 1) + 1,
+             "Indexed line offset mismatch");
+    }
+
+    // Asynchronous open: everything happens on the worker, the document
+    // grows as chunks are applied
+    for (bool windowed : {false, true}) {
+      Buffer async;
+      async.SetWindowedOpenThreshold(windowed ? 1 : 0);
+      std::atomic<int> posted{0};
+      async.SetIndexedCallback([&]() { posted++; });
+      async.Insert(0, "old text");
+      async.OpenFileAsync(testFile);
+      VERIFY(async.IsIndexing() && async.IsOpening() &&
+                 async.GetPath() == testFile,
+             "Async open did not start");
+      // Read-only until the open is applied, which replaces the document
+      async.Insert(0, "typed early");
+      async.Undo();
+      VERIFY(async.GetTotalLength() == 0 && !async.IsDirty(),
+             "Edited a buffer that was still opening");
+      size_t seen = 0;
+      while (!async.FinishIndexing(false)) {
+        VERIFY(async.GetTotalLength() >= seen, "Document shrank while loading");
+        seen = async.GetTotalLength();
+        VERIFY(async.GetText(0, seen) == text.substr(0, seen),
+               "Partially loaded content mismatch");
+      }
+      VERIFY(!async.LoadFailed() && posted >= 3 && !async.IsOpening() &&
+                 !async.CanUndo() && async.GetTotalLength() == text.size() &&
+                 async.GetTotalLines() == flat.GetTotalLines() &&
+                 async.GetText(0, text.size()) == text,
+             "Async open content mismatch");
+    }
+    {
+      Buffer missing;
+      missing.OpenFileAsync(L"no_such_file_for_async_open.txt");
+      VERIFY(missing.FinishIndexing(true) && missing.LoadFailed() &&
+                 missing.GetTotalLength() == 0,
+             "Async open of a missing file did not fail");
+      VERIFY(!missing.SaveFile(missing.GetPath()),
+             "Saved over a file that could not be read");
+      Buffer cancelled;
+      cancelled.OpenFileAsync(testFile);
+      cancelled.CancelIndexing();
+      VERIFY(!cancelled.IsIndexing() && cancelled.FinishIndexing(true),
+             "Cancelled open still indexing");
+    }
+  }
+
+  // 6. UTF-16 files are transcoded block by block as they are read
+  {
+    std::cout << "Testing UTF-16 Open..." << std::endl;
+    std::string utf8;
+    std::u16string utf16;
+    for (int i = 0; utf16.size() < 300 * 1024; ++i) {
+      std::string num = std::to_string(i);
+      utf8 += "Line " + num + " \xE3\x81\x82\xF0\x9F\x98\x80\n";
+      for (char c : "Line " + num + " ")
+        utf16 += static_cast<char16_t>(c);
+      utf16 += u"\u3042\U0001F600\n";
+    }
+    for (bool be : {false, true}) {
+      std::string bytes = be ? "\xFE\xFF" : "\xFF\xFE";
+      for (char16_t c : utf16) {
+        char lo = static_cast<char>(c & 0xFF), hi = static_cast<char>(c >> 8);
+        bytes += be ? hi : lo;
+        bytes += be ? lo : hi;
+      }
+      {
+        Buffer buf;
+        buf.Insert(0, bytes);
+        VERIFY(buf.SaveFile(testFile), "Failed to save UTF-16 test file");
+      }
+      for (bool windowed : {false, true}) {
+        Buffer buf;
+        buf.SetWindowedOpenThreshold(windowed ? 1 : 0);
+        VERIFY(buf.OpenFile(testFile), "Failed to open UTF-16 file");
+        VERIFY(buf.GetEncoding() ==
+                   (be ? Encoding::UTF16BE : Encoding::UTF16LE),
+               "UTF-16 encoding not detected");
+        VERIFY(buf.GetTotalLength() == utf8.size() &&
+                   buf.GetText(0, utf8.size()) == utf8,
+               "UTF-16 content mismatch");
+        size_t lines = std::count(utf8.begin(), utf8.end(), '\n') + 1;
+        VERIFY(buf.GetTotalLines() == lines, "UTF-16 line count mismatch");
+
+        Buffer async;
+        async.SetWindowedOpenThreshold(windowed ? 1 : 0);
+        async.OpenFileAsync(testFile);
+        VERIFY(async.FinishIndexing(true) && !async.LoadFailed() &&
+                   async.GetText(0, async.GetTotalLength()) == utf8,
+               "Async UTF-16 content mismatch");
+      }
+    }
+  }
+
+  // 7. Saving an edited file: unedited runs are copied from the original
+  {
+    std::cout << "Testing Save of Edited File..." << std::endl;
+    std::wstring copyFile = L"test_io_temp_copy.txt";
+    std::string content = "\xEF\xBB\xBF"; // BOM: text starts at offset 3
+    for (int i = 0; content.size() < 8 * 1024 * 1024; ++i)
+      content += "Line " + std::to_string(i) + " unchanged text\n";
+    {
+      Buffer buf;
+      buf.Insert(0, content);
+      VERIFY(buf.SaveFile(testFile), "Failed to save original");
+    }
+    for (bool windowed : {false, true}) {
+      Buffer buf;
+      buf.SetWindowedOpenThreshold(windowed ? 1 : 0);
+      VERIFY(buf.OpenFile(testFile), "Failed to open original");
+      std::string expected = content.substr(3);
+      // A few scattered edits leave long unedited runs, some much shorter
+      // than FileWriter::MIN_COPY_BYTES
+      for (size_t pos : {size_t(10), size_t(100000), size_t(3000000),
+                         size_t(3000100), expected.size() - 5}) {
+        buf.Insert(pos, "EDIT");
+        expected.insert(pos, "EDIT");
+      }
+      buf.Delete(5000000, 1000);
+      expected.erase(5000000, 1000);
+      // Saved twice: the second save copies from the same original again
+      for (int round = 0; round < 2; ++round) {
+        VERIFY(buf.SaveFile(copyFile), "Failed to save edited file");
+        Buffer saved;
+        VERIFY(saved.OpenFile(copyFile) &&
+                   saved.GetTotalLength() == expected.size() &&
+                   saved.GetText(0, expected.size()) == expected,
+               "Saved edited content mismatch, round " << round);
+      }
+    }
+    std::filesystem::remove(copyFile);
+  }
+
+  // 8. Background save: the file gets the text as it was when the save
+  // started, and edits made meanwhile keep the buffer dirty
+  {
+    std::cout << "Testing Background Save..." << std::endl;
+    std::string content;
+    for (int i = 0; content.size() < 4 * 1024 * 1024; ++i)
+      content += "Line " + std::to_string(i) + " saved in the background\n";
+    Buffer buf;
+    buf.Insert(0, content);
+    std::atomic<int> calls{0};
+    buf.SetSaveCallback([&]() { ++calls; });
+    buf.SaveFileAsync(testFile);
+    VERIFY(buf.IsSaving(), "Save did not start");
+    buf.Insert(0, "EDIT"); // made while the snapshot is written
+    bool saved = false;
+    VERIFY(buf.FinishSave(true, &saved) && saved, "Background save failed");
+    VERIFY(!buf.IsSaving(), "Save still running after FinishSave");
+    VERIFY(calls > 1, "Save progress not reported");
+    VERIFY(buf.IsDirty(), "Edit made during the save was marked saved");
+    {
+      Buffer check;
+      VERIFY(check.OpenFile(testFile) &&
+                 check.GetTotalLength() == content.size() &&
+                 check.GetText(0, content.size()) == content,
+             "Background save did not write the snapshot");
+    }
+
+    // Reopened and saved with no edits in between: the buffer is clean
+    Buffer reopened;
+    VERIFY(reopened.OpenFile(testFile), "Failed to reopen saved file");
+    reopened.Insert(0, "EDIT");
+    reopened.SaveFileAsync(testFile);
+    VERIFY(reopened.FinishSave(true, &saved) && saved,
+           "Background save over the open file failed");
+    VERIFY(!reopened.IsDirty(), "Buffer still dirty after its save");
+    Buffer check;
+    VERIFY(check.OpenFile(testFile) &&
+               check.GetText(0, check.GetTotalLength()) == "EDIT" + content,
+           "Background save over the open file wrote the wrong text");
+  }
+
+  // 9. Journal recovery: the edits of a session that never saved are
+  // replayed onto the file, up to a record torn by the crash
+  {
+    std::cout << "Testing Edit Journal Recovery..." << std::endl;
+    std::wstring journalFile = L"test_io_temp.journal";
+    std::string content = "first line\nsecond line\nthird line\n";
+    {
+      Buffer buf;
+      buf.Insert(0, content);
+      VERIFY(buf.SaveFile(testFile), "Failed to save journaled file");
+    }
+    {
+      // What a crashed session leaves behind: flushed, never discarded
+      EditJournal journal(1);
+      VERIFY(journal.Create(journalFile, EditJournal::Take(testFile)),
+             "Failed to create journal");
+      journal.Record(0, 0, "NEW ");
+      journal.Record(15, 6, "2nd");    // replace "second"
+      journal.Record(24, 5, "");       // delete "third"
+      journal.Close(false);
+      std::ofstream f(std::filesystem::path(journalFile),
+                      std::ios::binary | std::ios::app);
+      f.write("\x30\0\0\0torn", 8); // half of a record
+    }
+    std::string expected = "NEW first line\n2nd line\n line\n";
+    {
+      Buffer buf;
+      VERIFY(buf.OpenFile(testFile), "Failed to open journaled file");
+      VERIFY(buf.RecoverJournal(journalFile), "Journal not recovered");
+      VERIFY(buf.GetText(0, buf.GetTotalLength()) == expected,
+             "Recovered text mismatch");
+      VERIFY(buf.IsDirty() && buf.IsJournaling(),
+             "Recovered buffer not dirty and journaling");
+    }
+    // Closing the buffer discarded the journal
+    VERIFY(!std::filesystem::exists(journalFile),
+           "Journal left behind by a closed buffer");
+
+    // A journal never replays onto a file changed since
+    {
+      EditJournal journal(1);
+      VERIFY(journal.Create(journalFile, EditJournal::Take(testFile)),
+             "Failed to create journal");
+      journal.Record(0, 0, "X");
+      journal.Close(false);
+    }
+    {
+      Buffer buf;
+      buf.Insert(0, "changed on disk\n");
+      VERIFY(buf.SaveFile(testFile), "Failed to change journaled file");
+    }
+    {
+      Buffer buf;
+      VERIFY(buf.OpenFile(testFile), "Failed to reopen journaled file");
+      VERIFY(!buf.RecoverJournal(journalFile) &&
+                 buf.GetText(0, buf.GetTotalLength()) == "changed on disk\n",
+             "Journal replayed onto a changed file");
+    }
+
+    // A replace-all and its undo/redo are journaled as their matches, not
+    // their text, and replay to the same document
+    {
+      std::string line(1000, 'x');
+      line.replace(500, 6, "needle");
+      line.back() = '\n';
+      std::string large;
+      for (int i = 0; i < 5000; ++i)
+        large += line;
+      {
+        Buffer buf;
+        buf.Insert(0, large);
+        VERIFY(buf.SaveFile(testFile), "Failed to save replace-all file");
+      }
+      Buffer buf;
+      VERIFY(buf.OpenFile(testFile) && buf.StartJournal(journalFile, 1),
+             "Failed to journal replace-all file");
+      VERIFY(buf.ReplaceAll("needle", "pin") == 5000, "Replace-all count");
+      buf.Undo();
+      buf.Redo();
+      std::string edited = buf.GetText(0, buf.GetTotalLength());
+
+      // The writer flushes on its own; take copies until one has it all
+      std::wstring crashed = L"test_io_temp_crashed.journal";
+      bool recovered = false;
+      for (int attempt = 0; attempt < 500 && !recovered; ++attempt) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        std::filesystem::copy_file(
+            journalFile, crashed,
+            std::filesystem::copy_options::overwrite_existing);
+        Buffer replay;
+        VERIFY(replay.OpenFile(testFile) && replay.RecoverJournal(crashed),
+               "Replace-all journal not recovered");
+        recovered = replay.GetText(0, replay.GetTotalLength()) == edited;
+      }
+      VERIFY(recovered, "Replace-all journal replayed to the wrong text");
+      VERIFY(std::filesystem::file_size(journalFile) < large.size() / 4,
+             "Replace-all journaled as its text");
+      buf.StopJournal();
+
+      // Recovery indexes only as far as the edits reach
+      for (bool atEnd : {false, true}) {
+        {
+          EditJournal journal(1);
+          VERIFY(journal.Create(journalFile, EditJournal::Take(testFile)),
+                 "Failed to create journal");
+          journal.Record(0, 0, "A");
+          if (atEnd)
+            journal.Record(large.size() + 1, 0, "Z");
+          journal.Close(false);
+        }
+        Buffer partial;
+        partial.SetBackgroundIndexThreshold(1);
+        VERIFY(partial.OpenFile(testFile) &&
+                   partial.RecoverJournal(journalFile),
+               "Journal not recovered onto a partly indexed file");
+        VERIFY(atEnd ? partial.GetTotalLength() == large.size() + 2
+                     : partial.IsIndexing() &&
+                           partial.GetTotalLength() < large.size(),
+               "Recovery indexed more of the file than the edits reach");
+        VERIFY(partial.FinishIndexing(true) &&
+                   partial.GetText(0, partial.GetTotalLength()) ==
+                       "A" + large + (atEnd ? "Z" : ""),
+               "Journal replayed onto a partly indexed file mismatch");
+      }
+    }
+    std::filesystem::remove(journalFile);
+  }
+
+  // 10. A save encodes the text back as it was read: UTF-16 with the BOM
+  // it had or without one, and Shift-JIS, which refuses characters it
+  // lacks instead of writing '?'
+  {
+    std::cout << "Testing Save Encodings..." << std::endl;
+    auto fileBytes = [&]() {
+      std::ifstream in(std::filesystem::path(testFile), std::ios::binary);
+      return std::string(std::istreambuf_iterator<char>(in),
+                         std::istreambuf_iterator<char>());
+    };
+    auto writeBytes = [&](const std::string &bytes) {
+      std::ofstream(std::filesystem::path(testFile), std::ios::binary)
+          << bytes;
+    };
+    auto toUtf16 = [](const std::u16string &text, bool be, bool bom) {
+      std::string bytes = bom ? (be ? "\xFE\xFF" : "\xFF\xFE") : "";
+      for (char16_t c : text) {
+        char lo = static_cast<char>(c & 0xFF), hi = static_cast<char>(c >> 8);
+        bytes += be ? hi : lo;
+        bytes += be ? lo : hi;
+      }
+      return bytes;
+    };
+
+    std::u16string text;
+    for (int i = 0; i < 200; ++i)
+      text += u"Line \u3042\U0001F600\n";
+    for (bool be : {false, true}) {
+      for (bool bom : {false, true}) {
+        writeBytes(toUtf16(text, be, bom));
+        Buffer buf;
+        VERIFY(buf.OpenFile(testFile) &&
+                   buf.GetEncoding() ==
+                       (be ? Encoding::UTF16BE : Encoding::UTF16LE) &&
+                   buf.HasBom() == bom,
+               "UTF-16 file not detected, BOM " << bom);
+        buf.Insert(0, "\xE3\x81\x84 ");
+        VERIFY(buf.SaveFile(testFile) &&
+                   fileBytes() == toUtf16(u"\u3044 " + text, be, bom),
+               "UTF-16 not written back, BOM " << bom);
+      }
+    }
+    {
+      // No ASCII at all for more than an encoding chunk
+      std::u16string wide(1500000, u'\u3042');
+      writeBytes(toUtf16(wide, false, true));
+      Buffer buf;
+      VERIFY(buf.OpenFile(testFile), "Failed to open UTF-16 file");
+      buf.Insert(0, "\xE3\x81\x84");
+      VERIFY(buf.SaveFile(testFile) &&
+                 fileBytes() == toUtf16(u"\u3044" + wide, false, true),
+             "UTF-16 without ASCII not written back");
+    }
+
+    std::string sjis;
+    for (int i = 0; i < 200; ++i)
+      sjis += "\x82\xA0\x82\xA2\x82\xA4 abc\r\n"; // hiragana a, i, u
+    writeBytes(sjis);
+    Buffer buf;
+    VERIFY(buf.OpenFile(testFile) &&
+               buf.GetEncoding() == Encoding::ShiftJIS && !buf.HasBom(),
+           "Shift-JIS file not detected");
+    buf.Insert(0, "\xE3\x81\x88"); // hiragana e
+    VERIFY(buf.SaveFile(testFile) && fileBytes() == "\x82\xA6" + sjis,
+           "Shift-JIS not written back");
+    buf.Insert(0, "\xF0\x9F\x98\x80"); // no Shift-JIS form
+    VERIFY(!buf.SaveFile(testFile) && fileBytes() == "\x82\xA6" + sjis,
+           "Unmappable character saved");
+
+    // A file whose bytes the code page would not give back is read as they
+    // are, so an unedited save leaves it unchanged
+    std::string latin;
+    for (int i = 0; i < 200; ++i)
+      latin += "caf\xE9 \x81\x8D\x8F\x90\x9D na\xEFve\n";
+    writeBytes(latin);
+    {
+      Buffer raw;
+      VERIFY(raw.OpenFile(testFile), "Failed to open Latin-1 file");
+      raw.Insert(0, "x");
+      VERIFY(raw.SaveFile(testFile) && fileBytes() == "x" + latin,
+             "Latin-1 file changed by a save");
+    }
+
+    // Shift-JIS is decoded block by block as it is read; a stretch with no
+    // byte below 0x40 longer than a block is decoded with the block before
+    {
+      std::string bytes, utf8;
+      for (int i = 0; bytes.size() < 300 * 1024; ++i) {
+        std::string num = std::to_string(i);
+        bytes += "Line " + num + " \x82\xA0\x82\xA2 \xB1\r\n";
+        utf8 += "Line " + num + " \xE3\x81\x82\xE3\x81\x84 \xEF\xBD\xB1\r\n";
+        if (i == 1000) {
+          for (int j = 0; j < 70000; ++j) {
+            bytes += "\x82\xA4";
+            utf8 += "\xE3\x81\x86";
+          }
+        }
+      }
+      writeBytes(bytes);
+      for (bool windowed : {false, true}) {
+        Buffer big;
+        big.SetWindowedOpenThreshold(windowed ? 1 : 0);
+        VERIFY(big.OpenFile(testFile) &&
+                   big.GetEncoding() == Encoding::ShiftJIS &&
+                   big.GetTotalLength() == utf8.size() &&
+                   big.GetText(0, utf8.size()) == utf8,
+               "Shift-JIS content mismatch, windowed " << windowed);
+
+        Buffer async;
+        async.SetWindowedOpenThreshold(windowed ? 1 : 0);
+        async.OpenFileAsync(testFile);
+        VERIFY(async.FinishIndexing(true) && !async.LoadFailed() &&
+                   async.GetText(0, async.GetTotalLength()) == utf8,
+               "Async Shift-JIS content mismatch, windowed " << windowed);
+      }
+      Buffer big;
+      big.SetWindowedOpenThreshold(1);
+      VERIFY(big.OpenFile(testFile), "Failed to open Shift-JIS file");
+      big.Insert(0, "\xE3\x81\x88");
+      VERIFY(big.SaveFile(testFile) && fileBytes() == "\x82\xA6" + bytes,
+             "Large Shift-JIS file not written back");
+    }
+
+    // A look-alike is as lossy as '?': a-macron is not 'a'
+    bool lossy = false;
+    CodePage::FromUtf8("\xC4\x81", 2, CodePage::SHIFT_JIS, &lossy);
+    VERIFY(lossy, "Best-fit encoding not reported as lossy");
+    lossy = false;
+    VERIFY(CodePage::FromUtf8("a\xE3\x81\x82", 4, CodePage::SHIFT_JIS,
+                              &lossy) == "a\x82\xA0" &&
+               !lossy,
+           "Exact encoding reported as lossy");
+  }
+
+  std::filesystem::remove(testFile);
   std::cout << "File IO Tests Passed!" << std::endl;
 }
 
@@ -44,6 +44,88 @@ int main() {
   VERIFY(content.find("Done.") != std::string::npos,
          "Search did not finish correctly");
 
+  // Structured results carry the fields without a "path(line): text" trip
+  {
+    FileSearch s(testDir.wstring(), "match");
+    std::vector<FileSearchMatch> matches;
+    s.SetMatchCallback([&](const std::vector<FileSearchMatch> &batch) {
+      matches.insert(matches.end(), batch.begin(), batch.end());
+    });
+    VERIFY(s.Run() == 4 && matches.size() == 4, "structured match count");
+    bool found = false;
+    for (const FileSearchMatch &m : matches)
+      if (m.line == 3 && m.text == "Another match here" &&
+          m.path == (testDir / "file1.txt").u8string())
+        found = true;
+    VERIFY(found, "structured match fields");
+  }
+
+  // Filtering: ignore files, binary sniff, globs and size limit
+  VERIFY(FileSearch::GlobMatch("*.cpp", "Main.CPP"), "glob case");
+  VERIFY(!FileSearch::GlobMatch("*.cpp", "src/main.cpp"), "* crossed '/'");
+  VERIFY(FileSearch::GlobMatch("src/**/*.h", "src/a/b/x.h"), "** dirs");
+  VERIFY(FileSearch::GlobMatch("src/**/*.h", "src/x.h"), "** zero dirs");
+  VERIFY(FileSearch::GlobMatch("file[0-9].t?t", "file7.txt"), "class");
+  VERIFY(!FileSearch::GlobMatch("file[!0-9].txt", "file7.txt"), "neg class");
+
+  fs::create_directories(testDir / "build" / "obj");
+  fs::create_directories(testDir / "logs");
+  fs::create_directories(testDir / ".git");
+  {
+    std::ofstream f(testDir / ".gitignore");
+    f << "# build output\nbuild/\n*.log\n!keep.log\n";
+  }
+  {
+    std::ofstream f(testDir / "sub" / ".ecodeignore");
+    f << "/local.txt\n";
+  }
+  std::ofstream(testDir / "build" / "obj" / "out.txt") << "match\n";
+  std::ofstream(testDir / "logs" / "run.log") << "match\n";
+  std::ofstream(testDir / "logs" / "keep.log") << "match\n";
+  std::ofstream(testDir / ".git" / "HEAD") << "match\n";
+  std::ofstream(testDir / "sub" / "local.txt") << "match\n";
+  {
+    std::ofstream f(testDir / "image.bin", std::ios::binary);
+    f << std::string("match\0\x01\x02", 9);
+  }
+  std::ofstream(testDir / "big.txt") << std::string(5000, 'x') << "match\n";
+
+  auto search = [&](const FileSearchFilter &filter) {
+    FileSearch s(testDir.wstring(), "match");
+    s.SetFilter(filter);
+    std::string out;
+    s.SetResultCallback([&](const std::string &text) { out += text; });
+    s.Run();
+    return out;
+  };
+  std::string filtered = search(FileSearchFilter());
+  VERIFY(filtered.find("out.txt") == std::string::npos, "ignored dir searched");
+  VERIFY(filtered.find("run.log") == std::string::npos, "ignored file searched");
+  VERIFY(filtered.find("keep.log") != std::string::npos, "negation ignored");
+  VERIFY(filtered.find("HEAD") == std::string::npos, ".git searched");
+  VERIFY(filtered.find("local.txt") == std::string::npos, ".ecodeignore");
+  VERIFY(filtered.find("image.bin") == std::string::npos, "binary searched");
+  VERIFY(filtered.find("file1.txt(3)") != std::string::npos, "file1 missing");
+
+  FileSearchFilter all;
+  all.useIgnoreFiles = false;
+  all.skipBinary = false;
+  std::string unfiltered = search(all);
+  VERIFY(unfiltered.find("out.txt") != std::string::npos &&
+             unfiltered.find("HEAD") != std::string::npos &&
+             unfiltered.find("image.bin") != std::string::npos,
+         "unfiltered search skipped files");
+
+  FileSearchFilter globs;
+  globs.include = {"*.txt"};
+  globs.exclude = {"sub"};
+  globs.maxFileSize = 1000;
+  std::string globbed = search(globs);
+  VERIFY(globbed.find("file1.txt") != std::string::npos, "include glob");
+  VERIFY(globbed.find("keep.log") == std::string::npos, "include glob");
+  VERIFY(globbed.find("file2.txt") == std::string::npos, "exclude glob");
+  VERIFY(globbed.find("big.txt") == std::string::npos, "max file size");
+
   // Cleanup
   fs::remove_all(testDir);
 
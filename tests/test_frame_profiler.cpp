@@ -0,0 +1,74 @@
+#include "../include/FrameProfiler.h"
+#include <iostream>
+#include <thread>
+
+#define VERIFY(cond, msg)                                                      \
+  if (!(cond)) {                                                               \
+    std::cerr << "FAILURE at line " << __LINE__ << ": " << msg << std::endl;   \
+    exit(1);                                                                   \
+  }
+
+void TestPercentiles() {
+  FrameProfiler &profiler = FrameProfiler::Instance();
+  profiler.Reset();
+
+  FrameProfiler::Percentiles empty =
+      profiler.GetPercentiles(FrameProfiler::Stage::Layout);
+  VERIFY(empty.samples == 0 && empty.p99 == 0.0, "Empty stage should be zero");
+
+  // 1..100 in a scrambled order
+  for (int i = 0; i < 100; ++i)
+    profiler.Record(FrameProfiler::Stage::Layout, (i * 37) % 100 + 1);
+  FrameProfiler::Percentiles p =
+      profiler.GetPercentiles(FrameProfiler::Stage::Layout);
+  VERIFY(p.samples == 100, "Sample count mismatch");
+  VERIFY(p.p50 == 50.0, "p50 should be 50, got " << p.p50);
+  VERIFY(p.p95 == 95.0, "p95 should be 95, got " << p.p95);
+  VERIFY(p.p99 == 99.0, "p99 should be 99, got " << p.p99);
+  VERIFY(p.last == (99 * 37) % 100 + 1, "last should be the newest sample");
+
+  VERIFY(profiler.GetPercentiles(FrameProfiler::Stage::Draw).samples == 0,
+         "Stages should be independent");
+  std::cout << "Test 1 Passed: Percentiles" << std::endl;
+}
+
+void TestRollingWindow() {
+  FrameProfiler &profiler = FrameProfiler::Instance();
+  profiler.Reset();
+
+  // A slow start falls out of the window once enough fast frames follow
+  for (size_t i = 0; i < FrameProfiler::WINDOW; ++i)
+    profiler.Record(FrameProfiler::Stage::Frame, 5000.0);
+  for (size_t i = 0; i < FrameProfiler::WINDOW; ++i)
+    profiler.Record(FrameProfiler::Stage::Frame, 100.0);
+  FrameProfiler::Percentiles p =
+      profiler.GetPercentiles(FrameProfiler::Stage::Frame);
+  VERIFY(p.samples == FrameProfiler::WINDOW, "Window should stay bounded");
+  VERIFY(p.p99 == 100.0, "Old samples should have rolled out");
+  std::cout << "Test 2 Passed: Rolling Window" << std::endl;
+}
+
+void TestScope() {
+  FrameProfiler &profiler = FrameProfiler::Instance();
+  profiler.Reset();
+  {
+    FrameProfiler::Scope timer(FrameProfiler::Stage::Buffer);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    timer.Stop();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  FrameProfiler::Percentiles p =
+      profiler.GetPercentiles(FrameProfiler::Stage::Buffer);
+  VERIFY(p.samples == 1, "Stop then destruction should record once");
+  VERIFY(p.last >= 2000.0 && p.last < 20000.0,
+         "Scope should time until Stop, got " << p.last << " us");
+  std::cout << "Test 3 Passed: Scope" << std::endl;
+}
+
+int main() {
+  TestPercentiles();
+  TestRollingWindow();
+  TestScope();
+  std::cout << "All frame profiler tests passed!" << std::endl;
+  return 0;
+}
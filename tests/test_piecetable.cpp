@@ -1,4 +1,5 @@
 #include "../include/PieceTable.h"
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 
@@ -60,6 +61,205 @@ void TestPieceTable() {
   }
   std::cout << "Test 7 Passed: Undo Stack Pruning Logic" << std::endl;
 
+  // Test 8: Typed characters coalesce into one undo step
+  PieceTable pt3;
+  pt3.LoadOriginal("ab", 2);
+  pt3.Insert(1, "x");
+  pt3.Insert(2, "y");
+  pt3.Insert(3, "\xE3\x81\x82"); // multi-byte character still counts as one
+  pt3.Insert(0, "z");            // not adjacent: starts a new step
+  VERIFY(pt3.GetText(0, 8) == "zaxy\xE3\x81\x82" "b", "Typing content mismatch");
+  pt3.Undo();
+  VERIFY(pt3.GetText(0, 7) == "axy\xE3\x81\x82" "b", "Undo of new run failed");
+  pt3.Undo();
+  VERIFY(pt3.GetText(0, 2) == "ab" && !pt3.CanUndo(),
+         "Typing run not undone as one step");
+  pt3.Redo();
+  VERIFY(pt3.GetText(0, 7) == "axy\xE3\x81\x82" "b", "Redo of typing run failed");
+  std::cout << "Test 8 Passed: Typing Coalescing" << std::endl;
+
+  // Test 9: Explicit undo groups (nested) undo as one step
+  PieceTable pt4;
+  pt4.LoadOriginal("one two", 7);
+  pt4.BeginUndoGroup();
+  pt4.Delete(0, 3);
+  pt4.Insert(0, "1");
+  pt4.BeginUndoGroup();
+  pt4.Delete(2, 3);
+  pt4.Insert(2, "2");
+  pt4.EndUndoGroup();
+  pt4.EndUndoGroup();
+  pt4.BeginUndoGroup(); // empty transactions leave no history
+  pt4.EndUndoGroup();
+  VERIFY(pt4.GetText(0, 3) == "1 2", "Grouped edit content mismatch");
+  pt4.Undo();
+  VERIFY(pt4.GetText(0, 7) == "one two" && !pt4.CanUndo(),
+         "Group not undone as one step");
+  pt4.Redo();
+  VERIFY(pt4.GetText(0, 3) == "1 2" && !pt4.CanRedo(),
+         "Group not redone as one step");
+  std::cout << "Test 9 Passed: Undo Groups" << std::endl;
+
+  // Test 10: An original split into spans behaves like a contiguous one.
+  // Spans are not aligned to NEWLINE_BLOCK, and lines straddle both.
+  std::string big;
+  for (int i = 0; big.size() < 5 * PieceTable::NEWLINE_BLOCK; ++i)
+    big += std::string(i % 97, 'x') + (i % 5 == 0 ? "\n\n" : "\n");
+  big += "tail";
+  const size_t spanSize = 4093;
+  PieceTable flat, spans;
+  flat.LoadOriginal(big.data(), big.size());
+  spans.LoadOriginal(
+      [&](size_t offset) {
+        TextSpan span;
+        span.offset = offset / spanSize * spanSize;
+        span.data = big.data() + span.offset;
+        span.length = (std::min)(spanSize, big.size() - span.offset);
+        return span;
+      },
+      big.size());
+  auto sameAsFlat = [&]() {
+    if (spans.GetTotalLength() != flat.GetTotalLength() ||
+        spans.GetTotalLines() != flat.GetTotalLines())
+      return false;
+    for (size_t line = 0; line < flat.GetTotalLines(); line += 37) {
+      if (spans.GetLineOffset(line) != flat.GetLineOffset(line))
+        return false;
+    }
+    size_t last = flat.GetTotalLines() - 1;
+    if (spans.GetLineOffset(last) != flat.GetLineOffset(last))
+      return false;
+    for (size_t pos = 0; pos <= flat.GetTotalLength(); pos += 1009) {
+      if (spans.GetLineAtOffset(pos) != flat.GetLineAtOffset(pos))
+        return false;
+    }
+    std::string reversed;
+    spans.ForEachSpanReverse(0, spans.GetTotalLength(),
+                             [&](const char *data, size_t len, size_t) {
+                               reversed.insert(0, data, len);
+                               return true;
+                             });
+    return reversed == flat.GetText(0, flat.GetTotalLength()) &&
+           spans.GetText(0, spans.GetTotalLength()) == reversed;
+  };
+  VERIFY(sameAsFlat(), "Span-loaded original differs after load");
+  for (size_t pos : {size_t(0), size_t(4093), size_t(65535), size_t(200000)}) {
+    flat.Insert(pos, "new\nline");
+    spans.Insert(pos, "new\nline");
+    flat.Delete(pos + 20000, 3000);
+    spans.Delete(pos + 20000, 3000);
+  }
+  VERIFY(sameAsFlat(), "Span-loaded original differs after edits");
+  std::cout << "Test 10 Passed: Span Source Original" << std::endl;
+
+  // Test 11: Progressive load. The first lines are the document until the
+  // rest, indexed in chunks, is appended; edits made meanwhile survive.
+  for (bool useSpans : {false, true}) {
+    PieceTable pt5;
+    SpanSource source = [&](size_t offset) {
+      TextSpan span;
+      span.offset = offset / spanSize * spanSize;
+      span.data = big.data() + span.offset;
+      span.length = (std::min)(spanSize, big.size() - span.offset);
+      return span;
+    };
+    if (useSpans)
+      pt5.LoadOriginal(source, big.size(), 100000);
+    else
+      pt5.LoadOriginal(big.data(), big.size(), 100000);
+    size_t loaded = pt5.GetLoadedOriginalLength();
+    VERIFY(loaded >= 100000 && loaded < big.size() && big[loaded - 1] == '\n',
+           "Prefix does not end at a line end");
+    VERIFY(pt5.GetTotalLength() == loaded &&
+               pt5.GetText(0, loaded) == big.substr(0, loaded),
+           "Prefix content mismatch");
+    pt5.Insert(3, "edit");
+    PieceTable::OriginalIndex rest =
+        pt5.IndexOriginal(loaded, big.size(), nullptr, 3);
+    std::atomic<bool> cancel{true};
+    VERIFY(pt5.IndexOriginal(loaded, big.size(), &cancel, 3).end == loaded,
+           "Cancelled index not empty");
+    pt5.AppendOriginal(rest);
+    std::string expected = big;
+    expected.insert(3, "edit");
+    VERIFY(pt5.GetTotalLength() == expected.size() &&
+               pt5.GetText(0, expected.size()) == expected,
+           "Appended content mismatch");
+    VERIFY(pt5.GetTotalLines() ==
+               static_cast<size_t>(
+                   std::count(expected.begin(), expected.end(), '\n')) +
+                   1,
+           "Appended line count mismatch");
+    for (size_t line = 1; line < pt5.GetTotalLines(); line += 53) {
+      size_t offset = pt5.GetLineOffset(line);
+      VERIFY(offset > 0 && expected[offset - 1] == '\n' &&
+                 pt5.GetLineAtOffset(offset) == line,
+             "Appended line offset mismatch at line " << line);
+    }
+    pt5.Undo();
+    VERIFY(pt5.GetText(0, big.size()) == big, "Undo after append");
+  }
+  std::cout << "Test 11 Passed: Progressive Load" << std::endl;
+
+  // Test 12: Loading a new original discards the old document's history,
+  // so undo/redo never splice its pieces into the new text
+  {
+    PieceTable pt6;
+    std::string first = "first document";
+    pt6.LoadOriginal(first.c_str(), first.length());
+    pt6.Insert(0, "typed ");
+    pt6.Delete(6, 5);
+    pt6.Undo();
+    pt6.BeginUndoGroup();
+    std::string second = "second document";
+    pt6.LoadOriginal(second.c_str(), second.length());
+    VERIFY(!pt6.CanUndo() && !pt6.CanRedo(), "History survived a reload");
+    pt6.Undo();
+    pt6.Redo();
+    VERIFY(pt6.GetText(0, pt6.GetTotalLength()) == second,
+           "Stale history changed the reloaded text");
+    pt6.Insert(0, "a");
+    pt6.Insert(1, "b");
+    pt6.Insert(0, "x");
+    pt6.Undo();
+    VERIFY(pt6.GetText(0, pt6.GetTotalLength()) == "ab" + second,
+           "Undo group left open across a reload");
+  }
+  std::cout << "Test 12 Passed: Reload Clears History" << std::endl;
+
+  // Test 13: A snapshot shares the added text instead of copying it; text
+  // typed across added blocks reads back whole, and later edits leave the
+  // snapshot as it was
+  {
+    PieceTable pt7;
+    std::string expected;
+    for (size_t i = 0; i < 20000; ++i) {
+      char c = static_cast<char>('a' + i % 26);
+      pt7.Insert(pt7.GetTotalLength(), std::string(1, c));
+      expected += c;
+    }
+    VERIFY(pt7.GetText(0, pt7.GetTotalLength()) == expected,
+           "Text across added blocks mismatch");
+    std::string reversed;
+    pt7.ForEachSpanReverse(0, pt7.GetTotalLength(),
+                           [&](const char *data, size_t length, size_t) {
+                             reversed.insert(0, data, length);
+                             return true;
+                           });
+    VERIFY(reversed == expected, "Reverse walk across added blocks mismatch");
+
+    PieceTable::Snapshot snapshot = pt7.TakeSnapshot();
+    pt7.Insert(0, std::string(100000, 'x'));
+    pt7.Delete(100000, 10);
+    pt7.Insert(pt7.GetTotalLength(), "tail");
+    std::string saved;
+    snapshot.WriteTo([&](const char *data, size_t length) {
+      saved.append(data, length);
+    }, [](size_t, size_t) { return false; });
+    VERIFY(saved == expected, "Snapshot changed by later edits");
+  }
+  std::cout << "Test 13 Passed: Shared Snapshot" << std::endl;
+
   std::cout << "All PieceTable Tests Passed!" << std::endl;
 }
 
@@ -1,6 +1,8 @@
 #include "../include/PieceTable.h"
 #include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
 #include <random>
 #include <string>
@@ -125,7 +127,80 @@ void RunStressTest(int iterations) {
   std::cout << "Several-Items Stress Test Passed!" << std::endl;
 }
 
-int main() {
+// Simulates typing on a line deep inside a large synthetic file. Each
+// keystroke is an Insert followed by the lookups a repaint performs, so the
+// latency should depend on the edit, not on the file size.
+void RunKeystrokeLatencyBenchmark(size_t targetBytes, size_t targetLine) {
+  std::cout << "Building " << (targetBytes >> 20)
+            << " MB synthetic document..." << std::endl;
+  std::string data;
+  data.reserve(targetBytes + 128);
+  const std::string filler(80, 'x');
+  size_t lineNo = 0;
+  while (data.size() < targetBytes) {
+    data += std::to_string(lineNo++);
+    data += ' ';
+    data += filler;
+    data += '\n';
+  }
+  if (targetLine >= lineNo)
+    targetLine = lineNo / 2;
+
+  PieceTable pt;
+  auto loadStart = std::chrono::high_resolution_clock::now();
+  pt.LoadOriginal(data.data(), data.size());
+  auto loadEnd = std::chrono::high_resolution_clock::now();
+  std::cout << "LoadOriginal: "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(loadEnd -
+                                                                   loadStart)
+                   .count()
+            << " ms, " << pt.GetTotalLines() << " lines" << std::endl;
+
+  const int keystrokes = 2000;
+  const size_t viewportLines = 60;
+  size_t caret = pt.GetLineOffset(targetLine) + 10;
+  double totalUs = 0.0;
+  double maxUs = 0.0;
+  for (int i = 0; i < keystrokes; ++i) {
+    auto start = std::chrono::high_resolution_clock::now();
+    if (i % 40 == 39) {
+      pt.Insert(caret, "\n"); // Occasionally split the line
+    } else {
+      pt.Insert(caret, "a");
+    }
+    caret++;
+    size_t caretLine = pt.GetLineAtOffset(caret);
+    size_t top = caretLine > viewportLines / 2 ? caretLine - viewportLines / 2
+                                               : 0;
+    size_t startOff = pt.GetLineOffset(top);
+    size_t endOff = pt.GetLineOffset(top + viewportLines);
+    std::string viewport = pt.GetText(startOff, endOff - startOff);
+    auto end = std::chrono::high_resolution_clock::now();
+
+    double us =
+        std::chrono::duration<double, std::micro>(end - start).count();
+    totalUs += us;
+    if (us > maxUs)
+      maxUs = us;
+    if (viewport.empty()) {
+      std::cerr << "LATENCY FAILURE: empty viewport" << std::endl;
+      exit(1);
+    }
+  }
+
+  std::cout << "Keystroke latency on line " << targetLine << ": avg "
+            << (totalUs / keystrokes) << " us, max " << maxUs << " us ("
+            << keystrokes << " keystrokes)" << std::endl;
+}
+
+int main(int argc, char **argv) {
   RunStressTest(10000);
+
+  // Optional size override in MB, e.g. "test_piecetable_stress 64"
+  size_t megabytes = 1024;
+  if (argc > 1)
+    megabytes = (size_t)std::strtoull(argv[1], nullptr, 10);
+  if (megabytes > 0)
+    RunKeystrokeLatencyBenchmark(megabytes << 20, 5000000);
   return 0;
 }
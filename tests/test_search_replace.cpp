@@ -2,6 +2,7 @@
 #include <algorithm>
 #include <iostream>
 #include <random>
+#include <regex>
 #include <string>
 #include <vector>
 
@@ -134,9 +135,405 @@ void RunSearchStressTest(int iterations) {
   std::cout << "Search/Replace Stress Test Passed!" << std::endl;
 }
 
+void TestPieceStraddlingSearch() {
+  // Build the document from one-byte inserts in reverse order so every byte
+  // is its own piece and every match straddles piece boundaries.
+  std::string text;
+  std::mt19937 rng(99);
+  for (int i = 0; i < 3000; ++i)
+    text += "abcXYZ.-\n"[rng() % 9];
+  text.replace(1000, 40, "The Needle Spans Many Pieces In This Doc!");
+  text.replace(2500, 40, "the needle spans many pieces in this doc!");
+
+  Buffer buf;
+  for (size_t i = text.size(); i-- > 0;)
+    buf.Insert(0, std::string(1, text[i]));
+  VERIFY(buf.GetText(0, buf.GetTotalLength()) == text,
+         "Fragmented buffer content mismatch");
+
+  std::string lower = text;
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  const char *queries[] = {"a", "cX", "Z.-", "needle spans many pieces",
+                           "The Needle Spans Many Pieces In This Doc!"};
+  for (const char *q : queries) {
+    std::string query = q, lowerQuery = q;
+    std::transform(lowerQuery.begin(), lowerQuery.end(), lowerQuery.begin(),
+                   ::tolower);
+    for (size_t start = 0; start <= text.size(); start += 37) {
+      VERIFY(buf.Find(query, start, true, false, true) ==
+                 text.find(query, start),
+             "Straddling forward search mismatch for " << query);
+      VERIFY(buf.Find(query, start, false, false, true) ==
+                 text.rfind(query, start),
+             "Straddling backward search mismatch for " << query);
+      VERIFY(buf.Find(query, start, true, false, false) ==
+                 lower.find(lowerQuery, start),
+             "Straddling case-insensitive search mismatch for " << query);
+      VERIFY(buf.Find(query, start, false, false, false) ==
+                 lower.rfind(lowerQuery, start),
+             "Straddling case-insensitive backward mismatch for " << query);
+    }
+  }
+  std::cout << "Piece Straddling Search Passed" << std::endl;
+}
+
+void TestStreamingRegex() {
+  // Random text in a fragmented buffer, checked against std::regex
+  std::string text;
+  std::mt19937 rng(3);
+  const char *alphabet = "abcxyzAB 019\n";
+  for (int i = 0; i < 400; ++i)
+    text += alphabet[rng() % 13];
+  Buffer buf;
+  for (size_t i = 0; i < text.size(); i += 7)
+    buf.Insert(i, text.substr(i, 7));
+  for (int i = 0; i < 40; ++i) { // shuffle piece boundaries
+    size_t pos = rng() % buf.GetTotalLength();
+    buf.Delete(pos, 1);
+    buf.Insert(pos, text.substr(pos, 1));
+  }
+  VERIFY(buf.GetText(0, buf.GetTotalLength()) == text,
+         "Regex test buffer mismatch");
+
+  const char *patterns[] = {"a",         "ab|b",     "a+b",      "[a-c]+",
+                            "x*y",       "(ab)+",    "a.c",      "[^ab\n]+",
+                            "\\d{2,3}",  "b+?",      "(a|ab)(c|bcd)",
+                            "\\w+",      "\\s",      "[xyz]{2}", "a??b",
+                            "(?:x|y)z*", "A[B-C]",   "z{1,}9?"};
+  for (const char *pattern : patterns) {
+    for (bool matchCase : {true, false}) {
+      std::regex re(pattern, matchCase ? std::regex::ECMAScript
+                                       : std::regex::ECMAScript |
+                                             std::regex::icase);
+      for (size_t start = 0; start <= text.size(); start += 13) {
+        std::smatch m;
+        size_t expected = std::string::npos;
+        auto flags = start > 0 ? std::regex_constants::match_prev_avail
+                               : std::regex_constants::match_default;
+        if (std::regex_search(text.cbegin() + start, text.cend(), m, re,
+                              flags))
+          expected = start + m.position();
+        VERIFY(buf.Find(pattern, start, true, true, matchCase) == expected,
+               "Regex forward mismatch for " << pattern << " at " << start);
+
+        // Last match starting at or before 'start' that ends by 'start'
+        expected = std::string::npos;
+        for (size_t p = start + 1; p-- > 0;) {
+          if (std::regex_search(text.cbegin() + p, text.cbegin() + start, m,
+                                re, std::regex_constants::match_continuous)) {
+            expected = p;
+            break;
+          }
+        }
+        VERIFY(buf.Find(pattern, start, false, true, matchCase) == expected,
+               "Regex backward mismatch for " << pattern << " at " << start);
+      }
+    }
+  }
+
+  // Match lengths follow ECMAScript leftmost-first rules
+  {
+    Buffer lengths;
+    lengths.Insert(0, text);
+    std::string expected = std::regex_replace(
+        text, std::regex("(a|ab)(c|bcd)|x+?|[0-9]+"), "#");
+    SearchOptions options;
+    options.useRegex = true;
+    lengths.ReplaceAll("(a|ab)(c|bcd)|x+?|[0-9]+", "#", options);
+    VERIFY(lengths.GetText(0, lengths.GetTotalLength()) == expected,
+           "Regex ReplaceAll differs from std::regex_replace");
+  }
+
+  // Line anchors, word boundaries and UTF-8 characters
+  Buffer lines;
+  lines.Insert(0, "foo\nbar foo\nfoo");
+  VERIFY(lines.Find("^foo", 1, true, true, true) == 12, "^ anchor failed");
+  VERIFY(lines.Find("foo$", 0, true, true, true) == 0, "$ anchor failed");
+  VERIFY(lines.Find("^foo", 15, false, true, true) == 12,
+         "Backward ^ anchor failed");
+  VERIFY(lines.Find("\\bfoo\\b", 1, true, true, true) == 8,
+         "Word boundary failed");
+  VERIFY(lines.Find("o\\B", 0, true, true, true) == 1,
+         "Non-boundary failed");
+
+  Buffer wide;
+  wide.Insert(0, "x\xE3\x81\x82y A\xE3\x81\x84"
+                 "B");
+  VERIFY(wide.Find("x.y", 0, true, true, true) == 0, "UTF-8 '.' failed");
+  VERIFY(wide.Find("a[\xE3\x81\x82\xE3\x81\x84]b", 0, true, true, false) == 6,
+         "UTF-8 class failed");
+  VERIFY(wide.Find("[^x ]B", 0, true, true, true) == 7,
+         "Negated class over UTF-8 failed");
+
+  // Unsupported features fall back to std::regex; bad patterns find nothing
+  VERIFY(lines.Find("(o)\\1", 0, true, true, true) == 1,
+         "Backreference fallback failed");
+  VERIFY(lines.Find("(foo", 0, true, true, true) == std::string::npos,
+         "Invalid pattern should not match");
+  // ... where ^ and $ are still line anchors, not only at the search start
+  VERIFY(lines.Find("^f(o)\\1", 1, true, true, true) == 12,
+         "Fallback ^ anchor failed");
+  VERIFY(lines.Find("f(o)\\1$", 1, true, true, true) == 8,
+         "Fallback $ anchor failed");
+  VERIFY(lines.Find("^f(o)\\1", 14, false, true, true) == 0,
+         "Fallback backward ^ anchor failed");
+  {
+    Buffer anchored;
+    anchored.Insert(0, "foo\nbar foo\nfoo");
+    SearchOptions options;
+    options.useRegex = true;
+    VERIFY(anchored.ReplaceAll("^f(o)\\1", "X", options) == 2 &&
+               anchored.GetText(0, anchored.GetTotalLength()) ==
+                   "X\nbar foo\nX",
+           "Fallback ReplaceAll ^ anchor failed");
+  }
+
+  std::cout << "Streaming Regex Passed" << std::endl;
+}
+
+// Reference: replace matches one at a time, left to right
+static std::string SequentialReplace(Buffer &buf, const std::string &query,
+                                     const std::string &replacement,
+                                     bool matchCase) {
+  size_t pos = 0;
+  while ((pos = buf.Find(query, pos, true, false, matchCase)) !=
+         std::string::npos) {
+    buf.Replace(pos, pos + query.length(), replacement);
+    pos += replacement.length();
+  }
+  return buf.GetText(0, buf.GetTotalLength());
+}
+
+void TestReplaceAll() {
+  // Overlapping candidates, replacement containing the query, newlines
+  {
+    Buffer buf;
+    buf.Insert(0, "aaaa\nxaax\naaa");
+    VERIFY(buf.ReplaceAll("aa", "aab\n") == 4, "ReplaceAll count mismatch");
+    VERIFY(buf.GetText(0, buf.GetTotalLength()) ==
+               "aab\naab\n\nxaab\nx\naab\na",
+           "ReplaceAll content mismatch");
+    VERIFY(buf.GetTotalLines() == 7, "ReplaceAll line count mismatch");
+    VERIFY(buf.GetLineOffset(3) == 9, "ReplaceAll line offset mismatch");
+    buf.Undo();
+    VERIFY(buf.GetText(0, buf.GetTotalLength()) == "aaaa\nxaax\naaa",
+           "ReplaceAll not undone in one step");
+    buf.Redo();
+    VERIFY(buf.GetTotalLines() == 7, "ReplaceAll redo mismatch");
+  }
+
+  // Deleting matches, case-insensitive and regex options
+  {
+    Buffer buf;
+    buf.Insert(0, "Fox fox FOX dog");
+    SearchOptions options;
+    options.matchCase = false;
+    VERIFY(buf.ReplaceAll("fox ", "", options) == 3,
+           "Case-insensitive ReplaceAll count mismatch");
+    VERIFY(buf.GetText(0, buf.GetTotalLength()) == "dog",
+           "Case-insensitive ReplaceAll content mismatch");
+
+    buf.Insert(0, "cat1 cat22 ");
+    options.useRegex = true;
+    VERIFY(buf.ReplaceAll("cat[0-9]+", "pet", options) == 2,
+           "Regex ReplaceAll count mismatch");
+    VERIFY(buf.GetText(0, buf.GetTotalLength()) == "pet pet dog",
+           "Regex ReplaceAll content mismatch");
+  }
+
+  // Matches straddling the 1MB scan chunk boundary
+  {
+    const size_t CHUNK_SIZE = 1024 * 1024;
+    std::string text(CHUNK_SIZE + 64, 'x');
+    text.replace(CHUNK_SIZE - 2, 5, "ABCAB"); // "ABCAB" crosses the boundary
+    text.replace(CHUNK_SIZE + 10, 3, "ABC");
+    Buffer buf;
+    buf.Insert(0, text);
+    VERIFY(buf.ReplaceAll("ABC", "-") == 2, "Cross-chunk ReplaceAll failed");
+    VERIFY(buf.GetText(CHUNK_SIZE - 3, 4) == "x-AB",
+           "Cross-chunk ReplaceAll content mismatch");
+  }
+
+  // Randomised comparison against sequential replacement on a fragmented
+  // buffer
+  std::mt19937 rng(7);
+  const char *alphabet = "abAB\n";
+  for (int round = 0; round < 20; ++round) {
+    std::string text;
+    for (size_t i = 0; i < 2000; ++i)
+      text += alphabet[rng() % 5];
+
+    Buffer bulk, sequential;
+    bulk.Insert(0, text);
+    sequential.Insert(0, text);
+    for (int k = 0; k < 20; ++k) { // fragment the piece list
+      size_t pos = rng() % bulk.GetTotalLength();
+      bulk.Insert(pos, "ab");
+      sequential.Insert(pos, "ab");
+    }
+
+    std::string query = (round % 2) ? "ab" : "aBa";
+    std::string replacement = (round % 3) ? "X" : "";
+    bool matchCase = round % 4 != 0;
+    SearchOptions options;
+    options.matchCase = matchCase;
+    bulk.ReplaceAll(query, replacement, options);
+    std::string expected =
+        SequentialReplace(sequential, query, replacement, matchCase);
+    VERIFY(bulk.GetText(0, bulk.GetTotalLength()) == expected,
+           "ReplaceAll differs from sequential replacement");
+    VERIFY(bulk.GetTotalLines() == sequential.GetTotalLines(),
+           "ReplaceAll line count differs");
+  }
+
+  // Many matches: the splice rebuilds the piece tree in bulk
+  {
+    std::string text;
+    for (size_t i = 0; i < 200000; ++i)
+      text += alphabet[rng() % 5];
+    Buffer buf;
+    buf.Insert(0, text);
+    std::string expected = text;
+    size_t count = 0;
+    for (size_t pos = 0; (pos = expected.find("ab", pos)) != std::string::npos;
+         pos += 3, ++count)
+      expected.replace(pos, 2, "a\nb");
+    VERIFY(buf.ReplaceAll("ab", "a\nb") == count && count > 1024,
+           "Bulk ReplaceAll count mismatch");
+    VERIFY(buf.GetText(0, buf.GetTotalLength()) == expected,
+           "Bulk ReplaceAll content mismatch");
+    VERIFY(buf.GetTotalLines() ==
+               (size_t)std::count(expected.begin(), expected.end(), '\n') + 1,
+           "Bulk ReplaceAll line count mismatch");
+    buf.Undo();
+    VERIFY(buf.GetText(0, buf.GetTotalLength()) == text,
+           "Bulk ReplaceAll undo mismatch");
+    buf.Redo();
+    VERIFY(buf.GetText(0, buf.GetTotalLength()) == expected,
+           "Bulk ReplaceAll redo mismatch");
+  }
+
+  std::cout << "ReplaceAll Passed" << std::endl;
+}
+
+void TestFindAll() {
+  {
+    Buffer buf;
+    buf.Insert(0, "fox Fox fox\nfoxfox");
+    std::vector<size_t> offsets = buf.FindAll("fox");
+    VERIFY(offsets == std::vector<size_t>({0, 8, 12, 15}),
+           "FindAll offsets mismatch");
+    SearchOptions options;
+    options.matchCase = false;
+    VERIFY(buf.FindAll("FOX", options).size() == 5,
+           "Case-insensitive FindAll count mismatch");
+    options.useRegex = true;
+    VERIFY(buf.FindAll("^fox", options) == std::vector<size_t>({0, 12}),
+           "Regex FindAll offsets mismatch");
+    VERIFY(buf.FindAll("").empty(), "Empty query should find nothing");
+  }
+
+  // Split into many small ranges, the stitched result must equal one
+  // sequential scan, including matches that cross range boundaries
+  std::mt19937 rng(11);
+  PieceTable table;
+  std::string text;
+  const char *alphabet = "aab\n";
+  for (size_t i = 0; i < 100000; ++i)
+    text += alphabet[rng() % 4];
+  table.Insert(0, text);
+  for (int k = 0; k < 50; ++k)
+    table.Insert(rng() % table.GetTotalLength(), "aaaaab");
+
+  struct Query {
+    const char *text;
+    bool regex;
+  };
+  const Query queries[] = {{"aa", false},  {"aab", false},   {"b\na", false},
+                           {"a+b?", true}, {"(ab)*", true},  {"\\ba", true},
+                           {"b$", true},   {"[ab]+\n", true}, {"a{3,}", true}};
+  for (const Query &q : queries) {
+    SearchOptions options;
+    options.useRegex = q.regex;
+    MatchList expected = MatchIndex::Collect(table, q.text, options, 1);
+    VERIFY(!expected.empty(), "FindAll test query found nothing");
+    for (size_t workers : {2, 3, 7, 64}) {
+      VERIFY(MatchIndex::Collect(table, q.text, options, workers) == expected,
+             "Parallel FindAll differs for " << q.text << " with " << workers
+                                             << " workers");
+    }
+  }
+
+  std::cout << "FindAll Passed" << std::endl;
+}
+
+void TestIncrementalMatchIndex() {
+  struct Query {
+    const char *text;
+    bool regex;
+    bool matchCase;
+  };
+  const Query queries[] = {
+      {"aa", false, true},     {"ab\na", false, true}, {"Ab", false, false},
+      {"a+b", true, true},     {"^b", true, true},     {"a$", true, true},
+      {"\\bab", true, false},  {"x*", true, true},     {"b\\na", true, true},
+      {"(a|ab)(c|bcd)", true, true}};
+  const char *pieces[] = {"a", "b", "\n", "aa", "ab\n", "bcd", "c", "xAB"};
+
+  std::mt19937 rng(23);
+  for (const Query &q : queries) {
+    SearchOptions options;
+    options.useRegex = q.regex;
+    options.matchCase = q.matchCase;
+    Buffer buf;
+    std::string text;
+    for (size_t i = 0; i < 3000; ++i)
+      text += pieces[rng() % 8];
+    buf.Insert(0, text);
+    buf.SetMatchQuery(q.text, options);
+
+    for (int step = 0; step < 300; ++step) {
+      size_t total = buf.GetTotalLength();
+      int action = rng() % 10;
+      if (action < 5) {
+        buf.Insert(rng() % (total + 1), pieces[rng() % 8]);
+      } else if (action < 8 && total > 0) {
+        buf.Delete(rng() % total, 1 + rng() % 8);
+      } else if (action == 8) {
+        buf.Undo();
+      } else {
+        buf.Redo();
+      }
+
+      const MatchList &matches = buf.GetMatches();
+      std::vector<size_t> expected = buf.FindAll(q.text, options, false);
+      VERIFY(matches.size() == expected.size(),
+             "Match index count differs for " << q.text << " at step "
+                                              << step);
+      for (size_t i = 0; i < expected.size(); ++i) {
+        VERIFY(matches[i].first == expected[i],
+               "Match index offset differs for " << q.text << " at step "
+                                                 << step);
+      }
+      if (!matches.empty()) {
+        size_t i = rng() % matches.size();
+        VERIFY(buf.GetMatchNumber(matches[i].first) == i + 1,
+               "Match number mismatch");
+      }
+    }
+  }
+
+  std::cout << "Incremental Match Index Passed" << std::endl;
+}
+
 int main() {
   TestFunctionalSearch();
   TestLargeFileSearch();
+  TestPieceStraddlingSearch();
+  TestStreamingRegex();
+  TestReplaceAll();
+  TestFindAll();
+  TestIncrementalMatchIndex();
   RunSearchStressTest(2000);
   return 0;
 }
@@ -1,5 +1,6 @@
 #include "../include/PieceTable.h"
 #include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <random>
 #include <string>
@@ -134,7 +135,76 @@ void RunStructuredLoopStress(int iterations, int editsPerLoop) {
   std::cout << "Structured Undo/Redo Loop Stress Passed!" << std::endl;
 }
 
+// History cost on a heavily fragmented document: undo records must cost
+// O(changed pieces), independent of how many pieces the document has.
+void RunHistoryCostBenchmark(size_t targetPieces, int edits) {
+  int i = 0; // For VERIFY
+  std::string original;
+  for (int line = 0; line < 100000; ++line) {
+    original += "Original line " + std::to_string(line) + "\n";
+  }
+
+  PieceTable pt;
+  pt.LoadOriginal(original.data(), original.length());
+  std::mt19937 rng(2024);
+  while (pt.GetPieceCount() < targetPieces) {
+    pt.Insert(rng() % pt.GetTotalLength(), "x");
+  }
+
+  std::cout << "Starting History Cost Benchmark (" << pt.GetPieceCount()
+            << " pieces, " << edits << " edits)..." << std::endl;
+
+  std::string before = pt.GetText(0, pt.GetTotalLength());
+  size_t memBefore = pt.GetUndoMemoryUsage();
+
+  auto editStart = std::chrono::high_resolution_clock::now();
+  for (i = 0; i < edits; ++i) {
+    size_t pos = rng() % pt.GetTotalLength();
+    if (i % 3 == 2)
+      pt.Delete(pos, 1 + rng() % 8);
+    else
+      pt.Insert(pos, "edit");
+  }
+  auto editEnd = std::chrono::high_resolution_clock::now();
+
+  // The history is capped at 1000 records, so after 'edits' >= 1000 edits it
+  // holds exactly the measured ones
+  size_t memAfter = pt.GetUndoMemoryUsage();
+  double bytesPerEdit = (double)memAfter / edits;
+  std::cout << "  History memory: " << memBefore << " -> " << memAfter
+            << " bytes (~" << bytesPerEdit << " bytes per edit)" << std::endl;
+  VERIFY(bytesPerEdit < 1024.0,
+         "Undo record size should not scale with piece count");
+
+  double maxUndoUs = 0.0;
+  auto undoStart = std::chrono::high_resolution_clock::now();
+  for (i = 0; i < edits && pt.CanUndo(); ++i) {
+    auto s = std::chrono::high_resolution_clock::now();
+    pt.Undo();
+    auto e = std::chrono::high_resolution_clock::now();
+    maxUndoUs = (std::max)(
+        maxUndoUs, std::chrono::duration<double, std::micro>(e - s).count());
+  }
+  auto undoEnd = std::chrono::high_resolution_clock::now();
+
+  std::cout << "  Edit time: "
+            << std::chrono::duration<double, std::micro>(editEnd - editStart)
+                       .count() /
+                   edits
+            << " us/edit" << std::endl;
+  std::cout << "  Undo latency: avg "
+            << std::chrono::duration<double, std::micro>(undoEnd - undoStart)
+                       .count() /
+                   edits
+            << " us, max " << maxUndoUs << " us" << std::endl;
+  VERIFY(pt.GetText(0, pt.GetTotalLength()) == before,
+         "Content mismatch after undoing measured edits");
+
+  std::cout << "History Cost Benchmark Passed!" << std::endl;
+}
+
 int main() {
   RunStructuredLoopStress(50, 200); // 50 loops * 200 edits = 10,000 edits total
+  RunHistoryCostBenchmark(50000, 1000);
   return 0;
 }
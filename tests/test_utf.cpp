@@ -0,0 +1,138 @@
+#include "../include/Utf.h"
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#define VERIFY(cond, msg)                                                      \
+  if (!(cond)) {                                                               \
+    std::cerr << "FAILURE at line " << __LINE__ << ": " << msg << std::endl;   \
+    exit(1);                                                                   \
+  }
+
+static void Append(std::string &utf8, std::u16string &utf16, uint32_t cp) {
+  if (cp < 0x80) {
+    utf8 += static_cast<char>(cp);
+  } else if (cp < 0x800) {
+    utf8 += static_cast<char>(0xC0 | (cp >> 6));
+    utf8 += static_cast<char>(0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    utf8 += static_cast<char>(0xE0 | (cp >> 12));
+    utf8 += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    utf8 += static_cast<char>(0x80 | (cp & 0x3F));
+  } else {
+    utf8 += static_cast<char>(0xF0 | (cp >> 18));
+    utf8 += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+    utf8 += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    utf8 += static_cast<char>(0x80 | (cp & 0x3F));
+  }
+  if (cp >= 0x10000) {
+    utf16 += static_cast<char16_t>(0xD800 + ((cp - 0x10000) >> 10));
+    utf16 += static_cast<char16_t>(0xDC00 + (cp & 0x3FF));
+  } else {
+    utf16 += static_cast<char16_t>(cp);
+  }
+}
+
+static uint32_t RandomCodePoint(std::mt19937 &rng, int mix) {
+  switch (rng() % mix) {
+  case 0:
+    return 0x80 + rng() % 0x780;
+  case 1:
+    return 0x4E00 + rng() % 0x5000; // CJK
+  case 2:
+    return 0x10000 + rng() % 0x100000;
+  default:
+    return 0x20 + rng() % 0x5F;
+  }
+}
+
+static std::u16string Utf16Of(const std::string &utf8) {
+  return Utf::ToUtf16(utf8.data(), utf8.size());
+}
+
+void TestUtf() {
+  std::mt19937 rng(42);
+
+  // Test 1: well-formed text converts both ways, with lengths to match, for
+  // mostly ASCII, mixed and non-ASCII text around register boundaries
+  for (int mix : {40, 8, 3}) {
+    for (int round = 0; round < 200; ++round) {
+      std::string utf8;
+      std::u16string utf16;
+      size_t count = rng() % 300;
+      for (size_t i = 0; i < count; ++i)
+        Append(utf8, utf16, RandomCodePoint(rng, mix));
+      VERIFY(Utf16Of(utf8) == utf16, "UTF-8 to UTF-16 mismatch, mix " << mix);
+      VERIFY(Utf::ToUtf8(utf16.data(), utf16.size()) == utf8,
+             "UTF-16 to UTF-8 mismatch, mix " << mix);
+      VERIFY(Utf::Utf16Length(utf8.data(), utf8.size()) == utf16.size(),
+             "Utf16Length mismatch");
+      VERIFY(Utf::Utf8Length(utf16.data(), utf16.size()) == utf8.size(),
+             "Utf8Length mismatch");
+      VERIFY(Utf::IsValidUtf8(utf8.data(), utf8.size()),
+             "well-formed text reported invalid");
+      // Prefix lengths map byte offsets to character indexes
+      size_t cut = utf16.empty() ? 0 : rng() % utf16.size();
+      if (cut > 0 && utf16[cut] >= 0xDC00 && utf16[cut] <= 0xDFFF)
+        --cut;
+      size_t bytes = Utf::Utf8Length(utf16.data(), cut);
+      VERIFY(Utf::Utf16Length(utf8.data(), bytes) == cut,
+             "prefix length mismatch");
+    }
+  }
+  std::cout << "Test 1 Passed: Round trip" << std::endl;
+
+  // Test 2: ill-formed UTF-8 becomes one U+FFFD per maximal subpart
+  struct Case {
+    std::string in;
+    std::u16string out;
+  };
+  std::vector<Case> cases = {
+      {"a\x80z", u"a\uFFFDz"},                          // stray continuation
+      {"\xC0\xAF", u"\uFFFD\uFFFD"},                    // overlong lead
+      {"\xE0\x80\xAF", u"\uFFFD\uFFFD\uFFFD"},          // overlong 3-byte
+      {"\xE2\x82", u"\uFFFD"},                          // truncated
+      {"\xE2\x82x", u"\uFFFDx"},                        // interrupted
+      {"\xED\xA0\x80", u"\uFFFD\uFFFD\uFFFD"},          // encoded surrogate
+      {"\xF4\x90\x80\x80", u"\uFFFD\uFFFD\uFFFD\uFFFD"}, // past U+10FFFF
+      {"\xF0\x9F\x98", u"\uFFFD"},                      // truncated 4-byte
+      {"\xFF", u"\uFFFD"},                              // never a lead
+  };
+  for (const Case &c : cases) {
+    // Placed after a long ASCII run so the fast path hands over mid-text
+    std::string in = std::string(37, 'x') + c.in;
+    std::u16string out = std::u16string(37, u'x') + c.out;
+    VERIFY(Utf16Of(in) == out,
+           "replacement mismatch for case " << &c - &cases[0]);
+    VERIFY(Utf::Utf16Length(in.data(), in.size()) == out.size(),
+           "replacement length mismatch");
+    VERIFY(!Utf::IsValidUtf8(in.data(), in.size()), "ill-formed text valid");
+  }
+  std::string fffd = "\xEF\xBF\xBD";
+  VERIFY(Utf::IsValidUtf8(fffd.data(), fffd.size()), "U+FFFD itself invalid");
+  std::cout << "Test 2 Passed: Ill-formed UTF-8" << std::endl;
+
+  // Test 3: lone surrogates in UTF-16 become U+FFFD
+  {
+    std::u16string in = std::u16string(20, u'a');
+    in += static_cast<char16_t>(0xD800);
+    in += u'b';
+    in += static_cast<char16_t>(0xDC00);
+    in += static_cast<char16_t>(0xD83D); // ends the text
+    std::string expected = std::string(20, 'a') + "\xEF\xBF\xBD" "b" +
+                           "\xEF\xBF\xBD" + "\xEF\xBF\xBD";
+    VERIFY(Utf::ToUtf8(in.data(), in.size()) == expected,
+           "lone surrogate mismatch");
+    VERIFY(Utf::Utf8Length(in.data(), in.size()) == expected.size(),
+           "lone surrogate length mismatch");
+  }
+  std::cout << "Test 3 Passed: Lone surrogates" << std::endl;
+}
+
+int main() {
+  TestUtf();
+  std::cout << "All UTF conversion tests passed!" << std::endl;
+  return 0;
+}
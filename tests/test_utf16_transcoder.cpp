@@ -0,0 +1,222 @@
+#include "../include/Utf16Transcoder.h"
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+#define VERIFY(cond, msg)                                                      \
+  if (!(cond)) {                                                               \
+    std::cerr << "FAILURE at line " << __LINE__ << ": " << msg << std::endl;   \
+    exit(1);                                                                   \
+  }
+
+// Straightforward whole-string conversion to check the transcoder against
+static std::string ReferenceUtf8(const std::u16string &text) {
+  std::string out;
+  for (size_t i = 0; i < text.size(); ++i) {
+    uint32_t cp = text[i];
+    if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < text.size() &&
+        text[i + 1] >= 0xDC00 && text[i + 1] <= 0xDFFF) {
+      cp = 0x10000 + ((cp - 0xD800) << 10) + (text[i + 1] - 0xDC00);
+      ++i;
+    } else if (cp >= 0xD800 && cp <= 0xDFFF) {
+      cp = 0xFFFD;
+    }
+    if (cp < 0x80) {
+      out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+      out += static_cast<char>(0xC0 | (cp >> 6));
+      out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+      out += static_cast<char>(0xE0 | (cp >> 12));
+      out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+      out += static_cast<char>(0xF0 | (cp >> 18));
+      out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+      out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+  }
+  return out;
+}
+
+static std::string Encode(const std::u16string &text, bool bigEndian) {
+  std::string bytes;
+  for (char16_t c : text) {
+    char lo = static_cast<char>(c & 0xFF), hi = static_cast<char>(c >> 8);
+    bytes += bigEndian ? hi : lo;
+    bytes += bigEndian ? lo : hi;
+  }
+  return bytes;
+}
+
+// Hands out 'bytes' in spans of at most 'spanSize' bytes, so units and
+// surrogate pairs straddle span boundaries
+static SpanSource SplitSource(const std::string &bytes, size_t spanSize) {
+  return [&bytes, spanSize](size_t offset) {
+    TextSpan span;
+    if (offset >= bytes.size())
+      return span;
+    span.offset = offset / spanSize * spanSize;
+    span.data = bytes.data() + span.offset;
+    span.length = std::min(spanSize, bytes.size() - span.offset);
+    return span;
+  };
+}
+
+static std::string ReadAll(const Utf16Transcoder &t) {
+  std::string out;
+  while (out.size() < t.GetLength()) {
+    TextSpan span = t.GetSpan(out.size());
+    if (!span.data || span.offset != out.size() || span.length == 0)
+      break;
+    out.append(span.data, span.length);
+  }
+  return out;
+}
+
+static std::u16string RandomText(std::mt19937 &rng, size_t units) {
+  std::u16string text;
+  while (text.size() < units) {
+    switch (rng() % 8) {
+    case 0:
+      text += static_cast<char16_t>(0x80 + rng() % 0x780); // 2 bytes
+      break;
+    case 1:
+      text += static_cast<char16_t>(0x3040 + rng() % 0x60); // kana
+      break;
+    case 2: // pair
+      text += static_cast<char16_t>(0xD800 + rng() % 0x400);
+      text += static_cast<char16_t>(0xDC00 + rng() % 0x400);
+      break;
+    case 3: // lone surrogate, either half
+      text += static_cast<char16_t>(0xD800 + rng() % 0x800);
+      break;
+    case 4:
+      text += u'\n';
+      break;
+    default:
+      text += static_cast<char16_t>('a' + rng() % 26);
+      break;
+    }
+  }
+  text.resize(units);
+  return text;
+}
+
+void TestTranscoder() {
+  const size_t B = Utf16Transcoder::BLOCK_UNITS;
+  std::mt19937 rng(1234);
+
+  // Test 1: conversion matches the reference, in both byte orders
+  std::u16string text = RandomText(rng, B * 3 + 777);
+  // Pairs straddling block boundaries, and a high half ending a block with
+  // no low half after it
+  text[B - 1] = 0xD83D;
+  text[B] = 0xDE00;
+  text[2 * B - 1] = 0xD83D;
+  text[2 * B] = u'x';
+  text[3 * B] = 0xDC01;
+  std::string expected = ReferenceUtf8(text);
+  for (bool be : {false, true}) {
+    std::string bytes = Encode(text, be);
+    Utf16Transcoder t(SplitSource(bytes, 1001), bytes.size(), be);
+    VERIFY(t.BuildMap(), "BuildMap failed");
+    VERIFY(t.GetLength() == expected.size(), "UTF-8 length mismatch");
+    VERIFY(t.GetSourceLength() == bytes.size(), "source length mismatch");
+    VERIFY(ReadAll(t) == expected, "converted text mismatch");
+    // Any offset lands in the block that holds it
+    for (size_t off : {size_t(0), expected.size() / 2, expected.size() - 1}) {
+      TextSpan span = t.GetSpan(off);
+      VERIFY(span.data && span.offset <= off &&
+                 off < span.offset + span.length &&
+                 std::string(span.data, span.length) ==
+                     expected.substr(span.offset, span.length),
+             "span at " << off);
+    }
+    VERIFY(!t.GetSpan(expected.size()).data, "span past the end");
+  }
+  std::cout << "Test 1 Passed: Conversion" << std::endl;
+
+  // Test 2: the parallel map is the same as the serial one
+  {
+    std::u16string big = RandomText(rng, B * 11 + 5);
+    std::string bytes = Encode(big, false);
+    Utf16Transcoder serial(SplitSource(bytes, 4096), bytes.size(), false);
+    Utf16Transcoder parallel(SplitSource(bytes, 4096), bytes.size(), false);
+    VERIFY(serial.BuildMap(nullptr, 1) && parallel.BuildMap(nullptr, 3),
+           "BuildMap failed");
+    VERIFY(serial.GetLength() == parallel.GetLength(), "length differs");
+    VERIFY(ReadAll(parallel) == ReferenceUtf8(big), "parallel text mismatch");
+  }
+  std::cout << "Test 2 Passed: Parallel map" << std::endl;
+
+  // Test 3: offsets map both ways at character starts
+  {
+    std::string bytes = Encode(text, false);
+    Utf16Transcoder t(SplitSource(bytes, 1 << 20), bytes.size(), false);
+    VERIFY(t.BuildMap(), "BuildMap failed");
+    size_t utf8 = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+      bool pairLow = i > 0 && text[i] >= 0xDC00 && text[i] <= 0xDFFF &&
+                     text[i - 1] >= 0xD800 && text[i - 1] <= 0xDBFF;
+      if (pairLow)
+        continue;
+      VERIFY(t.ToUtf8Offset(i * 2) == utf8, "ToUtf8Offset at unit " << i);
+      VERIFY(t.ToSourceOffset(utf8) == i * 2, "ToSourceOffset at " << utf8);
+      bool pairHigh = i + 1 < text.size() && text[i] >= 0xD800 &&
+                      text[i] <= 0xDBFF && text[i + 1] >= 0xDC00 &&
+                      text[i + 1] <= 0xDFFF;
+      utf8 += ReferenceUtf8(text.substr(i, pairHigh ? 2 : 1)).size();
+    }
+    VERIFY(utf8 == t.GetLength(), "offset walk length mismatch");
+    VERIFY(t.ToUtf8Offset(bytes.size()) == t.GetLength(), "end offset");
+    VERIFY(t.ToSourceOffset(t.GetLength()) == bytes.size(), "end source");
+  }
+  std::cout << "Test 3 Passed: Offset mapping" << std::endl;
+
+  // Test 4: edge cases and cancellation
+  {
+    std::string odd = Encode(u"ab", false) + "x"; // trailing byte ignored
+    Utf16Transcoder t(SplitSource(odd, 7), odd.size(), false);
+    VERIFY(t.BuildMap() && ReadAll(t) == "ab", "odd length");
+
+    std::string empty;
+    Utf16Transcoder e(SplitSource(empty, 7), 0, false);
+    VERIFY(e.BuildMap() && e.GetLength() == 0, "empty source");
+
+    std::string bytes = Encode(text, false);
+    std::atomic<bool> cancel(true);
+    Utf16Transcoder c(SplitSource(bytes, 4096), bytes.size(), false);
+    VERIFY(!c.BuildMap(&cancel), "cancelled map should fail");
+
+    // A source that runs out early is reported, not read past
+    Utf16Transcoder s(SplitSource(empty, 7), 64, false);
+    VERIFY(!s.BuildMap(), "short source should fail");
+  }
+  std::cout << "Test 4 Passed: Edge cases" << std::endl;
+
+  // Test 5: a piece table reads the text through the transcoder
+  {
+    std::string bytes = Encode(text, true);
+    auto t = std::make_shared<Utf16Transcoder>(SplitSource(bytes, 65536),
+                                               bytes.size(), true);
+    VERIFY(t->BuildMap(), "BuildMap failed");
+    PieceTable pt;
+    pt.LoadOriginal(Utf16Transcoder::MakeSource(t), t->GetLength());
+    VERIFY(pt.GetText(0, pt.GetTotalLength()) == expected,
+           "piece table text mismatch");
+    size_t lines = 1;
+    for (char c : expected)
+      lines += c == '\n';
+    VERIFY(pt.GetTotalLines() == lines, "piece table line count mismatch");
+  }
+  std::cout << "Test 5 Passed: Piece table source" << std::endl;
+}
+
+int main() {
+  TestTranscoder();
+  std::cout << "All UTF-16 transcoder tests passed!" << std::endl;
+  return 0;
+}
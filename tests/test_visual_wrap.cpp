@@ -1,4 +1,5 @@
 #include "../src/Globals.inl"
+#include <cmath>
 #include <iostream>
 
 // Mocks are now in TestGlobals.cpp
@@ -83,10 +84,205 @@ void TestTextWrapping() {
   DestroyWindow(hwnd);
 }
 
+// Viewport of 'count' lines starting at 'first', as GetViewportText returns
+static std::string Viewport(const std::vector<std::string> &lines,
+                            size_t first, size_t count) {
+  std::string text;
+  for (size_t i = first; i < first + count; ++i) {
+    if (i > first)
+      text += "\n";
+    text += lines[i];
+  }
+  return text;
+}
+
+void TestLineLayoutCache() {
+  HWND hwnd = CreateHiddenWindow();
+  EditorBufferRenderer renderer;
+  VERIFY(renderer.Initialize(hwnd), "Failed to initialize renderer");
+  renderer.SetFont(L"Consolas", 14.0f);
+
+  std::vector<std::string> lines;
+  for (int i = 0; i < 20; ++i)
+    lines.push_back("line " + std::to_string(i) + " of the viewport");
+
+  renderer.DrawEditorLines(Viewport(lines, 0, 10));
+  auto stats = renderer.GetLayoutCacheStats();
+  VERIFY(stats.misses == 10 && stats.hits == 0,
+         "First frame should shape every line");
+
+  renderer.DrawEditorLines(Viewport(lines, 0, 10));
+  stats = renderer.GetLayoutCacheStats();
+  VERIFY(stats.misses == 0 && stats.hits == 10,
+         "Unchanged frame should reuse every line");
+
+  renderer.DrawEditorLines(Viewport(lines, 1, 10));
+  stats = renderer.GetLayoutCacheStats();
+  VERIFY(stats.misses == 1 && stats.hits == 9,
+         "Scrolling one line should shape one line");
+
+  lines[5] += "x";
+  renderer.DrawEditorLines(Viewport(lines, 1, 10));
+  stats = renderer.GetLayoutCacheStats();
+  VERIFY(stats.misses == 1 && stats.hits == 9,
+         "Typing should reshape only the edited line");
+
+  std::vector<Buffer::HighlightRange> highlights = {{0, 4, 1}};
+  renderer.DrawEditorLines(Viewport(lines, 1, 10), 0, nullptr, &highlights);
+  stats = renderer.GetLayoutCacheStats();
+  VERIFY(stats.misses == 1 && stats.hits == 9,
+         "A new highlight should reshape only its line");
+
+  renderer.SetFont(L"Consolas", 16.0f);
+  renderer.DrawEditorLines(Viewport(lines, 1, 10));
+  stats = renderer.GetLayoutCacheStats();
+  VERIFY(stats.misses == 10 && stats.cached == 10,
+         "Font change should drop cached layouts");
+
+  std::cout << "Test Passed: Line Layout Cache" << std::endl;
+  DestroyWindow(hwnd);
+}
+
+void TestPartialRepaint() {
+  HWND hwnd = CreateHiddenWindow();
+  EditorBufferRenderer renderer;
+  VERIFY(renderer.Initialize(hwnd), "Failed to initialize renderer");
+  renderer.SetFont(L"Consolas", 14.0f);
+
+  std::vector<std::string> lines;
+  for (int i = 0; i < 11; ++i)
+    lines.push_back("line " + std::to_string(i) + " of the viewport");
+
+  renderer.DrawEditorLines(Viewport(lines, 0, 10));
+  VERIFY(renderer.GetRepaintedLines() == 10, "First frame should draw all");
+
+  renderer.DrawEditorLines(Viewport(lines, 0, 10));
+  VERIFY(renderer.GetRepaintedLines() == 0,
+         "Unchanged frame should draw nothing");
+
+  lines[5] += "x";
+  renderer.DrawEditorLines(Viewport(lines, 0, 10));
+  VERIFY(renderer.GetRepaintedLines() == 1,
+         "Editing a line should redraw only that line");
+
+  size_t lineTwo = lines[0].size() + lines[1].size() + 2;
+  renderer.DrawEditorLines(Viewport(lines, 0, 10), lineTwo);
+  VERIFY(renderer.GetRepaintedLines() == 2,
+         "Moving the caret should redraw its old and new lines");
+
+  renderer.DrawEditorLines(Viewport(lines, 1, 10), 0, nullptr, nullptr, 2);
+  VERIFY(renderer.GetRepaintedLines() == 10, "Scrolling should redraw all");
+
+  // A blink repaints the caret row from the retained frame
+  D2D1_RECT_F caret = renderer.GetLastCaretRect();
+  RECT caretRect = {(LONG)std::ceil(caret.left), (LONG)std::ceil(caret.top),
+                    (LONG)caret.right, (LONG)caret.bottom};
+  renderer.SetCaretVisible(false);
+  VERIFY(renderer.RedrawCaret(caretRect),
+         "Caret row paint should be served from the retained frame");
+  VERIFY(renderer.GetRepaintedLines() == 1, "Blink should redraw one line");
+
+  RECT client;
+  GetClientRect(hwnd, &client);
+  VERIFY(!renderer.RedrawCaret(client),
+         "Full window paint must go through DrawEditorLines");
+
+  std::cout << "Test Passed: Partial Repaint" << std::endl;
+  DestroyWindow(hwnd);
+}
+
+void TestFontMetrics() {
+  HWND hwnd = CreateHiddenWindow();
+  EditorBufferRenderer renderer;
+  VERIFY(renderer.Initialize(hwnd), "Failed to initialize renderer");
+
+  renderer.SetFont(L"Consolas", 20.0f);
+  EditorBufferRenderer::FontMetrics metrics = renderer.GetFontMetrics();
+  VERIFY(metrics.lineHeight > 0 &&
+             metrics.lineHeight == renderer.GetLineHeight(),
+         "Line height should come from the cached metrics");
+  VERIFY(metrics.ascent > 0 && metrics.ascent < metrics.lineHeight,
+         "Ascent should lie within the line");
+  VERIFY(metrics.monospace, "Consolas should be detected as monospace");
+  VERIFY(std::fabs(renderer.GetTextWidth("0123456789") -
+                   10 * metrics.digitWidth) < 0.5f,
+         "Digit width should match a measured run of digits");
+
+  renderer.ZoomIn();
+  VERIFY(renderer.GetLineHeight() > metrics.lineHeight,
+         "Zoom should refresh the cached metrics");
+
+  renderer.SetFont(L"Segoe UI", 20.0f);
+  VERIFY(!renderer.GetFontMetrics().monospace,
+         "Segoe UI should be detected as proportional");
+
+  VERIFY(renderer.GetGutterWidth(99999) > renderer.GetGutterWidth(9),
+         "Gutter should widen with the digit count");
+  renderer.SetShowLineNumbers(false);
+  VERIFY(renderer.GetGutterWidth(99999) == 0.0f,
+         "Hidden line numbers should take no gutter");
+
+  std::cout << "Test Passed: Font Metrics" << std::endl;
+  DestroyWindow(hwnd);
+}
+
+void TestMonospaceFastPath() {
+  HWND hwnd = CreateHiddenWindow();
+  EditorBufferRenderer renderer;
+  VERIFY(renderer.Initialize(hwnd), "Failed to initialize renderer");
+  renderer.SetFont(L"Consolas", 20.0f);
+  renderer.SetShowLineNumbers(false);
+  VERIFY(renderer.GetFontMetrics().monospace, "Consolas should be monospace");
+
+  // Arithmetic hit testing and widths must agree with DirectWrite layouts,
+  // which a wrap width wider than any line forces without changing results.
+  // Points are sampled off glyph midpoints, where rounding may pick a side.
+  std::string text = "int main() {\n"
+                     "  return 0; // done\r\n"
+                     "e\xCC\x81t\xC3\xA9\n"
+                     "\xE3\x83\x86\xE3\x82\xAD\xE3\x82\xB9\xE3\x83\x88 abc";
+  const size_t rows = 3;
+  float lineHeight = renderer.GetLineHeight();
+  std::vector<size_t> fast;
+  for (size_t row = 0; row <= rows; ++row) {
+    // The last row may be taller with a fallback font: reach it from below
+    float y = row < rows ? (row + 0.5f) * lineHeight : 10 * lineHeight;
+    for (float x = 0.4f; x < 400; x += 2.9f)
+      fast.push_back(renderer.GetPositionFromPoint(text, x, y, 4));
+  }
+  // The combining mark above sends widths back to DirectWrite, so widths
+  // are compared on text the fast path measures itself
+  std::string widthText = "\tint x;\n"
+                          "  return 0; // done\n"
+                          "\xE3\x83\x86\xE3\x82\xAD\xE3\x82\xB9\xE3\x83\x88"
+                          "\tabc def ghi";
+  float fastWidth = renderer.GetTextWidth(widthText);
+
+  renderer.SetWordWrap(true);
+  renderer.SetWrapWidth(100000.0f);
+  size_t k = 0;
+  bool same = true;
+  for (size_t row = 0; row <= rows; ++row) {
+    float y = row < rows ? (row + 0.5f) * lineHeight : 10 * lineHeight;
+    for (float x = 0.4f; x < 400; x += 2.9f)
+      same = renderer.GetPositionFromPoint(text, x, y, 4) == fast[k++] && same;
+  }
+  VERIFY(same, "Fast path hit testing should match DirectWrite");
+  VERIFY(std::fabs(fastWidth - renderer.GetTextWidth(widthText)) < 0.5f,
+         "Fast path width should match DirectWrite");
+
+  std::cout << "Test Passed: Monospace Fast Path" << std::endl;
+  DestroyWindow(hwnd);
+}
+
 int main() {
   try {
     CoInitialize(NULL);
     TestTextWrapping();
+    TestLineLayoutCache();
+    TestPartialRepaint();
+    TestFontMetrics();
+    TestMonospaceFastPath();
     std::cout << "=== ALL VISUAL TESTS PASSED ===" << std::endl;
     CoUninitialize();
   } catch (const std::exception &e) {
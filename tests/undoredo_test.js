@@ -52,6 +52,19 @@ function test_undo_redo() {
     // 4. Verification after complete loop
     assertEqual(Editor.getText(0, Editor.getLength()), states[states.length - 1], "Line 51: Final content mismatch after full loops");
 
+    // 5. Undo group: several edits undo as one step
+    Editor.setStatusText("Testing Undo Groups...");
+    var before = Editor.getText(0, Editor.getLength());
+    Editor.beginUndoGroup();
+    Editor.insert(0, "[");
+    Editor.insert(Editor.getLength(), "]");
+    Editor.delete(1, 5);
+    Editor.endUndoGroup();
+    Editor.undo();
+    assertEqual(Editor.getText(0, Editor.getLength()), before, "Undo group was not undone as one step");
+    Editor.redo();
+    assertEqual(Editor.getText(0, Editor.getLength()).charAt(0), "[", "Undo group was not redone");
+
     Editor.setStatusText("Undo/Redo Tests: PASSED");
     return "SUCCESS";
 }